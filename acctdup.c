@@ -0,0 +1,161 @@
+/* Copyright (c) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+/* Content based duplicate detection for accounting requests. NAS
+ * retransmissions with a new RADIUS id, or the same record arriving through
+ * several proxies, are not caught by the id/authenticator check. Records are
+ * identified by an MD5 over a configured set of attributes; the cache is a
+ * fixed size open addressing table, so the oldest entries are replaced once
+ * it fills up. */
+
+#include "acctdup.h"
+#include "list.h"
+#include <nettle/md5.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* slots probed for a key before replacing the oldest of them */
+#define ACCTDUP_PROBES 8
+
+struct acctdupentry {
+    uint8_t key[16];
+    time_t added;
+};
+
+struct acctdup {
+    struct acctdupentry *entries;
+    uint32_t mask;
+    time_t interval;
+    pthread_mutex_t lock;
+};
+
+/**
+ * @brief create a duplicate cache
+ *
+ * @param size number of entries, rounded up to a power of two
+ * @param interval seconds a record is remembered
+ * @return the cache, or NULL if malloc fails
+ */
+struct acctdup *acctdup_create(uint32_t size, time_t interval) {
+    struct acctdup *d;
+    uint32_t n = ACCTDUP_PROBES;
+
+    while (n < size)
+        n <<= 1;
+    d = calloc(1, sizeof(struct acctdup));
+    if (!d)
+        return NULL;
+    d->entries = calloc(n, sizeof(struct acctdupentry));
+    if (!d->entries) {
+        free(d);
+        return NULL;
+    }
+    d->mask = n - 1;
+    d->interval = interval;
+    pthread_mutex_init(&d->lock, NULL);
+    return d;
+}
+
+void acctdup_free(struct acctdup *d) {
+    if (!d)
+        return;
+    pthread_mutex_destroy(&d->lock);
+    free(d->entries);
+    free(d);
+}
+
+/**
+ * @brief derive the key identifying an accounting record
+ *
+ * All occurrences of each attribute type in types are hashed in the order of
+ * types, so the order of attributes in the message does not matter.
+ *
+ * @param msg accounting request
+ * @param types attribute types to include
+ * @param ntypes number of types
+ * @param key 16 bytes receiving the key
+ * @return 1 if ok, 0 if msg has no Acct-Session-Id and is not checked
+ */
+int acctdup_key(struct radmsg *msg, const uint8_t *types, int ntypes, uint8_t *key) {
+    struct md5_ctx ctx;
+    struct list_node *node;
+    struct tlv *attr;
+    int i;
+
+    if (!radmsg_gettype(msg, RAD_Attr_Acct_Session_Id))
+        return 0;
+    md5_init(&ctx);
+    for (i = 0; i < ntypes; i++) {
+        for (node = list_first(msg->attrs); node; node = list_next(node)) {
+            attr = (struct tlv *)node->data;
+            if (attr->t != types[i])
+                continue;
+            md5_update(&ctx, 1, &attr->t);
+            md5_update(&ctx, 1, &attr->l);
+            md5_update(&ctx, attr->l, attr->v);
+        }
+    }
+    md5_digest(&ctx, 16, key);
+    return 1;
+}
+
+static uint32_t slot(struct acctdup *d, const uint8_t *key) {
+    uint32_t h;
+
+    memcpy(&h, key, sizeof(h));
+    return h & d->mask;
+}
+
+/**
+ * @brief check if a record was added within the interval
+ *
+ * @return 1 if it is a duplicate, else 0
+ */
+int acctdup_seen(struct acctdup *d, const uint8_t *key, time_t now) {
+    struct acctdupentry *e;
+    uint32_t s = slot(d, key);
+    int i, seen = 0;
+
+    pthread_mutex_lock(&d->lock);
+    for (i = 0; i < ACCTDUP_PROBES; i++) {
+        e = &d->entries[(s + i) & d->mask];
+        if (e->added && !memcmp(e->key, key, 16)) {
+            seen = now - e->added < d->interval;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&d->lock);
+    return seen;
+}
+
+/**
+ * @brief remember a record, replacing the oldest probed entry if needed
+ */
+void acctdup_add(struct acctdup *d, const uint8_t *key, time_t now) {
+    struct acctdupentry *e, *victim = NULL;
+    uint32_t s = slot(d, key);
+    int i;
+
+    pthread_mutex_lock(&d->lock);
+    for (i = 0; i < ACCTDUP_PROBES; i++) {
+        e = &d->entries[(s + i) & d->mask];
+        if (e->added && !memcmp(e->key, key, 16)) {
+            /* keep the time of the first reply, the window does not slide */
+            if (now - e->added >= d->interval)
+                e->added = now;
+            pthread_mutex_unlock(&d->lock);
+            return;
+        }
+        /* empty entries have added 0 and are taken first */
+        if (!victim || e->added < victim->added)
+            victim = e;
+    }
+    memcpy(victim->key, key, 16);
+    victim->added = now;
+    pthread_mutex_unlock(&d->lock);
+}
+
+/* Local Variables: */
+/* c-file-style: "stroustrup" */
+/* End: */
@@ -0,0 +1,26 @@
+/* Copyright (c) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+#ifndef _ACCTDUP_H
+#define _ACCTDUP_H
+
+#include "radmsg.h"
+#include <stdint.h>
+#include <time.h>
+
+/* entries in the accounting duplicate cache, a power of two */
+#define ACCTDUP_SIZE 65536
+
+struct acctdup;
+
+struct acctdup *acctdup_create(uint32_t size, time_t interval);
+void acctdup_free(struct acctdup *d);
+int acctdup_key(struct radmsg *msg, const uint8_t *types, int ntypes, uint8_t *key);
+int acctdup_seen(struct acctdup *d, const uint8_t *key, time_t now);
+void acctdup_add(struct acctdup *d, const uint8_t *key, time_t now);
+
+#endif /* _ACCTDUP_H */
+
+/* Local Variables: */
+/* c-file-style: "stroustrup" */
+/* End: */
@@ -0,0 +1,584 @@
+/* Copyright (c) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+/* Accounting sinks terminate the accounting requests of a realm locally by
+ * appending them to a file. Request threads format records into a buffer
+ * shared per sink; a writer thread writes everything collected since its
+ * last write at once, followed by fdatasync if replies wait for the records
+ * to be persisted, and rotates the file by size and age. */
+
+#include "acctsink.h"
+#include "debug.h"
+#include "list.h"
+#include "radsecproxy.h"
+#include "threadreg.h"
+#include "util.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct acctsink {
+    char *name;
+    char *file;
+    enum acctsink_format format;
+    uint8_t *types; /* attributes to record, NULL for all but secrets */
+    int ntypes;
+    long rotatesize;
+    long rotateinterval;
+    uint8_t persist; /* reply once written instead of once buffered */
+    acctsink_done_fn done;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint8_t *buf;
+    size_t len, size;
+    struct list *pending; /* ctx of the records in buf */
+    struct list *writing; /* ctx of the records being written */
+    int fd;
+    off_t written;
+    time_t opened;
+    uint8_t started;
+};
+
+static struct list *sinks;
+
+/* never written unless configured explicitly */
+static int secretattr(uint8_t type) {
+    return type == RAD_Attr_User_Password || type == RAD_Attr_CHAP_Password || type == RAD_Attr_Proxy_State ||
+           type == RAD_Attr_Tunnel_Password || type == RAD_Attr_Message_Authenticator;
+}
+
+/* attributes written as numbers and addresses in JSONL, others are strings or hex */
+static int intattr(uint8_t type) {
+    switch (type) {
+    case 5:  /* NAS-Port */
+    case 6:  /* Service-Type */
+    case 7:  /* Framed-Protocol */
+    case 27: /* Session-Timeout */
+    case 28: /* Idle-Timeout */
+    case RAD_Attr_Acct_Status_Type:
+    case RAD_Attr_Acct_Delay_Time:
+    case RAD_Attr_Acct_Input_Octets:
+    case RAD_Attr_Acct_Output_Octets:
+    case 45: /* Acct-Authentic */
+    case RAD_Attr_Acct_Session_Time:
+    case RAD_Attr_Acct_Input_Packets:
+    case RAD_Attr_Acct_Output_Packets:
+    case RAD_Attr_Acct_Terminate_Cause:
+    case 51: /* Acct-Link-Count */
+    case RAD_Attr_Acct_Input_Gigawords:
+    case RAD_Attr_Acct_Output_Gigawords:
+    case RAD_Attr_Event_Timestamp:
+    case 61: /* NAS-Port-Type */
+    case 85: /* Acct-Interim-Interval */
+        return 1;
+    }
+    return 0;
+}
+
+static int ipv4attr(uint8_t type) {
+    return type == RAD_Attr_NAS_IP_Address || type == RAD_Attr_Framed_IP_Address || type == 14; /* Login-IP-Host */
+}
+
+struct sbuf {
+    uint8_t *p;
+    size_t len, size;
+    int failed;
+};
+
+static void sbufput(struct sbuf *b, const void *data, size_t n) {
+    uint8_t *p;
+    size_t size;
+
+    if (b->failed)
+        return;
+    if (b->len + n > b->size) {
+        for (size = b->size ? b->size : 256; size < b->len + n; size *= 2)
+            ;
+        p = realloc(b->p, size);
+        if (!p) {
+            b->failed = 1;
+            return;
+        }
+        b->p = p;
+        b->size = size;
+    }
+    memcpy(b->p + b->len, data, n);
+    b->len += n;
+}
+
+static void sbufstr(struct sbuf *b, const char *s) {
+    sbufput(b, s, strlen(s));
+}
+
+static void jsonstring(struct sbuf *b, const uint8_t *s, size_t n) {
+    char esc[8];
+    size_t i;
+
+    sbufput(b, "\"", 1);
+    for (i = 0; i < n; i++) {
+        if (s[i] == '"' || s[i] == '\\') {
+            sbufput(b, "\\", 1);
+            sbufput(b, s + i, 1);
+        } else if (s[i] < 0x20 || s[i] == 0x7f) {
+            snprintf(esc, sizeof(esc), "\\u%04x", s[i]);
+            sbufstr(b, esc);
+        } else
+            sbufput(b, s + i, 1);
+    }
+    sbufput(b, "\"", 1);
+}
+
+static void jsonvalue(struct sbuf *b, struct tlv *attr) {
+    char tmp[INET_ADDRSTRLEN + 2];
+    uint32_t n;
+    int i;
+
+    if (attr->l == 4 && intattr(attr->t)) {
+        memcpy(&n, attr->v, 4);
+        snprintf(tmp, sizeof(tmp), "%u", ntohl(n));
+        sbufstr(b, tmp);
+    } else if (attr->l == 4 && ipv4attr(attr->t)) {
+        tmp[0] = '"';
+        inet_ntop(AF_INET, attr->v, tmp + 1, INET_ADDRSTRLEN);
+        strcat(tmp, "\"");
+        sbufstr(b, tmp);
+    } else if (verifyutf8(attr->v, attr->l)) {
+        jsonstring(b, attr->v, attr->l);
+    } else {
+        sbufstr(b, "\"0x");
+        for (i = 0; i < attr->l; i++) {
+            snprintf(tmp, sizeof(tmp), "%02x", attr->v[i]);
+            sbufput(b, tmp, 2);
+        }
+        sbufstr(b, "\"");
+    }
+}
+
+static int wanted(uint8_t type, const uint8_t *types, int ntypes) {
+    int i;
+
+    if (!types)
+        return !secretattr(type);
+    for (i = 0; i < ntypes; i++)
+        if (types[i] == type)
+            return 1;
+    return 0;
+}
+
+/**
+ * @brief format an accounting record
+ *
+ * JSONL records are one line
+ * {"time":T,"client":"C","realm":"R","attrs":[[type,value],...]}.
+ * Binary records are a 4 byte length of the whole record, 4 byte time, the
+ * client and realm names each preceded by a length byte and the attributes
+ * as in the RADIUS message, all numbers in network byte order.
+ *
+ * @param types attributes to include in the order of the message, NULL for all but secrets
+ * @param out receives the record, to be freed by the caller
+ * @return length of the record, 0 if malloc fails
+ */
+int acctsink_format(enum acctsink_format format, struct radmsg *msg, const uint8_t *types, int ntypes,
+                    const char *client, const char *realm, time_t now, uint8_t **out) {
+    struct sbuf b = {NULL, 0, 0, 0};
+    struct list_node *node;
+    struct tlv *attr;
+    char tmp[32];
+    uint32_t n;
+    uint8_t l, first = 1;
+
+    if (format == ACCTSINK_BINARY) {
+        sbufput(&b, "\0\0\0\0", 4);
+        n = htonl((uint32_t)now);
+        sbufput(&b, &n, 4);
+        l = strlen(client) > 255 ? 255 : strlen(client);
+        sbufput(&b, &l, 1);
+        sbufput(&b, client, l);
+        l = strlen(realm) > 255 ? 255 : strlen(realm);
+        sbufput(&b, &l, 1);
+        sbufput(&b, realm, l);
+        for (node = list_first(msg->attrs); node; node = list_next(node)) {
+            attr = (struct tlv *)node->data;
+            if (!wanted(attr->t, types, ntypes))
+                continue;
+            l = attr->l + 2;
+            sbufput(&b, &attr->t, 1);
+            sbufput(&b, &l, 1);
+            sbufput(&b, attr->v, attr->l);
+        }
+        if (!b.failed) {
+            n = htonl((uint32_t)b.len);
+            memcpy(b.p, &n, 4);
+        }
+    } else {
+        snprintf(tmp, sizeof(tmp), "{\"time\":%lld", (long long)now);
+        sbufstr(&b, tmp);
+        sbufstr(&b, ",\"client\":");
+        jsonstring(&b, (const uint8_t *)client, strlen(client));
+        sbufstr(&b, ",\"realm\":");
+        jsonstring(&b, (const uint8_t *)realm, strlen(realm));
+        sbufstr(&b, ",\"attrs\":[");
+        for (node = list_first(msg->attrs); node; node = list_next(node)) {
+            attr = (struct tlv *)node->data;
+            if (!wanted(attr->t, types, ntypes))
+                continue;
+            snprintf(tmp, sizeof(tmp), "%s[%u,", first ? "" : ",", attr->t);
+            sbufstr(&b, tmp);
+            jsonvalue(&b, attr);
+            sbufstr(&b, "]");
+            first = 0;
+        }
+        sbufstr(&b, "]}\n");
+    }
+    if (b.failed) {
+        free(b.p);
+        return 0;
+    }
+    *out = b.p;
+    return b.len;
+}
+
+static int openfile(struct acctsink *sink) {
+    struct stat st;
+
+    sink->fd = open(sink->file, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (sink->fd < 0) {
+        debugerrno(errno, DBG_ERR, "acctsink: failed to open %s", sink->file);
+        return 0;
+    }
+    sink->written = fstat(sink->fd, &st) ? 0 : st.st_size;
+    sink->opened = time(NULL);
+    return 1;
+}
+
+/* move the file aside with the time of rotation appended and start a new one;
+   a sequence number is added if the file was already rotated in that second */
+static void rotate(struct acctsink *sink, time_t now) {
+    char *rotated;
+    struct tm tm;
+    size_t len = strlen(sink->file) + 32, base;
+    int seq, ret;
+
+    rotated = malloc(len);
+    if (!rotated)
+        return;
+    gmtime_r(&now, &tm);
+    snprintf(rotated, len, "%s.", sink->file);
+    strftime(rotated + strlen(rotated), len - strlen(rotated), "%Y%m%dT%H%M%S", &tm);
+    base = strlen(rotated);
+    /* link() unlike rename() never replaces an earlier rotated file */
+    for (seq = 1; (ret = link(sink->file, rotated)) && errno == EEXIST && seq < 1000; seq++)
+        snprintf(rotated + base, len - base, ".%d", seq);
+    if (ret || unlink(sink->file))
+        debugerrno(errno, DBG_ERR, "acctsink: failed to rotate %s", sink->file);
+    else
+        debug(DBG_INFO, "acctsink: rotated %s to %s", sink->file, rotated);
+    free(rotated);
+    close(sink->fd);
+    if (!openfile(sink))
+        sink->opened = now; /* retry at the next rotation */
+}
+
+static int writeall(int fd, uint8_t *buf, size_t len) {
+    ssize_t n;
+
+    while (len) {
+        n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return 0;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 1;
+}
+
+static void *acctsinkwriter(void *arg) {
+    struct acctsink *sink = (struct acctsink *)arg;
+    struct list *done;
+    struct timespec deadline;
+    uint8_t *buf;
+    size_t len;
+    time_t now;
+    void *ctx;
+    int ok;
+
+    threadreg_name("sink:%s", sink->name);
+    for (;;) {
+        pthread_mutex_lock(&sink->lock);
+        while (!sink->len) {
+            if (!sink->rotateinterval) {
+                pthread_cond_wait(&sink->cond, &sink->lock);
+                continue;
+            }
+            deadline.tv_sec = sink->opened + sink->rotateinterval;
+            deadline.tv_nsec = 0;
+            if (pthread_cond_timedwait(&sink->cond, &sink->lock, &deadline) == ETIMEDOUT)
+                break;
+        }
+        /* take everything buffered so far, the next batch collects meanwhile */
+        buf = sink->buf;
+        len = sink->len;
+        sink->buf = NULL;
+        sink->len = sink->size = 0;
+        done = sink->pending;
+        sink->pending = sink->writing;
+        sink->writing = done;
+        pthread_mutex_unlock(&sink->lock);
+
+        ok = 1;
+        if (len) {
+            ok = sink->fd >= 0 && writeall(sink->fd, buf, len);
+            if (ok && sink->persist && fdatasync(sink->fd))
+                ok = 0;
+            if (!ok)
+                debugerrno(errno, DBG_ERR, "acctsink: failed to write %zu bytes of accounting records to %s", len, sink->file);
+            else
+                sink->written += len;
+            free(buf);
+        }
+        while (done->count) {
+            ctx = list_shift(done);
+            sink->done(ctx, ok);
+        }
+
+        now = time(NULL);
+        if ((sink->rotatesize && sink->written >= sink->rotatesize) ||
+            (sink->rotateinterval && sink->written && now - sink->opened >= sink->rotateinterval))
+            rotate(sink, now);
+        else if (sink->rotateinterval && now - sink->opened >= sink->rotateinterval)
+            sink->opened = now; /* nothing to rotate */
+    }
+    return NULL;
+}
+
+/**
+ * @brief queue an accounting record for writing
+ *
+ * @param ctx passed to the done callback once written, if the sink replies
+ * only after the records are persisted
+ * @return ACCTSINK_BUFFERED if the caller may reply now, ACCTSINK_PENDING
+ * if the done callback gets ctx, ACCTSINK_DROPPED if the record is lost
+ */
+int acctsink_write(struct acctsink *sink, struct radmsg *msg, const char *client, const char *realm, void *ctx) {
+    uint8_t *record, *buf;
+    size_t size;
+    int len, r = ACCTSINK_DROPPED;
+
+    len = acctsink_format(sink->format, msg, sink->types, sink->ntypes, client, realm, time(NULL), &record);
+    if (!len) {
+        debug(DBG_ERR, "acctsink_write: malloc failed");
+        return ACCTSINK_DROPPED;
+    }
+
+    pthread_mutex_lock(&sink->lock);
+    if (sink->len + len > ACCTSINK_MAXBUF) {
+        debug(DBG_WARN, "acctsink_write: sink %s is not keeping up, dropping accounting record", sink->name);
+        goto exit;
+    }
+    if (sink->len + len > sink->size) {
+        for (size = sink->size ? sink->size : 4096; size < sink->len + len; size *= 2)
+            ;
+        buf = realloc(sink->buf, size);
+        if (!buf) {
+            debug(DBG_ERR, "acctsink_write: malloc failed");
+            goto exit;
+        }
+        sink->buf = buf;
+        sink->size = size;
+    }
+    if (sink->persist && !list_push(sink->pending, ctx)) {
+        debug(DBG_ERR, "acctsink_write: malloc failed");
+        goto exit;
+    }
+    memcpy(sink->buf + sink->len, record, len);
+    if (!sink->len)
+        pthread_cond_signal(&sink->cond);
+    sink->len += len;
+    r = sink->persist ? ACCTSINK_PENDING : ACCTSINK_BUFFERED;
+
+exit:
+    pthread_mutex_unlock(&sink->lock);
+    free(record);
+    return r;
+}
+
+struct acctsink *acctsink_create(const char *name, const char *file, enum acctsink_format format,
+                                 long rotatesize, long rotateinterval, uint8_t persist) {
+    struct acctsink *sink;
+
+    sink = calloc(1, sizeof(struct acctsink));
+    if (!sink)
+        return NULL;
+    sink->name = stringcopy(name, 0);
+    sink->file = stringcopy(file, 0);
+    sink->pending = list_create();
+    sink->writing = list_create();
+    if (!sink->name || !sink->file || !sink->pending || !sink->writing) {
+        free(sink->name);
+        free(sink->file);
+        list_destroy(sink->pending);
+        list_destroy(sink->writing);
+        free(sink);
+        return NULL;
+    }
+    sink->format = format;
+    sink->rotatesize = rotatesize;
+    sink->rotateinterval = rotateinterval;
+    sink->persist = persist;
+    sink->fd = -1;
+    pthread_mutex_init(&sink->lock, NULL);
+    pthread_cond_init(&sink->cond, NULL);
+    return sink;
+}
+
+/* record only the given attribute types, instead of all but secrets */
+int acctsink_settypes(struct acctsink *sink, const uint8_t *types, int ntypes) {
+    free(sink->types);
+    sink->types = malloc(ntypes);
+    if (!sink->types)
+        return 0;
+    memcpy(sink->types, types, ntypes);
+    sink->ntypes = ntypes;
+    return 1;
+}
+
+const char *acctsink_name(struct acctsink *sink) {
+    return sink->name;
+}
+
+/**
+ * @brief open the file and start the writer thread of a sink
+ *
+ * @param done called with the ctx of each record once written
+ * @return 1 if ok, 0 on error
+ */
+int acctsink_start(struct acctsink *sink, acctsink_done_fn done) {
+    if (sink->started)
+        return 1;
+    sink->done = done;
+    if (!openfile(sink))
+        return 0;
+    if (pthread_create(&sink->thread, &pthread_attr, acctsinkwriter, sink)) {
+        debugerrno(errno, DBG_ERR, "acctsink: pthread_create failed");
+        return 0;
+    }
+    pthread_detach(sink->thread);
+    sink->started = 1;
+    return 1;
+}
+
+/* start all configured sinks */
+int acctsink_startall(acctsink_done_fn done) {
+    struct list_node *entry;
+
+    for (entry = list_first(sinks); entry; entry = list_next(entry))
+        if (!acctsink_start((struct acctsink *)entry->data, done))
+            return 0;
+    return 1;
+}
+
+struct acctsink *acctsink_get(const char *name) {
+    struct list_node *entry;
+
+    for (entry = list_first(sinks); entry; entry = list_next(entry))
+        if (!strcasecmp(((struct acctsink *)entry->data)->name, name))
+            return (struct acctsink *)entry->data;
+    return NULL;
+}
+
+int confacctsink_cb(struct gconffile **cf, void *arg, char *block, char *opt, char *val) {
+    struct acctsink *sink;
+    char *file = NULL, *format = NULL, *reply = NULL, **attrs = NULL, *end;
+    long int rotatesize = 0, rotateinterval = 0, type;
+    enum acctsink_format fmt = ACCTSINK_JSONL;
+    uint8_t persist = 0, types[256];
+    int n = 0, ok = 0;
+
+    debug(DBG_DBG, "confacctsink_cb called for %s", block);
+
+    if (!getgenericconfig(cf, block,
+                          "File", CONF_STR, &file,
+                          "Format", CONF_STR, &format,
+                          "Attribute", CONF_MSTR, &attrs,
+                          "RotateSize", CONF_LINT, &rotatesize,
+                          "RotateInterval", CONF_LINT, &rotateinterval,
+                          "Reply", CONF_STR, &reply,
+                          NULL)) {
+        debug(DBG_ERR, "confacctsink_cb: configuration error in block %s", val);
+        goto exit;
+    }
+    if (acctsink_get(val)) {
+        debug(DBG_ERR, "confacctsink_cb: accounting sink %s already defined", val);
+        goto exit;
+    }
+    if (!file) {
+        debug(DBG_ERR, "error in block %s, option File missing", block);
+        goto exit;
+    }
+    if (format) {
+        if (!strcasecmp(format, "JSONL"))
+            fmt = ACCTSINK_JSONL;
+        else if (!strcasecmp(format, "Binary"))
+            fmt = ACCTSINK_BINARY;
+        else {
+            debug(DBG_ERR, "error in block %s, Format must be JSONL or Binary", block);
+            goto exit;
+        }
+    }
+    if (reply) {
+        if (!strcasecmp(reply, "Persisted"))
+            persist = 1;
+        else if (strcasecmp(reply, "Buffered")) {
+            debug(DBG_ERR, "error in block %s, Reply must be Buffered or Persisted", block);
+            goto exit;
+        }
+    }
+    if (rotatesize < 0 || rotateinterval < 0) {
+        debug(DBG_ERR, "error in block %s, RotateSize and RotateInterval must not be negative", block);
+        goto exit;
+    }
+    for (n = 0; attrs && attrs[n]; n++) {
+        type = strtol(attrs[n], &end, 10);
+        if (*end || type < 1 || type > 255 || n == 256) {
+            debug(DBG_ERR, "error in block %s, Attribute %s must be an attribute type 1-255", block, attrs[n]);
+            goto exit;
+        }
+        types[n] = (uint8_t)type;
+    }
+
+    sink = acctsink_create(val, file, fmt, rotatesize, rotateinterval, persist);
+    if (!sink || (n && !acctsink_settypes(sink, types, n))) {
+        debug(DBG_ERR, "confacctsink_cb: malloc failed");
+        goto exit;
+    }
+    if (!sinks)
+        sinks = list_create();
+    if (!sinks || !list_push(sinks, sink)) {
+        debug(DBG_ERR, "confacctsink_cb: malloc failed");
+        goto exit;
+    }
+    debug(DBG_DBG, "confacctsink_cb: added accounting sink %s", val);
+    ok = 1;
+
+exit:
+    free(file);
+    free(format);
+    free(reply);
+    freegconfmstr(attrs);
+    return ok;
+}
+
+/* Local Variables: */
+/* c-file-style: "stroustrup" */
+/* End: */
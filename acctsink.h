@@ -0,0 +1,46 @@
+/* Copyright (c) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+#ifndef _ACCTSINK_H
+#define _ACCTSINK_H
+
+#include "radmsg.h"
+#include <stdint.h>
+#include <time.h>
+
+/* records buffered for a sink before new ones are dropped */
+#define ACCTSINK_MAXBUF (16 * 1024 * 1024)
+
+enum acctsink_format {
+    ACCTSINK_JSONL = 0,
+    ACCTSINK_BINARY
+};
+
+/* return values of acctsink_write */
+#define ACCTSINK_DROPPED 0
+#define ACCTSINK_BUFFERED 1
+#define ACCTSINK_PENDING 2
+
+struct acctsink;
+struct gconffile;
+
+/* called from the writer thread once the records are written, ok is 0 if writing failed */
+typedef void (*acctsink_done_fn)(void *ctx, int ok);
+
+int confacctsink_cb(struct gconffile **cf, void *arg, char *block, char *opt, char *val);
+struct acctsink *acctsink_create(const char *name, const char *file, enum acctsink_format format,
+                                 long rotatesize, long rotateinterval, uint8_t persist);
+int acctsink_settypes(struct acctsink *sink, const uint8_t *types, int ntypes);
+struct acctsink *acctsink_get(const char *name);
+const char *acctsink_name(struct acctsink *sink);
+int acctsink_start(struct acctsink *sink, acctsink_done_fn done);
+int acctsink_startall(acctsink_done_fn done);
+int acctsink_format(enum acctsink_format format, struct radmsg *msg, const uint8_t *types, int ntypes,
+                    const char *client, const char *realm, time_t now, uint8_t **out);
+int acctsink_write(struct acctsink *sink, struct radmsg *msg, const char *client, const char *realm, void *ctx);
+
+#endif /* _ACCTSINK_H */
+
+/* Local Variables: */
+/* c-file-style: "stroustrup" */
+/* End: */
@@ -0,0 +1,151 @@
+/* Copyright (c) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+/* Scanning for runs of printable ASCII (0x20-0x7e), the common case in user
+ * names, station ids and PSK identities, using vector instructions where the
+ * CPU has them. The scalar version is the reference for the others. */
+
+#include "asciiscan.h"
+#include "util.h"
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(__SSE2__)
+#define ASCIISCAN_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__SSE2__) && defined(__GNUC__) && !defined(__INTEL_COMPILER)
+#define ASCIISCAN_AVX2
+#include <immintrin.h>
+#endif
+#elif defined(__aarch64__)
+#define ASCIISCAN_NEON
+#include <arm_neon.h>
+#endif
+
+#define ISPRINTABLE(c) ((c) >= 0x20 && (c) <= 0x7e)
+
+/**
+ * @brief Count the leading printable ASCII bytes (0x20-0x7e) of s.
+ *
+ * @param s bytes to scan
+ * @param len number of bytes in s
+ * @return number of leading printable bytes, len if all of them are
+ */
+size_t printablespan_scalar(const unsigned char *s, size_t len) {
+    size_t i;
+
+    for (i = 0; i < len && ISPRINTABLE(s[i]); i++)
+        ;
+    return i;
+}
+
+#ifdef ASCIISCAN_SSE2
+/* adding 0x60 maps 0x20-0x7e to -128..-34 (signed) and everything else above that */
+static size_t printablespan_sse2(const unsigned char *s, size_t len) {
+    const __m128i bias = _mm_set1_epi8(0x60), limit = _mm_set1_epi8(-33);
+    size_t i;
+    int mask;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        __m128i v = _mm_add_epi8(_mm_loadu_si128((const __m128i *)(s + i)), bias);
+        mask = _mm_movemask_epi8(_mm_cmplt_epi8(v, limit));
+        if (mask != 0xffff)
+            return i + __builtin_ctz(~mask);
+    }
+    if (i == len || len < 16)
+        return i + printablespan_scalar(s + i, len - i);
+    /* the tail overlaps bytes already known to be printable */
+    i = len - 16;
+    mask = _mm_movemask_epi8(_mm_cmplt_epi8(_mm_add_epi8(_mm_loadu_si128((const __m128i *)(s + i)), bias), limit));
+    return mask == 0xffff ? len : i + __builtin_ctz(~mask);
+}
+#endif
+
+#ifdef ASCIISCAN_AVX2
+__attribute__((target("avx2"))) static size_t printablespan_avx2(const unsigned char *s, size_t len) {
+    const __m256i bias = _mm256_set1_epi8(0x60), limit = _mm256_set1_epi8(-33);
+    size_t i;
+    unsigned int mask;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_add_epi8(_mm256_loadu_si256((const __m256i *)(s + i)), bias);
+        mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpgt_epi8(limit, v));
+        if (mask != 0xffffffff)
+            return i + __builtin_ctz(~mask);
+    }
+    if (i == len)
+        return len;
+    if (len < 32)
+        return printablespan_sse2(s, len);
+    i = len - 32;
+    mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpgt_epi8(limit, _mm256_add_epi8(_mm256_loadu_si256((const __m256i *)(s + i)), bias)));
+    return mask == 0xffffffff ? len : i + __builtin_ctz(~mask);
+}
+#endif
+
+#ifdef ASCIISCAN_NEON
+static size_t printablespan_neon(const unsigned char *s, size_t len) {
+    const uint8x16_t lo = vdupq_n_u8(0x20), hi = vdupq_n_u8(0x7e);
+    size_t i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        uint8x16_t v = vld1q_u8(s + i);
+        if (vminvq_u8(vandq_u8(vcgeq_u8(v, lo), vcleq_u8(v, hi))) != 0xff)
+            return i + printablespan_scalar(s + i, 16);
+    }
+    return i + printablespan_scalar(s + i, len - i);
+}
+#endif
+
+/* by increasing CPU requirements, see cpuimpls() */
+static const struct asciiscanimpl impls[] = {
+    {"scalar", printablespan_scalar, 0},
+#ifdef ASCIISCAN_SSE2
+    {"sse2", printablespan_sse2, 0},
+#endif
+#ifdef ASCIISCAN_NEON
+    {"neon", printablespan_neon, 0},
+#endif
+#ifdef ASCIISCAN_AVX2
+    {"avx2", printablespan_avx2, CPU_AVX2},
+#endif
+};
+
+static int nimpls; /* the last one is used */
+static pthread_once_t selectonce = PTHREAD_ONCE_INIT;
+
+static void selectimpl(void) {
+    nimpls = cpuimpls(&impls[0].cpufeatures, sizeof(impls) / sizeof(impls[0]), sizeof(impls[0]));
+}
+
+/**
+ * @brief Count the leading printable ASCII bytes (0x20-0x7e) of s, using the
+ * fastest implementation supported by the CPU.
+ */
+size_t printablespan(const unsigned char *s, size_t len) {
+    pthread_once(&selectonce, selectimpl);
+    return impls[nimpls - 1].printablespan(s, len);
+}
+
+/**
+ * @brief Get the scanners this CPU can run, to check them against the scalar
+ * one in t_asciiscan and time them in b_asciiscan.
+ *
+ * @param count set to the number of scanners
+ * @return array of scanners, the scalar reference first
+ */
+const struct asciiscanimpl *asciiscanimpls(int *count) {
+    pthread_once(&selectonce, selectimpl);
+    *count = nimpls;
+    return impls;
+}
+
+const char *asciiscanimplname(void) {
+    pthread_once(&selectonce, selectimpl);
+    return impls[nimpls - 1].name;
+}
+
+/* Local Variables: */
+/* c-file-style: "stroustrup" */
+/* End: */
@@ -0,0 +1,26 @@
+/* Copyright (c) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+#ifndef _ASCIISCAN_H
+#define _ASCIISCAN_H
+
+#include <stddef.h>
+
+typedef size_t (*printablespan_fn)(const unsigned char *s, size_t len);
+
+struct asciiscanimpl {
+    const char *name;
+    printablespan_fn printablespan;
+    unsigned cpufeatures; /* CPU_* flags needed */
+};
+
+size_t printablespan(const unsigned char *s, size_t len);
+size_t printablespan_scalar(const unsigned char *s, size_t len);
+const struct asciiscanimpl *asciiscanimpls(int *count);
+const char *asciiscanimplname(void);
+
+#endif /* _ASCIISCAN_H */
+
+/* Local Variables: */
+/* c-file-style: "stroustrup" */
+/* End: */
@@ -4,12 +4,39 @@
 
 #include "debug.h"
 #include "gconfig.h"
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
-int listconfig(struct gconffile **cf, char *block, int compact) {
+/* record the include pattern and the files pushed by pushgconfpaths */
+static int snapinclude(struct gconffile **cf, FILE *snap, char *val) {
+    char *pattern, *globstamp = NULL, stamp[GCONF_SOURCE_STAMP_LEN], *p;
+    int i, n, ok = 0;
+
+    pattern = gconfincludepath(*cf, val);
+    if (!pattern || !gconfglobstamp(pattern, &globstamp) ||
+        !writegconfsnaprecord(snap, GCONF_SNAP_GLOB, pattern, globstamp))
+        goto exit;
+    if (!pushgconfpaths(cf, val))
+        debugx(1, DBG_ERR, "failed to include config file %s", val);
+    for (n = *globstamp ? 1 : 0, p = globstamp; *p; p++)
+        if (*p == '\n')
+            n++;
+    for (i = 0; i < n; i++)
+        if (!gconfsourcestamp((*cf)[i].path, stamp, sizeof(stamp)) ||
+            !writegconfsnaprecord(snap, GCONF_SNAP_SOURCE, (*cf)[i].path, stamp))
+            goto exit;
+    ok = 1;
+
+exit:
+    free(pattern);
+    free(globstamp);
+    return ok;
+}
+
+int listconfig(struct gconffile **cf, char *block, int compact, FILE *snap) {
     char *opt = NULL, *val = NULL;
     int conftype;
 
@@ -22,23 +49,37 @@ int listconfig(struct gconffile **cf, char *block, int compact) {
             return 0; /* Success.  */
 
         if (conftype == CONF_STR && !strcasecmp(opt, "include")) {
-            if (!pushgconfpaths(cf, val))
+            if (snap) {
+                if (!snapinclude(cf, snap, val))
+                    goto errsnap;
+            } else if (!pushgconfpaths(cf, val))
                 debugx(1, DBG_ERR, "failed to include config file %s", val);
             continue;
         }
 
         switch (conftype) {
         case CONF_STR:
-            if (block)
+            if (snap) {
+                if (!writegconfsnaprecord(snap, GCONF_SNAP_OPTION, opt, val))
+                    goto errsnap;
+            } else if (block)
                 printf(compact ? "%s=%s;" : "\t%s=%s\n", opt, val);
             else
                 printf("%s=%s\n", opt, val);
             break;
         case CONF_CBK:
-            printf("%s %s {%s", opt, val, compact ? "" : "\n");
-            if (listconfig(cf, val, compact))
+            if (snap) {
+                if (!writegconfsnaprecord(snap, GCONF_SNAP_BLOCK, opt, val))
+                    goto errsnap;
+            } else
+                printf("%s %s {%s", opt, val, compact ? "" : "\n");
+            if (listconfig(cf, val, compact, snap))
                 return -1;
-            printf("}\n");
+            if (snap) {
+                if (!writegconfsnaprecord(snap, GCONF_SNAP_BLOCKEND, "", ""))
+                    goto errsnap;
+            } else
+                printf("}\n");
             break;
         default:
             printf("Unsupported config type\n");
@@ -47,20 +88,105 @@ int listconfig(struct gconffile **cf, char *block, int compact) {
     }
 
     return 0; /* Success.  */
+
+errsnap:
+    free(opt);
+    free(val);
+    debug(DBG_ERR, "failed to write config snapshot");
+    return -1;
+}
+
+/* write the snapshot to a temporary file and move it in place when complete */
+int writesnapshot(const char *configfile) {
+    struct gconffile *cfs;
+    char path[PATH_MAX], *snappath = NULL, *tmppath = NULL, stamp[GCONF_SOURCE_STAMP_LEN];
+    FILE *snap = NULL;
+    int fd, result = -1;
+
+    /* made absolute but not resolved, so that relative includes are found
+       in the directory of configfile as radsecproxy does, also if it is a
+       symbolic link */
+    if (*configfile == '/') {
+        if (strlen(configfile) >= sizeof(path))
+            goto errpath;
+        strcpy(path, configfile);
+    } else if (!getcwd(path, sizeof(path)) || strlen(path) + strlen(configfile) + 2 > sizeof(path))
+        goto errpath;
+    else
+        sprintf(path + strlen(path), "/%s", configfile);
+    cfs = openconfigfile(path);
+    if (!cfs)
+        return -1;
+
+    snappath = malloc(strlen(configfile) + strlen(GCONF_SNAPSHOT_SUFFIX) + 1);
+    tmppath = malloc(strlen(configfile) + strlen(GCONF_SNAPSHOT_SUFFIX) + 8);
+    if (!snappath || !tmppath) {
+        debug(DBG_ERR, "malloc failed");
+        goto exit;
+    }
+    sprintf(snappath, "%s%s", configfile, GCONF_SNAPSHOT_SUFFIX);
+    sprintf(tmppath, "%s.XXXXXX", snappath);
+    if ((fd = mkstemp(tmppath)) < 0) {
+        debug(DBG_ERR, "could not create %s", tmppath);
+        goto exit;
+    }
+    if (!(snap = fdopen(fd, "w"))) {
+        close(fd);
+        goto errwrite;
+    }
+
+    if (fputs(GCONF_SNAPSHOT_MAGIC, snap) == EOF ||
+        !gconfsourcestamp(path, stamp, sizeof(stamp)) ||
+        !writegconfsnaprecord(snap, GCONF_SNAP_SOURCE, path, stamp))
+        goto errwrite;
+    if (listconfig(&cfs, NULL, 0, snap))
+        goto exit;
+    if (!writegconfsnaprecord(snap, GCONF_SNAP_END, "", ""))
+        goto errwrite;
+    if (fclose(snap)) {
+        snap = NULL;
+        goto errwrite;
+    }
+    snap = NULL;
+    if (rename(tmppath, snappath)) {
+        debug(DBG_ERR, "could not rename %s to %s", tmppath, snappath);
+        goto exit;
+    }
+    result = 0;
+    goto exit;
+
+errwrite:
+    debug(DBG_ERR, "failed to write config snapshot %s", tmppath);
+exit:
+    if (snap)
+        fclose(snap);
+    if (result && tmppath)
+        unlink(tmppath);
+    freegconf(&cfs);
+    free(snappath);
+    free(tmppath);
+    return result;
+
+errpath:
+    debug(DBG_ERR, "could not read config file %s", configfile);
+    return -1;
 }
 
 int main(int argc, char **argv) {
-    int c, compact = 0;
+    int c, compact = 0, snapshot = 0;
     struct gconffile *cfs;
 
     debug_init("radsecproxy-conf");
     debug_set_level(DBG_WARN);
 
-    while ((c = getopt(argc, argv, "c")) != -1) {
+    while ((c = getopt(argc, argv, "cs")) != -1) {
         switch (c) {
         case 'c':
             compact = 1;
             break;
+        case 's':
+            snapshot = 1;
+            break;
         default:
             goto usage;
         }
@@ -68,11 +194,13 @@ int main(int argc, char **argv) {
     if (argc - optind != 1)
         goto usage;
 
+    if (snapshot)
+        return writesnapshot(argv[optind]);
     cfs = openconfigfile(argv[optind]);
-    return listconfig(&cfs, NULL, compact);
+    return listconfig(&cfs, NULL, compact, NULL);
 
 usage:
-    debug(DBG_ERR, "Usage:\n%s [ -c ] configfile", argv[0]);
+    debug(DBG_ERR, "Usage:\n%s [ -c | -s ] configfile", argv[0]);
     exit(1);
 }
 
@@ -30,13 +30,14 @@
 #ifdef RADPROT_DTLS
 #include "debug.h"
 #include "hostport.h"
+#include "sockstats.h"
+#include "threadreg.h"
 #include "util.h"
 
 static void setprotoopts(struct commonprotoopts *opts);
 static char **getlistenerargs(void);
 void *dtlslistener(void *arg);
 int dtlsconnect(struct server *server, int timeout, int reconnect);
-void *dtlsclientrd(void *arg);
 int clientradputdtls(struct server *server, unsigned char *rad, int radlen);
 void addserverextradtls(struct clsrvconf *conf);
 void dtlssetsrcres(void);
@@ -56,8 +57,9 @@ static const struct protodefs protodefs = {
     getlistenerargs,        /* getlistenerargs */
     dtlslistener,           /* listener */
     dtlsconnect,            /* connecter */
-    dtlsclientrd,           /* clientconnreader */
+    tlsclientradget,        /* clientradget */
     clientradputdtls,       /* clientradput */
+    NULL,                   /* clientradflush */
     NULL,                   /* addclient */
     NULL,                   /* addserverextra */
     dtlssetsrcres,          /* setsrcres */
@@ -101,7 +103,7 @@ void *dtlsservernew(void *arg) {
     struct list_node *cur = NULL;
     X509 *cert = NULL;
     struct tls *accepted_tls = NULL;
-    int s = -1;
+    int s = -1, radius11;
     unsigned long error;
     struct timeval timeout;
     struct addrinfo tmpsrvaddr;
@@ -109,6 +111,7 @@ void *dtlsservernew(void *arg) {
     struct hostportres *hp;
 
     debug(DBG_WARN, "dtlsservernew: incoming DTLS connection from %s", addr2string((struct sockaddr *)&params->addr, tmp, sizeof(tmp)));
+    threadreg_name("dtlsrd:%s", tmp);
 
     if (!(conf = find_clconf(handle, (struct sockaddr *)&params->addr, &cur, &hp))) {
         debug(DBG_WARN, "dtlsservernew ignoring unknown DTLS client %s", addr2string((struct sockaddr *)&params->addr, tmp, sizeof(tmp)));
@@ -132,6 +135,7 @@ void *dtlsservernew(void *arg) {
     if (!SSL_set_ex_data(params->ssl, RSP_EX_DATA_CONFIG_LIST, find_all_clconf(handle, (struct sockaddr *)&params->addr, cur, &hp))) {
         debug(DBG_WARN, "dtlsservernew: failed to set ex data");
     }
+    tlssetradiusversions(params->ssl, handle, (struct sockaddr *)&params->addr, cur);
 
     if (sslaccepttimeout(params->ssl, 30) <= 0) {
         struct clsrvconf *selected = SSL_get_ex_data(params->ssl, RSP_EX_DATA_CONFIG);
@@ -185,9 +189,13 @@ void *dtlsservernew(void *arg) {
               addr2string((struct sockaddr *)&params->addr, tmp, sizeof(tmp)));
         goto exit;
     }
+    if ((radius11 = tlsradiusversion(params->ssl, conf)) < 0)
+        goto exit;
 
+    threadreg_name("dtlsrd:%s", conf->name);
     client = addclient(conf, 1);
     if (client) {
+        client->radius11 = radius11;
         client->sock = s;
         client->addr = addr_copy((struct sockaddr *)&params->addr);
         client->ssl = params->ssl;
@@ -210,8 +218,11 @@ exit:
     pthread_exit(NULL);
 }
 
-int getConnectionInfo(int socket, struct sockaddr *from, socklen_t fromlen, struct sockaddr *to, socklen_t tolen) {
-    uint8_t controlbuf[128];
+int getConnectionInfo(int socket, struct sockstats *st, struct sockaddr *from, socklen_t fromlen, struct sockaddr *to, socklen_t tolen) {
+    union {
+        uint8_t buf[SOCKSTATS_CMSG_SPACE + CMSG_SPACE(sizeof(struct in6_pktinfo))];
+        struct cmsghdr align;
+    } controlbuf;
     int ret;
     struct cmsghdr *ctrlhdr;
     struct msghdr msghdr;
@@ -224,7 +235,7 @@ int getConnectionInfo(int socket, struct sockaddr *from, socklen_t fromlen, stru
     msghdr.msg_namelen = fromlen;
     msghdr.msg_iov = iov;
     msghdr.msg_iovlen = (sizeof(iov) / sizeof(*(iov)));
-    msghdr.msg_control = controlbuf;
+    msghdr.msg_control = &controlbuf;
     msghdr.msg_controllen = sizeof(controlbuf);
     msghdr.msg_flags = 0;
 
@@ -232,6 +243,7 @@ int getConnectionInfo(int socket, struct sockaddr *from, socklen_t fromlen, stru
         debug(DBG_ERR, "getConnectionInfo: recvmsg failed: %s", strerror(errno));
         return ret;
     }
+    sockstats_update(st, &msghdr);
 
     debug(DBG_DBG, "udp packet from: %s", addr2string(from, tmp, sizeof(tmp)));
 
@@ -283,7 +295,9 @@ void *dtlslistener(void *arg) {
     SSL *ssl;
     SSL_CTX *ctx;
     char tmp[INET6_ADDRSTRLEN];
+    struct sockstats *st = sockstats_find(s);
 
+    threadreg_name("dtlslisten");
     debug(DBG_DBG, "dtlslistener: starting");
 
     if ((flags = fcntl(s, F_GETFL)) == -1)
@@ -294,11 +308,15 @@ void *dtlslistener(void *arg) {
     for (;;) {
         fds[0].fd = s;
         fds[0].events = POLLIN;
-        ndesc = poll(fds, 1, -1);
-        if (ndesc < 0)
+        do
+            ndesc = poll(fds, 1, -1);
+        while (ndesc < 0 && errno == EINTR);
+        if (ndesc < 0) {
+            debugerrno(errno, DBG_ERR, "dtlslistener: poll failed");
             continue;
+        }
 
-        if (getConnectionInfo(s, (struct sockaddr *)&from, sizeof(from), (struct sockaddr *)&to, sizeof(to)) < 0) {
+        if (getConnectionInfo(s, st, (struct sockaddr *)&from, sizeof(from), (struct sockaddr *)&to, sizeof(to)) < 0) {
             debug(DBG_DBG, "dtlslistener: getConnectionInfo failed");
             sock_dgram_skip(s);
             continue;
@@ -376,7 +394,7 @@ static void cleanup_connection(struct server *server) {
 int dtlsconnect(struct server *server, int timeout, int reconnect) {
     struct timeval socktimeout, now, start;
     uint32_t wait;
-    int firsttry = 1;
+    int firsttry = 1, radius11 = 0, origflags;
     X509 *cert;
     SSL_CTX *ctx = NULL;
     struct hostportres *hp;
@@ -398,14 +416,14 @@ int dtlsconnect(struct server *server, int timeout, int reconnect) {
             debug(DBG_WARN, "dtlsconnect: could not resolve source address to bind for server %s, using default", server->conf->name);
     }
 
-    gettimeofday(&start, NULL);
+    monotime(&start);
 
     for (;;) {
         /* ensure previous connection is properly closed */
         cleanup_connection(server);
 
         wait = connect_wait(start, server->connecttime, firsttry);
-        gettimeofday(&now, NULL);
+        monotime(&now);
         if (timeout && (now.tv_sec - start.tv_sec) + wait > timeout) {
             debug(DBG_DBG, "dtlsconnect: timeout");
             if (source)
@@ -414,7 +432,7 @@ int dtlsconnect(struct server *server, int timeout, int reconnect) {
         }
         if (wait)
             debug(DBG_INFO, "Next connection attempt to %s in %lds", server->conf->name, wait);
-        sleep(wait);
+        connect_sleep(wait);
         firsttry = 0;
 
         for (entry = list_first(server->conf->hostports); entry; entry = list_next(entry)) {
@@ -424,6 +442,7 @@ int dtlsconnect(struct server *server, int timeout, int reconnect) {
                 debug(DBG_ERR, "dtlsconnect: failed to bind socket for server %s (%s port %s)", server->conf->name, hp->host, hp->port);
                 goto concleanup;
             }
+            set_sockbufs(server->sock, server->conf->rcvbuf, server->conf->sndbuf);
             if (connect(server->sock, hp->addrinfo->ai_addr, hp->addrinfo->ai_addrlen)) {
                 debug(DBG_ERR, "dtlsconnect: failed to connect socket for server %s (%s port %s)", server->conf->name, hp->host, hp->port);
                 goto concleanup;
@@ -447,6 +466,11 @@ int dtlsconnect(struct server *server, int timeout, int reconnect) {
                 debug(DBG_WARN, "dtlsconnect: failed to set ex data");
             }
 
+            if (!tlssetalpn(server->ssl, server->conf->radiusversion)) {
+                debug(DBG_ERR, "dtlsconnect: failed to set ALPN");
+                goto concleanup;
+            }
+
             if (server->conf->sni) {
                 struct in6_addr tmp;
                 char *servername = server->conf->sniservername                                                   ? server->conf->sniservername
@@ -473,6 +497,8 @@ int dtlsconnect(struct server *server, int timeout, int reconnect) {
                 debug(DBG_ERR, "dtlsconnect: SSL connect to %s (%s port %s) failed", server->conf->name, hp->host, hp->port);
                 goto concleanup;
             }
+            if ((radius11 = tlsradiusversion(server->ssl, server->conf)) < 0)
+                goto concleanup;
             socktimeout.tv_sec = 5;
             socktimeout.tv_usec = 0;
             if (BIO_ctrl(bio, BIO_CTRL_DGRAM_SET_RECV_TIMEOUT, 0, &socktimeout) == -1)
@@ -516,15 +542,23 @@ int dtlsconnect(struct server *server, int timeout, int reconnect) {
         if (server->ssl)
             break;
     }
-    gettimeofday(&server->connecttime, NULL);
+    monotime(&server->connecttime);
     server->tlsnewkey = server->connecttime;
 
+    /* replies are read by the upstream reactor, which must never block */
+    origflags = fcntl(server->sock, F_GETFL, 0);
+    if (origflags == -1) {
+        debugerrno(errno, DBG_WARN, "Failed to get flags");
+    } else if (fcntl(server->sock, F_SETFL, origflags | O_NONBLOCK) == -1) {
+        debugerrno(errno, DBG_WARN, "Failed to set O_NONBLOCK");
+    }
+
     pthread_mutex_lock(&server->lock);
     server->state = RSP_SERVER_STATE_CONNECTED;
     pthread_mutex_unlock(&server->lock);
     pthread_mutex_lock(&server->newrq_mutex);
+    server->radius11 = radius11;
     server->conreset = reconnect;
-    pthread_cond_signal(&server->newrq_cond);
     pthread_mutex_unlock(&server->newrq_mutex);
     if (source)
         freeaddrinfo(source);
@@ -547,7 +581,7 @@ int clientradputdtls(struct server *server, unsigned char *rad, int radlen) {
         return 0;
     }
 
-    gettimeofday(&now, NULL);
+    monotime(&now);
 #if OPENSSL_VERSION_NUMBER >= 0x10101000
     if (now.tv_sec - server->tlsnewkey.tv_sec > RSP_TLS_REKEY_INTERVAL && SSL_version(server->ssl) >= TLS1_3_VERSION) {
         debug(DBG_DBG, "clientradputdtls: perform key update for long-running connection");
@@ -568,41 +602,6 @@ int clientradputdtls(struct server *server, unsigned char *rad, int radlen) {
     return 1;
 }
 
-void *dtlsclientrd(void *arg) {
-    struct server *server = (struct server *)arg;
-    unsigned char *buf = NULL;
-    int len = 0;
-
-    for (;;) {
-        len = radtlsget(server->ssl, server->conf->retryinterval * (server->conf->retrycount + 1), &server->lock, &buf);
-        if (buf && len > 0) {
-            if (!replyh(server, buf, len))
-                if (closeh(server))
-                    break;
-            buf = NULL;
-        } else if (SSL_get_shutdown(server->ssl)) {
-            if (closeh(server))
-                break;
-        } else {
-            if (timeouth(server))
-                break;
-        }
-    }
-
-    debug(DBG_INFO, "dtlsclientrd: exiting for %s", server->conf->name);
-    pthread_mutex_lock(&server->lock);
-    server->state = RSP_SERVER_STATE_FAILING;
-    SSL_shutdown(server->ssl);
-    close(server->sock);
-
-    /* Wake up clientwr(). */
-    server->clientrdgone = 1;
-    pthread_mutex_unlock(&server->lock);
-    pthread_mutex_lock(&server->newrq_mutex);
-    pthread_cond_signal(&server->newrq_cond);
-    pthread_mutex_unlock(&server->newrq_mutex);
-    return NULL;
-}
 
 #else
 const struct protodefs *dtlsinit(uint8_t h) {
@@ -0,0 +1,123 @@
+/* Copyright (c) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+/* Flight recorder: a summary of each of the last requests in a ring of
+ * fixed-size records in a memory-mapped file. The records are in the page
+ * cache as soon as they are written, so they survive a crash of the process
+ * and can be read with tools/flightrec.py after an incident, also while
+ * radsecproxy is running. Writers claim a slot with an atomic increment of
+ * the counter in the file header and fill it without any lock; the sequence
+ * number of a record is cleared while it is written and stored last, so
+ * that readers can skip records being written. A file written by a previous
+ * run with the same size is continued. */
+
+#include "flightrec.h"
+#include "debug.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct flightrec_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordsize;
+    uint64_t records;
+    uint64_t next; /* slots claimed so far */
+    uint8_t reserved[FLIGHTREC_HEADERSIZE - 32];
+};
+
+static struct flightrec_header *header;
+static struct flightrec_record *ring;
+static uint64_t nrecords;
+static size_t mapsize;
+
+/**
+ * @brief open or create the ring file and map it
+ *
+ * @param path the file
+ * @param records number of records in the ring
+ * @return 1 on success, 0 on failure
+ */
+int flightrec_open(const char *path, uint32_t records) {
+    int fd;
+    struct stat st;
+    size_t size = FLIGHTREC_HEADERSIZE + (size_t)records * sizeof(struct flightrec_record);
+    void *map;
+
+    if (!records)
+        return 0;
+    fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        debugerrno(errno, DBG_ERR, "flightrec_open: failed to open %s", path);
+        return 0;
+    }
+    if (fstat(fd, &st) || ((size_t)st.st_size != size && ftruncate(fd, size))) {
+        debugerrno(errno, DBG_ERR, "flightrec_open: failed to size %s", path);
+        close(fd);
+        return 0;
+    }
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        debugerrno(errno, DBG_ERR, "flightrec_open: failed to map %s", path);
+        return 0;
+    }
+
+    flightrec_close();
+    header = map;
+    ring = (struct flightrec_record *)((uint8_t *)map + FLIGHTREC_HEADERSIZE);
+    nrecords = records;
+    mapsize = size;
+    if (memcmp(header->magic, FLIGHTREC_MAGIC, sizeof(header->magic)) || header->version != FLIGHTREC_VERSION ||
+        header->recordsize != sizeof(struct flightrec_record) || header->records != records) {
+        memset(map, 0, size);
+        header->version = FLIGHTREC_VERSION;
+        header->recordsize = sizeof(struct flightrec_record);
+        header->records = records;
+        memcpy(header->magic, FLIGHTREC_MAGIC, sizeof(header->magic));
+    }
+    debug(DBG_INFO, "flightrec_open: recording the last %u requests in %s", records, path);
+    return 1;
+}
+
+int flightrec_enabled(void) {
+    return header != NULL;
+}
+
+/**
+ * @brief store a record in the next slot of the ring, lock-free
+ *
+ * @param rec the record, its seq is set here
+ */
+void flightrec_write(struct flightrec_record *rec) {
+    uint64_t slot;
+    struct flightrec_record *r;
+
+    if (!header)
+        return;
+    slot = __atomic_fetch_add(&header->next, 1, __ATOMIC_RELAXED);
+    r = &ring[slot % nrecords];
+    __atomic_store_n(&r->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    rec->seq = 0;
+    memcpy(r, rec, sizeof(*r));
+    __atomic_store_n(&r->seq, slot + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief unmap the ring, only when no thread writes to it any more
+ */
+void flightrec_close(void) {
+    if (!header)
+        return;
+    munmap(header, mapsize);
+    header = NULL;
+    ring = NULL;
+}
+
+/* Local Variables: */
+/* c-file-style: "stroustrup" */
+/* End: */
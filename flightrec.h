@@ -0,0 +1,53 @@
+/* Copyright (c) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+#ifndef _FLIGHTREC_H
+#define _FLIGHTREC_H
+
+#include <stdint.h>
+
+#define FLIGHTREC_MAGIC "RSPFREC1"
+#define FLIGHTREC_VERSION 1
+#define FLIGHTREC_HEADERSIZE 64
+#define FLIGHTREC_NAMELEN 24
+#define FLIGHTREC_DEFAULT_RECORDS 65536
+#define FLIGHTREC_MAX_RECORDS (1 << 24)
+
+/* how a request ended */
+#define FLIGHTREC_DROPPED 0   /* no reply, e.g. invalid or no route */
+#define FLIGHTREC_REPLIED 1   /* reply from the server passed on */
+#define FLIGHTREC_LOCAL 2     /* answered by radsecproxy itself */
+#define FLIGHTREC_TIMEOUT 3   /* no reply from the server */
+#define FLIGHTREC_DUPLICATE 4 /* retransmission of a request in progress */
+#define FLIGHTREC_SHED 5      /* dropped by the memory budget or realm share */
+
+/* One request, 128 bytes in host byte order. Names are truncated and only
+ * NUL terminated if shorter than FLIGHTREC_NAMELEN. */
+struct flightrec_record {
+    uint64_t seq;     /* slot number + 1, 0 while being written */
+    int64_t time;     /* wall-clock microseconds when the request ended */
+    uint32_t latency; /* microseconds since it was received */
+    uint8_t code;
+    uint8_t id;        /* RADIUS id from the client */
+    uint8_t replycode; /* 0 for none */
+    uint8_t outcome;
+    uint8_t tries;  /* times sent to the server */
+    uint8_t family; /* of addr, 0 if unknown */
+    uint16_t port;  /* network byte order */
+    uint8_t addr[16];
+    char client[FLIGHTREC_NAMELEN];
+    char realm[FLIGHTREC_NAMELEN];
+    char server[FLIGHTREC_NAMELEN];
+    uint8_t reserved[12];
+};
+
+int flightrec_open(const char *path, uint32_t records);
+int flightrec_enabled(void);
+void flightrec_write(struct flightrec_record *rec);
+void flightrec_close(void);
+
+#endif /* _FLIGHTREC_H */
+
+/* Local Variables: */
+/* c-file-style: "stroustrup" */
+/* End: */
@@ -3,49 +3,81 @@
 
 #include "fticks_hashmac.h"
 #include <ctype.h>
-#include <errno.h>
-#include <nettle/hmac.h>
-#include <nettle/sha.h>
-#include <stdio.h>
-#include <stdlib.h>
 #include <string.h>
 
 /** \a HASH is an input buffer of length SHA256_DIGEST_SIZE bytes.
     \a OUT_LEN is the size in bytes of \OUT.
     \a OUT is an output buffer of length \a OUT_LEN. */
 static void _format_hash(const uint8_t *hash, size_t out_len, uint8_t *out) {
-    int ir, iw;
+    static const char hex[] = "0123456789abcdef";
+    size_t ir, iw;
 
     if (out_len < 3) {
         memset(out, 0, out_len);
         return;
     }
 
-    for (ir = 0, iw = 0; iw <= out_len - 3; ir++, iw += 2)
-        sprintf((char *)out + iw, "%02x", hash[ir % SHA256_DIGEST_SIZE]);
+    for (ir = 0, iw = 0; iw + 3 <= out_len; ir++, iw += 2) {
+        out[iw] = hex[hash[ir % SHA256_DIGEST_SIZE] >> 4];
+        out[iw + 1] = hex[hash[ir % SHA256_DIGEST_SIZE] & 0xf];
+    }
+    out[iw] = '\0';
 }
 
-static void _hash(const uint8_t *in,
-                  const uint8_t *key,
-                  size_t out_len,
-                  uint8_t *out) {
-    if (key == NULL) {
-        struct sha256_ctx ctx;
-        uint8_t hash[SHA256_DIGEST_SIZE];
-
-        sha256_init(&ctx);
-        sha256_update(&ctx, strlen((char *)in), in);
-        sha256_digest(&ctx, sizeof(hash), hash);
-        _format_hash(hash, out_len, out);
-    } else {
-        struct hmac_sha256_ctx ctx;
-        uint8_t hash[SHA256_DIGEST_SIZE];
+/** Prepare \a CTX for hashing MAC addresses, keying a HMAC with \a
+    KEY unless \a KEY is NULL.  The inner and outer HMAC states are
+    computed once here rather than for every address hashed.  \a CTX
+    is not modified by fticks_hashmac_hash and may be shared by
+    threads.  */
+void fticks_hashmac_init(struct fticks_hashmac_ctx *ctx, const uint8_t *key) {
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->keyed = key != NULL;
+    if (key)
+        hmac_sha256_set_key(&ctx->hmac, strlen((const char *)key), key);
+}
+
+/** Hash the first \a IN_LEN bytes of \a IN, or up to the first NUL,
+    with the key of \a CTX, sanitising as described for
+    fticks_hashmac.  No memory is allocated; the sanitised address is
+    fed to the hash in pieces.  */
+void fticks_hashmac_hash(const struct fticks_hashmac_ctx *ctx,
+                         const uint8_t *in,
+                         size_t in_len,
+                         size_t out_len,
+                         uint8_t *out) {
+    struct hmac_sha256_ctx hmac;
+    struct sha256_ctx sha;
+    uint8_t buf[64], hash[SHA256_DIGEST_SIZE], c;
+    size_t i, n = 0;
+
+    if (ctx->keyed)
+        memcpy(&hmac, &ctx->hmac, sizeof(hmac));
+    else
+        sha256_init(&sha);
+
+    /* Sanitise and lowercase 'in' into 'buf'.  */
+    for (i = 0; i < in_len && in[i] != '\0' && in[i] != ';'; i++) {
+        c = tolower(in[i]);
+        if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f')) {
+            buf[n++] = c;
+            if (n == sizeof(buf)) {
+                if (ctx->keyed)
+                    hmac_sha256_update(&hmac, n, buf);
+                else
+                    sha256_update(&sha, n, buf);
+                n = 0;
+            }
+        }
+    }
 
-        hmac_sha256_set_key(&ctx, strlen((char *)key), key);
-        hmac_sha256_update(&ctx, strlen((char *)in), in);
-        hmac_sha256_digest(&ctx, sizeof(hash), hash);
-        _format_hash(hash, out_len, out);
+    if (ctx->keyed) {
+        hmac_sha256_update(&hmac, n, buf);
+        hmac_sha256_digest(&hmac, sizeof(hash), hash);
+    } else {
+        sha256_update(&sha, n, buf);
+        sha256_digest(&sha, sizeof(hash), hash);
     }
+    _format_hash(hash, out_len, out);
 }
 
 /** Hash the Ethernet MAC address in \a IN, keying a HMAC with \a KEY
@@ -69,35 +101,16 @@ static void _hash(const uint8_t *in,
     output is repeated by concatinating another hex ASCII
     representation of the hash to the output until the buffer is full.
 
-    \return 0 on success, -ENOMEM on out of memory.
+    \return 0 on success.
 */
 int fticks_hashmac(const uint8_t *in,
                    const uint8_t *key,
                    size_t out_len,
                    uint8_t *out) {
-    uint8_t *in_copy = NULL;
-    uint8_t *p = NULL;
-    int i;
-
-    in_copy = calloc(1, strlen((const char *)in) + 1);
-    if (in_copy == NULL)
-        return -ENOMEM;
-
-    /* Sanitise and lowercase 'in' into 'in_copy'.  */
-    for (i = 0, p = in_copy; in[i] != '\0'; i++) {
-        if (in[i] == ';') {
-            *p++ = '\0';
-            break;
-        }
-        if (in[i] >= '0' && in[i] <= '9') {
-            *p++ = in[i];
-        } else if (tolower(in[i]) >= 'a' && tolower(in[i]) <= 'f') {
-            *p++ = tolower(in[i]);
-        }
-    }
+    struct fticks_hashmac_ctx ctx;
 
-    _hash(in_copy, key, out_len, out);
-    free(in_copy);
+    fticks_hashmac_init(&ctx, key);
+    fticks_hashmac_hash(&ctx, in, strlen((const char *)in), out_len, out);
     return 0;
 }
 
@@ -1,14 +1,31 @@
 /* Copyright (c) 2011, NORDUnet A/S */
 /* See LICENSE for licensing information. */
 
+#ifndef _FTICKS_HASHMAC_H
+#define _FTICKS_HASHMAC_H
+
+#include <nettle/hmac.h>
 #include <stddef.h>
 #include <stdint.h>
 
+struct fticks_hashmac_ctx {
+    int keyed;
+    struct hmac_sha256_ctx hmac;
+};
+
+void fticks_hashmac_init(struct fticks_hashmac_ctx *ctx, const uint8_t *key);
+void fticks_hashmac_hash(const struct fticks_hashmac_ctx *ctx,
+                         const uint8_t *in,
+                         size_t in_len,
+                         size_t out_len,
+                         uint8_t *out);
 int fticks_hashmac(const uint8_t *in,
                    const uint8_t *key,
                    size_t out_len,
                    uint8_t *out);
 
+#endif /* _FTICKS_HASHMAC_H */
+
 /* Local Variables: */
 /* c-file-style: "stroustrup" */
 /* End: */
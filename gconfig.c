@@ -6,13 +6,18 @@
 #include "util.h"
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <glob.h>
 #include <libgen.h>
 #include <limits.h>
+#include <nettle/sha2.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 /* returns NULL on error, where to continue parsing if token and ok. E.g. "" will return token with empty string */
 char *strtokenquote(char *s, char **token, char *del, char *quote, char *comment) {
@@ -116,31 +121,35 @@ FILE *pushgconfpath(struct gconffile **cf, const char *path) {
     return pushgconffile(cf, f, path);
 }
 
+/* returns path of cfgpath, relative to the current config file if not absolute; caller must free */
+char *gconfincludepath(struct gconffile *cf, const char *cfgpath) {
+    char *path, *curfile, *dir;
+
+    if (*cfgpath == '/' || !cf || !cf->path)
+        return stringcopy(cfgpath, 0);
+
+    /* dirname may modify its argument */
+    curfile = stringcopy(cf->path, 0);
+    if (!curfile)
+        return NULL;
+    dir = dirname(curfile);
+    path = malloc(strlen(dir) + strlen(cfgpath) + 2);
+    if (path)
+        sprintf(path, "%s/%s", dir, cfgpath);
+    free(curfile);
+    return path;
+}
+
 FILE *pushgconfpaths(struct gconffile **cf, const char *cfgpath) {
     int i;
     FILE *f = NULL;
     glob_t globbuf;
-    char *path, *curfile = NULL, *dir;
-
-    /* if cfgpath is relative, make it relative to current config */
-    if (*cfgpath == '/')
-        path = (char *)cfgpath;
-    else {
-        /* dirname may modify its argument */
-        curfile = stringcopy((*cf)->path, 0);
-        if (!curfile) {
-            debug(DBG_ERR, "malloc failed");
-            goto exit;
-        }
-        dir = dirname(curfile);
-        path = malloc(strlen(dir) + strlen(cfgpath) + 2);
-        if (!path) {
-            debug(DBG_ERR, "malloc failed");
-            goto exit;
-        }
-        strcpy(path, dir);
-        path[strlen(dir)] = '/';
-        strcpy(path + strlen(dir) + 1, cfgpath);
+    char *path;
+
+    path = gconfincludepath(*cf, cfgpath);
+    if (!path) {
+        debug(DBG_ERR, "malloc failed");
+        return NULL;
     }
     memset(&globbuf, 0, sizeof(glob_t));
     if (glob(path, 0, NULL, &globbuf)) {
@@ -156,10 +165,7 @@ FILE *pushgconfpaths(struct gconffile **cf, const char *cfgpath) {
     globfree(&globbuf);
 
 exit:
-    if (curfile) {
-        free(curfile);
-        free(path);
-    }
+    free(path);
     return f;
 }
 
@@ -176,6 +182,9 @@ int popgconf(struct gconffile **cf) {
             debug(DBG_DBG, "closing config file %s", (*cf)[0].path);
             free((*cf)[0].path);
         }
+    } else if (i && (*cf)[0].datalen) {
+        munmap((void *)(*cf)[0].data, (*cf)[0].datalen);
+        free((*cf)[0].path);
     }
     if (i < 2) {
         free(*cf);
@@ -209,6 +218,9 @@ void freegconf(struct gconffile **cf) {
                 debug(DBG_DBG, "closing config file %s", (*cf)[i].path);
                 free((*cf)[i].path);
             }
+        } else if ((*cf)[i].datalen) {
+            munmap((void *)(*cf)[i].data, (*cf)[i].datalen);
+            free((*cf)[i].path);
         }
     }
     free(*cf);
@@ -226,6 +238,292 @@ struct gconffile *openconfigfile(const char *file) {
     return cf;
 }
 
+/* Config snapshots hold the output of getconfigline() for a whole config,
+ * with includes expanded, as a sequence of records:
+ *   type (1 byte), optlen (uint32_t), vallen (uint32_t), opt, '\0', val, '\0'
+ * Source and glob records describe the files the config was read from, so
+ * that a snapshot can be rejected when any of them changed. */
+
+int writegconfsnaprecord(FILE *f, char type, const char *opt, const char *val) {
+    uint32_t optlen = strlen(opt), vallen = strlen(val);
+
+    return fputc(type, f) != EOF &&
+           fwrite(&optlen, sizeof(optlen), 1, f) == 1 &&
+           fwrite(&vallen, sizeof(vallen), 1, f) == 1 &&
+           fwrite(opt, 1, optlen + 1, f) == optlen + 1 &&
+           fwrite(val, 1, vallen + 1, f) == vallen + 1;
+}
+
+static int getgconfsnaprecord(const char *data, size_t len, size_t *pos, char *type, const char **opt, const char **val) {
+    uint32_t optlen, vallen;
+    size_t p = *pos;
+
+    if (len - p < 1 + 2 * sizeof(uint32_t))
+        return 0;
+    *type = data[p++];
+    memcpy(&optlen, data + p, sizeof(optlen));
+    p += sizeof(optlen);
+    memcpy(&vallen, data + p, sizeof(vallen));
+    p += sizeof(vallen);
+    if (optlen >= len - p || data[p + optlen])
+        return 0;
+    *opt = data + p;
+    p += optlen + 1;
+    if (vallen >= len - p || data[p + vallen])
+        return 0;
+    *val = data + p;
+    *pos = p + vallen + 1;
+    return 1;
+}
+
+/* inode, size, modification and change time of a config file, the part of
+   its stamp that is checked without reading it */
+static int gconfsourcestat(const char *path, char *buf, size_t len, long long *size) {
+    struct stat st;
+
+    if (stat(path, &st))
+        return 0;
+    *size = st.st_size;
+    snprintf(buf, len, "%llu %lld %lld.%09ld %lld.%09ld", (unsigned long long)st.st_ino, (long long)st.st_size,
+             (long long)st.st_mtim.tv_sec, st.st_mtim.tv_nsec, (long long)st.st_ctim.tv_sec, st.st_ctim.tv_nsec);
+    return 1;
+}
+
+/* SHA-256 of the contents of a config file in hex */
+static int gconfsourcehash(const char *path, char *hex) {
+    struct sha256_ctx ctx;
+    uint8_t data[4096], hash[SHA256_DIGEST_SIZE];
+    size_t n;
+    FILE *f;
+    int i, ok;
+
+    if (!(f = fopen(path, "r")))
+        return 0;
+    sha256_init(&ctx);
+    while ((n = fread(data, 1, sizeof(data), f)) > 0)
+        sha256_update(&ctx, n, data);
+    ok = !ferror(f);
+    fclose(f);
+    if (!ok)
+        return 0;
+    sha256_digest(&ctx, sizeof(hash), hash);
+    for (i = 0; i < SHA256_DIGEST_SIZE; i++)
+        sprintf(hex + 2 * i, "%02x", hash[i]);
+    return 1;
+}
+
+/* stamp of a config file: its stat data and a hash of its contents, so that
+   any edit is noticed, also one keeping size and modification time */
+int gconfsourcestamp(const char *path, char *buf, size_t len) {
+    long long size;
+    size_t n;
+
+    if (len < GCONF_SOURCE_STAMP_LEN || !gconfsourcestat(path, buf, len, &size))
+        return 0;
+    n = strlen(buf);
+    buf[n++] = ' ';
+    return gconfsourcehash(path, buf + n);
+}
+
+/* Check a config file against its stamp. A file whose stat data is unchanged
+   is not read. Its change time moves with every write, also one restoring the
+   modification time, so the contents are only hashed when the file was
+   touched without a change of size. */
+static int gconfsourcefresh(const char *path, const char *stamp) {
+    char buf[GCONF_SOURCE_STAMP_LEN], hex[2 * SHA256_DIGEST_SIZE + 1];
+    const char *stampsize, *stamphash;
+    long long size;
+    size_t n;
+
+    if (!gconfsourcestat(path, buf, sizeof(buf), &size))
+        return 0;
+    n = strlen(buf);
+    if (!strncmp(stamp, buf, n) && stamp[n] == ' ')
+        return 1;
+    stampsize = strchr(stamp, ' ');
+    stamphash = strrchr(stamp, ' ');
+    if (!stampsize || !stamphash || strtoll(stampsize + 1, NULL, 10) != size)
+        return 0;
+    return gconfsourcehash(path, hex) && !strcmp(stamphash + 1, hex);
+}
+
+/* returns the paths matching pattern separated by newlines; caller must free */
+int gconfglobstamp(const char *pattern, char **stamp) {
+    glob_t globbuf;
+    size_t i, len = 1;
+    int ret;
+
+    memset(&globbuf, 0, sizeof(glob_t));
+    ret = glob(pattern, 0, NULL, &globbuf);
+    if (ret && ret != GLOB_NOMATCH) {
+        globfree(&globbuf);
+        return 0;
+    }
+    for (i = 0; i < globbuf.gl_pathc; i++)
+        len += strlen(globbuf.gl_pathv[i]) + 1;
+    *stamp = malloc(len);
+    if (!*stamp) {
+        globfree(&globbuf);
+        return 0;
+    }
+    **stamp = '\0';
+    for (i = 0; i < globbuf.gl_pathc; i++) {
+        if (i)
+            strcat(*stamp, "\n");
+        strcat(*stamp, globbuf.gl_pathv[i]);
+    }
+    globfree(&globbuf);
+    return 1;
+}
+
+/* verify structure and freshness of a snapshot, sets *start to the first config record */
+static int checkgconfsnapshot(const char *path, const char *data, size_t len, size_t *start) {
+    size_t pos = strlen(GCONF_SNAPSHOT_MAGIC), recpos;
+    const char *opt, *val;
+    char type, *globstamp;
+    int depth = 0, fresh;
+
+    *start = 0;
+    for (;;) {
+        recpos = pos;
+        if (!getgconfsnaprecord(data, len, &pos, &type, &opt, &val))
+            break;
+        if (!*start && type != GCONF_SNAP_SOURCE && type != GCONF_SNAP_GLOB)
+            *start = recpos;
+        switch (type) {
+        case GCONF_SNAP_SOURCE:
+            if (!gconfsourcefresh(opt, val)) {
+                debug(DBG_WARN, "config snapshot %s is stale, %s has changed", path, opt);
+                return 0;
+            }
+            break;
+        case GCONF_SNAP_GLOB:
+            if (!gconfglobstamp(opt, &globstamp)) {
+                debug(DBG_ERR, "malloc failed");
+                return 0;
+            }
+            fresh = !strcmp(globstamp, val);
+            free(globstamp);
+            if (!fresh) {
+                debug(DBG_WARN, "config snapshot %s is stale, files matching %s have changed", path, opt);
+                return 0;
+            }
+            break;
+        case GCONF_SNAP_BLOCK:
+            depth++;
+            break;
+        case GCONF_SNAP_BLOCKEND:
+            if (--depth < 0)
+                goto corrupt;
+            break;
+        case GCONF_SNAP_OPTION:
+            break;
+        case GCONF_SNAP_END:
+            if (depth || pos != len)
+                goto corrupt;
+            return 1;
+        default:
+            goto corrupt;
+        }
+    }
+corrupt:
+    debug(DBG_ERR, "config snapshot %s is corrupt", path);
+    return 0;
+}
+
+/* returns the snapshot of file if there is one and it is up to date, NULL otherwise */
+struct gconffile *openconfigsnapshot(const char *file) {
+    struct gconffile *cf = NULL;
+    struct stat st;
+    char *path, *data = MAP_FAILED;
+    size_t start;
+    int fd;
+
+    path = malloc(strlen(file) + strlen(GCONF_SNAPSHOT_SUFFIX) + 1);
+    if (!path) {
+        debug(DBG_ERR, "malloc failed");
+        return NULL;
+    }
+    sprintf(path, "%s%s", file, GCONF_SNAPSHOT_SUFFIX);
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        debug(DBG_DBG, "no config snapshot %s", path);
+        goto errexit;
+    }
+    if (!fstat(fd, &st) && st.st_size > (off_t)strlen(GCONF_SNAPSHOT_MAGIC))
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED || memcmp(data, GCONF_SNAPSHOT_MAGIC, strlen(GCONF_SNAPSHOT_MAGIC))) {
+        debug(DBG_ERR, "could not read config snapshot %s", path);
+        goto errexit;
+    }
+    if (!checkgconfsnapshot(path, data, st.st_size, &start))
+        goto errexit;
+
+    cf = calloc(2, sizeof(struct gconffile));
+    if (!cf) {
+        debug(DBG_ERR, "malloc failed");
+        goto errexit;
+    }
+    cf->path = path;
+    cf->data = data;
+    cf->datapos = start;
+    cf->datalen = st.st_size;
+    debug(DBG_INFO, "reading config snapshot %s", path);
+    return cf;
+
+errexit:
+    if (data != MAP_FAILED)
+        munmap(data, st.st_size);
+    free(path);
+    return NULL;
+}
+
+static int getsnapconfigline(struct gconffile **cf, char *block, char **opt, char **val, int *conftype) {
+    const char *o, *v;
+    char type;
+
+    do {
+        if (!getgconfsnaprecord((*cf)->data, (*cf)->datalen, &(*cf)->datapos, &type, &o, &v)) {
+            debug(DBG_ERR, "config snapshot %s is corrupt", (*cf)->path);
+            return 0;
+        }
+    } while (type == GCONF_SNAP_SOURCE || type == GCONF_SNAP_GLOB);
+
+    switch (type) {
+    case GCONF_SNAP_OPTION:
+        *conftype = CONF_STR;
+        break;
+    case GCONF_SNAP_BLOCK:
+        *conftype = CONF_CBK;
+        break;
+    case GCONF_SNAP_BLOCKEND:
+        if (block)
+            return 1;
+        debug(DBG_ERR, "configuration error, found } with no matching {");
+        return 0;
+    case GCONF_SNAP_END:
+        if (popgconf(cf))
+            return getconfigline(cf, block, opt, val, conftype);
+        return 1;
+    default:
+        debug(DBG_ERR, "config snapshot %s is corrupt", (*cf)->path);
+        return 0;
+    }
+
+    *opt = stringcopy(o, 0);
+    *val = stringcopy(v, 0);
+    if (*opt && *val)
+        return 1;
+    debug(DBG_ERR, "malloc failed");
+    free(*opt);
+    *opt = NULL;
+    free(*val);
+    *val = NULL;
+    return 0;
+}
+
 /* Parses config with following syntax:
  * One of these:
  * option-name value
@@ -274,6 +572,8 @@ int getconfigline(struct gconffile **cf, char *block, char **opt, char **val, in
 
     if (!cf || !*cf || (!(*cf)->file && !(*cf)->data))
         return 1;
+    if ((*cf)->datalen)
+        return getsnapconfigline(cf, block, opt, val, conftype);
 
     for (;;) {
         if (!getlinefromcf(*cf, line, 2048)) {
@@ -381,8 +681,19 @@ static char hextochar(char *hex) {
 }
 
 int unhex(char *str, uint8_t process_null) {
-    char *t = str, *s = str;
+    char *t = str, *s = str, *pct;
+    size_t run;
     while (*t) {
+        /* move everything up to the next escape at once */
+        if (*t != '%') {
+            pct = strchr(t, '%');
+            run = pct ? (size_t)(pct - t) : strlen(t);
+            if (s != t)
+                memmove(s, t, run);
+            s += run;
+            t += run;
+            continue;
+        }
         if (t[0] == '%' && ishexbyte(t + 1, process_null)) {
             *s++ = hextochar(t + 1);
             t += 3;
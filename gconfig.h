@@ -12,11 +12,24 @@
 #include <stdio.h>
 #include <stdint.h>
 
+/* precompiled config snapshot written by radsecproxy-conf -s */
+#define GCONF_SNAPSHOT_SUFFIX ".snapshot"
+#define GCONF_SNAPSHOT_MAGIC "RSPCONF1"
+#define GCONF_SNAP_SOURCE 'S' /* opt: path of a config file, val: size sha256 */
+#define GCONF_SNAP_GLOB 'G'   /* opt: include pattern, val: matching paths */
+#define GCONF_SNAP_OPTION 'o' /* opt val */
+#define GCONF_SNAP_BLOCK 'b'  /* opt val { */
+#define GCONF_SNAP_BLOCKEND 'e'
+#define GCONF_SNAP_END 'E'
+/* buffer size for gconfsourcestamp */
+#define GCONF_SOURCE_STAMP_LEN 192
+
 struct gconffile {
     char *path;
     FILE *file;
     const char *data;
     size_t datapos;
+    size_t datalen; /* set for mapped snapshots */
 };
 
 int getconfigline(struct gconffile **cf, char *block, char **opt, char **val, int *conftype);
@@ -29,6 +42,11 @@ int popgconf(struct gconffile **cf);
 void freegconfmstr(char **mstr);
 void freegconf(struct gconffile **cf);
 struct gconffile *openconfigfile(const char *file);
+struct gconffile *openconfigsnapshot(const char *file);
+char *gconfincludepath(struct gconffile *cf, const char *cfgpath);
+int gconfsourcestamp(const char *path, char *buf, size_t len);
+int gconfglobstamp(const char *pattern, char **stamp);
+int writegconfsnaprecord(FILE *f, char type, const char *opt, const char *val);
 int unhex(char *s, uint8_t process_null);
 
 /* Local Variables: */
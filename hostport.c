@@ -5,8 +5,10 @@
 
 #include "hostport.h"
 #include "debug.h"
+#include "threadreg.h"
 #include "util.h"
 #include <netdb.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -241,6 +243,71 @@ int resolvehostports(struct list *hostports, int af, int socktype) {
     return 1;
 }
 
+struct resolvepool {
+    struct resolvejob *jobs;
+    int count;
+    int next;
+    pthread_mutex_t lock;
+};
+
+static void *resolveworker(void *arg) {
+    struct resolvepool *pool = (struct resolvepool *)arg;
+    struct resolvejob *job;
+
+    threadreg_name("resolve");
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        job = pool->next < pool->count ? &pool->jobs[pool->next++] : NULL;
+        pthread_mutex_unlock(&pool->lock);
+        if (!job)
+            return NULL;
+        job->result = resolvehostports(job->hostports, job->af, job->socktype);
+    }
+}
+
+/**
+ * @brief Resolve the hostports of several jobs using a bounded pool of threads.
+ * Jobs are handed out in order; the calling thread takes part in the work, so
+ * resolution still completes if no thread can be created.
+ *
+ * @param jobs array of jobs, result of each job is set to the result of resolvehostports
+ * @param count number of jobs
+ * @param maxthreads maximum number of threads (including the caller) to use
+ * @return number of failed jobs
+ */
+int resolvehostportjobs(struct resolvejob *jobs, int count, int maxthreads) {
+    struct resolvepool pool;
+    pthread_t *threads = NULL;
+    int i, nthreads = 0, failed = 0;
+
+    pool.jobs = jobs;
+    pool.count = count;
+    pool.next = 0;
+    pthread_mutex_init(&pool.lock, NULL);
+
+    if (maxthreads > count)
+        maxthreads = count;
+    if (maxthreads > 1 && !(threads = calloc(maxthreads - 1, sizeof(pthread_t))))
+        debug(DBG_WARN, "resolvehostportjobs: malloc failed, resolving sequentially");
+    for (i = 0; threads && i < maxthreads - 1; i++) {
+        if (pthread_create(&threads[nthreads], NULL, resolveworker, &pool)) {
+            debug(DBG_WARN, "resolvehostportjobs: pthread_create failed, continuing with %d threads", nthreads + 1);
+            break;
+        }
+        nthreads++;
+    }
+    resolveworker(&pool);
+    for (i = 0; i < nthreads; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+    pthread_mutex_destroy(&pool.lock);
+
+    for (i = 0; i < count; i++)
+        if (!jobs[i].result)
+            failed++;
+    return failed;
+}
+
 struct addrinfo *resolvepassiveaddrinfo(char **hostport, int af, char *default_port, int socktype) {
     struct addrinfo *ai = NULL, *last_ai = NULL;
     int i;
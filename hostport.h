@@ -15,12 +15,20 @@ struct hostportres {
     struct addrinfo *addrinfo;
 };
 
+struct resolvejob {
+    struct list *hostports;
+    int af;
+    int socktype;
+    int result;
+};
+
 struct hostportres *newhostport(char *hostport, char *default_port, uint8_t prefixok);
 int addhostport(struct list **hostports, char **hostport, char *portdefault, uint8_t prefixok);
 void freehostport(struct hostportres *hp);
 void freehostports(struct list *hostports);
 int resolvehostport(struct hostportres *hp, int af, int socktype, uint8_t passive);
 int resolvehostports(struct list *hostports, int af, int socktype);
+int resolvehostportjobs(struct resolvejob *jobs, int count, int maxthreads);
 struct addrinfo *resolvepassiveaddrinfo(char **hostport, int af, char *default_port, int socktype);
 int hostportmatches(struct list *hostports, struct list *matchhostports, uint8_t checkport);
 int addressmatches(struct list *hostports, struct sockaddr *addr, uint8_t checkport, struct hostportres **hp);
@@ -0,0 +1,284 @@
+/* Copyright (c) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+/* Multi-buffer MD5: hash several independent messages at once, one message
+ * per 32 bit vector lane. RADIUS authenticators are MD5 over short packets,
+ * so a batch of packets fits the lanes well. Messages of different length
+ * are handled by masking lanes that have run out of blocks. The scalar
+ * implementation uses nettle and is the reference for the others. */
+
+#include "md5mb.h"
+#include "util.h"
+#include <nettle/md5.h>
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__SSE2__) || defined(__ARM_NEON))
+#define MD5MB_VEC4
+typedef uint32_t md5mb_v4 __attribute__((vector_size(16)));
+#endif
+#if defined(__GNUC__) && defined(__SSE2__) && !defined(__INTEL_COMPILER)
+#define MD5MB_AVX2
+typedef uint32_t md5mb_v8 __attribute__((vector_size(32)));
+#endif
+
+#define F1(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define F2(x, y, z) ((y) ^ ((z) & ((x) ^ (y))))
+#define F3(x, y, z) ((x) ^ (y) ^ (z))
+#define F4(x, y, z) ((y) ^ ((x) | ~(z)))
+
+#define STEP(f, a, b, c, d, w, k, s)               \
+    do {                                           \
+        (a) += f((b), (c), (d)) + (w) + (uint32_t)(k); \
+        (a) = ((a) << (s)) | ((a) >> (32 - (s)));  \
+        (a) += (b);                                \
+    } while (0)
+
+#define ROUNDS(a, b, c, d, w)                             \
+    do {                                                  \
+        STEP(F1, a, b, c, d, w[0], 0xd76aa478, 7);        \
+        STEP(F1, d, a, b, c, w[1], 0xe8c7b756, 12);       \
+        STEP(F1, c, d, a, b, w[2], 0x242070db, 17);       \
+        STEP(F1, b, c, d, a, w[3], 0xc1bdceee, 22);       \
+        STEP(F1, a, b, c, d, w[4], 0xf57c0faf, 7);        \
+        STEP(F1, d, a, b, c, w[5], 0x4787c62a, 12);       \
+        STEP(F1, c, d, a, b, w[6], 0xa8304613, 17);       \
+        STEP(F1, b, c, d, a, w[7], 0xfd469501, 22);       \
+        STEP(F1, a, b, c, d, w[8], 0x698098d8, 7);        \
+        STEP(F1, d, a, b, c, w[9], 0x8b44f7af, 12);       \
+        STEP(F1, c, d, a, b, w[10], 0xffff5bb1, 17);      \
+        STEP(F1, b, c, d, a, w[11], 0x895cd7be, 22);      \
+        STEP(F1, a, b, c, d, w[12], 0x6b901122, 7);       \
+        STEP(F1, d, a, b, c, w[13], 0xfd987193, 12);      \
+        STEP(F1, c, d, a, b, w[14], 0xa679438e, 17);      \
+        STEP(F1, b, c, d, a, w[15], 0x49b40821, 22);      \
+        STEP(F2, a, b, c, d, w[1], 0xf61e2562, 5);        \
+        STEP(F2, d, a, b, c, w[6], 0xc040b340, 9);        \
+        STEP(F2, c, d, a, b, w[11], 0x265e5a51, 14);      \
+        STEP(F2, b, c, d, a, w[0], 0xe9b6c7aa, 20);       \
+        STEP(F2, a, b, c, d, w[5], 0xd62f105d, 5);        \
+        STEP(F2, d, a, b, c, w[10], 0x02441453, 9);       \
+        STEP(F2, c, d, a, b, w[15], 0xd8a1e681, 14);      \
+        STEP(F2, b, c, d, a, w[4], 0xe7d3fbc8, 20);       \
+        STEP(F2, a, b, c, d, w[9], 0x21e1cde6, 5);        \
+        STEP(F2, d, a, b, c, w[14], 0xc33707d6, 9);       \
+        STEP(F2, c, d, a, b, w[3], 0xf4d50d87, 14);       \
+        STEP(F2, b, c, d, a, w[8], 0x455a14ed, 20);       \
+        STEP(F2, a, b, c, d, w[13], 0xa9e3e905, 5);       \
+        STEP(F2, d, a, b, c, w[2], 0xfcefa3f8, 9);        \
+        STEP(F2, c, d, a, b, w[7], 0x676f02d9, 14);       \
+        STEP(F2, b, c, d, a, w[12], 0x8d2a4c8a, 20);      \
+        STEP(F3, a, b, c, d, w[5], 0xfffa3942, 4);        \
+        STEP(F3, d, a, b, c, w[8], 0x8771f681, 11);       \
+        STEP(F3, c, d, a, b, w[11], 0x6d9d6122, 16);      \
+        STEP(F3, b, c, d, a, w[14], 0xfde5380c, 23);      \
+        STEP(F3, a, b, c, d, w[1], 0xa4beea44, 4);        \
+        STEP(F3, d, a, b, c, w[4], 0x4bdecfa9, 11);       \
+        STEP(F3, c, d, a, b, w[7], 0xf6bb4b60, 16);       \
+        STEP(F3, b, c, d, a, w[10], 0xbebfbc70, 23);      \
+        STEP(F3, a, b, c, d, w[13], 0x289b7ec6, 4);       \
+        STEP(F3, d, a, b, c, w[0], 0xeaa127fa, 11);       \
+        STEP(F3, c, d, a, b, w[3], 0xd4ef3085, 16);       \
+        STEP(F3, b, c, d, a, w[6], 0x04881d05, 23);       \
+        STEP(F3, a, b, c, d, w[9], 0xd9d4d039, 4);        \
+        STEP(F3, d, a, b, c, w[12], 0xe6db99e5, 11);      \
+        STEP(F3, c, d, a, b, w[15], 0x1fa27cf8, 16);      \
+        STEP(F3, b, c, d, a, w[2], 0xc4ac5665, 23);       \
+        STEP(F4, a, b, c, d, w[0], 0xf4292244, 6);        \
+        STEP(F4, d, a, b, c, w[7], 0x432aff97, 10);       \
+        STEP(F4, c, d, a, b, w[14], 0xab9423a7, 15);      \
+        STEP(F4, b, c, d, a, w[5], 0xfc93a039, 21);       \
+        STEP(F4, a, b, c, d, w[12], 0x655b59c3, 6);       \
+        STEP(F4, d, a, b, c, w[3], 0x8f0ccc92, 10);       \
+        STEP(F4, c, d, a, b, w[10], 0xffeff47d, 15);      \
+        STEP(F4, b, c, d, a, w[1], 0x85845dd1, 21);       \
+        STEP(F4, a, b, c, d, w[8], 0x6fa87e4f, 6);        \
+        STEP(F4, d, a, b, c, w[15], 0xfe2ce6e0, 10);      \
+        STEP(F4, c, d, a, b, w[6], 0xa3014314, 15);       \
+        STEP(F4, b, c, d, a, w[13], 0x4e0811a1, 21);      \
+        STEP(F4, a, b, c, d, w[4], 0xf7537e82, 6);        \
+        STEP(F4, d, a, b, c, w[11], 0xbd3af235, 10);      \
+        STEP(F4, c, d, a, b, w[2], 0x2ad7d2bb, 15);       \
+        STEP(F4, b, c, d, a, w[9], 0xeb86d391, 21);       \
+    } while (0)
+
+/* state holds a, b, c and d for all lanes, words the 16 message words for all
+ * lanes, each lane in its own vector element */
+#define COMPRESS(vtype)                        \
+    vtype a, b, c, d, a0, b0, c0, d0, w[16];   \
+    memcpy(&a, state, sizeof(vtype));          \
+    memcpy(&b, state + 1 * sizeof(vtype) / 4, sizeof(vtype)); \
+    memcpy(&c, state + 2 * sizeof(vtype) / 4, sizeof(vtype)); \
+    memcpy(&d, state + 3 * sizeof(vtype) / 4, sizeof(vtype)); \
+    memcpy(w, words, sizeof(w));               \
+    a0 = a, b0 = b, c0 = c, d0 = d;            \
+    ROUNDS(a, b, c, d, w);                     \
+    a += a0, b += b0, c += c0, d += d0;        \
+    memcpy(state, &a, sizeof(vtype));          \
+    memcpy(state + 1 * sizeof(vtype) / 4, &b, sizeof(vtype)); \
+    memcpy(state + 2 * sizeof(vtype) / 4, &c, sizeof(vtype)); \
+    memcpy(state + 3 * sizeof(vtype) / 4, &d, sizeof(vtype));
+
+#ifdef MD5MB_VEC4
+static void md5mb_compress4(uint32_t *state, const uint32_t *words) {
+    COMPRESS(md5mb_v4)
+}
+#endif
+
+#ifdef MD5MB_AVX2
+__attribute__((target("avx2"))) static void md5mb_compress8(uint32_t *state, const uint32_t *words) {
+    COMPRESS(md5mb_v8)
+}
+#endif
+
+/* by increasing number of lanes, see cpuimpls() */
+static const struct md5mbimpl impls[] = {
+    {"scalar", 1, NULL, 0},
+#ifdef MD5MB_VEC4
+#ifdef __ARM_NEON
+    {"neon", 4, md5mb_compress4, 0},
+#else
+    {"sse2", 4, md5mb_compress4, 0},
+#endif
+#endif
+#ifdef MD5MB_AVX2
+    {"avx2", 8, md5mb_compress8, CPU_AVX2},
+#endif
+};
+
+static int nimpls; /* the widest is used for batches */
+static pthread_once_t selectonce = PTHREAD_ONCE_INIT;
+
+static void selectimpl(void) {
+    nimpls = cpuimpls(&impls[0].cpufeatures, sizeof(impls) / sizeof(impls[0]), sizeof(impls[0]));
+}
+
+static size_t md5mb_blocks(size_t len) {
+    return (len + 8) / 64 + 1;
+}
+
+/* return block number b of the padded message, using tmp for the blocks
+ * that contain the padding */
+static const uint8_t *md5mb_block(const struct md5mbjob *job, size_t b, size_t nblocks, uint8_t *tmp) {
+    size_t off = b * 64, i;
+    uint64_t bits;
+
+    if (off + 64 <= job->len)
+        return job->data + off;
+
+    memset(tmp, 0, 64);
+    if (off < job->len)
+        memcpy(tmp, job->data + off, job->len - off);
+    if (off <= job->len)
+        tmp[job->len - off] = 0x80;
+    if (b == nblocks - 1) {
+        bits = (uint64_t)job->len << 3;
+        for (i = 0; i < 8; i++)
+            tmp[56 + i] = (uint8_t)(bits >> (8 * i));
+    }
+    return tmp;
+}
+
+static void md5mb_lanes(const struct md5mbimpl *impl, struct md5mbjob *jobs, int count) {
+    static const uint32_t iv[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+    uint32_t state[4 * MD5MB_MAXLANES], saved[4 * MD5MB_MAXLANES], words[16 * MD5MB_MAXLANES];
+    size_t nblocks[MD5MB_MAXLANES], maxblocks, b;
+    uint8_t tmp[64];
+    const uint8_t *p;
+    int lanes = impl->lanes, base, n, l, i;
+
+    for (base = 0; base < count; base += lanes) {
+        n = count - base < lanes ? count - base : lanes;
+        maxblocks = 0;
+        for (l = 0; l < lanes; l++) {
+            for (i = 0; i < 4; i++)
+                state[i * lanes + l] = iv[i];
+            nblocks[l] = l < n ? md5mb_blocks(jobs[base + l].len) : 0;
+            if (nblocks[l] > maxblocks)
+                maxblocks = nblocks[l];
+        }
+
+        for (b = 0; b < maxblocks; b++) {
+            memcpy(saved, state, sizeof(uint32_t) * 4 * lanes);
+            for (l = 0; l < lanes; l++) {
+                if (b >= nblocks[l]) {
+                    for (i = 0; i < 16; i++)
+                        words[i * lanes + l] = 0;
+                    continue;
+                }
+                p = md5mb_block(&jobs[base + l], b, nblocks[l], tmp);
+                for (i = 0; i < 16; i++)
+                    words[i * lanes + l] = (uint32_t)p[4 * i] | (uint32_t)p[4 * i + 1] << 8 |
+                                           (uint32_t)p[4 * i + 2] << 16 | (uint32_t)p[4 * i + 3] << 24;
+            }
+            impl->compress(state, words);
+            /* lanes that are done keep their final state */
+            for (l = 0; l < lanes; l++)
+                if (b >= nblocks[l])
+                    for (i = 0; i < 4; i++)
+                        state[i * lanes + l] = saved[i * lanes + l];
+        }
+
+        for (l = 0; l < n; l++)
+            for (i = 0; i < 16; i++)
+                jobs[base + l].digest[i] = (uint8_t)(state[(i / 4) * lanes + l] >> (8 * (i % 4)));
+    }
+}
+
+/**
+ * @brief Compute the MD5 digests of several messages with the given
+ * implementation.
+ *
+ * @param impl implementation, see md5mbimpls()
+ * @param jobs messages to hash, the digests are stored in the jobs
+ * @param count number of jobs
+ */
+void md5mb_impl(const struct md5mbimpl *impl, struct md5mbjob *jobs, int count) {
+    struct md5_ctx ctx;
+    int i;
+
+    if (!impl->compress) {
+        for (i = 0; i < count; i++) {
+            md5_init(&ctx);
+            md5_update(&ctx, jobs[i].len, jobs[i].data);
+            md5_digest(&ctx, MD5_DIGEST_SIZE, jobs[i].digest);
+        }
+        return;
+    }
+    md5mb_lanes(impl, jobs, count);
+}
+
+/**
+ * @brief Compute the MD5 digests of several messages, using the widest
+ * implementation supported by the CPU. Single messages are hashed by the
+ * scalar implementation.
+ *
+ * @param jobs messages to hash, the digests are stored in the jobs
+ * @param count number of jobs
+ */
+void md5mb(struct md5mbjob *jobs, int count) {
+    pthread_once(&selectonce, selectimpl);
+    md5mb_impl(count > 1 ? &impls[nimpls - 1] : &impls[0], jobs, count);
+}
+
+/**
+ * @brief Get the MD5 implementations this CPU can run, by increasing number of
+ * lanes, to check them against nettle in t_md5mb and time them in b_md5mb.
+ *
+ * @param count set to the number of implementations
+ * @return array of implementations, the single lane nettle one first
+ */
+const struct md5mbimpl *md5mbimpls(int *count) {
+    pthread_once(&selectonce, selectimpl);
+    *count = nimpls;
+    return impls;
+}
+
+const char *md5mbimplname(void) {
+    pthread_once(&selectonce, selectimpl);
+    return impls[nimpls - 1].name;
+}
+
+/* Local Variables: */
+/* c-file-style: "stroustrup" */
+/* End: */
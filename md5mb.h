@@ -0,0 +1,36 @@
+/* Copyright (c) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+#ifndef _MD5MB_H
+#define _MD5MB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MD5MB_MAXLANES 8
+
+struct md5mbjob {
+    const uint8_t *data;
+    size_t len;
+    uint8_t digest[16];
+};
+
+typedef void (*md5mb_compress_fn)(uint32_t *state, const uint32_t *words);
+
+struct md5mbimpl {
+    const char *name;
+    int lanes;
+    md5mb_compress_fn compress;
+    unsigned cpufeatures; /* CPU_* flags needed */
+};
+
+void md5mb(struct md5mbjob *jobs, int count);
+void md5mb_impl(const struct md5mbimpl *impl, struct md5mbjob *jobs, int count);
+const struct md5mbimpl *md5mbimpls(int *count);
+const char *md5mbimplname(void);
+
+#endif /* _MD5MB_H */
+
+/* Local Variables: */
+/* c-file-style: "stroustrup" */
+/* End: */
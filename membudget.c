@@ -0,0 +1,149 @@
+/* Copyright (c) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+/* Global budget for the memory held by requests. Every request is charged an
+ * estimate of what it holds, from when it is received until its last
+ * reference is gone; this covers requests waiting for a server, replies in
+ * client queues and the duplicate cache. Above the soft limit, requests that
+ * can be retried without harm (accounting and the first request of a new
+ * session) are dropped, above the hard limit all new requests are. Both
+ * checks only look at the raw packet, so shedding is cheap. */
+
+#include "membudget.h"
+#include "debug.h"
+#include "radmsg.h"
+#include <pthread.h>
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t soft, hard, used;
+static uint64_t shedsoft, shedhard;
+static int level;
+
+/**
+ * @brief set the limits, 0 for none
+ *
+ * @param softlimit bytes above which only essential requests are admitted
+ * @param hardlimit bytes above which no requests are admitted
+ */
+void membudget_init(uint64_t softlimit, uint64_t hardlimit) {
+    pthread_mutex_lock(&lock);
+    soft = softlimit;
+    hard = hardlimit;
+    used = shedsoft = shedhard = 0;
+    level = MEMBUDGET_OK;
+    pthread_mutex_unlock(&lock);
+}
+
+static int currentlevel(void) {
+    if (hard && used >= hard)
+        return MEMBUDGET_HARD;
+    if (soft && used >= soft)
+        return MEMBUDGET_SOFT;
+    return MEMBUDGET_OK;
+}
+
+/* log changes of the level, with the requests dropped meanwhile; the level
+ * only goes down again 10% below the limit, so that usage around a limit
+ * does not flood the log */
+static void checklevel(void) {
+    int now = currentlevel();
+    uint64_t limit = level == MEMBUDGET_HARD ? hard : soft;
+
+    if (now == level || (now < level && used >= limit - limit / 10))
+        return;
+    if (now > level)
+        debug(DBG_WARN, "membudget: %llu bytes held by requests, above the %s limit, dropping %s new requests",
+              (unsigned long long)used, now == MEMBUDGET_HARD ? "hard" : "soft", now == MEMBUDGET_HARD ? "all" : "non-essential");
+    else
+        debug(DBG_NOTICE, "membudget: %llu bytes held by requests, back below the %s limit (%llu requests dropped above the soft limit, %llu above the hard limit so far)",
+              (unsigned long long)used, level == MEMBUDGET_HARD ? "hard" : "soft", (unsigned long long)shedsoft, (unsigned long long)shedhard);
+    level = now;
+}
+
+/* add (or with bytes < 0 release) memory held by a request */
+void membudget_charge(int64_t bytes) {
+    if (!soft && !hard)
+        return;
+    pthread_mutex_lock(&lock);
+    if (bytes < 0 && (uint64_t)-bytes > used)
+        used = 0;
+    else
+        used += bytes;
+    checklevel();
+    pthread_mutex_unlock(&lock);
+}
+
+int membudget_level(void) {
+    int l;
+
+    pthread_mutex_lock(&lock);
+    l = currentlevel();
+    pthread_mutex_unlock(&lock);
+    return l;
+}
+
+uint64_t membudget_used(void) {
+    uint64_t u;
+
+    pthread_mutex_lock(&lock);
+    u = used;
+    pthread_mutex_unlock(&lock);
+    return u;
+}
+
+/**
+ * @brief whether a raw request should be served even above the soft limit
+ *
+ * Status-Server and Access-Requests continuing a session (those with a State
+ * attribute) are essential, dropping them would break authentications that
+ * already hold memory in the proxy and the servers.
+ */
+int membudget_essential(const uint8_t *buf, int len) {
+    const uint8_t *attr, *end = buf + len;
+
+    if (len < 20)
+        return 0;
+    if (buf[0] == RAD_Status_Server)
+        return 1;
+    if (buf[0] != RAD_Access_Request)
+        return 0;
+    for (attr = buf + 20; attr + 2 <= end && attr[1] >= 2 && attr + attr[1] <= end; attr += attr[1])
+        if (attr[0] == RAD_Attr_State)
+            return 1;
+    return 0;
+}
+
+/**
+ * @brief check whether a newly received request fits into the budget
+ *
+ * @return 1 if the request may be served, 0 if it should be dropped
+ */
+int membudget_admit(const uint8_t *buf, int len) {
+    int l;
+
+    if (!soft && !hard)
+        return 1;
+    pthread_mutex_lock(&lock);
+    l = currentlevel();
+    if (l == MEMBUDGET_HARD)
+        shedhard++;
+    else if (l == MEMBUDGET_SOFT && !membudget_essential(buf, len))
+        shedsoft++;
+    else
+        l = MEMBUDGET_OK;
+    pthread_mutex_unlock(&lock);
+    return l == MEMBUDGET_OK;
+}
+
+void membudget_log(void) {
+    if (!soft && !hard)
+        return;
+    pthread_mutex_lock(&lock);
+    debug(DBG_NOTICE, "membudget: %llu bytes held by requests (soft limit %llu, hard limit %llu), %llu requests dropped above the soft limit, %llu above the hard limit",
+          (unsigned long long)used, (unsigned long long)soft, (unsigned long long)hard, (unsigned long long)shedsoft, (unsigned long long)shedhard);
+    pthread_mutex_unlock(&lock);
+}
+
+/* Local Variables: */
+/* c-file-style: "stroustrup" */
+/* End: */
@@ -0,0 +1,26 @@
+/* Copyright (c) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+#ifndef _MEMBUDGET_H
+#define _MEMBUDGET_H
+
+#include <stdint.h>
+
+/* levels returned by membudget_level */
+#define MEMBUDGET_OK 0
+#define MEMBUDGET_SOFT 1
+#define MEMBUDGET_HARD 2
+
+void membudget_init(uint64_t soft, uint64_t hard);
+void membudget_charge(int64_t bytes);
+int membudget_level(void);
+int membudget_essential(const uint8_t *buf, int len);
+int membudget_admit(const uint8_t *buf, int len);
+uint64_t membudget_used(void);
+void membudget_log(void);
+
+#endif /* _MEMBUDGET_H */
+
+/* Local Variables: */
+/* c-file-style: "stroustrup" */
+/* End: */
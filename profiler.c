@@ -0,0 +1,417 @@
+/* Copyright (c) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+/* Sampling profiler for where perf cannot be attached. Every registered
+ * thread gets a timer on its own cpu clock that sends it SIGPROF, so threads
+ * are sampled in proportion to the cpu time they use and idle threads are
+ * left alone. The signal handler walks the frame pointer chain of the
+ * interrupted code into a preallocated buffer, claiming a slot with an
+ * atomic increment; no lock is taken and nothing is allocated, as
+ * backtrace() would. The walk only reads the thread's own stack, so a chain
+ * broken by code built without frame pointers, such as most of libc, ends
+ * there instead of faulting. At the end of a run the stacks are counted and
+ * written in the folded format read by flamegraph.pl, each stack starting
+ * with the name of its thread. Functions without a dynamic symbol are
+ * written as object+offset, for addr2line -f -e. */
+
+#define _GNU_SOURCE
+
+#include "profiler.h"
+#include "debug.h"
+#include "radsecproxy.h"
+#include "threadreg.h"
+#include "util.h"
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ucontext.h>
+
+#if defined(__linux__) && defined(SIGEV_THREAD_ID) && (defined(__x86_64__) || defined(__aarch64__))
+#define PROFILER_SUPPORTED 1
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+#endif
+
+struct sample {
+    int thread;
+    int depth;
+    void *pcs[PROFILER_MAX_DEPTH];
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static char *outfile;
+static int seconds = PROFILER_DEFAULT_SECONDS;
+static int frequency = PROFILER_DEFAULT_FREQUENCY;
+static int running;
+
+/* the last collection */
+static struct sample *samples;
+static char (*names)[THREADREG_NAMELEN];
+static int nnames;
+static unsigned long nsamples; /* samples taken, including dropped ones */
+static int active;             /* set while the timers run */
+static int busy;               /* signal handlers in progress */
+
+/**
+ * @brief whether profiling is supported on this platform
+ */
+int profiler_supported(void) {
+#if defined(PROFILER_SUPPORTED)
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+#if defined(PROFILER_SUPPORTED)
+/* the pc of the interrupted code, followed by the return addresses of the
+ * frame records it links to: the saved frame pointer and return address,
+ * both on x86_64 and aarch64 */
+static int walkstack(void *ucontext, void **pcs, int max) {
+    ucontext_t *uc = (ucontext_t *)ucontext;
+    uintptr_t pc, fp, sp, lo, hi, *frame;
+    int depth = 0;
+
+#if defined(__x86_64__)
+    pc = uc->uc_mcontext.gregs[REG_RIP];
+    fp = uc->uc_mcontext.gregs[REG_RBP];
+    sp = uc->uc_mcontext.gregs[REG_RSP];
+#else
+    pc = uc->uc_mcontext.pc;
+    fp = uc->uc_mcontext.regs[29];
+    sp = uc->uc_mcontext.sp;
+#endif
+    pcs[depth++] = (void *)pc;
+    threadreg_stack(&lo, &hi);
+    if (sp > lo)
+        lo = sp;
+    while (depth < max && fp >= lo && fp + 2 * sizeof(uintptr_t) <= hi && !(fp % sizeof(uintptr_t))) {
+        frame = (uintptr_t *)fp;
+        if (!frame[1])
+            break;
+        pcs[depth++] = (void *)frame[1];
+        /* frames are further up the stack */
+        if (frame[0] <= fp)
+            break;
+        fp = frame[0];
+    }
+    return depth;
+}
+
+static void sample(int sig, siginfo_t *info, void *ucontext) {
+    int saved = errno;
+    unsigned long i;
+
+    __atomic_fetch_add(&busy, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&active, __ATOMIC_SEQ_CST) && info->si_code == SI_TIMER) {
+        i = __atomic_fetch_add(&nsamples, 1, __ATOMIC_RELAXED);
+        if (i < PROFILER_MAX_SAMPLES) {
+            samples[i].thread = info->si_value.sival_int;
+            samples[i].depth = walkstack(ucontext, samples[i].pcs, PROFILER_MAX_DEPTH);
+        }
+    }
+    __atomic_fetch_sub(&busy, 1, __ATOMIC_SEQ_CST);
+    errno = saved;
+}
+#endif
+
+static void freesamples(void) {
+    free(samples);
+    samples = NULL;
+    free(names);
+    names = NULL;
+    nnames = 0;
+    nsamples = 0;
+}
+
+/**
+ * @brief sample the stacks of all registered threads
+ *
+ * The samples are kept for profiler_write. Blocks for the duration of the
+ * run; only one run may be in progress.
+ *
+ * @param hz samples per second of cpu time of a thread
+ * @param millis duration of the run in milliseconds
+ * @return the number of samples taken, -1 on error
+ */
+int profiler_collect(int hz, int millis) {
+#if defined(PROFILER_SUPPORTED)
+    static int installed = 0;
+    struct threadstats *stats;
+    struct sigaction sa;
+    struct sigevent sev;
+    struct itimerspec its;
+    struct timespec deadline;
+    timer_t *timers;
+    int n, i, ntimers = 0;
+
+    if (hz < 1 || hz > PROFILER_MAX_FREQUENCY || millis < 1)
+        return -1;
+    freesamples();
+
+    if (!installed) {
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = sample;
+        sa.sa_flags = SA_SIGINFO | SA_RESTART | SA_ONSTACK;
+        sigemptyset(&sa.sa_mask);
+        if (sigaction(SIGPROF, &sa, NULL)) {
+            debugerrno(errno, DBG_ERR, "profiler_collect: sigaction failed");
+            return -1;
+        }
+        installed = 1;
+    }
+
+    n = threadreg_snapshot(&stats);
+    if (n < 0)
+        return -1;
+    samples = malloc(PROFILER_MAX_SAMPLES * sizeof(struct sample));
+    names = calloc(n + 1, sizeof(*names));
+    timers = calloc(n + 1, sizeof(timer_t));
+    if (!samples || !names || !timers) {
+        debug(DBG_ERR, "profiler_collect: malloc failed");
+        free(stats);
+        free(timers);
+        freesamples();
+        return -1;
+    }
+    for (i = 0; i < n; i++)
+        memcpy(names[i], stats[i].name, sizeof(names[i]));
+    nnames = n;
+
+    __atomic_store_n(&active, 1, __ATOMIC_SEQ_CST);
+    memset(&its, 0, sizeof(its));
+    its.it_interval.tv_nsec = 1000000000 / hz;
+    its.it_value = its.it_interval;
+    for (i = 0; i < n; i++) {
+        if (!stats[i].tid || stats[i].clock == (clockid_t)-1)
+            continue;
+        memset(&sev, 0, sizeof(sev));
+        sev.sigev_notify = SIGEV_THREAD_ID;
+        sev.sigev_signo = SIGPROF;
+        sev.sigev_value.sival_int = i;
+        sev.sigev_notify_thread_id = stats[i].tid;
+        /* fails if the thread has exited since the snapshot */
+        if (timer_create(stats[i].clock, &sev, &timers[ntimers]))
+            continue;
+        if (timer_settime(timers[ntimers], 0, &its, NULL)) {
+            timer_delete(timers[ntimers]);
+            continue;
+        }
+        ntimers++;
+    }
+    free(stats);
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += millis / 1000;
+    deadline.tv_nsec += (long)(millis % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR)
+        ;
+
+    for (i = 0; i < ntimers; i++)
+        timer_delete(timers[i]);
+    free(timers);
+    /* signals still pending find active cleared and leave the buffer alone */
+    __atomic_store_n(&active, 0, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&busy, __ATOMIC_SEQ_CST))
+        sched_yield();
+
+    if (nsamples > PROFILER_MAX_SAMPLES)
+        debug(DBG_WARN, "profiler_collect: %lu samples dropped, buffer full", nsamples - PROFILER_MAX_SAMPLES);
+    debug(DBG_DBG, "profiler_collect: %lu samples of %d threads", nsamples, ntimers);
+    return nsamples > PROFILER_MAX_SAMPLES ? PROFILER_MAX_SAMPLES : (int)nsamples;
+#else
+    debug(DBG_ERR, "profiler_collect: profiling not supported on this platform");
+    return -1;
+#endif
+}
+
+static int cmpsample(const void *a, const void *b) {
+    const struct sample *x = (const struct sample *)a, *y = (const struct sample *)b;
+
+    if (x->thread != y->thread)
+        return x->thread < y->thread ? -1 : 1;
+    if (x->depth != y->depth)
+        return x->depth < y->depth ? -1 : 1;
+    return memcmp(x->pcs, y->pcs, x->depth * sizeof(void *));
+}
+
+struct stack {
+    char *line;
+    int count;
+};
+
+static int cmpstack(const void *a, const void *b) {
+    return strcmp(((const struct stack *)a)->line, ((const struct stack *)b)->line);
+}
+
+static void foldframe(char *buf, size_t size, size_t *len, void *pc) {
+    Dl_info info;
+    const char *obj;
+    int n;
+
+    if (*len >= size)
+        return;
+    memset(&info, 0, sizeof(info));
+    if (dladdr(pc, &info) && info.dli_sname)
+        n = snprintf(buf + *len, size - *len, ";%s", info.dli_sname);
+    else if (info.dli_fname) {
+        obj = strrchr(info.dli_fname, '/');
+        n = snprintf(buf + *len, size - *len, ";%s+0x%lx", obj ? obj + 1 : info.dli_fname, (unsigned long)((char *)pc - (char *)info.dli_fbase));
+    } else
+        n = snprintf(buf + *len, size - *len, ";0x%lx", (unsigned long)pc);
+    *len += n > 0 ? n : 0;
+}
+
+/**
+ * @brief write the stacks of the last collection in folded format, one
+ * line per distinct stack: thread name and functions from the outermost,
+ * separated by semicolons, then the number of samples; the samples are
+ * freed
+ *
+ * @param f the file to write to
+ * @return the number of lines written, -1 on error
+ */
+int profiler_write(FILE *f) {
+    struct stack *stacks;
+    char buf[PROFILER_MAX_DEPTH * 128];
+    size_t len;
+    int n, i, j, count, nstacks = 0, lines = 0;
+
+    n = nsamples > PROFILER_MAX_SAMPLES ? PROFILER_MAX_SAMPLES : nsamples;
+    stacks = calloc(n + 1, sizeof(struct stack));
+    if (!stacks) {
+        freesamples();
+        return -1;
+    }
+
+    /* symbolise each distinct stack once, then merge the stacks that only
+     * differ in addresses within the same functions */
+    if (n)
+        qsort(samples, n, sizeof(struct sample), cmpsample);
+    for (i = 0; i < n; i += count) {
+        for (count = 1; i + count < n && !cmpsample(&samples[i], &samples[i + count]); count++)
+            ;
+        len = snprintf(buf, sizeof(buf), "%s", samples[i].thread < nnames ? names[samples[i].thread] : "unknown");
+        for (j = samples[i].depth - 1; j >= 0; j--)
+            /* return addresses point after the call, look up the call */
+            foldframe(buf, sizeof(buf), &len, (char *)samples[i].pcs[j] - (j ? 1 : 0));
+        stacks[nstacks].line = stringcopy(buf, 0);
+        stacks[nstacks++].count = count;
+    }
+    freesamples();
+
+    if (nstacks)
+        qsort(stacks, nstacks, sizeof(struct stack), cmpstack);
+    for (i = 0; i < nstacks; i += j) {
+        for (count = stacks[i].count, j = 1; i + j < nstacks && !strcmp(stacks[i].line, stacks[i + j].line); j++)
+            count += stacks[i + j].count;
+        fprintf(f, "%s %d\n", stacks[i].line, count);
+        lines++;
+    }
+    for (i = 0; i < nstacks; i++)
+        free(stacks[i].line);
+    free(stacks);
+    return ferror(f) ? -1 : lines;
+}
+
+/**
+ * @brief set where and how profiler_start profiles
+ *
+ * @param file the file the folded stacks are written to, NULL to disable
+ * @param secs duration of a run
+ * @param hz samples per second of cpu time of a thread
+ */
+void profiler_configure(const char *file, int secs, int hz) {
+    pthread_mutex_lock(&lock);
+    free(outfile);
+    outfile = file ? stringcopy(file, 0) : NULL;
+    seconds = secs;
+    frequency = hz;
+    pthread_mutex_unlock(&lock);
+    if (file && profiler_supported())
+        threadreg_altstack(PROFILER_STACK_SIZE);
+}
+
+static void *profilerrun(void *arg) {
+    char *file;
+    FILE *f;
+    int n, secs, hz;
+
+    threadreg_name("profiler");
+    pthread_mutex_lock(&lock);
+    file = stringcopy(outfile, 0);
+    secs = seconds;
+    hz = frequency;
+    pthread_mutex_unlock(&lock);
+
+    if (file) {
+        debug(DBG_NOTICE, "profiler: sampling for %d seconds at %d Hz", secs, hz);
+        n = profiler_collect(hz, secs * 1000);
+        if (n >= 0) {
+            f = fopen(file, "w");
+            if (!f)
+                debugerrno(errno, DBG_ERR, "profiler: failed to open %s", file);
+            else {
+                n = profiler_write(f);
+                if (fclose(f) || n < 0)
+                    debugerrno(errno, DBG_ERR, "profiler: failed to write %s", file);
+                else
+                    debug(DBG_NOTICE, "profiler: wrote %d stacks to %s", n, file);
+            }
+        }
+        freesamples();
+        free(file);
+    }
+
+    pthread_mutex_lock(&lock);
+    running = 0;
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+/**
+ * @brief start a profiling run in the background, as configured
+ *
+ * @return 1 if started, 0 if not configured, not supported or already running
+ */
+int profiler_start(void) {
+    pthread_t th;
+
+    pthread_mutex_lock(&lock);
+    if (!outfile || running || !profiler_supported()) {
+        if (!outfile)
+            debug(DBG_WARN, "profiler_start: no Profiler file configured");
+        else if (running)
+            debug(DBG_WARN, "profiler_start: already running");
+        else
+            debug(DBG_WARN, "profiler_start: profiling not supported on this platform");
+        pthread_mutex_unlock(&lock);
+        return 0;
+    }
+    running = 1;
+    pthread_mutex_unlock(&lock);
+
+    if (pthread_create(&th, &pthread_attr, profilerrun, NULL)) {
+        debugerrno(errno, DBG_ERR, "profiler_start: pthread_create failed");
+        pthread_mutex_lock(&lock);
+        running = 0;
+        pthread_mutex_unlock(&lock);
+        return 0;
+    }
+    pthread_detach(th);
+    return 1;
+}
+
+/* Local Variables: */
+/* c-file-style: "stroustrup" */
+/* End: */
@@ -0,0 +1,29 @@
+/* Copyright (c) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+#ifndef _PROFILER_H
+#define _PROFILER_H
+
+#include <stdio.h>
+
+#define PROFILER_DEFAULT_SECONDS 30
+#define PROFILER_MAX_SECONDS 3600
+#define PROFILER_DEFAULT_FREQUENCY 99
+#define PROFILER_MAX_FREQUENCY 1000
+/* samples kept per run, further ones are counted as dropped */
+#define PROFILER_MAX_SAMPLES 32768
+#define PROFILER_MAX_DEPTH 32
+/* alternate signal stack of each thread while profiling is configured */
+#define PROFILER_STACK_SIZE 65536
+
+int profiler_supported(void);
+void profiler_configure(const char *file, int seconds, int frequency);
+int profiler_start(void);
+int profiler_collect(int frequency, int millis);
+int profiler_write(FILE *f);
+
+#endif /* _PROFILER_H */
+
+/* Local Variables: */
+/* c-file-style: "stroustrup" */
+/* End: */
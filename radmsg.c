@@ -4,6 +4,7 @@
 
 #include "debug.h"
 #include "list.h"
+#include "md5mb.h"
 #include "raddict.h"
 #include "radmsg.h"
 #include "util.h"
@@ -26,8 +27,19 @@
  * A 0 value is also consiedered invalid.
  */
 int get_checked_rad_length(uint8_t *buf) {
+    return get_checked_rad_length_max(buf, RAD_Max_Length);
+}
+
+/**
+ * @brief Like get_checked_rad_length, but with a different upper bound.
+ *
+ * @param buf raw message buffer
+ * @param maxlen largest valid length, e.g. RAD_Max_Length_Extended on connections allowing larger packets
+ * @return int the length of the radius message if valid, or its negative value if invalid.
+ */
+int get_checked_rad_length_max(uint8_t *buf, int maxlen) {
     int len = RADLEN(buf);
-    if (len < RAD_Min_Length || len > RAD_Max_Length) {
+    if (len < RAD_Min_Length || len > maxlen) {
         return -len;
     }
     return len;
@@ -133,25 +145,28 @@ int radmsg_copy_attrs(struct radmsg *dst,
     return n;
 }
 
-int _checkmsgauth(unsigned char *rad, int radlen, uint8_t *authattr, uint8_t *secret, int secret_len) {
+/* check the Message-Authenticator value authattr of rad, hashing the packet
+ * with the value zeroed and, for replies, the Request Authenticator rqauth in
+ * place of the Response Authenticator; rad is not modified */
+int _checkmsgauth(unsigned char *rad, int radlen, uint8_t *authattr, uint8_t *rqauth, uint8_t *secret, int secret_len) {
     int result = 0; /* Fail. */
     static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
     struct hmac_md5_ctx hmacctx;
-    uint8_t auth[16], hash[MD5_DIGEST_SIZE];
+    uint8_t zero[16], hash[MD5_DIGEST_SIZE];
+    int off = authattr - rad;
 
     pthread_mutex_lock(&lock);
 
-    /* FIXME: Why clearing authattr during hashing? */
-    memcpy(auth, authattr, 16);
-    memset(authattr, 0, 16);
-
+    memset(zero, 0, 16);
     hmac_md5_set_key(&hmacctx, secret_len, secret);
-    hmac_md5_update(&hmacctx, radlen, rad);
+    hmac_md5_update(&hmacctx, 4, rad);
+    hmac_md5_update(&hmacctx, 16, rqauth ? rqauth : rad + 4);
+    hmac_md5_update(&hmacctx, off - 20, rad + 20);
+    hmac_md5_update(&hmacctx, 16, zero);
+    hmac_md5_update(&hmacctx, radlen - off - 16, authattr + 16);
     hmac_md5_digest(&hmacctx, sizeof(hash), hash);
 
-    memcpy(authattr, auth, 16);
-
-    if (memcmp(auth, hash, 16)) {
+    if (memcmp(authattr, hash, 16)) {
         debug(DBG_WARN, "message authenticator, wrong value");
         goto out;
     }
@@ -278,10 +293,198 @@ int radmsg2buf(struct radmsg *msg, uint8_t *secret, int secret_len, uint8_t **bu
     return size;
 }
 
-/* if secret set we also validate message authenticator if present */
-struct radmsg *buf2radmsg(uint8_t *buf, int len, uint8_t *secret, int secret_len, uint8_t *rqauth) {
+/* find the first Message-Authenticator attribute following attr, or the first
+ * one in the message if attr is NULL. Stops at malformed attributes. */
+static uint8_t *_findmsgauth(uint8_t *buf, int len, uint8_t *attr) {
+    uint8_t *p = attr ? attr + ATTRLEN(attr) : buf + 20;
+
+    while (p - buf + 2 <= len && ATTRLEN(p) >= 2 && p - buf + ATTRLEN(p) <= len) {
+        if (ATTRTYPE(p) == RAD_Attr_Message_Authenticator)
+            return p;
+        p += ATTRLEN(p);
+    }
+    return NULL;
+}
+
+/* can the authenticators of this job be checked */
+static int _checkable(struct radauthjob *job) {
+    return job->secret && job->len >= RAD_Min_Length && job->len == RADLEN(job->buf);
+}
+
+static void _verifyauth(struct radauthjob *job) {
+    uint8_t auth[16], *ma;
+
+    job->authvalid = 1;
+    job->msgauthinvalid = 0;
+    if (!_checkable(job))
+        return;
+
+    if (job->buf[0] == RAD_Accounting_Request) {
+        memset(auth, 0, 16);
+        if (!_validauth(job->buf, job->len, auth, job->secret, job->secret_len)) {
+            job->authvalid = 0;
+            return;
+        }
+    }
+    if (job->rqauth && !_validauth(job->buf, job->len, job->rqauth, job->secret, job->secret_len)) {
+        job->authvalid = 0;
+        return;
+    }
+
+    /* the Message-Authenticator of a reply is computed with the request authenticator */
+    for (ma = _findmsgauth(job->buf, job->len, NULL); ma; ma = _findmsgauth(job->buf, job->len, ma))
+        if (ATTRVALLEN(ma) != 16 || !_checkmsgauth(job->buf, job->len, ATTRVAL(ma), job->rqauth, job->secret, job->secret_len))
+            job->msgauthinvalid = 1;
+}
+
+/**
+ * @brief Verify the Request/Response Authenticators and Message-Authenticators
+ * of several packets at once, hashing them with multi-buffer MD5.
+ * A single packet, and packets with more than one Message-Authenticator,
+ * are verified one by one with the scalar code.
+ * Jobs without secret are not checked.
+ *
+ * @param jobs packets to verify, results are stored in authvalid and msgauthinvalid
+ * @param count number of jobs
+ */
+void radmsg_verifyauth(struct radauthjob *jobs, int count) {
+    struct md5mbjob *md5jobs = NULL;
+    struct md5_ctx mdctx;
+    uint8_t **msgauth = NULL, *scratch = NULL, *s, *key, hkey[MD5_DIGEST_SIZE];
+    int *authidx = NULL, *inneridx, *outeridx, i, j, n, keylen;
+    size_t size = 0;
+    struct radauthjob *job;
+
+    if (count > 1) {
+        md5jobs = malloc(3 * count * sizeof(struct md5mbjob));
+        msgauth = calloc(count, sizeof(uint8_t *));
+        authidx = malloc(3 * count * sizeof(int));
+    }
+    if (!md5jobs || !msgauth || !authidx)
+        goto scalar;
+    inneridx = authidx + count;
+    outeridx = authidx + 2 * count;
+
+    for (i = 0; i < count; i++) {
+        job = &jobs[i];
+        job->authvalid = 1;
+        job->msgauthinvalid = 0;
+        authidx[i] = inneridx[i] = outeridx[i] = -1;
+        if (!_checkable(job))
+            continue;
+        msgauth[i] = _findmsgauth(job->buf, job->len, NULL);
+        if ((job->buf[0] == RAD_Accounting_Request && job->rqauth) ||
+            (msgauth[i] && _findmsgauth(job->buf, job->len, msgauth[i]))) {
+            _verifyauth(job);
+            msgauth[i] = NULL;
+            continue;
+        }
+        if (job->buf[0] == RAD_Accounting_Request || job->rqauth)
+            authidx[i] = 0;
+        if (msgauth[i] && ATTRVALLEN(msgauth[i]) != 16) {
+            job->msgauthinvalid = 1;
+            msgauth[i] = NULL;
+        }
+        size += (authidx[i] < 0 ? 0 : job->len + job->secret_len) + (msgauth[i] ? 64 + job->len + 64 + 16 : 0);
+    }
+    scratch = malloc(size ? size : 1);
+    if (!scratch)
+        goto scalar;
+
+    /* first round: authenticators and inner hmac */
+    s = scratch;
+    n = 0;
+    for (i = 0; i < count; i++) {
+        job = &jobs[i];
+        if (authidx[i] == 0) {
+            memcpy(s, job->buf, 4);
+            if (job->rqauth)
+                memcpy(s + 4, job->rqauth, 16);
+            else
+                memset(s + 4, 0, 16);
+            memcpy(s + 20, job->buf + 20, job->len - 20);
+            memcpy(s + job->len, job->secret, job->secret_len);
+            md5jobs[n].data = s;
+            md5jobs[n].len = job->len + job->secret_len;
+            authidx[i] = n++;
+            s += job->len + job->secret_len;
+        }
+        if (msgauth[i]) {
+            key = job->secret;
+            keylen = job->secret_len;
+            if (keylen > 64) {
+                md5_init(&mdctx);
+                md5_update(&mdctx, keylen, key);
+                md5_digest(&mdctx, sizeof(hkey), hkey);
+                key = hkey;
+                keylen = sizeof(hkey);
+            }
+            for (j = 0; j < 64; j++)
+                s[j] = (j < keylen ? key[j] : 0) ^ 0x36;
+            memcpy(s + 64, job->buf, job->len);
+            if (job->rqauth)
+                memcpy(s + 64 + 4, job->rqauth, 16);
+            memset(s + 64 + (ATTRVAL(msgauth[i]) - job->buf), 0, 16);
+            md5jobs[n].data = s;
+            md5jobs[n].len = 64 + job->len;
+            inneridx[i] = n++;
+            s += 64 + job->len;
+            /* outer hmac block, digest of the inner one is appended after the first round */
+            for (j = 0; j < 64; j++)
+                s[j] = (j < keylen ? key[j] : 0) ^ 0x5c;
+            s += 64 + 16;
+        }
+    }
+    md5mb(md5jobs, n);
+
+    /* second round: outer hmac */
+    j = n;
+    for (i = 0; i < count; i++) {
+        job = &jobs[i];
+        if (authidx[i] >= 0 && memcmp(md5jobs[authidx[i]].digest, job->buf + 4, 16)) {
+            job->authvalid = 0;
+            continue;
+        }
+        if (inneridx[i] < 0)
+            continue;
+        s = (uint8_t *)md5jobs[inneridx[i]].data + md5jobs[inneridx[i]].len;
+        memcpy(s + 64, md5jobs[inneridx[i]].digest, 16);
+        md5jobs[j].data = s;
+        md5jobs[j].len = 64 + 16;
+        outeridx[i] = j++;
+    }
+    md5mb(md5jobs + n, j - n);
+
+    for (i = 0; i < count; i++)
+        if (outeridx[i] >= 0 && memcmp(md5jobs[outeridx[i]].digest, ATTRVAL(msgauth[i]), 16)) {
+            debug(DBG_WARN, "message authenticator, wrong value");
+            jobs[i].msgauthinvalid = 1;
+        }
+    goto out;
+
+scalar:
+    for (i = 0; i < count; i++)
+        _verifyauth(&jobs[i]);
+
+out:
+    free(scratch);
+    free(authidx);
+    free(msgauth);
+    free(md5jobs);
+}
+
+/**
+ * @brief Parse a packet verified by radmsg_verifyauth.
+ * Packets with invalid authenticator are rejected, an invalid
+ * Message-Authenticator is flagged in msgauthinvalid of the message.
+ *
+ * @param job verified packet
+ * @return the message, or NULL if invalid
+ */
+struct radmsg *buf2radmsg_verified(struct radauthjob *job) {
     struct radmsg *msg;
-    uint8_t t, l, *v = NULL, *p, auth[16];
+    uint8_t t, l, *v = NULL, *p, *buf = job->buf;
+    int len = job->len;
     struct tlv *attr;
 
     if (len != RADLEN(buf)) {
@@ -289,16 +492,11 @@ struct radmsg *buf2radmsg(uint8_t *buf, int len, uint8_t *secret, int secret_len
         return NULL;
     }
 
-    if (secret && buf[0] == RAD_Accounting_Request) {
-        memset(auth, 0, 16);
-        if (!_validauth(buf, len, auth, secret, secret_len)) {
+    if (!job->authvalid) {
+        if (buf[0] == RAD_Accounting_Request)
             debug(DBG_WARN, "buf2radmsg: Accounting-Request message authentication failed");
-            return NULL;
-        }
-    }
-
-    if (rqauth && secret && !_validauth(buf, len, rqauth, secret, secret_len)) {
-        debug(DBG_WARN, "buf2radmsg: Invalid auth, ignoring reply");
+        else
+            debug(DBG_WARN, "buf2radmsg: Invalid auth, ignoring reply");
         return NULL;
     }
 
@@ -326,16 +524,12 @@ struct radmsg *buf2radmsg(uint8_t *buf, int len, uint8_t *secret, int secret_len
             p += l;
         }
 
-        if (t == RAD_Attr_Message_Authenticator && secret) {
-            if (rqauth)
-                memcpy(buf + 4, rqauth, 16);
-            if (l != 16 || !_checkmsgauth(buf, len, v, secret, secret_len)) {
+        if (t == RAD_Attr_Message_Authenticator && job->secret) {
+            if (l != 16 || job->msgauthinvalid) {
                 debug(DBG_DBG, "buf2radmsg: message authentication failed");
                 msg->msgauthinvalid = 1;
             } else
                 debug(DBG_DBG, "buf2radmsg: message auth ok");
-            if (rqauth)
-                memcpy(buf + 4, msg->auth, 16);
         }
 
         attr = maketlv(t, l, v);
@@ -353,6 +547,14 @@ struct radmsg *buf2radmsg(uint8_t *buf, int len, uint8_t *secret, int secret_len
     return msg;
 }
 
+/* if secret set we also validate message authenticator if present */
+struct radmsg *buf2radmsg(uint8_t *buf, int len, uint8_t *secret, int secret_len, uint8_t *rqauth) {
+    struct radauthjob job = {buf, len, secret, secret_len, rqauth, 0, 0};
+
+    radmsg_verifyauth(&job, 1);
+    return buf2radmsg_verified(&job);
+}
+
 /* should accept both names and numeric values, only numeric right now */
 uint8_t attrname2val(char *attrname) {
     int val = 0;
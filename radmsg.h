@@ -11,6 +11,7 @@
 
 #define RAD_Min_Length 20
 #define RAD_Max_Length 4096
+#define RAD_Max_Length_Extended 65535 /* RFC 7930, TCP and TLS only */
 #define RAD_Max_Attr_Value_Length 253
 
 #define RAD_Access_Request 1
@@ -34,11 +35,14 @@
 #define RAD_Attr_NAS_IP_Address 4
 #define RAD_Attr_Framed_IP_Address 8
 #define RAD_Attr_Reply_Message 18
+#define RAD_Attr_State 24
 #define RAD_Attr_Vendor_Specific 26
 #define RAD_Attr_Called_Station_Id 30
 #define RAD_Attr_Calling_Station_Id 31
+#define RAD_Attr_NAS_Identifier 32
 #define RAD_Attr_Proxy_State 33
 #define RAD_Attr_Acct_Status_Type 40
+#define RAD_Attr_Acct_Delay_Time 41
 #define RAD_Attr_Acct_Input_Octets 42
 #define RAD_Attr_Acct_Output_Octets 43
 #define RAD_Attr_Acct_Session_Id 44
@@ -46,6 +50,8 @@
 #define RAD_Attr_Acct_Input_Packets 47
 #define RAD_Attr_Acct_Output_Packets 48
 #define RAD_Attr_Acct_Terminate_Cause 49
+#define RAD_Attr_Acct_Input_Gigawords 52
+#define RAD_Attr_Acct_Output_Gigawords 53
 #define RAD_Attr_Event_Timestamp 55
 #define RAD_Attr_CHAP_Challenge 60
 #define RAD_Attr_Tunnel_Password 69
@@ -76,12 +82,24 @@ struct radmsg {
     uint8_t msgauthinvalid;
 };
 
+/* a packet to be verified by radmsg_verifyauth, see there */
+struct radauthjob {
+    uint8_t *buf;
+    int len;
+    uint8_t *secret;
+    int secret_len;
+    uint8_t *rqauth;
+    uint8_t authvalid;      /* result: Request/Response Authenticator ok or not checked */
+    uint8_t msgauthinvalid; /* result: a Message-Authenticator is present and wrong */
+};
+
 #define ATTRTYPE(x) ((x)[0])
 #define ATTRLEN(x) ((x)[1])
 #define ATTRVAL(x) ((x) + 2)
 #define ATTRVALLEN(x) ((x)[1] - 2)
 
 int get_checked_rad_length(uint8_t *buf);
+int get_checked_rad_length_max(uint8_t *buf, int maxlen);
 void radmsg_free(struct radmsg *);
 struct radmsg *radmsg_init(uint8_t, uint8_t, uint8_t *);
 int radmsg_add(struct radmsg *, struct tlv *, uint8_t front);
@@ -93,6 +111,8 @@ int radmsg_copy_attrs(struct radmsg *dst,
 uint8_t *tlv2buf(uint8_t *p, const struct tlv *tlv);
 int radmsg2buf(struct radmsg *msg, uint8_t *, int, uint8_t **);
 struct radmsg *buf2radmsg(uint8_t *, int, uint8_t *, int, uint8_t *);
+void radmsg_verifyauth(struct radauthjob *jobs, int count);
+struct radmsg *buf2radmsg_verified(struct radauthjob *job);
 uint8_t attrname2val(char *attrname);
 int vattrname2val(char *attrname, uint32_t *vendor, uint32_t *type);
 int attrvalidate(unsigned char *attrs, int length);
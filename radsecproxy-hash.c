@@ -1,9 +1,13 @@
 /* Copyright (c) 2011,2013, NORDUnet A/S */
 /* See LICENSE for licensing information. */
 
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "fticks_hashmac.h"
@@ -11,60 +15,414 @@
 
 void usage(void) {
     fprintf(stderr,
-            "usage: radsecproxy-hash [-h] [-k key] [mac]...\n"
+            "usage: radsecproxy-hash [-h] [-a] [-k key] [mac]...\n"
+            "       radsecproxy-hash -b [-a] [-k key] [-t threads] [file]...\n"
 #if defined(READ_CONFIG)
             "   -c configfile\tuse configuration from CONFIGFILE\n"
 #endif
+            "   -a\t\t\tprint the address and all its hashed forms\n"
+            "   -b\t\t\tbulk mode, hash the lines of FILEs or stdin\n"
             "   -h\t\t\tdisplay this help and exit\n"
             "   -k key\t\tuse KEY for HMAC\n"
-            "      mac\t\tMAC address to hash. Read from stdin if omittedn.\n");
+            "   -t threads\t\tnumber of threads in bulk mode\n"
+            "      mac\t\tMAC address to hash. Read from stdin if omitted.\n");
     exit(1);
 }
 
 #define MYNAME "radsecproxy-hash"
 
-void print_hash(uint8_t *mac, uint8_t *key) {
-    uint8_t buf[64 + 1];
+/* input is cut into chunks of about this size, at line ends */
+#define CHUNK_SIZE (1 << 20)
+/* max output for a line, in addition to the line itself */
+#define LINE_OUT_MAX 260
 
-    if (fticks_hashmac(mac, key, sizeof(buf), buf) != 0) {
+struct hashconf {
+    struct fticks_hashmac_ctx plain;
+    struct fticks_hashmac_ctx keyed;
+    int haskey;
+    int all;
+};
+
+struct chunk {
+    const uint8_t *in;
+    size_t inlen;
+    uint8_t *buf; /* holds the input when read from a stream */
+    size_t bufsize;
+    char *out;
+    size_t outlen;
+    size_t outsize;
+    int done;
+};
+
+struct bulk {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    pthread_cond_t done;
+    const struct hashconf *conf;
+    struct chunk *chunks;
+    int nchunks;
+    unsigned long next;   /* the next chunk to be hashed */
+    unsigned long filled; /* the number of chunks filled so far */
+    int eof;
+};
+
+static void *xrealloc(void *p, size_t size) {
+    p = realloc(p, size);
+    if (!p) {
         fprintf(stderr, "%s: out of memory\n", MYNAME);
         exit(3);
     }
-    puts((const char *)buf);
+    return p;
+}
+
+/* the F-Ticks vendor forms keep the first nine characters */
+static size_t vendorhash(const struct fticks_hashmac_ctx *ctx, const uint8_t *in, size_t len, char *out) {
+    size_t n = len < 9 ? len : 9;
+
+    memcpy(out, in, n);
+    fticks_hashmac_hash(ctx, in, len, 2 * 32 + 1 - 9, (uint8_t *)out + n);
+    return n + strlen(out + n);
+}
+
+/* Hash the line IN of LEN bytes, without its newline, and write the
+ * result followed by a newline to OUT, which has room for at least LEN +
+ * LINE_OUT_MAX bytes. With conf->all, the line is followed by its
+ * VendorHashed and FullyHashed forms, and, if a key is given, its
+ * VendorKeyHashed and FullyKeyHashed forms, separated by tabs. */
+static size_t hashline(const struct hashconf *conf, const uint8_t *in, size_t len, char *out) {
+    size_t n = 0;
+
+    if (!conf->all) {
+        fticks_hashmac_hash(conf->haskey ? &conf->keyed : &conf->plain, in, len, 2 * 32 + 1, (uint8_t *)out);
+        n = 2 * 32;
+    } else {
+        memcpy(out, in, len);
+        n = len;
+        out[n++] = '\t';
+        n += vendorhash(&conf->plain, in, len, out + n);
+        out[n++] = '\t';
+        fticks_hashmac_hash(&conf->plain, in, len, 2 * 32 + 1, (uint8_t *)out + n);
+        n += 2 * 32;
+        if (conf->haskey) {
+            out[n++] = '\t';
+            n += vendorhash(&conf->keyed, in, len, out + n);
+            out[n++] = '\t';
+            fticks_hashmac_hash(&conf->keyed, in, len, 2 * 32 + 1, (uint8_t *)out + n);
+            n += 2 * 32;
+        }
+    }
+    out[n++] = '\n';
+    return n;
+}
+
+static size_t linelen(const uint8_t *line, size_t len) {
+    while (len && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+        len--;
+    return len;
+}
+
+static void print_hash(const struct hashconf *conf, const uint8_t *mac) {
+    static char *out = NULL;
+    size_t len = linelen(mac, strlen((const char *)mac));
+
+    out = xrealloc(out, len + LINE_OUT_MAX);
+    fwrite(out, 1, hashline(conf, mac, len, out), stdout);
+}
+
+static void hashchunk(const struct hashconf *conf, struct chunk *c) {
+    const uint8_t *line = c->in, *end = c->in + c->inlen, *nl;
+    size_t len;
+
+    c->outlen = 0;
+    while (line < end) {
+        nl = memchr(line, '\n', end - line);
+        len = nl ? (size_t)(nl - line) : (size_t)(end - line);
+        if (c->outlen + len + LINE_OUT_MAX > c->outsize) {
+            c->outsize = 2 * (c->outlen + len + LINE_OUT_MAX);
+            c->out = xrealloc(c->out, c->outsize);
+        }
+        c->outlen += hashline(conf, line, linelen(line, len), c->out + c->outlen);
+        line += len + 1;
+    }
+}
+
+static void *worker(void *arg) {
+    struct bulk *b = (struct bulk *)arg;
+    struct chunk *c;
+
+    for (;;) {
+        pthread_mutex_lock(&b->lock);
+        while (b->next == b->filled && !b->eof)
+            pthread_cond_wait(&b->ready, &b->lock);
+        if (b->next == b->filled) {
+            pthread_mutex_unlock(&b->lock);
+            return NULL;
+        }
+        c = &b->chunks[b->next++ % b->nchunks];
+        pthread_mutex_unlock(&b->lock);
+
+        hashchunk(b->conf, c);
+
+        pthread_mutex_lock(&b->lock);
+        c->done = 1;
+        pthread_cond_broadcast(&b->done);
+        pthread_mutex_unlock(&b->lock);
+    }
+}
+
+/* An input: a memory-mapped file, or a stream read into the chunk
+ * buffers with the partial last line carried over to the next chunk. */
+struct input {
+    FILE *f;
+    const uint8_t *map;
+    size_t maplen;
+    size_t off;
+    uint8_t *carry;
+    size_t carrylen;
+};
+
+static int fillchunk(struct input *in, struct chunk *c) {
+    const uint8_t *nl;
+    size_t len, n;
+
+    if (!in->f) {
+        if (in->off == in->maplen)
+            return 0;
+        len = in->maplen - in->off < CHUNK_SIZE ? in->maplen - in->off : CHUNK_SIZE;
+        nl = memchr(in->map + in->off + len - 1, '\n', in->maplen - in->off - len + 1);
+        if (nl)
+            len = nl + 1 - (in->map + in->off);
+        else
+            len = in->maplen - in->off;
+        c->in = in->map + in->off;
+        c->inlen = len;
+        in->off += len;
+        return 1;
+    }
+
+    len = in->carrylen;
+    if (c->bufsize < len + CHUNK_SIZE) {
+        c->bufsize = len + CHUNK_SIZE;
+        c->buf = xrealloc(c->buf, c->bufsize);
+    }
+    memcpy(c->buf, in->carry, len);
+    for (;;) {
+        nl = NULL;
+        len += fread(c->buf + len, 1, c->bufsize - len, in->f);
+        if (len < c->bufsize)
+            break; /* end of input */
+        /* the buffer is full, end the chunk after its last line */
+        for (nl = c->buf + len; nl > c->buf && nl[-1] != '\n'; nl--)
+            ;
+        if (nl > c->buf)
+            break;
+        /* a line longer than the buffer */
+        c->bufsize *= 2;
+        c->buf = xrealloc(c->buf, c->bufsize);
+    }
+    if (ferror(in->f)) {
+        fprintf(stderr, "%s: read error\n", MYNAME);
+        exit(2);
+    }
+    if (!len)
+        return 0;
+    /* at end of input the last line need not end with a newline */
+    n = nl ? (size_t)(nl - c->buf) : len;
+    in->carrylen = len - n;
+    in->carry = xrealloc(in->carry, in->carrylen + 1);
+    memcpy(in->carry, c->buf + n, in->carrylen);
+    c->in = c->buf;
+    c->inlen = n;
+    return 1;
+}
+
+static int openinput(struct input *in, const char *name) {
+    struct stat st;
+    int fd;
+
+    memset(in, 0, sizeof(*in));
+    if (!name || !strcmp(name, "-")) {
+        in->f = stdin;
+        return 1;
+    }
+    fd = open(name, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st)) {
+        perror(name);
+        if (fd >= 0)
+            close(fd);
+        return 0;
+    }
+    if (S_ISREG(st.st_mode)) {
+        in->maplen = st.st_size;
+        if (in->maplen) {
+            in->map = mmap(NULL, in->maplen, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (in->map == MAP_FAILED) {
+                perror(name);
+                close(fd);
+                return 0;
+            }
+            madvise((void *)in->map, in->maplen, MADV_SEQUENTIAL);
+        }
+        close(fd);
+        return 1;
+    }
+    /* pipes and the like are read as streams */
+    in->f = fdopen(fd, "r");
+    if (!in->f) {
+        perror(name);
+        close(fd);
+        return 0;
+    }
+    return 1;
+}
+
+static void closeinput(struct input *in) {
+    if (in->map)
+        munmap((void *)in->map, in->maplen);
+    if (in->f && in->f != stdin)
+        fclose(in->f);
+    free(in->carry);
+}
+
+static void writechunk(struct bulk *b, unsigned long seq) {
+    struct chunk *c = &b->chunks[seq % b->nchunks];
+
+    pthread_mutex_lock(&b->lock);
+    while (!c->done)
+        pthread_cond_wait(&b->done, &b->lock);
+    c->done = 0;
+    pthread_mutex_unlock(&b->lock);
+    if (fwrite(c->out, 1, c->outlen, stdout) != c->outlen) {
+        perror(MYNAME);
+        exit(3);
+    }
+}
+
+/* Hash the lines of the files, or of stdin if there are none, in
+ * chunks processed by worker threads and written in input order. The
+ * chunks of a file are written before the next file is mapped, so that
+ * a chunk pointing into a mapping is never used after it is unmapped. */
+static int bulkhash(const struct hashconf *conf, int threads, char **files, int nfiles) {
+    struct bulk b;
+    struct input in;
+    pthread_t *th;
+    unsigned long written = 0;
+    int i, ret = 0;
+
+    memset(&b, 0, sizeof(b));
+    pthread_mutex_init(&b.lock, NULL);
+    pthread_cond_init(&b.ready, NULL);
+    pthread_cond_init(&b.done, NULL);
+    b.conf = conf;
+    b.nchunks = 4 * threads;
+    b.chunks = xrealloc(NULL, b.nchunks * sizeof(struct chunk));
+    memset(b.chunks, 0, b.nchunks * sizeof(struct chunk));
+    th = xrealloc(NULL, threads * sizeof(pthread_t));
+    for (i = 0; i < threads; i++)
+        if (pthread_create(&th[i], NULL, worker, &b)) {
+            fprintf(stderr, "%s: failed to create thread\n", MYNAME);
+            exit(3);
+        }
+
+    for (i = 0; i < (nfiles ? nfiles : 1); i++) {
+        if (!openinput(&in, nfiles ? files[i] : NULL)) {
+            ret = 2;
+            continue;
+        }
+        for (;;) {
+            if (b.filled - written == (unsigned long)b.nchunks)
+                writechunk(&b, written++);
+            if (!fillchunk(&in, &b.chunks[b.filled % b.nchunks]))
+                break;
+            pthread_mutex_lock(&b.lock);
+            b.filled++;
+            pthread_cond_signal(&b.ready);
+            pthread_mutex_unlock(&b.lock);
+        }
+        while (written < b.filled)
+            writechunk(&b, written++);
+        closeinput(&in);
+    }
+
+    pthread_mutex_lock(&b.lock);
+    b.eof = 1;
+    pthread_cond_broadcast(&b.ready);
+    pthread_mutex_unlock(&b.lock);
+    for (i = 0; i < threads; i++)
+        pthread_join(th[i], NULL);
+    for (i = 0; i < b.nchunks; i++) {
+        free(b.chunks[i].buf);
+        free(b.chunks[i].out);
+    }
+    free(b.chunks);
+    free(th);
+    if (fflush(stdout)) {
+        perror(MYNAME);
+        return 3;
+    }
+    return ret;
 }
 
 int main(int argc, char *argv[]) {
-    int opt;
+    int opt, bulk = 0, threads = 0;
 #if defined(READ_CONFIG)
     char *config = NULL;
 #endif
     char mac[80 + 1];
     uint8_t *key = NULL;
+    struct hashconf conf;
 
-    while ((opt = getopt(argc, argv, "hk:")) != -1) {
+    memset(&conf, 0, sizeof(conf));
+    while ((opt = getopt(argc, argv, "abhk:t:")) != -1) {
         switch (opt) {
 #if defined(READ_CONFIG)
         case 'c':
             config = optarg;
             break;
 #endif
+        case 'a':
+            conf.all = 1;
+            break;
+        case 'b':
+            bulk = 1;
+            break;
         case 'h':
             usage();
         case 'k':
             key = (uint8_t *)optarg;
             break;
+        case 't':
+            threads = atoi(optarg);
+            if (threads < 1)
+                usage();
+            break;
         default:
             usage();
         }
     }
 
+    fticks_hashmac_init(&conf.plain, NULL);
+    if (key) {
+        fticks_hashmac_init(&conf.keyed, key);
+        conf.haskey = 1;
+    }
+
+    if (bulk) {
+        if (!threads) {
+            threads = sysconf(_SC_NPROCESSORS_ONLN);
+            if (threads < 1)
+                threads = 1;
+        }
+        return bulkhash(&conf, threads, argv + optind, argc - optind);
+    }
+
     if (optind < argc) {
         while (optind < argc) {
-            print_hash((uint8_t *)argv[optind++], key);
+            print_hash(&conf, (uint8_t *)argv[optind++]);
         }
     } else {
         while (fgets(mac, sizeof(mac), stdin) != NULL) {
-            print_hash((uint8_t *)mac, key);
+            print_hash(&conf, (uint8_t *)mac);
         }
     }
 
@@ -7,23 +7,24 @@
  *              rd is responsible for init and launching wr
  * For TLS there is a server instance that launches tlsserverrd for each TLS peer
  *          each tlsserverrd launches tlsserverwr
- * For each UDP/TLS peer there is clientrd and clientwr, clientwr is responsible
- *          for init and launching rd
+ * All UDP/TLS peers we send requests to are served by the upstream reactor
+ *          threads, see upstream.c
  *
  * serverrd will receive a request, processes it and puts it in the requestq of
- *          the appropriate clientwr
- * clientwr monitors its requestq and sends requests
- * clientrd looks for responses, processes them and puts them in the replyq of
- *          the peer the request came from
+ *          the appropriate server and signals its reactor
+ * the reactor runs clientwrrun which monitors the requestq and sends requests
+ * the reactor (or udpclientrd for UDP) looks for responses, processes them and
+ *          puts them in the replyq of the peer the request came from
  * serverwr monitors its reply and sends replies
  *
  * In addition to the main thread, we have:
  * If UDP peers are configured, there will be 2 + 2 * #peers UDP threads
- * If TLS peers are configured, there will initially be 2 * #peers TLS threads
+ * There are UpstreamThreads reactor threads, plus a short-lived helper thread
+ *       for each server being set up or reconnecting
  * For each TLS peer connecting to us there will be 2 more TLS threads
  *       This is only for connected peers
  * Example: With 3 UDP peers and 30 TLS peers, there will be a max of
- *          1 + (2 + 2 * 3) + (2 * 30) + (2 * 30) = 129 threads
+ *          1 + (2 + 2 * 3) + 1 + (2 * 30) = 70 threads
  */
 
 /* Bugs:
@@ -47,15 +48,24 @@
 #ifdef SYS_SOLARIS
 #include <fcntl.h>
 #endif
+#include "acctdup.h"
+#include "acctsink.h"
+#include "asciiscan.h"
 #include "debug.h"
 #include "dns.h"
 #include "dtls.h"
+#include "flightrec.h"
 #include "fticks.h"
 #include "fticks_hashmac.h"
 #include "hash.h"
 #include "hostport.h"
+#include "membudget.h"
+#include "profiler.h"
 #include "radsecproxy.h"
+#include "sockfilter.h"
+#include "sockstats.h"
 #include "tcp.h"
+#include "threadreg.h"
 #include "tls.h"
 #include "udp.h"
 #include "util.h"
@@ -78,6 +88,8 @@
 static struct options options;
 static struct list *clconfs, *srvconfs;
 static struct list *realms;
+static int nrealmslots; /* number of configured realms */
+static struct acctdup *acctdupcache;
 
 #ifdef __CYGWIN__
 extern int __declspec(dllimport) optind;
@@ -91,7 +103,6 @@ pthread_attr_t pthread_attr;
 
 /* minimum required declarations to avoid reordering code */
 struct realm *adddynamicrealmserver(struct realm *realm, char *id);
-void *clientwr(void *arg);
 int compileserverconfig(struct clsrvconf *conf, const char *block);
 int mergesrvconf(struct clsrvconf *dst, struct clsrvconf *src);
 int dynamicconfig(struct server *server);
@@ -100,7 +111,7 @@ void freerealm(struct realm *realm);
 void freeclsrvconf(struct clsrvconf *conf);
 void freerq(struct request *rq);
 void freerqoutdata(struct rqout *rqout);
-void rmclientrq(struct request *rq, uint8_t id);
+void rmclientrq(struct request *rq);
 
 static const struct protodefs *(*protoinits[])(uint8_t) = {udpinit, tlsinit, tcpinit, dtlsinit};
 
@@ -221,7 +232,16 @@ struct client *addclient(struct clsrvconf *conf, uint8_t lock) {
         }
     }
 
-    new = calloc(1, sizeof(struct client));
+    new = alignedcalloc(CACHE_LINE, 1, sizeof(struct client));
+    if (new) {
+        new->nrqs = conf->radiusversion == RSP_RADIUS_V10 ? MAX_REQUESTS : RADIUS11_MAX_REQUESTS;
+        if (!options.lowmemory)
+            new->rqs = calloc(new->nrqs, sizeof(struct request *));
+        if (!options.lowmemory && !new->rqs) {
+            free(new);
+            new = NULL;
+        }
+    }
     if (!new) {
         debug(DBG_ERR, "malloc failed");
         if (lock)
@@ -229,6 +249,7 @@ struct client *addclient(struct clsrvconf *conf, uint8_t lock) {
         return NULL;
     }
     if (!list_push(conf->clients, new)) {
+        free(new->rqs);
         free(new);
         if (lock)
             pthread_mutex_unlock(conf->lock);
@@ -250,31 +271,117 @@ pthread_mutex_t *removeclientrqs_sendrq_freeserver_lock(void) {
     return &lock;
 }
 
+/* the duplicate cache of client, NULL until allocated with LowMemory; the
+ * pointer is stored once by addclientrq while other threads may read it */
+static struct request **clientrqs(struct client *client) {
+    return __atomic_load_n(&client->rqs, __ATOMIC_ACQUIRE);
+}
+
 void removeclientrq(struct client *client, int i) {
     struct request *rq;
     struct rqout *rqout;
 
-    rq = client->rqs[i];
+    rq = clientrqs(client)[i];
     if (!rq)
         return;
 
     pthread_mutex_lock(removeclientrqs_sendrq_freeserver_lock());
-    if (rq->to) {
+    if (rq->to && rq->from == client) {
         rqout = rq->to->requests + rq->newid;
-        pthread_mutex_lock(rqout->lock);
+        pthread_mutex_lock(&rqout->lock);
         if (rqout->rq == rq) /* still pointing to our request */
             freerqoutdata(rqout);
-        pthread_mutex_unlock(rqout->lock);
+        pthread_mutex_unlock(&rqout->lock);
     }
-    client->rqs[i] = NULL;
+    if (rq->insink && rq->from == client)
+        rq->from = NULL; /* nobody to reply to once the sink is done */
+    clientrqs(client)[i] = NULL;
     freerq(rq);
     pthread_mutex_unlock(removeclientrqs_sendrq_freeserver_lock());
 }
 
+/* the address of client without the port, the key of the shared duplicate
+ * cache together with the RADIUS id */
+static void shareddupaddr(struct client *client, uint8_t *addr) {
+    memset(addr, 0, 16);
+    if (client->addr->sa_family == AF_INET6)
+        memcpy(addr, &((struct sockaddr_in6 *)client->addr)->sin6_addr, 16);
+    else if (client->addr->sa_family == AF_INET) {
+        addr[10] = addr[11] = 0xff;
+        memcpy(addr + 12, &((struct sockaddr_in *)client->addr)->sin_addr, 4);
+    }
+}
+
+/**
+ * @brief find the request with id from addr in the shared duplicate cache
+ *
+ * The IDs of a client address occupy consecutive entries from a position
+ * given by the address, and an entry is looked for in the SHAREDDUP_PROBES
+ * entries from there. With replace set, it is also given the entry to store a
+ * new request in if there is none: an empty one, or else the oldest one.
+ *
+ * @return the entry, or NULL if there is none
+ */
+static struct shareddup *shareddupfind(struct clsrvconf *conf, const uint8_t *addr, uint8_t id, struct shareddup **replace) {
+    struct shareddup *e;
+    uint32_t h = 0, i;
+
+    for (i = 0; i < 16; i++)
+        h = h * 31 + addr[i];
+    h ^= h >> 15;
+    h += id;
+    if (replace)
+        *replace = NULL;
+    for (i = 0; i < SHAREDDUP_PROBES; i++) {
+        e = conf->duprqs + ((h + i) & (SHAREDDUP_SIZE - 1));
+        if (e->rq && e->id == id && !memcmp(e->addr, addr, 16))
+            return e;
+        if (replace && (!*replace || ((*replace)->rq && (!e->rq || e->rq->created.tv_sec < (*replace)->rq->created.tv_sec))))
+            *replace = e;
+    }
+    return NULL;
+}
+
+/* hand the requests of a closing connection over to conf->dupclient, so
+ * outstanding ones are not cancelled and a retransmit on a new connection
+ * can be joined to them or answered from the shared duplicate cache */
+static void orphanclientrqs(struct client *client) {
+    struct clsrvconf *conf = client->conf;
+    struct shareddup *e;
+    struct request *rq;
+    struct rqout *rqout;
+    uint8_t addr[16];
+    int i;
+
+    shareddupaddr(client, addr);
+    pthread_mutex_lock(removeclientrqs_sendrq_freeserver_lock());
+    for (i = 0; i < client->nrqs; i++) {
+        rq = clientrqs(client)[i];
+        if (!rq || rq->from != client)
+            continue;
+        if (!rq->to) {
+            rq->from = conf->dupclient;
+            continue;
+        }
+        rqout = rq->to->requests + rq->newid;
+        pthread_mutex_lock(&rqout->lock);
+        rq->from = conf->dupclient;
+        e = shareddupfind(conf, addr, rq->rqid, NULL);
+        if (rqout->rq == rq && (!e || e->rq != rq))
+            freerqoutdata(rqout);
+        pthread_mutex_unlock(&rqout->lock);
+    }
+    pthread_mutex_unlock(removeclientrqs_sendrq_freeserver_lock());
+}
+
 void removeclientrqs(struct client *client) {
     int i;
 
-    for (i = 0; i < MAX_REQUESTS; i++)
+    if (!clientrqs(client))
+        return;
+    if (client->conf->duprqs)
+        orphanclientrqs(client);
+    for (i = 0; i < client->nrqs; i++)
         removeclientrq(client, i);
 }
 
@@ -287,6 +394,7 @@ void removelockedclient(struct client *client) {
         removequeue(client->replyq);
         list_removedata(conf->clients, client);
         pthread_mutex_destroy(&client->lock);
+        free(client->rqs);
         free(client->addr);
         free(client);
     }
@@ -313,21 +421,23 @@ void freeserver(struct server *server, uint8_t destroymutex) {
     pthread_mutex_lock(removeclientrqs_sendrq_freeserver_lock());
     if (server->requests) {
         rqout = server->requests;
-        for (end = rqout + MAX_REQUESTS; rqout < end; rqout++) {
+        for (end = rqout + server->nrequests; rqout < end; rqout++) {
             freerqoutdata(rqout);
-            pthread_mutex_destroy(rqout->lock);
-            free(rqout->lock);
+            pthread_mutex_destroy(&rqout->lock);
         }
         free(server->requests);
     }
     free(server->dynamiclookuparg);
+    radreadreset(&server->rd);
+    radwritereset(&server->wr);
     if (server->ssl) {
         SSL_free(server->ssl);
     }
+    free(server->realmslots);
     if (destroymutex) {
         pthread_mutex_destroy(&server->lock);
-        pthread_cond_destroy(&server->newrq_cond);
         pthread_mutex_destroy(&server->newrq_mutex);
+        pthread_mutex_destroy(&server->realmslots_mutex);
     }
     pthread_mutex_unlock(removeclientrqs_sendrq_freeserver_lock());
     free(server);
@@ -335,18 +445,16 @@ void freeserver(struct server *server, uint8_t destroymutex) {
 
 int addserver(struct clsrvconf *conf, const char *dynamiclookuparg) {
     int i;
-    pthread_t clientth;
 
     if (conf->servers) {
         debug(DBG_ERR, "addserver: currently works with just one server per conf");
         return 0;
     }
-    conf->servers = malloc(sizeof(struct server));
+    conf->servers = alignedcalloc(CACHE_LINE, 1, sizeof(struct server));
     if (!conf->servers) {
         debug(DBG_ERR, "malloc failed");
         return 0;
     }
-    memset(conf->servers, 0, sizeof(struct server));
     conf->servers->conf = conf;
 
     conf->pdef->setsrcres();
@@ -355,21 +463,17 @@ int addserver(struct clsrvconf *conf, const char *dynamiclookuparg) {
     if (conf->pdef->addserverextra)
         conf->pdef->addserverextra(conf);
 
-    conf->servers->requests = calloc(MAX_REQUESTS, sizeof(struct rqout));
+    conf->servers->nrequests = conf->radiusversion == RSP_RADIUS_V10 ? MAX_REQUESTS : RADIUS11_MAX_REQUESTS;
+    conf->servers->radius11 = conf->radiusversion == RSP_RADIUS_V11;
+    conf->servers->requests = alignedcalloc(CACHE_LINE, conf->servers->nrequests, sizeof(struct rqout));
     if (!conf->servers->requests) {
         debug(DBG_ERR, "malloc failed");
         goto errexit;
     }
-    for (i = 0; i < MAX_REQUESTS; i++) {
-        conf->servers->requests[i].lock = malloc(sizeof(pthread_mutex_t));
-        if (!conf->servers->requests[i].lock) {
-            debug(DBG_ERR, "malloc failed");
-            goto errexit;
-        }
-        if (pthread_mutex_init(conf->servers->requests[i].lock, NULL)) {
+    for (i = 0; i < conf->servers->nrequests; i++) {
+        if (pthread_mutex_init(&conf->servers->requests[i].lock, NULL)) {
             debugerrno(errno, DBG_ERR, "mutex init failed");
-            free(conf->servers->requests[i].lock);
-            conf->servers->requests[i].lock = NULL;
+            conf->servers->nrequests = i;
             goto errexit;
         }
     }
@@ -384,10 +488,10 @@ int addserver(struct clsrvconf *conf, const char *dynamiclookuparg) {
         pthread_mutex_destroy(&conf->servers->lock);
         goto errexit;
     }
-    if (pthread_cond_init(&conf->servers->newrq_cond, NULL)) {
+    if (pthread_mutex_init(&conf->servers->realmslots_mutex, NULL)) {
         debugerrno(errno, DBG_ERR, "mutex init failed");
-        pthread_mutex_destroy(&conf->servers->newrq_mutex);
         pthread_mutex_destroy(&conf->servers->lock);
+        pthread_mutex_destroy(&conf->servers->newrq_mutex);
         goto errexit;
     }
 
@@ -396,14 +500,12 @@ int addserver(struct clsrvconf *conf, const char *dynamiclookuparg) {
     if (conf->dynamiclookupcommand)
         conf->servers->dynamiclookuparg = stringcopy(dynamiclookuparg, 0);
 
-    debug(DBG_DBG, "%s: starting new client writer for %s", __func__, conf->name);
-    if (pthread_create(&clientth, &pthread_attr, clientwr, (void *)(conf->servers))) {
-        debugerrno(errno, DBG_ERR, "addserver: pthread_create failed");
+    debug(DBG_DBG, "%s: handing %s to the upstream reactor", __func__, conf->name);
+    if (!upstreamadd(conf->servers)) {
         freeserver(conf->servers, 1);
         conf->servers = NULL;
         return 0;
-    } else
-        pthread_detach(clientth);
+    }
     return 1;
 
 errexit:
@@ -443,6 +545,7 @@ void freerq(struct request *rq) {
     pthread_mutex_unlock(&rq->refmutex);
     if (rq->origusername)
         free(rq->origusername);
+    free(rq->routeuser);
     if (rq->buf) {
         memset(rq->buf, 0, rq->buflen);
         free(rq->buf);
@@ -453,50 +556,237 @@ void freerq(struct request *rq) {
     }
     if (rq->msg)
         radmsg_free(rq->msg);
+    if (rq->memcharge)
+        membudget_charge(-(int64_t)rq->memcharge);
     pthread_mutex_destroy(&rq->refmutex);
     free(rq);
 }
 
+/* charge memory held by rq to the budget, released when rq is freed */
+static void rqcharge(struct request *rq, uint32_t bytes) {
+    rq->memcharge += bytes;
+    membudget_charge(bytes);
+}
+
+/* the configured realm whose share a request for realm uses */
+static struct realm *slotsrealm(struct realm *realm) {
+    while (realm->parent)
+        realm = realm->parent;
+    return realm;
+}
+
+/* count an ID of to as taken (n = 1) or released (n = -1) by the realm of rq */
+void realmslotsadd(struct server *to, struct request *rq, int n) {
+    struct realmslots *slots;
+
+    if (!rq->realm || rq->inslots == (n > 0))
+        return;
+    pthread_mutex_lock(&to->realmslots_mutex);
+    if (!to->realmslots)
+        to->realmslots = calloc(nrealmslots, sizeof(struct realmslots));
+    if (to->realmslots) {
+        slots = to->realmslots + rq->realm->slotsidx;
+        if (n > 0 && !slots->out++)
+            to->realmweight += rq->realm->share;
+        else if (n < 0 && !--slots->out)
+            to->realmweight -= rq->realm->share;
+        to->realmslotsout += n;
+        rq->inslots = n > 0;
+    }
+    pthread_mutex_unlock(&to->realmslots_mutex);
+}
+
+/* note that rq found no free ID of to while its realm had no other request
+ * outstanding there, so that realmslotstake() holds IDs back for it */
+void realmslotsstarved(struct server *to, struct request *rq) {
+    struct timeval now;
+
+    if (!rq->realm)
+        return;
+    pthread_mutex_lock(&to->realmslots_mutex);
+    if (to->realmslots && to->realmslots[rq->realm->slotsidx].out <= (uint32_t)rq->inslots) {
+        monotime(&now);
+        to->realmstarved = now.tv_sec;
+    }
+    pthread_mutex_unlock(&to->realmslots_mutex);
+}
+
+/**
+ * @brief take one of the ids IDs of to for the realm of rq, if within its share
+ *
+ * A realm never has more than its ServerQuota requests outstanding. Once half
+ * of the IDs are in use and another realm has requests outstanding or found no
+ * free ID within DUPLICATE_INTERVAL, a realm also gets no more than its
+ * ServerShare weighted part of them among the realms with requests
+ * outstanding, with one share held back for realms that have none yet. So a
+ * realm whose requests time out can only hold on to part of the IDs, and the
+ * others still find free ones, while a realm that is alone uses all of them.
+ *
+ * @return 1 if the ID is taken, 0 if the request should be dropped
+ */
+int realmslotstake(struct server *to, struct request *rq, int ids) {
+    struct realmslots *slots;
+    struct realm *realm = rq->realm;
+    struct timeval now;
+    uint32_t out, weight;
+    int ok = 1;
+
+    if (!realm)
+        return 1;
+    pthread_mutex_lock(&to->realmslots_mutex);
+    slots = to->realmslots ? to->realmslots + realm->slotsidx : NULL;
+    out = slots ? slots->out : 0;
+    if (realm->quota && out >= realm->quota)
+        ok = 0;
+    else if (to->realmslotsout >= (uint32_t)ids / 2) {
+        weight = to->realmweight + (out ? 0 : realm->share);
+        if (weight == realm->share && to->realmstarved) {
+            monotime(&now);
+            if (now.tv_sec - to->realmstarved >= DUPLICATE_INTERVAL)
+                to->realmstarved = 0;
+        }
+        if (weight > realm->share || to->realmstarved)
+            ok = out < (uint64_t)ids * realm->share / (weight + 1);
+    }
+    if (!ok && slots)
+        slots->shed++;
+    pthread_mutex_unlock(&to->realmslots_mutex);
+    if (ok)
+        realmslotsadd(to, rq, 1);
+    return ok;
+}
+
+/* names in flight records are truncated, and NUL terminated only if shorter */
+static void recordname(char *dst, const char *name) {
+    size_t len;
+
+    if (!name)
+        return;
+    len = strlen(name);
+    memcpy(dst, name, len < FLIGHTREC_NAMELEN ? len : FLIGHTREC_NAMELEN);
+}
+
+/* microseconds of the precise monotonic clock; monotime() is too coarse
+   for the latency of fast replies */
+static uint64_t precisemicros(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* write the summary of a request from a client to the flight recorder, once */
+static void recordrq(struct request *rq, uint8_t outcome, uint8_t replycode) {
+    struct flightrec_record rec;
+    struct timespec ts;
+    int64_t latency;
+
+    if (!flightrec_enabled() || !rq->from || __atomic_exchange_n(&rq->recorded, 1, __ATOMIC_RELAXED))
+        return;
+    memset(&rec, 0, sizeof(rec));
+    clock_gettime(CLOCK_REALTIME, &ts);
+    rec.time = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    latency = rq->received ? (int64_t)(precisemicros() - rq->received) : 0;
+    rec.latency = latency < 0 ? 0 : latency > UINT32_MAX ? UINT32_MAX : latency;
+    rec.code = rq->rqcode;
+    rec.id = rq->rqid;
+    rec.replycode = replycode;
+    rec.outcome = outcome;
+    rec.tries = rq->tries;
+    if (rq->from->addr) {
+        rec.family = rq->from->addr->sa_family;
+        if (rec.family == AF_INET) {
+            memcpy(rec.addr, &((struct sockaddr_in *)rq->from->addr)->sin_addr, 4);
+            rec.port = ((struct sockaddr_in *)rq->from->addr)->sin_port;
+        } else if (rec.family == AF_INET6) {
+            memcpy(rec.addr, &((struct sockaddr_in6 *)rq->from->addr)->sin6_addr, 16);
+            rec.port = ((struct sockaddr_in6 *)rq->from->addr)->sin6_port;
+        }
+    }
+    recordname(rec.client, rq->from->conf->name);
+    if (rq->realm)
+        recordname(rec.realm, rq->realm->name);
+    if (rq->to)
+        recordname(rec.server, rq->to->conf->name);
+    flightrec_write(&rec);
+}
+
 void freerqoutdata(struct rqout *rqout) {
     if (!rqout)
         return;
     if (rqout->rq) {
+        recordrq(rqout->rq, FLIGHTREC_DROPPED, 0);
+        if (rqout->rq->to)
+            realmslotsadd(rqout->rq->to, rqout->rq, -1);
         if (rqout->rq->buf) {
             free(rqout->rq->buf);
             rqout->rq->buf = NULL;
         }
+        /* the dup cache only needs the authenticator and the encoded reply */
+        if (options.lowmemory && rqout->rq->msg) {
+            radmsg_free(rqout->rq->msg);
+            rqout->rq->msg = NULL;
+        }
         rqout->rq->to = NULL;
         freerq(rqout->rq);
         rqout->rq = NULL;
     }
     rqout->tries = 0;
-    memset(&rqout->expiry, 0, sizeof(struct timeval));
+    rqout->expiry = 0;
+}
+
+/* RADIUS/1.1 has no Message-Authenticator, the TLS layer protects the packet */
+static void removemsgauth(struct radmsg *msg) {
+    static uint8_t msgauth[] = {RAD_Attr_Message_Authenticator, 0};
+
+    dorewriterm(msg, msgauth, NULL, 0);
 }
 
-int _internal_sendrq(struct server *to, uint8_t id, struct request *rq) {
+/* returns 1 if the request was queued with id, 0 if id is in use and -1 if
+   the request can not be sent to this server at all */
+int _internal_sendrq(struct server *to, int id, struct request *rq) {
+    uint32_t token;
+
     if (!to->requests[id].rq) {
-        pthread_mutex_lock(to->requests[id].lock);
+        pthread_mutex_lock(&to->requests[id].lock);
         if (!to->requests[id].rq) {
             rq->newid = id;
-            rq->msg->id = id;
-            rq->buflen = radmsg2buf(rq->msg, to->conf->secret, to->conf->secret_len, &rq->buf);
+            if (rq->radius11) {
+                /* the Token replaces ID and authenticator, the rest is reserved */
+                token = htonl((to->tokenseq++ << RADIUS11_TOKEN_BITS) | id);
+                rq->msg->id = 0;
+                memset(rq->msg->auth, 0, 16);
+                memcpy(rq->msg->auth, &token, 4);
+                removemsgauth(rq->msg);
+                rq->buflen = radmsg2buf(rq->msg, NULL, 0, &rq->buf);
+            } else {
+                rq->msg->id = id;
+                rq->buflen = radmsg2buf(rq->msg, to->conf->secret, to->conf->secret_len, &rq->buf);
+            }
             if (!rq->buf || rq->buflen <= 0) {
-                pthread_mutex_unlock(to->requests[id].lock);
+                pthread_mutex_unlock(&to->requests[id].lock);
                 debug(DBG_ERR, "sendrq: radmsg2buf failed");
                 return 0;
             }
+            if (rq->buflen > to->conf->maxpacketlen) {
+                pthread_mutex_unlock(&to->requests[id].lock);
+                debug(DBG_WARN, "sendrq: request of %d bytes exceeds the maximum packet length %d of server %s, dropping request", rq->buflen, to->conf->maxpacketlen, to->conf->name);
+                free(rq->buf);
+                rq->buf = NULL;
+                return -1;
+            }
             debug(DBG_DBG, "sendrq: inserting packet with id %d in queue for %s", id, to->conf->name);
             to->requests[id].rq = rq;
-            pthread_mutex_unlock(to->requests[id].lock);
+            pthread_mutex_unlock(&to->requests[id].lock);
             return 1;
         }
-        pthread_mutex_unlock(to->requests[id].lock);
+        pthread_mutex_unlock(&to->requests[id].lock);
     }
     return 0;
 }
 
 void sendrq(struct request *rq) {
-    int i, start;
+    int i, start, max, r = 0, shed = 0;
     struct server *to;
 
     pthread_mutex_lock(removeclientrqs_sendrq_freeserver_lock());
@@ -505,27 +795,39 @@ void sendrq(struct request *rq) {
         goto errexit;
 
     start = to->conf->statusserver == RSP_STATSRV_OFF ? 0 : 1;
+    /* RADIUS/1.0 IDs are 8 bit, RADIUS/1.1 may use the whole table */
+    max = rq->radius11 ? to->nrequests : MAX_REQUESTS;
     pthread_mutex_lock(&to->newrq_mutex);
+    if (rq->radius11 != to->radius11) {
+        debug(DBG_INFO, "sendrq: RADIUS version of server %s changed, dropping request", to->conf->name);
+        goto errexit;
+    }
     if (start && rq->msg->code == RAD_Status_Server) {
-        if (!_internal_sendrq(to, 0, rq)) {
+        if (!(r = _internal_sendrq(to, 0, rq))) {
             debug(DBG_INFO, "sendrq: status server already in queue, dropping request");
             goto errexit;
         }
     } else {
-        if (!to->nextid)
+        if (!realmslotstake(to, rq, max - start)) {
+            debug(DBG_INFO, "sendrq: realm %s exceeds its share of server %s, dropping request", rq->realm->name, to->conf->name);
+            shed = 1;
+            goto errexit;
+        }
+        if (!to->nextid || to->nextid >= max)
             to->nextid = start;
         /* might simplify if only try nextid, might be ok */
-        for (i = to->nextid; i < MAX_REQUESTS; i++) {
-            if (_internal_sendrq(to, i, rq))
+        for (i = to->nextid; i < max; i++) {
+            if ((r = _internal_sendrq(to, i, rq)))
                 break;
         }
-        if (i == MAX_REQUESTS) {
+        if (i == max) {
             for (i = start; i < to->nextid; i++) {
-                if (_internal_sendrq(to, i, rq))
+                if ((r = _internal_sendrq(to, i, rq)))
                     break;
             }
             if (i == to->nextid) {
                 debug(DBG_WARN, "sendrq: no room in queue for server %s, dropping request", to->conf->name);
+                realmslotsstarved(to, rq);
                 goto errexit;
             }
         }
@@ -533,11 +835,13 @@ void sendrq(struct request *rq) {
         if (i >= start) /* i is not reserved for statusserver */
             to->nextid = i + 1;
     }
+    if (r < 0)
+        goto errexit;
 
     if (!to->newrq) {
         to->newrq = 1;
-        debug(DBG_DBG, "sendrq: signalling client writer");
-        pthread_cond_signal(&to->newrq_cond);
+        debug(DBG_DBG, "sendrq: signalling upstream reactor");
+        upstreamwakeup(to);
     }
 
     pthread_mutex_unlock(&to->newrq_mutex);
@@ -545,8 +849,11 @@ void sendrq(struct request *rq) {
     return;
 
 errexit:
+    recordrq(rq, shed ? FLIGHTREC_SHED : FLIGHTREC_DROPPED, 0);
+    if (to)
+        realmslotsadd(to, rq, -1);
     if (rq->from)
-        rmclientrq(rq, rq->rqid);
+        rmclientrq(rq);
     freerq(rq);
     if (to)
         pthread_mutex_unlock(&to->newrq_mutex);
@@ -557,8 +864,19 @@ void sendreply(struct request *rq) {
     uint8_t first;
     struct client *to = rq->from;
 
-    if (!rq->replybuf)
-        rq->replybuflen = radmsg2buf(rq->msg, to->conf->secret, to->conf->secret_len, &rq->replybuf);
+    if (!rq->replybuf) {
+        /* the record is acknowledged, answer later copies of it locally */
+        if (rq->hasacctkey && rq->msg->code == RAD_Accounting_Response)
+            acctdup_add(acctdupcache, rq->acctkey, monosec());
+        if (to->radius11) {
+            removemsgauth(rq->msg);
+            rq->replybuflen = radmsg2buf(rq->msg, NULL, 0, &rq->replybuf);
+        } else
+            rq->replybuflen = radmsg2buf(rq->msg, to->conf->secret, to->conf->secret_len, &rq->replybuf);
+        if (rq->replybuflen > 0)
+            rqcharge(rq, rq->replybuflen);
+    }
+    recordrq(rq, rq->to ? FLIGHTREC_REPLIED : FLIGHTREC_LOCAL, rq->replybuflen > 0 ? rq->replybuf[0] : 0);
     radmsg_free(rq->msg);
     rq->msg = NULL;
     if (!rq->replybuf || rq->replybuflen <= 0) {
@@ -566,6 +884,17 @@ void sendreply(struct request *rq) {
         debug(DBG_ERR, "sendreply: radmsg2buf failed");
         return;
     }
+    if (rq->replybuflen > to->conf->maxpacketlen) {
+        debug(DBG_WARN, "sendreply: reply of %d bytes exceeds the maximum packet length %d of client %s, dropping reply", rq->replybuflen, to->conf->maxpacketlen, to->conf->name);
+        freerq(rq);
+        return;
+    }
+    if (!to->replyq) {
+        /* connection closed, keep the reply in the shared duplicate cache only */
+        debug(DBG_DBG, "sendreply: connection of client %s closed, caching reply", to->conf->name);
+        freerq(rq);
+        return;
+    }
 
     pthread_mutex_lock(&to->replyq->mutex);
     first = list_first(to->replyq->entries) == NULL;
@@ -937,6 +1266,147 @@ int msmppe(unsigned char *attrs, int length, uint8_t type, char *attrtxt, struct
     return 1;
 }
 
+/* RADIUS/1.1 (RFC 9765) sends User-Password, Tunnel-Password and the MS-MPPE
+ * keys in clear text. The functions below convert them from and to the
+ * RADIUS/1.0 encryption when proxying between the two versions. */
+
+/* encrypt a clear text User-Password, padding it to a multiple of 16 */
+int pwdhide(struct tlv *attr, uint8_t *secret, int secret_len, uint8_t *auth) {
+    uint8_t len = attr->l, padded;
+
+    if (len > 128) {
+        debug(DBG_WARN, "pwdhide: invalid password length");
+        return 0;
+    }
+    padded = len ? (len + 15) / 16 * 16 : 16;
+    if (!resizeattr(attr, padded))
+        return 0;
+    memset(attr->v + len, 0, padded - len);
+    return pwdcrypt(1, attr->v, padded, secret, secret_len, auth, NULL, 0);
+}
+
+/* decrypt a User-Password and strip the padding */
+int pwdreveal(struct tlv *attr, uint8_t *secret, int secret_len, uint8_t *auth) {
+    uint8_t len = attr->l;
+
+    if (len < 16 || len > 128 || len % 16) {
+        debug(DBG_WARN, "pwdreveal: invalid password length");
+        return 0;
+    }
+    if (!pwdcrypt(0, attr->v, len, secret, secret_len, auth, NULL, 0))
+        return 0;
+    while (len && !attr->v[len - 1])
+        len--;
+    return resizeattr(attr, len);
+}
+
+/* encrypt a clear text Tunnel-Password (tag, password), adding salt and length */
+int tunnelpwdhide(struct tlv *attr, uint8_t *secret, int secret_len, uint8_t *auth) {
+    uint8_t len, padded, buf[3 + 128];
+
+    if (attr->l < 1 || attr->l - 1 > 127) {
+        debug(DBG_WARN, "tunnelpwdhide: invalid password length");
+        return 0;
+    }
+    len = attr->l - 1;
+    padded = (len + 1 + 15) / 16 * 16;
+    memset(buf, 0, sizeof(buf));
+    buf[0] = attr->v[0];
+    if (!RAND_bytes(buf + 1, 2))
+        return 0;
+    buf[1] |= 0x80;
+    buf[3] = len;
+    memcpy(buf + 4, attr->v + 1, len);
+    if (!pwdcrypt(1, buf + 3, padded, secret, secret_len, auth, buf + 1, 2) ||
+        !resizeattr(attr, 3 + padded))
+        return 0;
+    memcpy(attr->v, buf, 3 + padded);
+    memset(buf, 0, sizeof(buf));
+    return 1;
+}
+
+/* decrypt a Tunnel-Password, leaving tag and password */
+int tunnelpwdreveal(struct tlv *attr, uint8_t *secret, int secret_len, uint8_t *auth) {
+    uint8_t len;
+
+    if (attr->l < 3 + 16 || attr->l - 3 > 128 || (attr->l - 3) % 16) {
+        debug(DBG_WARN, "tunnelpwdreveal: invalid password length");
+        return 0;
+    }
+    if (!pwdcrypt(0, attr->v + 3, attr->l - 3, secret, secret_len, auth, attr->v + 1, 2))
+        return 0;
+    len = attr->v[3];
+    if (len > attr->l - 4) {
+        debug(DBG_WARN, "tunnelpwdreveal: invalid data length");
+        return 0;
+    }
+    memmove(attr->v + 1, attr->v + 4, len);
+    return resizeattr(attr, 1 + len);
+}
+
+/* convert the MS-MPPE-Send-Key and MS-MPPE-Recv-Key in a Microsoft VSA between
+ * the clear text key and the RADIUS/1.0 form (salt, encrypted length, key and padding) */
+int msmppeconvert(struct tlv *attr, uint8_t hide, uint8_t *secret, int secret_len, uint8_t *auth) {
+    uint8_t buf[RAD_Max_Attr_Value_Length], plain[RAD_Max_Attr_Value_Length], *p, *sub, *end;
+    int len, padded, ok = 0;
+
+    if (attr->l < 4 || !attrvalidate(attr->v + 4, attr->l - 4))
+        return 0;
+    memcpy(buf, attr->v, 4);
+    p = buf + 4;
+    end = attr->v + attr->l;
+    for (sub = attr->v + 4; sub < end; sub += ATTRLEN(sub)) {
+        if (ATTRTYPE(sub) != RAD_VS_ATTR_MS_MPPE_Send_Key && ATTRTYPE(sub) != RAD_VS_ATTR_MS_MPPE_Recv_Key) {
+            if (p + ATTRLEN(sub) > buf + sizeof(buf))
+                goto exit;
+            memcpy(p, sub, ATTRLEN(sub));
+            p += ATTRLEN(sub);
+            continue;
+        }
+        if (hide) {
+            len = ATTRVALLEN(sub);
+            padded = (len + 1 + 15) / 16 * 16;
+            if (p + 4 + padded > buf + sizeof(buf))
+                goto exit;
+            p[0] = ATTRTYPE(sub);
+            p[1] = 4 + padded;
+            if (!RAND_bytes(p + 2, 2))
+                goto exit;
+            p[2] |= 0x80;
+            memset(p + 4, 0, padded);
+            p[4] = len;
+            memcpy(p + 5, ATTRVAL(sub), len);
+            if (!msmppencrypt(p + 4, padded, secret, secret_len, auth, p + 2))
+                goto exit;
+        } else {
+            padded = ATTRVALLEN(sub) - 2;
+            if (ATTRVALLEN(sub) < 18 || padded % 16)
+                goto exit;
+            memcpy(plain, ATTRVAL(sub) + 2, padded);
+            if (!msmppdecrypt(plain, padded, secret, secret_len, auth, ATTRVAL(sub)))
+                goto exit;
+            len = plain[0];
+            if (len >= padded)
+                goto exit;
+            p[0] = ATTRTYPE(sub);
+            p[1] = 2 + len;
+            memcpy(p + 2, plain + 1, len);
+        }
+        p += ATTRLEN(p);
+    }
+    if (!resizeattr(attr, p - buf))
+        goto exit;
+    memcpy(attr->v, buf, p - buf);
+    ok = 1;
+
+exit:
+    if (!ok)
+        debug(DBG_WARN, "msmppeconvert: failed to convert msppe key");
+    memset(buf, 0, sizeof(buf));
+    memset(plain, 0, sizeof(plain));
+    return ok;
+}
+
 int rewriteusername(struct request *rq, struct tlv *attr) {
     char *orig = (char *)tlv2str(attr);
     if (!orig)
@@ -1047,16 +1517,15 @@ void char2hex(char *h, unsigned char c) {
 }
 
 uint8_t *radattr2ascii(struct tlv *attr) {
-    int i, l;
+    int i, l, run;
     uint8_t *a, *d;
 
     if (!attr)
         return NULL;
 
     l = attr->l;
-    for (i = 0; i < attr->l; i++)
-        if (attr->v[i] < 32 || attr->v[i] > 126)
-            l += 2;
+    for (i = printablespan(attr->v, attr->l); i < attr->l; i += 1 + printablespan(attr->v + i + 1, attr->l - i - 1))
+        l += 2;
     if (l == attr->l)
         return (uint8_t *)stringcopy((char *)attr->v, attr->l);
 
@@ -1065,13 +1534,17 @@ uint8_t *radattr2ascii(struct tlv *attr) {
         return NULL;
 
     d = a;
-    for (i = 0; i < attr->l; i++)
-        if (attr->v[i] < 32 || attr->v[i] > 126) {
-            *d++ = '%';
-            char2hex((char *)d, attr->v[i]);
-            d += 2;
-        } else
-            *d++ = attr->v[i];
+    for (i = 0; i < attr->l; i++) {
+        run = printablespan(attr->v + i, attr->l - i);
+        memcpy(d, attr->v + i, run);
+        d += run;
+        i += run;
+        if (i == attr->l)
+            break;
+        *d++ = '%';
+        char2hex((char *)d, attr->v[i]);
+        d += 2;
+    }
     *d = '\0';
     return a;
 }
@@ -1286,66 +1759,181 @@ exit:
     return server;
 }
 
+/* stamp a request as received now */
+void stamprq(struct request *rq) {
+    monotime(&rq->created);
+    if (flightrec_enabled())
+        rq->received = precisemicros();
+}
+
 struct request *newrequest(void) {
     struct request *rq;
 
-    rq = malloc(sizeof(struct request));
+    rq = alignedcalloc(CACHE_LINE, 1, sizeof(struct request));
     if (!rq) {
         debug(DBG_ERR, "newrequest: malloc failed");
         return NULL;
     }
-    memset(rq, 0, sizeof(struct request));
     rq->refcount = 1;
     pthread_mutex_init(&rq->refmutex, NULL);
-    gettimeofday(&rq->created, NULL);
+    stamprq(rq);
     return rq;
 }
 
 static void
 purgedupcache(struct client *client) {
-    struct request *r;
+    struct request **rqs = clientrqs(client), *r;
     struct timeval now;
     int i;
 
-    gettimeofday(&now, NULL);
-    for (i = 0; i < MAX_REQUESTS; i++) {
-        r = client->rqs[i];
-        if (r && now.tv_sec - r->created.tv_sec > r->from->conf->dupinterval) {
+    if (!rqs)
+        return;
+    monotime(&now);
+    for (i = 0; i < client->nrqs; i++) {
+        r = rqs[i];
+        if (r && now.tv_sec - r->created.tv_sec > client->conf->dupinterval) {
             removeclientrq(client, i);
         }
     }
 }
 
-int addclientrq(struct request *rq) {
+/* answer rq with a copy of the reply already sent for r on another connection */
+static void resendreplycopy(struct request *rq, struct request *r) {
+    rq->replybuf = malloc(r->replybuflen);
+    if (!rq->replybuf) {
+        debug(DBG_ERR, "resendreplycopy: malloc failed");
+        return;
+    }
+    memcpy(rq->replybuf, r->replybuf, r->replybuflen);
+    rq->replybuflen = r->replybuflen;
+    rqcharge(rq, rq->replybuflen);
+    sendreply(newrqref(rq));
+}
+
+/* Check the duplicate cache shared by all connections of the client's conf,
+ * keyed by client address and RADIUS id. Returns 1 if rq is new, 0 if it has
+ * been answered from the cache, joined to the outstanding request of a closed
+ * connection or is still outstanding on another open one. */
+static int addsharedrq(struct request *rq) {
+    struct clsrvconf *conf = rq->from->conf;
+    struct shareddup *e, *replace;
     struct request *r;
+    struct rqout *rqout;
     struct timeval now;
+    uint8_t addr[16];
     char tmp[INET6_ADDRSTRLEN];
+    int new = 1;
 
-    r = rq->from->rqs[rq->rqid];
+    pthread_mutex_lock(removeclientrqs_sendrq_freeserver_lock());
+    if (!conf->duprqs) {
+        conf->duprqs = calloc(SHAREDDUP_SIZE, sizeof(struct shareddup));
+        conf->dupclient = alignedcalloc(CACHE_LINE, 1, sizeof(struct client));
+        if (conf->dupclient)
+            conf->dupclient->addr = calloc(1, sizeof(struct sockaddr_storage));
+        if (!conf->duprqs || !conf->dupclient || !conf->dupclient->addr) {
+            debug(DBG_ERR, "addsharedrq: malloc failed");
+            if (conf->dupclient)
+                free(conf->dupclient->addr);
+            free(conf->dupclient);
+            free(conf->duprqs);
+            conf->dupclient = NULL;
+            conf->duprqs = NULL;
+            pthread_mutex_unlock(removeclientrqs_sendrq_freeserver_lock());
+            return 1;
+        }
+        conf->dupclient->conf = conf;
+        conf->dupclient->addr->sa_family = AF_INET;
+        conf->dupclient->nrqs = MAX_REQUESTS;
+    }
+
+    shareddupaddr(rq->from, addr);
+    e = shareddupfind(conf, addr, rq->rqid, &replace);
+    r = e ? e->rq : NULL;
+    monotime(&now);
+    if (r && r->from != rq->from && !memcmp(rq->rqauth, r->rqauth, 16) &&
+        now.tv_sec - r->created.tv_sec < conf->dupinterval) {
+        if (r->replybuf) {
+            debug(DBG_INFO, "addsharedrq: already sent reply to request with id %d from %s on another connection, resending", rq->rqid, addr2string(rq->from->addr, tmp, sizeof(tmp)));
+            clientrqs(rq->from)[rq->rqidx] = newrqref(rq);
+            resendreplycopy(rq, r);
+            new = 0;
+        } else if (r->from != conf->dupclient) {
+            /* the reply goes to the connection still waiting for it */
+            debug(DBG_INFO, "addsharedrq: already got request with id %d from %s on another connection, ignoring", rq->rqid, addr2string(rq->from->addr, tmp, sizeof(tmp)));
+            new = 0;
+        } else if (r->to) {
+            rqout = r->to->requests + r->newid;
+            pthread_mutex_lock(&rqout->lock);
+            if (rqout->rq == r) {
+                debug(DBG_INFO, "addsharedrq: request with id %d from %s is outstanding from a closed connection, joining", rq->rqid, addr2string(rq->from->addr, tmp, sizeof(tmp)));
+                r->from = rq->from;
+                clientrqs(rq->from)[rq->rqidx] = newrqref(r);
+                new = 0;
+            }
+            pthread_mutex_unlock(&rqout->lock);
+        }
+    }
+    if (new) {
+        if (!e)
+            e = replace;
+        freerq(e->rq);
+        e->rq = newrqref(rq);
+        memcpy(e->addr, addr, 16);
+        e->id = rq->rqid;
+    }
+    pthread_mutex_unlock(removeclientrqs_sendrq_freeserver_lock());
+    return new;
+}
+
+int addclientrq(struct request *rq) {
+    struct request **rqs = clientrqs(rq->from), *r;
+    struct timeval now;
+    char tmp[INET6_ADDRSTRLEN];
+
+    if (!rqs) {
+        /* LowMemory, allocate the dup cache once the client sends something */
+        pthread_mutex_lock(removeclientrqs_sendrq_freeserver_lock());
+        rqs = clientrqs(rq->from);
+        if (!rqs && (rqs = calloc(rq->from->nrqs, sizeof(struct request *))))
+            __atomic_store_n(&rq->from->rqs, rqs, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(removeclientrqs_sendrq_freeserver_lock());
+        if (!rqs) {
+            debug(DBG_ERR, "addclientrq: malloc failed");
+            return 0;
+        }
+    }
+    r = rqs[rq->rqidx];
     if (r) {
         if (!memcmp(rq->rqauth, r->rqauth, 16)) {
-            gettimeofday(&now, NULL);
-            if (now.tv_sec - r->created.tv_sec < r->from->conf->dupinterval) {
+            monotime(&now);
+            if (now.tv_sec - r->created.tv_sec < rq->from->conf->dupinterval) {
                 if (r->replybuf) {
-                    debug(DBG_INFO, "addclientrq: already sent reply to request with id %d from %s, resending", rq->rqid, addr2string(r->from->addr, tmp, sizeof(tmp)));
-                    sendreply(newrqref(r));
+                    debug(DBG_INFO, "addclientrq: already sent reply to request with id %d from %s, resending", rq->rqid, addr2string(rq->from->addr, tmp, sizeof(tmp)));
+                    if (r->from == rq->from)
+                        sendreply(newrqref(r));
+                    else
+                        resendreplycopy(rq, r);
                 } else
-                    debug(DBG_INFO, "addclientrq: already got request with id %d from %s, ignoring", rq->rqid, addr2string(r->from->addr, tmp, sizeof(tmp)));
+                    debug(DBG_INFO, "addclientrq: already got request with id %d from %s, ignoring", rq->rqid, addr2string(rq->from->addr, tmp, sizeof(tmp)));
                 return 0;
             }
         }
-        removeclientrq(rq->from, rq->rqid);
+        removeclientrq(rq->from, rq->rqidx);
     }
-    rq->from->rqs[rq->rqid] = newrqref(rq);
+    if (rq->from->conf->shareddupcache && !rq->from->radius11 && !addsharedrq(rq))
+        return 0;
+    rqs[rq->rqidx] = newrqref(rq);
     return 1;
 }
 
-void rmclientrq(struct request *rq, uint8_t id) {
-    struct request *r;
+void rmclientrq(struct request *rq) {
+    struct request **rqs, *r;
 
-    r = rq->from->rqs[id];
+    if (!rq->from || !(rqs = clientrqs(rq->from)))
+        return;
+    r = rqs[rq->rqidx];
     if (r) {
-        rq->from->rqs[id] = NULL;
+        rqs[rq->rqidx] = NULL;
         rq->from = NULL;
         freerq(r);
     }
@@ -1410,6 +1998,38 @@ static int ensuremsgauthfront(struct radmsg *msg) {
     return 1;
 }
 
+/* called by the accounting sink writer once the record of rq is written */
+static void acctsinkdone(void *arg, int ok) {
+    struct request *rq = (struct request *)arg;
+
+    pthread_mutex_lock(removeclientrqs_sendrq_freeserver_lock());
+    rq->insink = 0;
+    if (ok && rq->from)
+        respond(rq, RAD_Accounting_Response, NULL, 0);
+    else
+        recordrq(rq, FLIGHTREC_DROPPED, 0);
+    pthread_mutex_unlock(removeclientrqs_sendrq_freeserver_lock());
+    freerq(rq);
+}
+
+/* terminate an accounting request in the accounting sink of its realm */
+static void tosink(struct request *rq, struct realm *realm) {
+    int r;
+
+    pthread_mutex_lock(removeclientrqs_sendrq_freeserver_lock());
+    rq->insink = 1;
+    pthread_mutex_unlock(removeclientrqs_sendrq_freeserver_lock());
+    r = acctsink_write(realm->acctsink, rq->msg, rq->from->conf->name, realm->name, newrqref(rq));
+    if (r == ACCTSINK_PENDING)
+        return;
+    pthread_mutex_lock(removeclientrqs_sendrq_freeserver_lock());
+    rq->insink = 0;
+    pthread_mutex_unlock(removeclientrqs_sendrq_freeserver_lock());
+    freerq(rq);
+    if (r == ACCTSINK_BUFFERED)
+        respond(rq, RAD_Accounting_Response, NULL, 0);
+}
+
 /* Called from server readers, handling incoming requests from
  * clients. */
 /* returns 0 if validation/authentication fails, else 1 */
@@ -1423,7 +2043,21 @@ int radsrv(struct request *rq) {
     int ttlres;
     char tmp[INET6_ADDRSTRLEN];
 
-    msg = buf2radmsg(rq->buf, rq->buflen, from->conf->secret, from->conf->secret_len, NULL);
+    rq->rqcode = rq->buf[0];
+    rq->rqid = rq->buf[1];
+    if (!membudget_admit(rq->buf, rq->buflen)) {
+        debug(DBG_DBG, "radsrv: memory budget exceeded, dropping request from %s", from->conf->name);
+        recordrq(rq, FLIGHTREC_SHED, 0);
+        freerq(rq);
+        return 1;
+    }
+    /* the received and later the re-encoded packet, and the decoded message */
+    rqcharge(rq, sizeof(struct request) + 2 * rq->buflen);
+
+    if (from->radius11)
+        msg = buf2radmsg(rq->buf, rq->buflen, NULL, 0, NULL);
+    else
+        msg = buf2radmsg(rq->buf, rq->buflen, from->conf->secret, from->conf->secret_len, NULL);
     memset(rq->buf, 0, rq->buflen);
     free(rq->buf);
     rq->buf = NULL;
@@ -1431,6 +2065,7 @@ int radsrv(struct request *rq) {
     if (!msg || msg->msgauthinvalid) {
         debug(DBG_NOTICE, "radsrv: ignoring request from %s (%s), validation failed.", from->conf->name, addr2string(from->addr, tmp, sizeof(tmp)));
         radmsg_free(msg);
+        recordrq(rq, FLIGHTREC_DROPPED, 0);
         freerq(rq);
         return 0;
     }
@@ -1438,6 +2073,13 @@ int radsrv(struct request *rq) {
     rq->msg = msg;
     rq->rqid = msg->id;
     memcpy(rq->rqauth, msg->auth, 16);
+    if (from->radius11) {
+        uint32_t token;
+        memcpy(&token, msg->auth, 4);
+        rq->rqidx = ntohl(token) % from->nrqs;
+        removemsgauth(msg);
+    } else
+        rq->rqidx = msg->id;
 
     debug(DBG_DBG, "radsrv: code %d, id %d", msg->code, msg->id);
     if (msg->code == RAD_Disconnect_Request) {
@@ -1454,14 +2096,32 @@ int radsrv(struct request *rq) {
     }
 
     purgedupcache(from);
-    if (!addclientrq(rq))
+    if (!addclientrq(rq)) {
+        recordrq(rq, FLIGHTREC_DUPLICATE, 0);
         goto exit;
+    }
 
     if (msg->code == RAD_Status_Server) {
         respond(rq, RAD_Access_Accept, NULL, 1);
         goto exit;
     }
 
+    if (msg->code == RAD_Accounting_Request && acctdupcache &&
+        acctdup_key(msg, options.acctduptypes, options.acctduptypecount, rq->acctkey)) {
+        rq->hasacctkey = 1;
+        if (acctdup_seen(acctdupcache, rq->acctkey, monosec())) {
+            uint32_t hits;
+
+            pthread_mutex_lock(from->conf->lock);
+            hits = ++from->conf->acctduphits;
+            pthread_mutex_unlock(from->conf->lock);
+            debug(DBG_INFO, "radsrv: duplicate accounting request (id %d) from client %s (%s), responding locally (%u duplicates from this client)",
+                  msg->id, from->conf->name, addr2string(from->addr, tmp, sizeof(tmp)), hits);
+            respond(rq, RAD_Accounting_Response, NULL, 0);
+            goto exit;
+        }
+    }
+
     /* below: code == RAD_Access_Request || code == RAD_Accounting_Request */
 
     if ((from->conf->reqmsgauth || from->conf->reqmsgauthproxy) && (from->conf->type == RAD_UDP || from->conf->type == RAD_TCP) &&
@@ -1514,6 +2174,12 @@ int radsrv(struct request *rq) {
         debug(DBG_INFO, "radsrv: ignoring request, don't know where to send it");
         goto exit;
     }
+    rq->realm = slotsrealm(realm);
+
+    if (realm->acctsink && msg->code == RAD_Accounting_Request) {
+        tosink(rq, realm);
+        goto exit;
+    }
 
     if (!to) {
         if (realm->message && msg->code == RAD_Access_Request) {
@@ -1533,11 +2199,18 @@ int radsrv(struct request *rq) {
         goto exit;
     }
 
+    /* rewriteOut of the server may change User-Name, failoverrq needs the
+     * one the realm was found by */
+    if (to->conf->failoverrqs && !(rq->routeuser = (char *)tlv2str(attr))) {
+        debug(DBG_ERR, "radsrv: malloc failed");
+        goto rmclrqexit;
+    }
+
     /* If there is a CHAP-Password attribute but no CHAP-Challenge
      * one, create a CHAP-Challenge containing the Request
      * Authenticator because that's what the CHAP-Password is based
      * on. */
-    attr = radmsg_gettype(msg, RAD_Attr_CHAP_Password);
+    attr = from->radius11 ? NULL : radmsg_gettype(msg, RAD_Attr_CHAP_Password);
     if (attr) {
         debug(DBG_DBG, "%s: found CHAP-Password with value length %d", __func__,
               attr->l);
@@ -1555,8 +2228,9 @@ int radsrv(struct request *rq) {
         }
     }
 
-    /* Create new Request Authenticator. */
-    if (msg->code == RAD_Accounting_Request)
+    /* Create new Request Authenticator, a RADIUS/1.1 Token is set when queued. */
+    rq->radius11 = to->radius11;
+    if (rq->radius11 || msg->code == RAD_Accounting_Request)
         memset(msg->auth, 0, 16);
     else if (!RAND_bytes(msg->auth, 16)) {
         debug(DBG_WARN, "radsrv: failed to generate random auth");
@@ -1570,14 +2244,20 @@ int radsrv(struct request *rq) {
     attr = radmsg_gettype(msg, RAD_Attr_User_Password);
     if (attr) {
         debug(DBG_DBG, "radsrv: found userpwdattr with value length %d", attr->l);
-        if (!pwdrecrypt(attr->v, attr->l, from->conf->secret, from->conf->secret_len, to->conf->secret, to->conf->secret_len, rq->rqauth, msg->auth, NULL, 0, NULL, 0))
+        if (from->radius11 && !rq->radius11) {
+            if (!pwdhide(attr, to->conf->secret, to->conf->secret_len, msg->auth))
+                goto rmclrqexit;
+        } else if (!from->radius11 && rq->radius11) {
+            if (!pwdreveal(attr, from->conf->secret, from->conf->secret_len, rq->rqauth))
+                goto rmclrqexit;
+        } else if (!rq->radius11 && !pwdrecrypt(attr->v, attr->l, from->conf->secret, from->conf->secret_len, to->conf->secret, to->conf->secret_len, rq->rqauth, msg->auth, NULL, 0, NULL, 0))
             goto rmclrqexit;
     }
 
     if (to->conf->rewriteout && !dorewrite(msg, to->conf->rewriteout))
         goto rmclrqexit;
 
-    if (msg->code == RAD_Access_Request &&
+    if (msg->code == RAD_Access_Request && !rq->radius11 &&
         !ensuremsgauthfront(msg))
         goto rmclrqexit;
 
@@ -1592,8 +2272,10 @@ int radsrv(struct request *rq) {
     return 1;
 
 rmclrqexit:
-    rmclientrq(rq, msg->id);
+    rmclientrq(rq);
 exit:
+    if (!rq->insink)
+        recordrq(rq, FLIGHTREC_DROPPED, 0);
     freerq(rq);
     free(userascii);
     if (realm) {
@@ -1603,7 +2285,151 @@ exit:
     return 1;
 }
 
-/** Called from client readers if waiting for packets times out
+/* The connected server with the fewest lost requests among srvconfs that rq,
+ * outstanding at failed, can be moved to. The message was already prepared for
+ * failed, so only servers with the same RADIUS version and rewriteOut qualify,
+ * and loop prevention applies as in radsrv. */
+struct server *failoverserver(struct list *srvconfs, struct server *failed, struct request *rq) {
+    struct list_node *entry;
+    struct clsrvconf *conf;
+    struct server *server, *best = NULL;
+    uint8_t bestlostrqs = 0;
+
+    for (entry = list_first(srvconfs); entry; entry = list_next(entry)) {
+        conf = (struct clsrvconf *)entry->data;
+        server = conf->servers;
+        if (!server || server == failed || conf->rewriteout != failed->conf->rewriteout)
+            continue;
+        if ((conf->loopprevention == 1 || (conf->loopprevention == UCHAR_MAX && options.loopprevention == 1)) &&
+            !strcmp(rq->from->conf->name, conf->name))
+            continue;
+        pthread_mutex_lock(&server->lock);
+        if (server->state == RSP_SERVER_STATE_CONNECTED && server->radius11 == rq->radius11 &&
+            (!best || server->lostrqs < bestlostrqs)) {
+            best = server;
+            bestlostrqs = server->lostrqs;
+        }
+        pthread_mutex_unlock(&server->lock);
+    }
+    return best;
+}
+
+/* Send a request that was outstanding at failed to another server of its realm,
+ * see failoverserver(). The password is re-encrypted for the new secret and the
+ * rest is re-encoded by sendrq. The realm is found by the
+ * User-Name radsrv routed the request by, as rewriteOut may have changed it.
+ * Consumes the reference on success, returns 0 and leaves rq untouched if
+ * there is no other server. */
+static int failoverrq(struct request *rq, struct server *failed) {
+    struct radmsg *msg = rq->msg;
+    struct realm *realm;
+    struct server *to;
+    struct tlv *attr;
+
+    if (!rq->routeuser)
+        return 0;
+    /* returns with lock on realm, kept until the request is queued as in radsrv */
+    realm = id2realm(realms, rq->routeuser);
+    if (!realm)
+        return 0;
+    to = failoverserver(msg->code == RAD_Accounting_Request ? realm->accsrvconfs : realm->srvconfs, failed, rq);
+    if (!to)
+        goto errexit;
+
+    attr = rq->radius11 ? NULL : radmsg_gettype(msg, RAD_Attr_User_Password);
+    if (attr && !pwdrecrypt(attr->v, attr->l, failed->conf->secret, failed->conf->secret_len, to->conf->secret, to->conf->secret_len, msg->auth, msg->auth, NULL, 0, NULL, 0))
+        goto errexit;
+    /* the Request Authenticator of accounting requests is computed from the zeroed field */
+    if (!rq->radius11 && msg->code == RAD_Accounting_Request)
+        memset(msg->auth, 0, 16);
+
+    debug(DBG_DBG, "failoverrq: moving request for %s from server %s to %s", realm->name, failed->conf->name, to->conf->name);
+    rq->to = to;
+    sendrq(rq);
+    pthread_mutex_unlock(&realm->mutex);
+    freerealm(realm);
+    return 1;
+
+errexit:
+    pthread_mutex_unlock(&realm->mutex);
+    freerealm(realm);
+    return 0;
+}
+
+/* Move the requests outstanding at a server that lost its connection to other
+ * servers instead of waiting for the reconnect. Later rounds of an EAP
+ * conversation carry State, which only the failed server can make sense of,
+ * they stay and are resent after reconnecting. */
+static void failoverrqs(struct server *server) {
+    struct rqout *rqout;
+    struct request *rq;
+    uint8_t *buf;
+    int i, moved = 0;
+
+    for (i = 0; i < server->nrequests; i++) {
+        rqout = server->requests + i;
+        if (!rqout->rq)
+            continue;
+        pthread_mutex_lock(&rqout->lock);
+        rq = rqout->rq;
+        if (!rq || !rq->msg || !rq->from || rq->msg->code == RAD_Status_Server ||
+            radmsg_gettype(rq->msg, RAD_Attr_State)) {
+            pthread_mutex_unlock(&rqout->lock);
+            continue;
+        }
+        /* take over the reference of rqout, sendrq must not be called with rqout->lock held */
+        rqout->rq = NULL;
+        realmslotsadd(server, rq, -1);
+        rqout->tries = 0;
+        rqout->expiry = 0;
+        buf = rq->buf;
+        rq->buf = NULL;
+        pthread_mutex_unlock(&rqout->lock);
+
+        if (failoverrq(rq, server)) {
+            free(buf);
+            moved++;
+            continue;
+        }
+        pthread_mutex_lock(&rqout->lock);
+        rq->buf = buf;
+        if (!rqout->rq) {
+            rqout->rq = rq;
+            realmslotsadd(server, rq, 1);
+        } else
+            freerq(rq);
+        pthread_mutex_unlock(&rqout->lock);
+    }
+    if (moved) {
+        server->failovers += moved;
+        debug(DBG_NOTICE, "failoverrqs: moved %d outstanding requests from server %s to other servers (%u in total)", moved, server->conf->name, server->failovers);
+    }
+}
+
+/* a standby server is ready while connected and answering status server */
+static uint8_t standbyready(struct server *server) {
+    uint8_t ready;
+
+    pthread_mutex_lock(&server->lock);
+    ready = server->state == RSP_SERVER_STATE_CONNECTED && !server->lostrqs;
+    pthread_mutex_unlock(&server->lock);
+    return ready;
+}
+
+/* log when a standby server becomes usable or stops being usable */
+static void standbystate(struct server *server, uint8_t lost) {
+    uint8_t ready;
+
+    if (!server->conf->standby)
+        return;
+    ready = !lost && standbyready(server);
+    if (ready == server->standbyready)
+        return;
+    server->standbyready = ready;
+    debug(ready ? DBG_NOTICE : DBG_WARN, "standby server %s is %s", server->conf->name, ready ? "ready" : "not ready");
+}
+
+/** Called from the upstream reactor if waiting for packets times out
  * return 0 if client should continue waiting
  *        1 if client should close the connection and exit
 */
@@ -1617,14 +2443,17 @@ int timeouth(struct server *server) {
 
     if (unresponsive) {
         debug(DBG_WARN, "timeouth: server %s did not respond to status server, closing connection.", server->conf->name);
+        standbystate(server, 1);
+        if (server->conf->failoverrqs)
+            failoverrqs(server);
 
         if (server->dynamiclookuparg)
             return 1;
         if (server->conf->pdef->connecter)
-            server->conf->pdef->connecter(server, 0, 1);
+            upstreamreconnect(server);
         return 0;
     } else if (server->dynamiclookuparg) {
-        gettimeofday(&now, NULL);
+        monotime(&now);
         if (now.tv_sec - server->lastreply.tv_sec > IDLE_TIMEOUT) {
             debug(DBG_INFO, "timeouth: idle timeout for server %s (%s)", server->conf->name, server->dynamiclookuparg);
             return 1;
@@ -1634,20 +2463,23 @@ int timeouth(struct server *server) {
     return 0;
 }
 
-/** Called from client readers if connection is lost 
+/** Called from the upstream reactor if connection is lost
  * return 0 if client should retry receiving packets
  *        1 if client should clean up and exit
 */
 int closeh(struct server *server) {
     debug(DBG_WARN, "closeh: connection to server %s lost", server->conf->name);
+    standbystate(server, 1);
+    if (server->conf->failoverrqs)
+        failoverrqs(server);
     if (!server->dynamiclookuparg && server->conf->pdef->connecter) {
-        server->conf->pdef->connecter(server, 0, 1);
+        upstreamreconnect(server);
         return 0;
     }
     return 1;
 }
 
-/* Called from client readers, handling replies from servers. */
+/* Called from the upstream reactor and the UDP client reader, handling replies from servers. */
 /* returns 0 if validation/authentication fails, else 1 */
 int replyh(struct server *server, uint8_t *buf, int len) {
     struct client *from;
@@ -1663,15 +2495,33 @@ int replyh(struct server *server, uint8_t *buf, int len) {
     server->lostrqs = 0;
     pthread_mutex_unlock(&server->lock);
 
-    rqout = server->requests + buf[1];
-    pthread_mutex_lock(rqout->lock);
-    msg = buf2radmsg(buf, len, server->conf->secret, server->conf->secret_len, rqout->rq ? rqout->rq->msg->auth : NULL);
+    if (server->radius11) {
+        uint32_t token;
+        memcpy(&token, buf + 4, 4);
+        rqout = server->requests + (ntohl(token) & (server->nrequests - 1));
+        pthread_mutex_lock(&rqout->lock);
+        /* a reply to an earlier request in the same slot */
+        if (rqout->rq && rqout->rq->buf && memcmp(rqout->rq->buf + 4, buf + 4, 4)) {
+            debug(DBG_INFO, "replyh: no outstanding request with this token from server %s, ignoring reply", server->conf->name);
+            memset(buf, 0, len);
+            free(buf);
+            pthread_mutex_unlock(&rqout->lock);
+            return 1;
+        }
+        msg = buf2radmsg(buf, len, NULL, 0, NULL);
+        if (msg)
+            removemsgauth(msg);
+    } else {
+        rqout = server->requests + buf[1];
+        pthread_mutex_lock(&rqout->lock);
+        msg = buf2radmsg(buf, len, server->conf->secret, server->conf->secret_len, rqout->rq ? rqout->rq->msg->auth : NULL);
+    }
     memset(buf, 0, len);
     free(buf);
     buf = NULL;
     if (!msg) {
         debug(DBG_NOTICE, "replyh: message decode/validation error from server %s", server->conf->name);
-        pthread_mutex_unlock(rqout->lock);
+        pthread_mutex_unlock(&rqout->lock);
         return 0;
     }
 
@@ -1689,7 +2539,7 @@ int replyh(struct server *server, uint8_t *buf, int len) {
     if (msg->msgauthinvalid) {
         debug(DBG_WARN, "replyh: message-authenticator invalid from server %s", server->conf->name);
         radmsg_free(msg);
-        pthread_mutex_unlock(rqout->lock);
+        pthread_mutex_unlock(&rqout->lock);
         return 0;
     }
 
@@ -1702,7 +2552,7 @@ int replyh(struct server *server, uint8_t *buf, int len) {
     }
     debug(DBG_DBG, "got %s message with id %d", radmsgtype2string(msg->code), msg->id);
 
-    gettimeofday(&server->lastrcv, NULL);
+    monotime(&server->lastrcv);
 
     if (rqout->rq->msg->code == RAD_Status_Server) {
         freerqoutdata(rqout);
@@ -1712,7 +2562,7 @@ int replyh(struct server *server, uint8_t *buf, int len) {
         goto errunlock;
     }
 
-    gettimeofday(&server->lastreply, NULL);
+    monotime(&server->lastreply);
 
     if (server->conf->rewritein && !dorewrite(msg, server->conf->rewritein)) {
         debug(DBG_INFO, "replyh: rewritein failed");
@@ -1739,11 +2589,17 @@ int replyh(struct server *server, uint8_t *buf, int len) {
 
         sublen = attr->l - 4;
         subattrs = attr->v + 4;
-        if (!attrvalidate(subattrs, sublen) ||
-            !msmppe(subattrs, sublen, RAD_VS_ATTR_MS_MPPE_Send_Key, "MS MPPE Send Key",
-                    rqout->rq, server->conf->secret, server->conf->secret_len, from->conf->secret, from->conf->secret_len) ||
-            !msmppe(subattrs, sublen, RAD_VS_ATTR_MS_MPPE_Recv_Key, "MS MPPE Recv Key",
-                    rqout->rq, server->conf->secret, server->conf->secret_len, from->conf->secret, from->conf->secret_len))
+        if (!attrvalidate(subattrs, sublen))
+            break;
+        if (server->radius11 != from->radius11) {
+            if (server->radius11 ? !msmppeconvert(attr, 1, from->conf->secret, from->conf->secret_len, rqout->rq->rqauth)
+                                 : !msmppeconvert(attr, 0, server->conf->secret, server->conf->secret_len, rqout->rq->buf + 4))
+                break;
+        } else if (!server->radius11 &&
+                   (!msmppe(subattrs, sublen, RAD_VS_ATTR_MS_MPPE_Send_Key, "MS MPPE Send Key",
+                            rqout->rq, server->conf->secret, server->conf->secret_len, from->conf->secret, from->conf->secret_len) ||
+                    !msmppe(subattrs, sublen, RAD_VS_ATTR_MS_MPPE_Recv_Key, "MS MPPE Recv Key",
+                            rqout->rq, server->conf->secret, server->conf->secret_len, from->conf->secret, from->conf->secret_len)))
             break;
     }
     if (node) {
@@ -1753,7 +2609,12 @@ int replyh(struct server *server, uint8_t *buf, int len) {
 
     /* reencrypt tunnel-password RFC2868 */
     attr = radmsg_gettype(msg, RAD_Attr_Tunnel_Password);
-    if (attr && msg->code == RAD_Access_Accept) {
+    if (attr && msg->code == RAD_Access_Accept && server->radius11 != from->radius11) {
+        debug(DBG_DBG, "replyh: found tunnelpwdattr with value length %d", attr->l);
+        if (server->radius11 ? !tunnelpwdhide(attr, from->conf->secret, from->conf->secret_len, rqout->rq->rqauth)
+                             : !tunnelpwdreveal(attr, server->conf->secret, server->conf->secret_len, rqout->rq->msg->auth))
+            goto errunlock;
+    } else if (attr && msg->code == RAD_Access_Accept && !server->radius11) {
         uint8_t newsalt[2];
         debug(DBG_DBG, "replyh: found tunnelpwdattr with value length %d", attr->l);
         if (!RAND_bytes(newsalt, 2))
@@ -1788,7 +2649,7 @@ int replyh(struct server *server, uint8_t *buf, int len) {
     }
 
     if ((msg->code == RAD_Access_Challenge || msg->code == RAD_Access_Accept || msg->code == RAD_Access_Reject) &&
-        !ensuremsgauthfront(msg))
+        !from->radius11 && !ensuremsgauthfront(msg))
         goto errunlock;
 
     if (ttlres == -1 && (options.addttl || from->conf->addttl))
@@ -1800,12 +2661,12 @@ int replyh(struct server *server, uint8_t *buf, int len) {
     rqout->rq->msg = msg;
     sendreply(newrqref(rqout->rq));
     freerqoutdata(rqout);
-    pthread_mutex_unlock(rqout->lock);
+    pthread_mutex_unlock(&rqout->lock);
     return 1;
 
 errunlock:
     radmsg_free(msg);
-    pthread_mutex_unlock(rqout->lock);
+    pthread_mutex_unlock(&rqout->lock);
     return 1;
 }
 
@@ -1840,219 +2701,246 @@ static void incrementlostrqs(struct server *server) {
     pthread_mutex_unlock(&server->lock);
 }
 
-/* code for removing state not finished */
-void *clientwr(void *arg) {
-    struct server *server = (struct server *)arg;
-    struct rqout *rqout = NULL;
-    pthread_t clientrdth;
-    int i;
-    time_t secs;
-    uint8_t rnd, do_resend = 0, statusserver_requested = 0;
-    struct timeval now, laststatsrv;
-    struct timespec timeout;
-    struct request *statsrvrq;
+/** Set up a new server: dynamic lookup, resolving and the initial connection.
+ * Runs in a helper thread of the upstream reactor, it may block for a long time.
+ * return 1 if the server is up
+ *        0 if it should be removed
+ *       -1 if it should be removed after FAILED_SERVER_HOLD seconds
+ */
+int clientwrstart(struct server *server) {
     struct clsrvconf *conf;
 
     assert(server);
     conf = server->conf;
 
-#define ZZZ 900
-
     if (server->state != RSP_SERVER_STATE_BLOCKING_STARTUP)
         server->state = RSP_SERVER_STATE_STARTUP;
     if (!conf->hostports && server->dynamiclookuparg && !dynamicconfig(server)) {
         server->state = RSP_SERVER_STATE_FAILING;
         debug(DBG_WARN, "%s: dynamicconfig(%s: %s) failed, Not trying again for %ds",
-              __func__, server->conf->name, server->dynamiclookuparg, ZZZ);
-        goto errexitwait;
+              __func__, server->conf->name, server->dynamiclookuparg, FAILED_SERVER_HOLD);
+        return -1;
     }
-    /* FIXME: Is resolving not always done by compileserverconfig(),
-     * either as part of static configuration setup or by
-     * dynamicconfig() above?  */
+    /* static servers are resolved at startup, this resolves servers set up by dynamicconfig() */
     if (!resolvehostports(conf->hostports, conf->hostaf, conf->pdef->socktype)) {
-        debug(DBG_WARN, "%s: resolve failed, Not trying again for %ds", __func__, ZZZ);
+        debug(DBG_WARN, "%s: resolve failed, Not trying again for %ds", __func__, FAILED_SERVER_HOLD);
         server->state = RSP_SERVER_STATE_FAILING;
-        goto errexitwait;
+        return -1;
     }
 
-    memset(&timeout, 0, sizeof(struct timespec));
-
-    gettimeofday(&server->lastreply, NULL);
+    monotime(&server->lastreply);
     server->lastrcv = server->lastreply;
-    laststatsrv = server->lastreply;
+    server->laststatsrv = server->lastreply;
 
     if (conf->pdef->connecter) {
         if (!conf->pdef->connecter(server, server->dynamiclookuparg ? 5 : 0, 0)) {
             server->state = RSP_SERVER_STATE_FAILING;
             if (server->dynamiclookuparg) {
-                debug(DBG_WARN, "%s: connect failed, giving up. Not trying again for %ds", __func__, ZZZ);
-                goto errexitwait;
+                debug(DBG_WARN, "%s: connect failed, giving up. Not trying again for %ds", __func__, FAILED_SERVER_HOLD);
+                return -1;
             }
-            goto errexit;
-        }
-        if (pthread_create(&clientrdth, &pthread_attr, conf->pdef->clientconnreader, (void *)server)) {
-            debugerrno(errno, DBG_ERR, "clientwr: pthread_create failed");
-            server->state = RSP_SERVER_STATE_FAILING;
-            goto errexit;
+            return 0;
         }
     }
     server->state = RSP_SERVER_STATE_CONNECTED;
+    return 1;
+}
 
-    for (;;) {
-        pthread_mutex_lock(&server->newrq_mutex);
-        if (!server->newrq) {
-            gettimeofday(&now, NULL);
-            /* random 0-7 seconds */
-            RAND_bytes(&rnd, 1);
-            rnd /= 32;
-            if (conf->statusserver != RSP_STATSRV_OFF) {
-                secs = server->lastrcv.tv_sec > laststatsrv.tv_sec ? server->lastrcv.tv_sec : laststatsrv.tv_sec;
-                if (now.tv_sec - secs > STATUS_SERVER_PERIOD)
-                    secs = now.tv_sec;
-                if (!timeout.tv_sec || timeout.tv_sec > secs + STATUS_SERVER_PERIOD + rnd)
-                    timeout.tv_sec = secs + STATUS_SERVER_PERIOD + rnd;
-            } else {
-                if (!timeout.tv_sec || timeout.tv_sec > now.tv_sec + STATUS_SERVER_PERIOD + rnd)
-                    timeout.tv_sec = now.tv_sec + STATUS_SERVER_PERIOD + rnd;
-            }
-#if 0
-	    if (timeout.tv_sec > now.tv_sec)
-		debug(DBG_DBG, "clientwr: waiting up to %ld secs for new request", timeout.tv_sec - now.tv_sec);
-#endif
-            pthread_cond_timedwait(&server->newrq_cond, &server->newrq_mutex, &timeout);
-            timeout.tv_sec = 0;
-        }
-        if (server->newrq) {
-            debug(DBG_DBG, "clientwr: got new request");
-            server->newrq = 0;
-        }
-        if (server->conreset) {
-            debug(DBG_DBG, "clientwr: connection reset; resending all outstanding requests");
-            do_resend = 1;
-            server->conreset = 0;
-            gettimeofday(&server->lastrcv, NULL);
-        }
-#if 0
-	else
-	    debug(DBG_DBG, "clientwr: request timer expired, processing request queue");
-#endif
-        pthread_mutex_unlock(&server->newrq_mutex);
+/** Process the request queue of a server: send new requests, retransmit
+ * or expire old ones and send status server requests when due.
+ * Called from the upstream reactor when the server is signalled or the
+ * time returned by the previous call has been reached.
+ * return the time of the next call
+ */
+time_t clientwrrun(struct server *server) {
+    struct rqout *rqout = NULL;
+    int i;
+    time_t secs;
+    uint8_t rnd, do_resend = 0;
+    struct timeval now;
+    time_t timeout = 0;
+    struct request *statsrvrq;
+    struct clsrvconf *conf = server->conf;
 
-        if (do_resend || server->lastrcv.tv_sec > laststatsrv.tv_sec)
-            statusserver_requested = 0;
+    standbystate(server, 0);
 
-        for (i = 0; i < MAX_REQUESTS; i++) {
-            if (server->clientrdgone) {
-                server->state = RSP_SERVER_STATE_FAILING;
-                if (conf->pdef->connecter)
-                    pthread_join(clientrdth, NULL);
-                goto errexit;
-            }
+    pthread_mutex_lock(&server->newrq_mutex);
+    if (server->newrq) {
+        debug(DBG_DBG, "clientwrrun: got new request");
+        server->newrq = 0;
+    }
+    if (server->conreset) {
+        debug(DBG_DBG, "clientwrrun: connection reset; resending all outstanding requests");
+        do_resend = 1;
+        server->conreset = 0;
+        monotime(&server->lastrcv);
+    }
+    pthread_mutex_unlock(&server->newrq_mutex);
 
-            for (; i < MAX_REQUESTS; i++) {
-                rqout = server->requests + i;
-                if (rqout->rq) {
-                    pthread_mutex_lock(rqout->lock);
-                    if (rqout->rq)
-                        break;
-                    pthread_mutex_unlock(rqout->lock);
-                }
+    if (do_resend || server->lastrcv.tv_sec > server->laststatsrv.tv_sec)
+        server->statsrvrequested = 0;
+
+    for (i = 0; i < server->nrequests; i++) {
+        for (; i < server->nrequests; i++) {
+            rqout = server->requests + i;
+            if (rqout->rq) {
+                pthread_mutex_lock(&rqout->lock);
+                if (rqout->rq)
+                    break;
+                pthread_mutex_unlock(&rqout->lock);
             }
+        }
 
-            if (i == MAX_REQUESTS)
-                break;
+        if (i == server->nrequests)
+            break;
 
-            gettimeofday(&now, NULL);
-            if (do_resend) {
-                if (rqout->tries > 0)
-                    rqout->tries--;
-            } else if (now.tv_sec < rqout->expiry.tv_sec) {
-                if (!timeout.tv_sec || rqout->expiry.tv_sec < timeout.tv_sec)
-                    timeout.tv_sec = rqout->expiry.tv_sec;
-                pthread_mutex_unlock(rqout->lock);
-                continue;
-            }
+        monotime(&now);
+        if (do_resend) {
+            if (rqout->tries > 0)
+                rqout->tries--;
+        } else if (now.tv_sec < rqout->expiry) {
+            if (!timeout || rqout->expiry < timeout)
+                timeout = rqout->expiry;
+            pthread_mutex_unlock(&rqout->lock);
+            continue;
+        }
 
-            if (rqout->tries > 0 && now.tv_sec - server->lastrcv.tv_sec > conf->retryinterval && !do_resend)
-                statusserver_requested = 1;
-            if (do_resend && *rqout->rq->buf == RAD_Status_Server) {
-                freerqoutdata(rqout);
-                pthread_mutex_unlock(rqout->lock);
-                continue;
-            }
-            if (rqout->tries == (*rqout->rq->buf == RAD_Status_Server ? 1 : conf->retrycount + 1)) {
-                debug(DBG_DBG, "clientwr: removing expired packet from queue");
-                replylog(rqout->rq->msg, server, rqout->rq);
-                if (conf->statusserver == RSP_STATSRV_ON || conf->statusserver == RSP_STATSRV_MINIMAL) {
-                    if (*rqout->rq->buf == RAD_Status_Server) {
-                        debug(DBG_WARN, "clientwr: no status server response, %s dead?", conf->name);
-                        incrementlostrqs(server);
+        if (rqout->tries > 0 && now.tv_sec - server->lastrcv.tv_sec > conf->retryinterval && !do_resend)
+            server->statsrvrequested = 1;
+        if (do_resend && *rqout->rq->buf == RAD_Status_Server) {
+            freerqoutdata(rqout);
+            pthread_mutex_unlock(&rqout->lock);
+            continue;
+        }
+        if (rqout->rq->radius11 != server->radius11) {
+            debug(DBG_INFO, "clientwrrun: RADIUS version of server %s changed, dropping request", conf->name);
+            rmclientrq(rqout->rq);
+            freerqoutdata(rqout);
+            pthread_mutex_unlock(&rqout->lock);
+            continue;
+        }
+        if (rqout->tries == (*rqout->rq->buf == RAD_Status_Server ? 1 : conf->retrycount + 1)) {
+            debug(DBG_DBG, "clientwrrun: removing expired packet from queue");
+            replylog(rqout->rq->msg, server, rqout->rq);
+            recordrq(rqout->rq, FLIGHTREC_TIMEOUT, 0);
+            if (conf->statusserver == RSP_STATSRV_ON || conf->statusserver == RSP_STATSRV_MINIMAL) {
+                if (*rqout->rq->buf == RAD_Status_Server) {
+                    debug(DBG_WARN, "clientwrrun: no status server response, %s dead?", conf->name);
+                    incrementlostrqs(server);
+                }
+            } else {
+                if (conf->statusserver == RSP_STATSRV_AUTO && *rqout->rq->buf == RAD_Status_Server) {
+                    if (server->lastreply.tv_sec >= server->laststatsrv.tv_sec) {
+                        debug(DBG_DBG, "clientwrrun: status server autodetect failed, disabling status server for %s", conf->name);
+                        conf->statusserver = RSP_STATSRV_OFF;
                     }
                 } else {
-                    if (conf->statusserver == RSP_STATSRV_AUTO && *rqout->rq->buf == RAD_Status_Server) {
-                        if (server->lastreply.tv_sec >= laststatsrv.tv_sec) {
-                            debug(DBG_DBG, "clientwr: status server autodetect failed, disabling status server for %s", conf->name);
-                            conf->statusserver = RSP_STATSRV_OFF;
-                        }
-                    } else {
-                        debug(DBG_WARN, "clientwr: no server response, %s dead?", conf->name);
-                        incrementlostrqs(server);
-                    }
+                    debug(DBG_WARN, "clientwrrun: no server response, %s dead?", conf->name);
+                    incrementlostrqs(server);
                 }
-                freerqoutdata(rqout);
-                pthread_mutex_unlock(rqout->lock);
-                continue;
             }
+            freerqoutdata(rqout);
+            pthread_mutex_unlock(&rqout->lock);
+            continue;
+        }
 
-            rqout->expiry.tv_sec = now.tv_sec + conf->retryinterval;
-            if (!timeout.tv_sec || rqout->expiry.tv_sec < timeout.tv_sec)
-                timeout.tv_sec = rqout->expiry.tv_sec;
-            rqout->tries++;
-            if (!conf->pdef->clientradput(server, rqout->rq->buf, rqout->rq->buflen)) {
-                debug(DBG_WARN, "clientwr: could not send request to server %s", conf->name);
-                incrementlostrqs(server);
-            }
-            pthread_mutex_unlock(rqout->lock);
-        }
-        do_resend = 0;
-        if (server->state == RSP_SERVER_STATE_CONNECTED && !(conf->statusserver == RSP_STATSRV_OFF)) {
-            gettimeofday(&now, NULL);
-            if ((conf->statusserver == RSP_STATSRV_ON && now.tv_sec - (server->lastrcv.tv_sec > laststatsrv.tv_sec ? server->lastrcv.tv_sec : laststatsrv.tv_sec) > STATUS_SERVER_PERIOD) ||
-                ((conf->statusserver == RSP_STATSRV_MINIMAL || conf->statusserver == RSP_STATSRV_ON) && statusserver_requested && now.tv_sec - laststatsrv.tv_sec > STATUS_SERVER_PERIOD) ||
-                (conf->statusserver == RSP_STATSRV_AUTO && server->lastreply.tv_sec >= laststatsrv.tv_sec)) {
-
-                laststatsrv = now;
-                statsrvrq = createstatsrvrq();
-                if (statsrvrq) {
-                    statsrvrq->to = server;
-                    debug(DBG_DBG, "clientwr: sending %s to %s", radmsgtype2string(RAD_Status_Server), conf->name);
-                    sendrq(statsrvrq);
-                }
-                statusserver_requested = 0;
+        rqout->expiry = now.tv_sec + conf->retryinterval;
+        if (!timeout || rqout->expiry < timeout)
+            timeout = rqout->expiry;
+        rqout->tries++;
+        rqout->rq->tries = rqout->tries;
+        if (!conf->pdef->clientradput(server, rqout->rq->buf, rqout->rq->buflen)) {
+            debug(DBG_WARN, "clientwrrun: could not send request to server %s", conf->name);
+            incrementlostrqs(server);
+        }
+        pthread_mutex_unlock(&rqout->lock);
+    }
+
+    monotime(&now);
+    if (server->state == RSP_SERVER_STATE_CONNECTED && !(conf->statusserver == RSP_STATSRV_OFF)) {
+        if ((conf->statusserver == RSP_STATSRV_ON && now.tv_sec - (server->lastrcv.tv_sec > server->laststatsrv.tv_sec ? server->lastrcv.tv_sec : server->laststatsrv.tv_sec) > STATUS_SERVER_PERIOD) ||
+            ((conf->statusserver == RSP_STATSRV_MINIMAL || conf->statusserver == RSP_STATSRV_ON) && server->statsrvrequested && now.tv_sec - server->laststatsrv.tv_sec > STATUS_SERVER_PERIOD) ||
+            (conf->statusserver == RSP_STATSRV_AUTO && server->lastreply.tv_sec >= server->laststatsrv.tv_sec)) {
+
+            server->laststatsrv = now;
+            statsrvrq = createstatsrvrq();
+            if (statsrvrq) {
+                statsrvrq->to = server;
+                statsrvrq->radius11 = server->radius11;
+                debug(DBG_DBG, "clientwrrun: sending %s to %s", radmsgtype2string(RAD_Status_Server), conf->name);
+                sendrq(statsrvrq);
             }
+            server->statsrvrequested = 0;
         }
     }
 
-errexitwait:
-    /* flush request queue so we don't block incoming retries by removing blocked duplicates*/
-    for (i = 0; i < MAX_REQUESTS; i++) {
+    /* random 0-7 seconds */
+    RAND_bytes(&rnd, 1);
+    rnd /= 32;
+    if (conf->statusserver != RSP_STATSRV_OFF) {
+        secs = server->lastrcv.tv_sec > server->laststatsrv.tv_sec ? server->lastrcv.tv_sec : server->laststatsrv.tv_sec;
+        if (now.tv_sec - secs > STATUS_SERVER_PERIOD)
+            secs = now.tv_sec;
+        if (!timeout || timeout > secs + STATUS_SERVER_PERIOD + rnd)
+            timeout = secs + STATUS_SERVER_PERIOD + rnd;
+    } else {
+        if (!timeout || timeout > now.tv_sec + STATUS_SERVER_PERIOD + rnd)
+            timeout = now.tv_sec + STATUS_SERVER_PERIOD + rnd;
+    }
+    return timeout;
+}
+
+/** Flush the request queue of a server that failed to set up,
+ * so we don't block incoming retries by removing blocked duplicates */
+void clientwrflush(struct server *server) {
+    struct rqout *rqout;
+    int i;
+
+    for (i = 0; i < server->nrequests; i++) {
         rqout = server->requests + i;
-        pthread_mutex_lock(rqout->lock);
+        pthread_mutex_lock(&rqout->lock);
         if (rqout->rq)
-            rmclientrq(rqout->rq, rqout->rq->rqid);
+            rmclientrq(rqout->rq);
         freerqoutdata(rqout);
-        pthread_mutex_unlock(rqout->lock);
+        pthread_mutex_unlock(&rqout->lock);
     }
-    sleep(ZZZ);
-errexit:
-    debug(DBG_DBG, "clientwr: server %s (%s) finished, cleaning up", server->conf->name,
+}
+
+/** Remove a server that is no longer served by the upstream reactor */
+void clientwrcleanup(struct server *server) {
+    struct clsrvconf *conf = server->conf;
+
+    debug(DBG_DBG, "clientwrcleanup: server %s (%s) finished, cleaning up", conf->name,
           server->dynamiclookuparg ? server->dynamiclookuparg : "static");
     if (server->dynamiclookuparg) {
         removeserversubrealms(realms, conf);
         freeclsrvconf(conf);
     }
     freeserver(server, 1);
-    return NULL;
+}
+
+/* let the kernel drop datagrams from unknown clients on a listener socket */
+void setclientfilter(int s, int family, uint8_t type) {
+    struct list *hostportlists;
+    struct list_node *entry;
+    struct clsrvconf *conf;
+
+    hostportlists = list_create();
+    if (!hostportlists) {
+        debug(DBG_ERR, "malloc failed");
+        return;
+    }
+    for (entry = list_first(clconfs); entry; entry = list_next(entry)) {
+        conf = (struct clsrvconf *)entry->data;
+        if (conf->type == type && !list_push(hostportlists, conf->hostports)) {
+            debug(DBG_ERR, "malloc failed");
+            list_free(hostportlists);
+            return;
+        }
+    }
+    if (attachsourcefilter(s, family, hostportlists))
+        debug(DBG_INFO, "createlistener: dropping %s datagrams from unknown clients in the kernel on socket %d", protodefs[type]->name, s);
+    list_free(hostportlists);
 }
 
 void createlistener(uint8_t type, char *arg) {
@@ -2060,7 +2948,7 @@ void createlistener(uint8_t type, char *arg) {
     struct addrinfo *res;
     int s = -1, on = 1, *sp = NULL;
     struct hostportres *hp = newhostport(arg, protodefs[type]->portdefault, 0);
-    char tmp[INET6_ADDRSTRLEN];
+    char tmp[INET6_ADDRSTRLEN], name[INET6_ADDRSTRLEN + 64];
 
     if (!hp || !resolvehostport(hp, AF_UNSPEC, protodefs[type]->socktype, 1))
         debugx(1, DBG_ERR, "createlistener: failed to resolve %s", arg);
@@ -2100,6 +2988,14 @@ void createlistener(uint8_t type, char *arg) {
             close(s);
             continue;
         }
+        if (res->ai_socktype == SOCK_DGRAM && options.socketfilter)
+            setclientfilter(s, res->ai_family, type);
+        set_sockbufs(s, options.listenrcvbuf, options.listensndbuf);
+        if (res->ai_socktype == SOCK_DGRAM) {
+            snprintf(name, sizeof(name), "%s listener %s port %s", protodefs[type]->name, addr2string(res->ai_addr, tmp, sizeof(tmp)), hp->port);
+            if (!sockstats_add(s, name))
+                debugx(1, DBG_ERR, "malloc failed");
+        }
 
         sp = malloc(sizeof(int));
         if (!sp)
@@ -2379,6 +3275,7 @@ struct realm *adddynamicrealmserver(struct realm *realm, char *id) {
         realm->subrealms = NULL;
         return NULL;
     }
+    newrealm->acctsink = realm->acctsink;
 
     newrealm->parent = newrealmref(realm);
     /* add server and accserver to newrealm */
@@ -2388,11 +3285,12 @@ struct realm *adddynamicrealmserver(struct realm *realm, char *id) {
 }
 
 int dynamicconfigexternal(struct server *server) {
-    int ok = 0, fd[2], status;
+    int ok = 0, fd[2], status, waited;
     pid_t pid;
     struct clsrvconf *conf = server->conf;
     struct gconffile *cf = NULL;
     struct pollfd fds[1];
+    struct timeval start, now;
     FILE *pipein;
 
     if (pipe(fd) > 0) {
@@ -2421,7 +3319,14 @@ int dynamicconfigexternal(struct server *server) {
     pipein = fdopen(fd[0], "r");
     fds[0].fd = fd[0];
     fds[0].events = POLLIN;
-    status = poll(fds, 1, 5000);
+    monotime(&start);
+    /* a signal such as the SIGPROF of the profiler must not cut the wait
+       short, so poll again for what is left of the 5 seconds */
+    do {
+        monotime(&now);
+        waited = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_usec - start.tv_usec) / 1000;
+        status = poll(fds, 1, waited < 5000 ? 5000 - waited : 0);
+    } while (status < 0 && errno == EINTR);
     if (status < 0) {
         debugerrno(errno, DBG_ERR, "dynamicconfigexternal: error while waiting for command output");
     } else if (status == 0) {
@@ -2723,7 +3628,11 @@ int mergesrvconf(struct clsrvconf *dst, struct clsrvconf *src) {
         if (src->retrycount != 255)
             dst->retrycount = src->retrycount;
         dst->blockingstartup = src->blockingstartup;
+        dst->failoverrqs = src->failoverrqs;
+        dst->standby = src->standby;
         dst->sni = src->sni;
+        dst->radiusversion = src->radiusversion;
+        dst->maxpacketlen = src->maxpacketlen;
     }
     dst->shallow = 0;
     return 1;
@@ -2787,12 +3696,49 @@ static int confapplytls(struct clsrvconf *conf, const char *block) {
     return 1;
 }
 
+static int confradiusversion(struct clsrvconf *conf, const char *radiusversion, const char *block) {
+    if (!radiusversion)
+        return 1;
+    if (strcmp(radiusversion, "1.0") == 0)
+        conf->radiusversion = RSP_RADIUS_V10;
+    else if (strcmp(radiusversion, "1.1") == 0)
+        conf->radiusversion = RSP_RADIUS_V11;
+    else if (strcasecmp(radiusversion, "Auto") == 0)
+        conf->radiusversion = RSP_RADIUS_ANY;
+    else {
+        debug(DBG_ERR, "error in block %s, invalid RadiusVersion value: %s", block, radiusversion);
+        return 0;
+    }
+    if (conf->radiusversion != RSP_RADIUS_V10 && conf->type != RAD_TLS && conf->type != RAD_DTLS) {
+        debug(DBG_ERR, "error in block %s, RadiusVersion %s is only supported for tls and dtls", block, radiusversion);
+        return 0;
+    }
+    return 1;
+}
+
+static int confmaxpacketlength(struct clsrvconf *conf, long maxpacketlength, const char *block) {
+    if (maxpacketlength == LONG_MIN) {
+        if (!conf->maxpacketlen)
+            conf->maxpacketlen = RAD_Max_Length;
+        return 1;
+    }
+    if (maxpacketlength < RAD_Max_Length || maxpacketlength > RAD_Max_Length_Extended) {
+        debug(DBG_ERR, "error in block %s, value of option MaxPacketLength is %ld, must be %d-%d", block, maxpacketlength, RAD_Max_Length, RAD_Max_Length_Extended);
+        return 0;
+    }
+    if (conf->type != RAD_TCP && conf->type != RAD_TLS) {
+        debug(DBG_ERR, "error in block %s, MaxPacketLength is only supported for tcp and tls", block);
+        return 0;
+    }
+    conf->maxpacketlen = (int)maxpacketlength;
+    return 1;
+}
+
 int confclient_cb(struct gconffile **cf, void *arg, char *block, char *opt, char *val) {
-    struct clsrvconf *conf, *existing;
-    char *conftype = NULL, *rewriteinalias = NULL;
-    long int dupinterval = LONG_MIN, addttl = LONG_MIN;
+    struct clsrvconf *conf;
+    char *conftype = NULL, *rewriteinalias = NULL, *radiusversion = NULL;
+    long int dupinterval = LONG_MIN, addttl = LONG_MIN, maxpacketlength = LONG_MIN;
     uint8_t ipv4only = 0, ipv6only = 0;
-    struct list_node *entry;
 
     debug(DBG_DBG, "confclient_cb called for %s", block);
     conf = calloc(1, sizeof(struct clsrvconf));
@@ -2814,6 +3760,7 @@ int confclient_cb(struct gconffile **cf, void *arg, char *block, char *opt, char
             "MatchCertificateAttribute", CONF_MSTR, &conf->confmatchcertattrs,
             "CertificateNameCheck", CONF_BLN, &conf->certnamecheck,
             "ServerName", CONF_STR, &conf->servername,
+            "RadiusVersion", CONF_STR, &radiusversion,
 #endif
             "DuplicateInterval", CONF_LINT, &dupinterval,
             "addTTL", CONF_LINT, &addttl,
@@ -2826,6 +3773,8 @@ int confclient_cb(struct gconffile **cf, void *arg, char *block, char *opt, char
             "fticksVISINST", CONF_STR, &conf->fticks_visinst,
             "requireMessageAuthenticator", CONF_BLN, &conf->reqmsgauth,
             "requireMessageAuthenticatorProxy", CONF_BLN, &conf->reqmsgauthproxy,
+            "MaxPacketLength", CONF_LINT, &maxpacketlength,
+            "SharedDuplicateCache", CONF_BLN, &conf->shareddupcache,
             NULL))
         debugx(1, DBG_ERR, "configuration error");
 
@@ -2847,6 +3796,14 @@ int confclient_cb(struct gconffile **cf, void *arg, char *block, char *opt, char
         debugx(1, DBG_ERR, "error in block %s, unknown transport %s", block, conftype);
     free(conftype);
     conf->pdef = protodefs[conf->type];
+    if (conf->shareddupcache && conf->type == RAD_UDP)
+        debugx(1, DBG_ERR, "error in block %s, SharedDuplicateCache is only supported for tcp, tls and dtls clients", block);
+
+    if (!confradiusversion(conf, radiusversion, block))
+        debugx(1, DBG_ERR, "config error: ^");
+    free(radiusversion);
+    if (!confmaxpacketlength(conf, maxpacketlength, block))
+        debugx(1, DBG_ERR, "config error: ^");
 
     if (!confapplytls(conf, block))
         debugx(1, DBG_ERR, "config error: ^");
@@ -2895,9 +3852,9 @@ int confclient_cb(struct gconffile **cf, void *arg, char *block, char *opt, char
             debugx(1, DBG_ERR, "error in block %s, invalid RewriteAttributeValue", block);
     }
 
-    if (!addhostport(&conf->hostports, conf->hostsrc, conf->pdef->portdefault, 1) ||
-        !resolvehostports(conf->hostports, conf->hostaf, conf->pdef->socktype))
-        debugx(1, DBG_ERR, "%s: resolve failed, exiting", __func__);
+    /* hostports are resolved in bulk by resolveconfhostports() once the config is read */
+    if (!addhostport(&conf->hostports, conf->hostsrc, conf->pdef->portdefault, 1))
+        debugx(1, DBG_ERR, "error in block %s, failed to parse %s", block, *conf->hostsrc);
 
     if (!conf->secret) {
         if (!conf->pdef->secretdefault)
@@ -2909,18 +3866,6 @@ int confclient_cb(struct gconffile **cf, void *arg, char *block, char *opt, char
     if ((conf->type == RAD_UDP || conf->type == RAD_TCP) && conf->secret_len <= RSP_SECRET_LEN_WARN)
         debug(DBG_WARN, "warning! shared secret should be at least %d characters long! (block %s)", RSP_SECRET_LEN_WARN, block);
 
-    if (conf->tlsconf) {
-        for (entry = list_first(clconfs); entry; entry = list_next(entry)) {
-            existing = (struct clsrvconf *)entry->data;
-
-            if (existing->type == conf->type &&
-                existing->tlsconf != conf->tlsconf &&
-                hostportmatches(existing->hostports, conf->hostports, 0)) {
-
-                debugx(1, DBG_ERR, "error in block %s, masked by overlapping (equal or less specific IP/prefix) client %s with different tls block", block, existing->name);
-            }
-        }
-    }
     if (conf->pskkey) {
         conf->pskkeylen = unhex((char *)conf->pskkey, 1);
         if (conf->pskkeylen < PSK_MIN_LENGTH)
@@ -2984,22 +3929,18 @@ int compileserverconfig(struct clsrvconf *conf, const char *block) {
         }
     }
 
+    /* resolving is done by resolveconfhostports() for static servers and by clientwrstart() for dynamic ones */
     if (!addhostport(&conf->hostports, conf->hostsrc, conf->portsrc, 0)) {
         debug(DBG_ERR, "error in block %s, failed to parse %s", block, *conf->hostsrc);
         return 0;
     }
-
-    if (!resolvehostports(conf->hostports, conf->hostaf, conf->pdef->socktype)) {
-        debug(DBG_ERR, "%s: resolve failed", __func__);
-        return 0;
-    }
     return 1;
 }
 
 int confserver_cb(struct gconffile **cf, void *arg, char *block, char *opt, char *val) {
     struct clsrvconf *conf, *resconf;
-    char *conftype = NULL, *rewriteinalias = NULL, *statusserver = NULL;
-    long int retryinterval = LONG_MIN, retrycount = LONG_MIN, addttl = LONG_MIN;
+    char *conftype = NULL, *rewriteinalias = NULL, *statusserver = NULL, *radiusversion = NULL;
+    long int retryinterval = LONG_MIN, retrycount = LONG_MIN, addttl = LONG_MIN, maxpacketlength = LONG_MIN;
     uint8_t ipv4only = 0, ipv6only = 0, confmerged = 0;
 
     debug(DBG_DBG, "confserver_cb called for %s", block);
@@ -3016,8 +3957,13 @@ int confserver_cb(struct gconffile **cf, void *arg, char *block, char *opt, char
         conf->certnamecheck = resconf->certnamecheck;
         conf->secret_len = resconf->secret_len;
         conf->blockingstartup = resconf->blockingstartup;
+        conf->failoverrqs = resconf->failoverrqs;
         conf->type = resconf->type;
         conf->sni = resconf->sni;
+        conf->radiusversion = resconf->radiusversion;
+        conf->maxpacketlen = resconf->maxpacketlen;
+        conf->rcvbuf = resconf->rcvbuf;
+        conf->sndbuf = resconf->sndbuf;
     } else {
         conf->certnamecheck = 1;
         conf->sni = options.sni;
@@ -3038,6 +3984,7 @@ int confserver_cb(struct gconffile **cf, void *arg, char *block, char *opt, char
                           "MatchCertificateAttribute", CONF_MSTR, &conf->confmatchcertattrs,
                           "CertificateNameCheck", CONF_BLN, &conf->certnamecheck,
                           "ServerName", CONF_STR, &conf->servername,
+                          "RadiusVersion", CONF_STR, &radiusversion,
 #endif
                           "addTTL", CONF_LINT, &addttl,
                           "tcpKeepalive", CONF_BLN, &conf->keepalive,
@@ -3050,10 +3997,15 @@ int confserver_cb(struct gconffile **cf, void *arg, char *block, char *opt, char
                           "DynamicLookupCommand", CONF_STR, &conf->dynamiclookupcommand,
                           "LoopPrevention", CONF_BLN, &conf->loopprevention,
                           "BlockingStartup", CONF_BLN, &conf->blockingstartup,
+                          "FailoverRequests", CONF_BLN, &conf->failoverrqs,
+                          "Standby", CONF_BLN, &conf->standby,
                           "SNI", CONF_BLN, &conf->sni,
                           "SNIservername", CONF_STR, &conf->sniservername,
                           "DTLSForceMTU", CONF_LINT, &conf->dtlsmtu,
                           "requireMessageAuthenticator", CONF_BLN, &conf->reqmsgauth,
+                          "MaxPacketLength", CONF_LINT, &maxpacketlength,
+                          "ReceiveBuffer", CONF_LINT, &conf->rcvbuf,
+                          "SendBuffer", CONF_LINT, &conf->sndbuf,
                           NULL)) {
         debug(DBG_ERR, "configuration error");
         goto errexit;
@@ -3088,6 +4040,17 @@ int confserver_cb(struct gconffile **cf, void *arg, char *block, char *opt, char
         conf->pdef = protodefs[conf->type];
     }
 
+    if (!confradiusversion(conf, radiusversion, block))
+        goto errexit;
+    free(radiusversion);
+    radiusversion = NULL;
+    if (!confmaxpacketlength(conf, maxpacketlength, block))
+        goto errexit;
+    if (conf->rcvbuf < 0 || conf->rcvbuf > INT_MAX || conf->sndbuf < 0 || conf->sndbuf > INT_MAX) {
+        debug(DBG_ERR, "error in block %s, ReceiveBuffer and SendBuffer must be 0-%d", block, INT_MAX);
+        goto errexit;
+    }
+
     conf->hostaf = AF_UNSPEC;
     if (config_hostaf("top level", options.ipv4only, options.ipv6only, &conf->hostaf) ||
         config_hostaf(block, ipv4only, ipv6only, &conf->hostaf)) {
@@ -3127,6 +4090,19 @@ int confserver_cb(struct gconffile **cf, void *arg, char *block, char *opt, char
         conf->addttl = (uint8_t)addttl;
     }
 
+    if (conf->standby && !resconf) {
+        /* kept alive and checked by status server while idle */
+        if (statusserver && strcasecmp(statusserver, "On")) {
+            debug(DBG_ERR, "error in block %s, Standby requires StatusServer On", block);
+            goto errexit;
+        }
+        if (conf->type == RAD_UDP || conf->dynamiclookupcommand) {
+            debug(DBG_ERR, "error in block %s, Standby is only supported for static tcp, tls and dtls servers", block);
+            goto errexit;
+        }
+        conf->statusserver = RSP_STATSRV_ON;
+    }
+
     if (statusserver) {
         if (strcasecmp(statusserver, "Off") == 0)
             conf->statusserver = RSP_STATSRV_OFF;
@@ -3207,6 +4183,7 @@ errexit:
     free(conftype);
     free(rewriteinalias);
     free(statusserver);
+    free(radiusversion);
     /* if conf was merged into resconf, don't free it */
     if (!confmerged)
         freeclsrvconf(conf);
@@ -3247,8 +4224,10 @@ int confrewrite_cb(struct gconffile **cf, void *arg, char *block, char *opt, cha
 }
 
 int confrealm_cb(struct gconffile **cf, void *arg, char *block, char *opt, char *val) {
-    char **servers = NULL, **accservers = NULL, *msg = NULL;
+    char **servers = NULL, **accservers = NULL, *msg = NULL, *acctsink = NULL;
     uint8_t accresp = 0, acclog = 0;
+    long int share = 1, quota = 0;
+    struct realm *realm;
 
     debug(DBG_DBG, "confrealm_cb called for %s", block);
 
@@ -3258,10 +4237,28 @@ int confrealm_cb(struct gconffile **cf, void *arg, char *block, char *opt, char
                           "ReplyMessage", CONF_STR, &msg,
                           "AccountingResponse", CONF_BLN, &accresp,
                           "AccountingLog", CONF_BLN, &acclog,
+                          "AccountingSink", CONF_STR, &acctsink,
+                          "ServerShare", CONF_LINT, &share,
+                          "ServerQuota", CONF_LINT, &quota,
                           NULL))
         debugx(1, DBG_ERR, "configuration error");
+    if (share < 1 || share > 255)
+        debugx(1, DBG_ERR, "error in block %s, ServerShare must be between 1 and 255", block);
+    if (quota < 0 || quota > RADIUS11_MAX_REQUESTS)
+        debugx(1, DBG_ERR, "error in block %s, ServerQuota must be between 0 and %d", block, RADIUS11_MAX_REQUESTS);
 
-    addrealm(realms, val, servers, accservers, msg, accresp, acclog);
+    realm = addrealm(realms, val, servers, accservers, msg, accresp, acclog);
+    if (realm) {
+        realm->share = share;
+        realm->quota = quota;
+        realm->slotsidx = nrealmslots++;
+    }
+    if (realm && acctsink) {
+        realm->acctsink = acctsink_get(acctsink);
+        if (!realm->acctsink)
+            debugx(1, DBG_ERR, "error in block %s, accounting sink %s not defined", block, acctsink);
+    }
+    free(acctsink);
     return 1;
 }
 
@@ -3298,8 +4295,105 @@ void warnpskreuse(struct list_node *entry, struct clsrvconf *conf, char *type, u
     }
 }
 
+/* log the duration of a startup phase and start timing the next one */
+void logstartupphase(const char *phase, struct timeval *phasestart) {
+    struct timeval now;
+    long ms;
+
+    monotime(&now);
+    ms = (now.tv_sec - phasestart->tv_sec) * 1000 + (now.tv_usec - phasestart->tv_usec) / 1000;
+    debug(DBG_INFO, "startup: %s took %ld.%03lds", phase, ms / 1000, ms % 1000);
+    *phasestart = now;
+}
+
+void resolveconfhostports(void) {
+    struct resolvejob *jobs;
+    struct list_node *entry, *prev;
+    struct clsrvconf *conf, *existing;
+    int count = 0, i;
+
+    jobs = calloc(list_count(clconfs) + list_count(srvconfs), sizeof(struct resolvejob));
+    if (!jobs)
+        debugx(1, DBG_ERR, "malloc failed");
+    for (entry = list_first(clconfs); entry; entry = list_next(entry)) {
+        conf = (struct clsrvconf *)entry->data;
+        jobs[count++] = (struct resolvejob){conf->hostports, conf->hostaf, conf->pdef->socktype, 0};
+    }
+    for (entry = list_first(srvconfs); entry; entry = list_next(entry)) {
+        conf = (struct clsrvconf *)entry->data;
+        if (conf->hostports)
+            jobs[count++] = (struct resolvejob){conf->hostports, conf->hostaf, conf->pdef->socktype, 0};
+    }
+
+    debug(DBG_DBG, "%s: resolving %d clients and servers using up to %d threads", __func__, count, RESOLVER_THREADS);
+    if (resolvehostportjobs(jobs, count, RESOLVER_THREADS)) {
+        for (i = 0; i < count; i++)
+            if (!jobs[i].result)
+                debug(DBG_ERR, "%s: failed to resolve %s", __func__, ((struct hostportres *)list_first(jobs[i].hostports)->data)->host);
+        debugx(1, DBG_ERR, "%s: resolve failed, exiting", __func__);
+    }
+    free(jobs);
+
+    for (entry = list_first(clconfs); entry; entry = list_next(entry)) {
+        conf = (struct clsrvconf *)entry->data;
+        if (!conf->tlsconf)
+            continue;
+        for (prev = list_first(clconfs); prev != entry; prev = list_next(prev)) {
+            existing = (struct clsrvconf *)prev->data;
+            if (existing->type == conf->type &&
+                existing->tlsconf != conf->tlsconf &&
+                hostportmatches(existing->hostports, conf->hostports, 0)) {
+
+                debugx(1, DBG_ERR, "error in block client %s, masked by overlapping (equal or less specific IP/prefix) client %s with different tls block", conf->name, existing->name);
+            }
+        }
+    }
+}
+
+/* attribute types identifying an accounting record by default, Acct-Delay-Time
+ * is left out since it changes when the NAS retransmits */
+static const uint8_t acctdupdefaulttypes[] = {
+    RAD_Attr_NAS_IP_Address, RAD_Attr_NAS_Identifier, RAD_Attr_Acct_Session_Id, RAD_Attr_Acct_Status_Type,
+    RAD_Attr_Event_Timestamp, RAD_Attr_Acct_Session_Time, RAD_Attr_Acct_Input_Octets, RAD_Attr_Acct_Output_Octets,
+    RAD_Attr_Acct_Input_Packets, RAD_Attr_Acct_Output_Packets, RAD_Attr_Acct_Input_Gigawords, RAD_Attr_Acct_Output_Gigawords};
+
+static void confacctdupattrs(char **attrs, const char *configfile) {
+    char *end;
+    long type;
+    int i, n;
+
+    if (!attrs) {
+        options.acctduptypes = (uint8_t *)acctdupdefaulttypes;
+        options.acctduptypecount = sizeof(acctdupdefaulttypes);
+    } else {
+        for (n = 0; attrs[n]; n++)
+            ;
+        options.acctduptypes = malloc(n);
+        if (!options.acctduptypes)
+            debugx(1, DBG_ERR, "malloc failed");
+        for (i = 0; i < n; i++) {
+            type = strtol(attrs[i], &end, 10);
+            if (*end || type < 1 || type > 255)
+                debugx(1, DBG_ERR, "error in %s, value of option AccountingDuplicateAttribute is %s, must be an attribute type 1-255", configfile, attrs[i]);
+            if (type == RAD_Attr_Acct_Delay_Time)
+                debug(DBG_WARN, "AccountingDuplicateAttribute %ld (Acct-Delay-Time) changes on retransmission, duplicates will not be detected", type);
+            options.acctduptypes[i] = (uint8_t)type;
+        }
+        options.acctduptypecount = n;
+        freegconfmstr(attrs);
+    }
+    if (!options.acctdupinterval)
+        return;
+    acctdupcache = acctdup_create(ACCTDUP_SIZE, options.acctdupinterval);
+    if (!acctdupcache)
+        debugx(1, DBG_ERR, "malloc failed");
+}
+
 void getmainconfig(const char *configfile) {
-    long int addttl = LONG_MIN, loglevel = LONG_MIN;
+    long int addttl = LONG_MIN, loglevel = LONG_MIN, upstreamthreads = LONG_MIN, acctdupinterval = LONG_MIN;
+    long int memsoftlimit = 0, memhardlimit = 0, flightrecordersize = LONG_MIN;
+    long int profilerseconds = LONG_MIN, profilerfrequency = LONG_MIN;
+    char **acctdupattrs = NULL;
     struct gconffile *cfs;
     char **listenargs[RAD_PROTOCOUNT];
     char **sourceargs[RAD_PROTOCOUNT];
@@ -3310,8 +4404,12 @@ void getmainconfig(const char *configfile) {
     uint8_t *fticks_key_str = NULL;
     int i;
     struct list_node *entry;
+    struct timeval phasestart;
 
-    cfs = openconfigfile(configfile);
+    monotime(&phasestart);
+    cfs = openconfigsnapshot(configfile);
+    if (!cfs)
+        cfs = openconfigfile(configfile);
     memset(&options, 0, sizeof(options));
     memset(&listenargs, 0, sizeof(listenargs));
     memset(&sourceargs, 0, sizeof(sourceargs));
@@ -3365,6 +4463,7 @@ void getmainconfig(const char *configfile) {
             "TLS", CONF_CBK, conftls_cb, NULL,
 #endif
             "Rewrite", CONF_CBK, confrewrite_cb, NULL,
+            "AccountingSink", CONF_CBK, confacctsink_cb, NULL,
             "FTicksReporting", CONF_STR, &fticks_reporting_str,
             "FTicksMAC", CONF_STR, &fticks_mac_str,
             "FTicksKey", CONF_STR, &fticks_key_str,
@@ -3374,6 +4473,21 @@ void getmainconfig(const char *configfile) {
             "IPv6Only", CONF_BLN, &options.ipv6only,
             "SNI", CONF_BLN, &options.sni,
             "VerifyEAP", CONF_BLN, &options.verifyeap,
+            "SocketFilter", CONF_BLN, &options.socketfilter,
+            "UpstreamThreads", CONF_LINT, &upstreamthreads,
+            "LowMemory", CONF_BLN, &options.lowmemory,
+            "AccountingDuplicateInterval", CONF_LINT, &acctdupinterval,
+            "AccountingDuplicateAttribute", CONF_MSTR, &acctdupattrs,
+            "MemorySoftLimit", CONF_LINT, &memsoftlimit,
+            "MemoryHardLimit", CONF_LINT, &memhardlimit,
+            "ListenReceiveBuffer", CONF_LINT, &options.listenrcvbuf,
+            "ListenSendBuffer", CONF_LINT, &options.listensndbuf,
+            "SocketTimestamps", CONF_BLN, &options.sockettimestamps,
+            "FlightRecorder", CONF_STR, &options.flightrecorder,
+            "FlightRecorderSize", CONF_LINT, &flightrecordersize,
+            "Profiler", CONF_STR, &options.profiler,
+            "ProfilerSeconds", CONF_LINT, &profilerseconds,
+            "ProfilerFrequency", CONF_LINT, &profilerfrequency,
             NULL))
         debugx(1, DBG_ERR, "configuration error");
 
@@ -3382,6 +4496,54 @@ void getmainconfig(const char *configfile) {
             debugx(1, DBG_ERR, "error in %s, value of option LogLevel is %d, must be 1, 2, 3, 4 or 5", configfile, loglevel);
         options.loglevel = (uint8_t)loglevel;
     }
+    if (upstreamthreads != LONG_MIN) {
+        if (upstreamthreads < 1 || upstreamthreads > UPSTREAM_MAX_THREADS)
+            debugx(1, DBG_ERR, "error in %s, value of option UpstreamThreads is %ld, must be 1-%d", configfile, upstreamthreads, UPSTREAM_MAX_THREADS);
+        options.upstreamthreads = (uint8_t)upstreamthreads;
+    } else
+        options.upstreamthreads = 1;
+#if defined(RADPROT_TLS) || defined(RADPROT_DTLS)
+    tlssetlowmemory(options.lowmemory);
+#endif
+    if (acctdupinterval != LONG_MIN) {
+        if (acctdupinterval < 0 || acctdupinterval > 255)
+            debugx(1, DBG_ERR, "error in %s, value of option AccountingDuplicateInterval is %ld, must be 0-255", configfile, acctdupinterval);
+        options.acctdupinterval = (uint8_t)acctdupinterval;
+    }
+    confacctdupattrs(acctdupattrs, configfile);
+    if (memsoftlimit < 0 || memhardlimit < 0 || memsoftlimit > UINT32_MAX || memhardlimit > UINT32_MAX)
+        debugx(1, DBG_ERR, "error in %s, MemorySoftLimit and MemoryHardLimit must be 0-%u MB", configfile, UINT32_MAX);
+    if (memsoftlimit && memhardlimit && memsoftlimit > memhardlimit)
+        debugx(1, DBG_ERR, "error in %s, MemorySoftLimit must not be above MemoryHardLimit", configfile);
+    options.memsoftlimit = memsoftlimit;
+    options.memhardlimit = memhardlimit;
+    membudget_init((uint64_t)options.memsoftlimit << 20, (uint64_t)options.memhardlimit << 20);
+    if (options.listenrcvbuf < 0 || options.listenrcvbuf > INT_MAX || options.listensndbuf < 0 || options.listensndbuf > INT_MAX)
+        debugx(1, DBG_ERR, "error in %s, ListenReceiveBuffer and ListenSendBuffer must be 0-%d", configfile, INT_MAX);
+    sockstats_timestamps(options.sockettimestamps);
+    if (flightrecordersize != LONG_MIN) {
+        if (flightrecordersize < 1 || flightrecordersize > FLIGHTREC_MAX_RECORDS)
+            debugx(1, DBG_ERR, "error in %s, value of option FlightRecorderSize is %ld, must be 1-%d", configfile, flightrecordersize, FLIGHTREC_MAX_RECORDS);
+        options.flightrecordersize = flightrecordersize;
+    } else
+        options.flightrecordersize = FLIGHTREC_DEFAULT_RECORDS;
+    if (options.flightrecorder && !flightrec_open(options.flightrecorder, options.flightrecordersize))
+        debugx(1, DBG_ERR, "error in %s, cannot use FlightRecorder %s", configfile, options.flightrecorder);
+    if (profilerseconds != LONG_MIN) {
+        if (profilerseconds < 1 || profilerseconds > PROFILER_MAX_SECONDS)
+            debugx(1, DBG_ERR, "error in %s, value of option ProfilerSeconds is %ld, must be 1-%d", configfile, profilerseconds, PROFILER_MAX_SECONDS);
+        options.profilerseconds = profilerseconds;
+    } else
+        options.profilerseconds = PROFILER_DEFAULT_SECONDS;
+    if (profilerfrequency != LONG_MIN) {
+        if (profilerfrequency < 1 || profilerfrequency > PROFILER_MAX_FREQUENCY)
+            debugx(1, DBG_ERR, "error in %s, value of option ProfilerFrequency is %ld, must be 1-%d", configfile, profilerfrequency, PROFILER_MAX_FREQUENCY);
+        options.profilerfrequency = profilerfrequency;
+    } else
+        options.profilerfrequency = PROFILER_DEFAULT_FREQUENCY;
+    if (options.profiler && !profiler_supported())
+        debug(DBG_WARN, "Profiler is not supported on this platform, ignoring it");
+    profiler_configure(options.profiler, options.profilerseconds, options.profilerfrequency);
     if (log_mac_str != NULL) {
         if (strcasecmp(log_mac_str, "Static") == 0)
             options.log_mac = RSP_MAC_STATIC;
@@ -3426,6 +4588,10 @@ void getmainconfig(const char *configfile) {
         if (listenargs[i] || sourceargs[i])
             setprotoopts(i, listenargs[i], sourceargs[i]);
 
+    logstartupphase("reading configuration", &phasestart);
+    resolveconfhostports();
+    logstartupphase("resolving hostnames", &phasestart);
+
     for (entry = list_first(clconfs); entry; entry = list_next(entry))
         warnpskreuse(list_next(entry), (struct clsrvconf *)entry->data, "client", 1);
     for (entry = list_first(srvconfs); entry; entry = list_next(entry))
@@ -3549,14 +4715,42 @@ void revalidateconnections(void) {
     }
 }
 
+/* log the state of each server: IDs used per realm, and readiness of standby servers */
+static void logservers(void) {
+    struct list_node *entry, *realmentry;
+    struct server *server;
+    struct realm *realm;
+    struct realmslots *slots;
+
+    for (entry = list_first(srvconfs); entry; entry = list_next(entry)) {
+        server = ((struct clsrvconf *)entry->data)->servers;
+        if (!server)
+            continue;
+        if (server->conf->standby)
+            debug(DBG_NOTICE, "server %s: standby server is %s", server->conf->name, standbyready(server) ? "ready" : "not ready");
+        pthread_mutex_lock(&server->realmslots_mutex);
+        debug(DBG_NOTICE, "server %s: %u requests of realms outstanding", server->conf->name, server->realmslotsout);
+        for (realmentry = list_first(realms); server->realmslots && realmentry; realmentry = list_next(realmentry)) {
+            realm = (struct realm *)realmentry->data;
+            slots = server->realmslots + realm->slotsidx;
+            if (slots->out || slots->shed)
+                debug(DBG_NOTICE, "server %s: realm %s has %u requests outstanding, %u dropped over its share", server->conf->name, realm->name, slots->out, slots->shed);
+        }
+        pthread_mutex_unlock(&server->realmslots_mutex);
+    }
+}
+
 void *sighandler(void *arg) {
     sigset_t sigset;
     int sig;
 
+    threadreg_name("signal");
     for (;;) {
         sigemptyset(&sigset);
         sigaddset(&sigset, SIGHUP);
         sigaddset(&sigset, SIGPIPE);
+        sigaddset(&sigset, SIGUSR1);
+        sigaddset(&sigset, SIGUSR2);
         sigwait(&sigset, &sig);
         switch (sig) {
         case 0:
@@ -3573,6 +4767,16 @@ void *sighandler(void *arg) {
         case SIGPIPE:
             debug(DBG_WARN, "sighandler: got SIGPIPE, TLS write error?");
             break;
+        case SIGUSR1:
+            logservers();
+            membudget_log();
+            sockstats_log();
+            threadreg_log();
+            break;
+        case SIGUSR2:
+            debug(DBG_INFO, "sighandler: got SIGUSR2, starting profiler");
+            profiler_start();
+            break;
         default:
             debug(DBG_WARN, "sighandler: ignoring signal %d", sig);
         }
@@ -3595,8 +4799,10 @@ int radsecproxy_main(int argc, char **argv) {
     uint8_t foreground = 0, pretend = 0, loglevel = 0;
     char *configfile = NULL, *pidfile = NULL;
     struct clsrvconf *srvconf;
+    struct timeval starttime, phasestart;
     int i;
 
+    monotime(&starttime);
     debug_init("radsecproxy");
     debug_set_level(DEBUG_LEVEL);
 
@@ -3660,19 +4866,29 @@ int radsecproxy_main(int argc, char **argv) {
 
     debug_timestamp_on();
     debug(DBG_INFO, "radsecproxy %s starting", PACKAGE_VERSION);
+    /* after daemon(), which leaves us in a new process */
+    threadreg_name("main");
     if (!pidfile)
         pidfile = options.pidfile;
     if (pidfile && !createpidfile(pidfile))
         debugx(1, DBG_ERR, "failed to create pidfile %s: %s", pidfile, strerror(errno));
 
     sigemptyset(&sigset);
-    /* exit on all but SIGHUP|SIGPIPE, ignore more? */
+    /* exit on all but SIGHUP|SIGPIPE|SIGUSR1|SIGUSR2, ignore more? */
     sigaddset(&sigset, SIGHUP);
     sigaddset(&sigset, SIGPIPE);
+    sigaddset(&sigset, SIGUSR1);
+    sigaddset(&sigset, SIGUSR2);
     pthread_sigmask(SIG_BLOCK, &sigset, NULL);
     if (pthread_create(&sigth, &pthread_attr, sighandler, NULL))
         debugx(1, DBG_ERR, "pthread_create failed: sighandler");
 
+    if (!acctsink_startall(acctsinkdone))
+        debugx(1, DBG_ERR, "failed to start accounting sinks");
+
+    monotime(&phasestart);
+    if (!upstreaminit(options.upstreamthreads))
+        debugx(1, DBG_ERR, "failed to start upstream reactor");
     for (entry = list_first(srvconfs); entry; entry = list_next(entry)) {
         srvconf = (struct clsrvconf *)entry->data;
         if (srvconf->dynamiclookupcommand)
@@ -3680,6 +4896,7 @@ int radsecproxy_main(int argc, char **argv) {
         if (!addserver(srvconf, NULL))
             debugx(1, DBG_ERR, "failed to add server");
     }
+    logstartupphase("starting servers", &phasestart);
 
     for (i = 0; i < RAD_PROTOCOUNT; i++) {
         if (!protodefs[i])
@@ -3689,6 +4906,8 @@ int radsecproxy_main(int argc, char **argv) {
         if (find_clconf_type(i, NULL))
             createlisteners(i);
     }
+    logstartupphase("creating listeners", &phasestart);
+    logstartupphase("startup", &starttime);
 
     /* just hang around doing nothing, anything to do here? */
     for (;;)
@@ -11,6 +11,7 @@
 #include "list.h"
 #include "radmsg.h"
 #include "rewrite.h"
+#include "upstream.h"
 #include <netinet/in.h>
 #include <pthread.h>
 #include <regex.h>
@@ -25,18 +26,32 @@
 
 /* MAX_REQUESTS must be 256 due to Radius' 8 bit ID field */
 #define MAX_REQUESTS 256
+/* RADIUS/1.1 (RFC 9765) requests are matched by a 32 bit Token, the lower
+ * RADIUS11_TOKEN_BITS of which select the slot in the request table */
+#define RADIUS11_TOKEN_BITS 12
+#define RADIUS11_MAX_REQUESTS (1 << RADIUS11_TOKEN_BITS)
 #define MAX_LOSTRQS 16
+/* entries of the SharedDuplicateCache of a client block, a power of two */
+#define SHAREDDUP_SIZE 4096
+/* entries probed for a client address and id, see shareddupfind() */
+#define SHAREDDUP_PROBES 16
+/* data written by different threads is kept in separate cache lines */
+#define CACHE_LINE 64
+#define CACHE_ALIGNED __attribute__((aligned(CACHE_LINE)))
 #define REQUEST_RETRY_INTERVAL 5
 #define REQUEST_RETRY_COUNT 2
 #define DUPLICATE_INTERVAL REQUEST_RETRY_INTERVAL *REQUEST_RETRY_COUNT
 #define MAX_CERT_DEPTH 5
 #define STATUS_SERVER_PERIOD 25
 #define IDLE_TIMEOUT 300
+/* seconds a server that could not be set up is kept before it is removed */
+#define FAILED_SERVER_HOLD 900
 #define PSK_MIN_LENGTH 16
 #define RSP_SECRET_LEN_WARN 10
 /* Older OpenSSL API had a 256 byte limit; keep this limit to maximize compatibility*/
 #define PSK_ID_MAX_LENGTH 256
 #define RSP_TLS_REKEY_INTERVAL 3600
+#define RESOLVER_THREADS 16
 
 /* Target value for stack size.
  * Some platforms might define higher minimums in PTHREAD_STACK_MIN. */
@@ -88,6 +103,12 @@ enum rsp_statsrv {
     RSP_STATSRV_AUTO
 };
 
+enum rsp_radiusversion {
+    RSP_RADIUS_V10 = 0, /* Default.  */
+    RSP_RADIUS_V11,
+    RSP_RADIUS_ANY
+};
+
 struct options {
     char *pidfile;
     char *logdestination;
@@ -109,6 +130,22 @@ struct options {
     uint8_t ipv6only;
     uint8_t sni;
     uint8_t verifyeap;
+    uint8_t socketfilter;
+    uint8_t upstreamthreads;
+    uint8_t lowmemory;
+    uint8_t acctdupinterval;
+    uint8_t *acctduptypes;
+    int acctduptypecount;
+    uint32_t memsoftlimit; /* MB, 0 for none */
+    uint32_t memhardlimit;
+    char *flightrecorder;
+    uint32_t flightrecordersize;
+    long listenrcvbuf; /* bytes, 0 for the kernel default */
+    long listensndbuf;
+    uint8_t sockettimestamps;
+    char *profiler;
+    int profilerseconds;
+    int profilerfrequency;
 };
 
 struct commonprotoopts {
@@ -117,28 +154,57 @@ struct commonprotoopts {
 };
 
 struct request {
-    struct timeval created;
-    uint32_t refcount;
+    /* taken and dropped by all threads handling the request */
     pthread_mutex_t refmutex;
+    uint32_t refcount;
+    struct timeval created CACHE_ALIGNED;
     uint8_t *buf, *replybuf;
     int buflen, replybuflen;
     struct radmsg *msg;
     struct client *from;
     struct server *to;
     char *origusername;
+    char *routeuser; /* User-Name the realm was found by, for failoverrq */
     uint8_t rqid;
     uint8_t rqauth[16];
-    uint8_t newid;
+    int rqidx; /* index in from->rqs */
+    int newid; /* index in to->requests */
+    uint8_t radius11; /* sent to server as RADIUS/1.1 */
     int udpsock; /* only for UDP */
+    uint8_t hasacctkey;
+    uint8_t acctkey[16]; /* identifies the accounting record, see acctdup.c */
+    uint8_t insink;      /* waiting for an accounting sink to persist it */
+    struct realm *realm; /* configured realm, whose share of to->requests it uses */
+    uint8_t inslots;     /* counted in to->realmslots */
+    uint32_t memcharge;  /* bytes charged to the memory budget */
+    uint8_t rqcode;      /* code of the request from the client */
+    uint8_t tries;       /* times sent to the server so far */
+    uint8_t recorded;    /* written to the flight recorder */
+    uint64_t received;   /* precise monotonic microseconds, for the flight recorder */
+};
+
+/* a request in the SharedDuplicateCache, by client address and RADIUS id */
+struct shareddup {
+    struct request *rq;
+    uint8_t addr[16]; /* IPv6 or IPv4-mapped address of the client, no port */
+    uint8_t id;
+};
+
+/* IDs of a server used by a configured realm, see realmslotstake() */
+struct realmslots {
+    uint32_t out;  /* outstanding requests */
+    uint32_t shed; /* requests dropped for exceeding the share or quota */
 };
 
-/* requests that our client will send */
+/* requests that our client will send, a cache line each since neighbouring
+ * slots are used by sendrq and the upstream reactor at the same time; keep
+ * the fields small enough that the slot does not spill into a second line */
 struct rqout {
-    pthread_mutex_t *lock;
+    pthread_mutex_t lock;
     struct request *rq;
+    uint32_t expiry; /* monotime() seconds */
     uint8_t tries;
-    struct timeval expiry;
-};
+} CACHE_ALIGNED;
 
 struct gqueue {
     struct list *entries;
@@ -180,6 +246,8 @@ struct clsrvconf {
     uint8_t keepalive;
     uint8_t loopprevention;
     uint8_t blockingstartup;
+    uint8_t failoverrqs;
+    uint8_t standby;
     struct rewrite *rewritein;
     struct rewrite *rewriteout;
     pthread_mutex_t *lock; /* only used for updating clients so far */
@@ -193,42 +261,68 @@ struct clsrvconf {
     long dtlsmtu;
     uint8_t reqmsgauth;
     uint8_t reqmsgauthproxy;
+    enum rsp_radiusversion radiusversion;
+    int maxpacketlen;
+    uint8_t shareddupcache;
+    struct shareddup *duprqs; /* SharedDuplicateCache, see shareddupfind() */
+    struct client *dupclient; /* stands in for closed connections in duprqs */
+    uint32_t acctduphits;     /* duplicate accounting requests answered locally */
+    long rcvbuf;              /* socket buffer sizes, 0 for the kernel default */
+    long sndbuf;
 };
 
 #include "tlscommon.h"
 
 struct client {
     struct clsrvconf *conf;
-    int sock;
-    SSL *ssl;
-    pthread_mutex_t lock;
-    struct request *rqs[MAX_REQUESTS];
+    struct request **rqs; /* allocated on first request with LowMemory */
+    int nrqs;
+    uint8_t radius11;
     struct gqueue *replyq;
     struct sockaddr *addr;
-    time_t expiry; /* for udp */
+    /* connection state, used by the reader and the writer */
+    pthread_mutex_t lock CACHE_ALIGNED;
+    int sock;
+    SSL *ssl;
     struct timeval tlsnewkey;
+    time_t expiry; /* for udp */
 };
 
 struct server {
     struct clsrvconf *conf;
+    struct upstreamsrv *upstream;
+    char *dynamiclookuparg;
+    struct rqout *requests;
+    int nrequests;
+    uint8_t radius11;
+    /* connection state, mostly written by the upstream reactor */
+    pthread_mutex_t lock CACHE_ALIGNED;
     int sock;
     SSL *ssl;
-    pthread_mutex_t lock;
-    pthread_t clientth;
-    uint8_t clientrdgone;
+    enum rsp_server_state state;
+    uint8_t lostrqs;
+    uint8_t statsrvrequested;
+    uint8_t conreset;
+    uint8_t standbyready; /* last logged state of a standby server */
     struct timeval connecttime;
     struct timeval lastreply;
     struct timeval tlsnewkey;
-    enum rsp_server_state state;
-    uint8_t lostrqs;
-    char *dynamiclookuparg;
-    int nextid;
     struct timeval lastrcv;
-    struct rqout *requests;
+    struct timeval laststatsrv;
+    struct radread rd;
+    struct radwrite wr;
+    uint32_t failovers; /* requests moved to other servers after losing the connection */
+    /* queueing of new requests, by sendrq in the client threads */
+    pthread_mutex_t newrq_mutex CACHE_ALIGNED;
+    int nextid;
+    uint32_t tokenseq;
     uint8_t newrq;
-    uint8_t conreset;
-    pthread_mutex_t newrq_mutex;
-    pthread_cond_t newrq_cond;
+    /* IDs in use per realm, by sendrq and when requests are done */
+    pthread_mutex_t realmslots_mutex CACHE_ALIGNED;
+    struct realmslots *realmslots; /* indexed by realm->slotsidx */
+    uint32_t realmslotsout;        /* sum of realmslots[].out */
+    uint32_t realmweight;          /* sum of the shares of realms with requests out */
+    time_t realmstarved;           /* monotime() a realm without requests out found no free ID */
 };
 
 struct realm {
@@ -236,6 +330,10 @@ struct realm {
     char *message;
     uint8_t accresp;
     uint8_t acclog;
+    struct acctsink *acctsink;
+    uint8_t share;    /* weight for the IDs of busy servers */
+    uint32_t quota;   /* max outstanding requests per server, 0 for no limit */
+    int slotsidx;     /* index in server->realmslots, configured realms only */
     regex_t regex;
     uint32_t refcount;
     pthread_mutex_t refmutex;
@@ -260,8 +358,9 @@ struct protodefs {
     char **(*getlistenerargs)(void);
     void *(*listener)(void *);
     int (*connecter)(struct server *, int, int);
-    void *(*clientconnreader)(void *);
+    int (*clientradget)(struct server *, uint8_t **);
     int (*clientradput)(struct server *, unsigned char *, int);
+    int (*clientradflush)(struct server *);
     void (*addclient)(struct client *);
     void (*addserverextra)(struct clsrvconf *);
     void (*setsrcres)(void);
@@ -275,15 +374,32 @@ struct clsrvconf *find_clconf_type(uint8_t type, struct list_node **cur);
 struct client *addclient(struct clsrvconf *conf, uint8_t lock);
 void removelockedclient(struct client *client);
 void removeclient(struct client *client);
+void removeclientrqs(struct client *client);
 struct gqueue *newqueue(void);
 struct request *newrequest(void);
+void stamprq(struct request *rq);
+void realmslotsadd(struct server *to, struct request *rq, int n);
+void realmslotsstarved(struct server *to, struct request *rq);
+int realmslotstake(struct server *to, struct request *rq, int ids);
+struct server *failoverserver(struct list *srvconfs, struct server *failed, struct request *rq);
+struct request *newrqref(struct request *rq);
 void freerq(struct request *rq);
+int addclientrq(struct request *rq);
 int radsrv(struct request *rq);
 int timeouth(struct server *server);
 int closeh(struct server *server);
 int replyh(struct server *server, uint8_t *buf, int buflen);
+int clientwrstart(struct server *server);
+time_t clientwrrun(struct server *server);
+void clientwrflush(struct server *server);
+void clientwrcleanup(struct server *server);
 struct addrinfo *resolve_hostport_addrinfo(uint8_t type, char *hostport);
 uint8_t *radattr2ascii(struct tlv *attr); /* TODO: mv this to radmsg? */
+int pwdhide(struct tlv *attr, uint8_t *secret, int secret_len, uint8_t *auth);
+int pwdreveal(struct tlv *attr, uint8_t *secret, int secret_len, uint8_t *auth);
+int tunnelpwdhide(struct tlv *attr, uint8_t *secret, int secret_len, uint8_t *auth);
+int tunnelpwdreveal(struct tlv *attr, uint8_t *secret, int secret_len, uint8_t *auth);
+int msmppeconvert(struct tlv *attr, uint8_t hide, uint8_t *secret, int secret_len, uint8_t *auth);
 extern pthread_attr_t pthread_attr;
 
 #endif /* _RADSECPROXY_H */
@@ -0,0 +1,230 @@
+/* Copyright (c) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+#include "sockfilter.h"
+#include "debug.h"
+#include "hostport.h"
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#ifdef __linux__
+#include <linux/filter.h>
+#endif
+
+#if defined(SO_ATTACH_FILTER) && defined(SKF_NET_OFF)
+
+struct srcprefix {
+    uint8_t addr[16];
+    uint8_t len;
+};
+
+static int prefixcmp(const void *a, const void *b) {
+    const struct srcprefix *pa = a, *pb = b;
+
+    if (pa->len != pb->len)
+        return pa->len - pb->len;
+    return memcmp(pa->addr, pb->addr, sizeof(pa->addr));
+}
+
+static void maskprefix(struct srcprefix *p) {
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        if (p->len >= 8 * (i + 1))
+            continue;
+        p->addr[i] &= p->len > 8 * i ? (uint8_t)(0xff << (8 - (p->len - 8 * i))) : 0;
+    }
+}
+
+static uint32_t prefixword(struct srcprefix *p, int w) {
+    return (uint32_t)p->addr[4 * w] << 24 | (uint32_t)p->addr[4 * w + 1] << 16 |
+           (uint32_t)p->addr[4 * w + 2] << 8 | p->addr[4 * w + 3];
+}
+
+static uint32_t wordmask(uint8_t len, int w) {
+    int bits = len - 32 * w;
+
+    if (bits >= 32)
+        return 0xffffffff;
+    if (bits <= 0)
+        return 0;
+    return 0xffffffff << (32 - bits);
+}
+
+/* collect the unique prefixes of family from all hostport lists, returns -1 on error, else count.
+ * *any is set if one of them matches all addresses */
+static int collectprefixes(int family, struct list *hostportlists, struct srcprefix **prefixes, int *any) {
+    struct list_node *lentry, *hentry;
+    struct hostportres *hp;
+    struct addrinfo *ai;
+    struct srcprefix *p;
+    int count = 0, size = 0, i, j;
+    uint8_t maxlen = family == AF_INET ? 32 : 128;
+
+    *prefixes = NULL;
+    *any = 0;
+    for (lentry = list_first(hostportlists); lentry; lentry = list_next(lentry)) {
+        for (hentry = list_first((struct list *)lentry->data); hentry; hentry = list_next(hentry)) {
+            hp = (struct hostportres *)hentry->data;
+            for (ai = hp->addrinfo; ai; ai = ai->ai_next) {
+                if (ai->ai_family != family)
+                    continue;
+                if (count == size) {
+                    size = size ? 2 * size : 64;
+                    p = realloc(*prefixes, size * sizeof(struct srcprefix));
+                    if (!p) {
+                        free(*prefixes);
+                        *prefixes = NULL;
+                        return -1;
+                    }
+                    *prefixes = p;
+                }
+                p = &(*prefixes)[count++];
+                memset(p, 0, sizeof(struct srcprefix));
+                if (family == AF_INET)
+                    memcpy(p->addr, &((struct sockaddr_in *)ai->ai_addr)->sin_addr, 4);
+                else
+                    memcpy(p->addr, &((struct sockaddr_in6 *)ai->ai_addr)->sin6_addr, 16);
+                p->len = hp->prefixlen == 255 || hp->prefixlen > maxlen ? maxlen : hp->prefixlen;
+                if (!p->len)
+                    *any = 1;
+                maskprefix(p);
+            }
+        }
+    }
+    if (!count)
+        return 0;
+
+    qsort(*prefixes, count, sizeof(struct srcprefix), prefixcmp);
+    for (i = 1, j = 0; i < count; i++)
+        if (prefixcmp(&(*prefixes)[i], &(*prefixes)[j]))
+            (*prefixes)[++j] = (*prefixes)[i];
+    return j + 1;
+}
+
+#define EMIT(c, t, f, kk)                                                            \
+    do {                                                                             \
+        if (n == SOCKFILTER_MAXINSNS)                                                \
+            return -1;                                                               \
+        prog[n].code = (c);                                                          \
+        prog[n].jt = (t);                                                            \
+        prog[n].jf = (f);                                                            \
+        prog[n].k = (kk);                                                            \
+        n++;                                                                         \
+    } while (0)
+
+/* Prefixes are sorted by length. IPv4 prefixes of the same length are checked
+ * by loading and masking the source address once, followed by runs of up to
+ * 255 compares sharing one accept, as conditional jumps reach 255 instructions
+ * at most. IPv6 prefixes are checked one at a time, word by word. */
+static int buildfilter(int family, struct srcprefix *prefixes, int count, struct sock_filter *prog) {
+    int n = 0, i, j, run, w, v, words, skip;
+    uint32_t srcoff = family == AF_INET ? 12 : 8;
+
+    if (family == AF_INET) {
+        for (i = 0; i < count; i = j) {
+            EMIT(BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_NET_OFF + srcoff);
+            if (prefixes[i].len < 32)
+                EMIT(BPF_ALU | BPF_AND | BPF_K, 0, 0, wordmask(prefixes[i].len, 0));
+            for (j = i; j < count && prefixes[j].len == prefixes[i].len;) {
+                for (run = 0; run < 255 && j + run < count && prefixes[j + run].len == prefixes[i].len;)
+                    run++;
+                for (w = 0; w < run; w++)
+                    EMIT(BPF_JMP | BPF_JEQ | BPF_K, run - w, 0, prefixword(&prefixes[j + w], 0));
+                EMIT(BPF_JMP | BPF_JA, 0, 0, 1);
+                EMIT(BPF_RET | BPF_K, 0, 0, 0xffffffff);
+                j += run;
+            }
+        }
+    } else {
+        for (i = 0; i < count; i++) {
+            words = (prefixes[i].len + 31) / 32;
+            for (w = 0; w < words; w++) {
+                EMIT(BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_NET_OFF + srcoff + 4 * w);
+                if (wordmask(prefixes[i].len, w) != 0xffffffff)
+                    EMIT(BPF_ALU | BPF_AND | BPF_K, 0, 0, wordmask(prefixes[i].len, w));
+                /* on mismatch, skip the checks of the remaining words and the accept */
+                for (skip = 1, v = w + 1; v < words; v++)
+                    skip += wordmask(prefixes[i].len, v) == 0xffffffff ? 2 : 3;
+                EMIT(BPF_JMP | BPF_JEQ | BPF_K, 0, skip, prefixword(&prefixes[i], w));
+            }
+            EMIT(BPF_RET | BPF_K, 0, 0, 0xffffffff);
+        }
+    }
+    EMIT(BPF_RET | BPF_K, 0, 0, 0);
+    return n;
+}
+#undef EMIT
+
+/**
+ * @brief Attach a socket filter that drops datagrams from sources not covered by any
+ * of the hostports, so that unknown peers are dropped by the kernel.
+ * If no filter is needed or it cannot be built, any existing filter is removed.
+ *
+ * @param s the socket
+ * @param family address family of the socket
+ * @param hostportlists list of resolved hostport lists that may send to the socket
+ * @return 1 if a filter is attached, 0 otherwise
+ */
+int attachsourcefilter(int s, int family, struct list *hostportlists) {
+    struct srcprefix *prefixes;
+    struct sock_filter *prog;
+    struct sock_fprog fprog;
+    int count, any, len, dummy = 0;
+
+    if (family != AF_INET && family != AF_INET6)
+        return 0;
+    count = collectprefixes(family, hostportlists, &prefixes, &any);
+    if (count < 0) {
+        debug(DBG_ERR, "attachsourcefilter: malloc failed");
+        goto detach;
+    }
+    if (any) {
+        free(prefixes);
+        goto detach;
+    }
+    prog = calloc(SOCKFILTER_MAXINSNS, sizeof(struct sock_filter));
+    if (!prog) {
+        free(prefixes);
+        debug(DBG_ERR, "attachsourcefilter: malloc failed");
+        goto detach;
+    }
+    len = buildfilter(family, prefixes, count, prog);
+    free(prefixes);
+    if (len < 0) {
+        free(prog);
+        debug(DBG_WARN, "attachsourcefilter: too many peers for a socket filter on socket %d, not filtering", s);
+        goto detach;
+    }
+
+    fprog.len = len;
+    fprog.filter = prog;
+    if (setsockopt(s, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog))) {
+        debugerrno(errno, DBG_WARN, "attachsourcefilter: SO_ATTACH_FILTER failed on socket %d", s);
+        free(prog);
+        return 0;
+    }
+    free(prog);
+    debug(DBG_DBG, "attachsourcefilter: attached filter for %d prefixes (%d instructions) to socket %d", count, len, s);
+    return 1;
+
+detach:
+    setsockopt(s, SOL_SOCKET, SO_DETACH_FILTER, &dummy, sizeof(dummy));
+    return 0;
+}
+
+#else
+
+int attachsourcefilter(int s, int family, struct list *hostportlists) {
+    debug(DBG_WARN, "attachsourcefilter: socket filters are not supported on this platform");
+    return 0;
+}
+
+#endif
+
+/* Local Variables: */
+/* c-file-style: "stroustrup" */
+/* End: */
@@ -0,0 +1,18 @@
+/* Copyright (c) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+#ifndef _SOCKFILTER_H
+#define _SOCKFILTER_H
+
+#include "list.h"
+
+/* max number of instructions of a socket filter program, as BPF_MAXINSNS on Linux */
+#define SOCKFILTER_MAXINSNS 4096
+
+int attachsourcefilter(int s, int family, struct list *hostportlists);
+
+#endif /* _SOCKFILTER_H */
+
+/* Local Variables: */
+/* c-file-style: "stroustrup" */
+/* End: */
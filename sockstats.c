@@ -0,0 +1,191 @@
+/* Copyright (c) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+/* Telemetry for the datagram sockets we read from. The kernel reports how
+ * many packets it dropped on a socket (SO_RXQ_OVFL), because the receive
+ * buffer was full or the SocketFilter rejected them, and, optionally, when
+ * each packet arrived (SO_TIMESTAMPNS), which tells how long packets wait in
+ * the receive queue before a reader thread gets to them. Both come as
+ * control messages with the packet, so reading them costs no extra system
+ * call. Every socket has one reader thread, so the lock of each socket is
+ * only taken by it and sockstats_log. */
+
+#include "sockstats.h"
+#include "debug.h"
+#include "list.h"
+#include "util.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct list *socks;
+static int timestamps;
+
+static void enabletimestamps(int sock) {
+#ifdef SO_TIMESTAMPNS
+    int on = 1;
+
+    if (setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) == -1)
+        debugerrno(errno, DBG_WARN, "sockstats: SO_TIMESTAMPNS");
+#endif
+}
+
+/**
+ * @brief record receive queue delays on all sockets, registered or not yet
+ *
+ * @param on non-zero to enable
+ */
+void sockstats_timestamps(int on) {
+    struct list_node *entry;
+
+#ifndef SO_TIMESTAMPNS
+    if (on)
+        debug(DBG_WARN, "sockstats_timestamps: receive timestamps not supported on this platform");
+#endif
+    pthread_mutex_lock(&lock);
+    if (on && !timestamps)
+        for (entry = list_first(socks); entry; entry = list_next(entry))
+            enabletimestamps(((struct sockstats *)entry->data)->sock);
+    timestamps = on;
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * @brief register a datagram socket and ask the kernel for its telemetry
+ *
+ * @param sock the socket
+ * @param name how the socket is called in the log
+ * @return the statistics of the socket, NULL on malloc failure
+ */
+struct sockstats *sockstats_add(int sock, const char *name) {
+    struct sockstats *st;
+#ifdef SO_RXQ_OVFL
+    int on = 1;
+
+    if (setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)) == -1)
+        debugerrno(errno, DBG_WARN, "sockstats_add: SO_RXQ_OVFL");
+#endif
+
+    st = calloc(1, sizeof(struct sockstats));
+    if (!st)
+        return NULL;
+    st->sock = sock;
+    st->name = stringcopy(name, 0);
+    pthread_mutex_init(&st->lock, NULL);
+    pthread_mutex_lock(&lock);
+    if (!socks)
+        socks = list_create();
+    if (!st->name || !socks || !list_push(socks, st)) {
+        pthread_mutex_unlock(&lock);
+        pthread_mutex_destroy(&st->lock);
+        free(st->name);
+        free(st);
+        return NULL;
+    }
+    if (timestamps)
+        enabletimestamps(sock);
+    pthread_mutex_unlock(&lock);
+    return st;
+}
+
+/**
+ * @brief look up the statistics of a registered socket
+ *
+ * @param sock the socket
+ * @return the statistics, NULL if the socket is not registered
+ */
+struct sockstats *sockstats_find(int sock) {
+    struct list_node *entry;
+    struct sockstats *st = NULL;
+
+    pthread_mutex_lock(&lock);
+    for (entry = list_first(socks); entry; entry = list_next(entry))
+        if (((struct sockstats *)entry->data)->sock == sock) {
+            st = (struct sockstats *)entry->data;
+            break;
+        }
+    pthread_mutex_unlock(&lock);
+    return st;
+}
+
+/**
+ * @brief account a packet, taking the telemetry from its control messages
+ *
+ * @param st the statistics of the socket, nothing is done if NULL
+ * @param msg the message as returned by recvmsg
+ */
+void sockstats_update(struct sockstats *st, struct msghdr *msg) {
+    struct cmsghdr *cmsg;
+#ifdef SCM_TIMESTAMPNS
+    struct timespec ts, now;
+    int64_t delay;
+#endif
+
+    if (!st)
+        return;
+    pthread_mutex_lock(&st->lock);
+    st->packets++;
+    for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET)
+            continue;
+#ifdef SO_RXQ_OVFL
+        if (cmsg->cmsg_type == SO_RXQ_OVFL)
+            memcpy(&st->drops, CMSG_DATA(cmsg), sizeof(uint32_t));
+#endif
+#ifdef SCM_TIMESTAMPNS
+        if (cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            /* the kernel stamps packets with the wall-clock time */
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+            clock_gettime(CLOCK_REALTIME, &now);
+            delay = (int64_t)(now.tv_sec - ts.tv_sec) * 1000000 + (now.tv_nsec - ts.tv_nsec) / 1000;
+            if (delay < 0)
+                delay = 0;
+            st->qdelaysum += delay;
+            st->qdelayn++;
+            if (delay > st->qdelaymax)
+                st->qdelaymax = delay > UINT32_MAX ? UINT32_MAX : delay;
+        }
+#endif
+    }
+    pthread_mutex_unlock(&st->lock);
+}
+
+/**
+ * @brief log the statistics of all registered sockets, the maximum queue
+ * delay is reset so that every dump shows the maximum since the last one
+ */
+void sockstats_log(void) {
+    struct list_node *entry;
+    struct sockstats *st;
+    int rcvbuf, sndbuf;
+    socklen_t len;
+
+    pthread_mutex_lock(&lock);
+    for (entry = list_first(socks); entry; entry = list_next(entry)) {
+        st = (struct sockstats *)entry->data;
+        len = sizeof(rcvbuf);
+        if (getsockopt(st->sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &len))
+            rcvbuf = -1;
+        len = sizeof(sndbuf);
+        if (getsockopt(st->sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, &len))
+            sndbuf = -1;
+        pthread_mutex_lock(&st->lock);
+        if (st->qdelayn)
+            debug(DBG_NOTICE, "sockstats: %s: %llu packets, %u kernel drops (buffer overflow or socket filter, %u since last), receive queue delay avg %lluus max %uus, rcvbuf %d sndbuf %d",
+                  st->name, (unsigned long long)st->packets, st->drops, st->drops - st->dropslast,
+                  (unsigned long long)(st->qdelaysum / st->qdelayn), st->qdelaymax, rcvbuf, sndbuf);
+        else
+            debug(DBG_NOTICE, "sockstats: %s: %llu packets, %u kernel drops (buffer overflow or socket filter, %u since last), rcvbuf %d sndbuf %d",
+                  st->name, (unsigned long long)st->packets, st->drops, st->drops - st->dropslast, rcvbuf, sndbuf);
+        st->dropslast = st->drops;
+        st->qdelaymax = 0;
+        pthread_mutex_unlock(&st->lock);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/* Local Variables: */
+/* c-file-style: "stroustrup" */
+/* End: */
@@ -0,0 +1,37 @@
+/* Copyright (c) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+#ifndef _SOCKSTATS_H
+#define _SOCKSTATS_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <time.h>
+
+/* control buffer space needed for the messages read by sockstats_update */
+#define SOCKSTATS_CMSG_SPACE (CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(uint32_t)))
+
+struct sockstats {
+    pthread_mutex_t lock;
+    int sock;
+    char *name;
+    uint64_t packets;
+    uint32_t drops;     /* kernel drop counter, from SO_RXQ_OVFL */
+    uint32_t dropslast; /* drops at the last sockstats_log */
+    uint64_t qdelaysum; /* microseconds spent in the receive queue */
+    uint64_t qdelayn;
+    uint32_t qdelaymax;
+};
+
+void sockstats_timestamps(int on);
+struct sockstats *sockstats_add(int sock, const char *name);
+struct sockstats *sockstats_find(int sock);
+void sockstats_update(struct sockstats *st, struct msghdr *msg);
+void sockstats_log(void);
+
+#endif /* _SOCKSTATS_H */
+
+/* Local Variables: */
+/* c-file-style: "stroustrup" */
+/* End: */
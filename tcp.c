@@ -3,6 +3,8 @@
  * Copyright (c) 2023, SWITCH */
 /* See LICENSE for licensing information. */
 
+#include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <netdb.h>
 #include <netinet/in.h>
@@ -10,9 +12,6 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <unistd.h>
-#ifdef SYS_SOLARIS
-#include <fcntl.h>
-#endif
 #include "hostport.h"
 #include "list.h"
 #include "radsecproxy.h"
@@ -27,13 +26,15 @@
 
 #ifdef RADPROT_TCP
 #include "debug.h"
+#include "threadreg.h"
 #include "util.h"
 static void setprotoopts(struct commonprotoopts *opts);
 static char **getlistenerargs(void);
 void *tcplistener(void *arg);
 int tcpconnect(struct server *server, int timeout, int reconnect);
-void *tcpclientrd(void *arg);
+int clientradgettcp(struct server *server, uint8_t **buf);
 int clientradputtcp(struct server *server, unsigned char *rad, int radlen);
+int clientradflushtcp(struct server *server);
 void tcpsetsrcres(void);
 
 static const struct protodefs protodefs = {
@@ -50,8 +51,9 @@ static const struct protodefs protodefs = {
     getlistenerargs,                             /* getlistenerargs */
     tcplistener,                                 /* listener */
     tcpconnect,                                  /* connecter */
-    tcpclientrd,                                 /* clientconnreader */
+    clientradgettcp,                             /* clientradget */
     clientradputtcp,                             /* clientradput */
+    clientradflushtcp,                           /* clientradflush */
     NULL,                                        /* addclient */
     NULL,                                        /* addserverextra */
     tcpsetsrcres,                                /* setsrcres */
@@ -101,7 +103,7 @@ int tcpconnect(struct server *server, int timeout, int reconnect) {
             debug(DBG_WARN, "tcpconnect: could not resolve source address to bind for server %s, using default", server->conf->name);
     }
 
-    gettimeofday(&start, NULL);
+    monotime(&start);
 
     for (;;) {
         if (server->sock >= 0)
@@ -109,7 +111,7 @@ int tcpconnect(struct server *server, int timeout, int reconnect) {
         server->sock = -1;
 
         wait = connect_wait(start, server->connecttime, firsttry);
-        gettimeofday(&now, NULL);
+        monotime(&now);
         if (timeout && (now.tv_sec - start.tv_sec) + wait > timeout) {
             debug(DBG_DBG, "tcpconnect: timeout");
             if (source)
@@ -118,7 +120,7 @@ int tcpconnect(struct server *server, int timeout, int reconnect) {
         }
         if (wait)
             debug(DBG_INFO, "Next connection attempt to %s in %lds", server->conf->name, wait);
-        sleep(wait);
+        connect_sleep(wait);
         firsttry = 0;
 
         for (entry = list_first(server->conf->hostports); entry; entry = list_next(entry)) {
@@ -136,16 +138,21 @@ int tcpconnect(struct server *server, int timeout, int reconnect) {
 
         if (server->conf->keepalive)
             enable_keepalive(server->sock);
+        set_sockbufs(server->sock, server->conf->rcvbuf, server->conf->sndbuf);
+        /* the upstream reactor must never block on a slow server */
+        if (fcntl(server->sock, F_SETFL, fcntl(server->sock, F_GETFL) | O_NONBLOCK) == -1)
+            debugerrno(errno, DBG_WARN, "tcpconnect: failed to set O_NONBLOCK");
         break;
     }
-    gettimeofday(&server->connecttime, NULL);
+    monotime(&server->connecttime);
     pthread_mutex_lock(&server->lock);
+    /* whatever was queued for the previous connection is resent as a whole */
+    radwritereset(&server->wr);
     server->state = RSP_SERVER_STATE_CONNECTED;
     server->lostrqs = 0;
     pthread_mutex_unlock(&server->lock);
     pthread_mutex_lock(&server->newrq_mutex);
     server->conreset = reconnect;
-    pthread_cond_signal(&server->newrq_cond);
     pthread_mutex_unlock(&server->newrq_mutex);
 
     if (source)
@@ -165,7 +172,9 @@ int tcpreadtimeout(int s, unsigned char *buf, int num, int timeout) {
     for (len = 0; len < num; len += cnt) {
         fds[0].fd = s;
         fds[0].events = POLLIN;
-        ndesc = poll(fds, 1, timeout ? timeout * 1000 : -1);
+        do
+            ndesc = poll(fds, 1, timeout ? timeout * 1000 : -1);
+        while (ndesc < 0 && errno == EINTR);
         if (ndesc < 1)
             return ndesc;
 
@@ -181,7 +190,7 @@ int tcpreadtimeout(int s, unsigned char *buf, int num, int timeout) {
 
 /* timeout in seconds, 0 means no timeout (blocking)
    return 0 on timeout, <0 on error */
-int radtcpget(int s, int timeout, uint8_t **buf) {
+int radtcpget(int s, int timeout, int maxlen, uint8_t **buf) {
     int cnt, len;
     unsigned char init_buf[4];
 
@@ -191,7 +200,7 @@ int radtcpget(int s, int timeout, uint8_t **buf) {
         return cnt;
     }
 
-    len = get_checked_rad_length(init_buf);
+    len = get_checked_rad_length_max(init_buf, maxlen);
     if (len <= 0) {
         debug(DBG_ERR, "radtcpget: invalid message length (%d)! closing connection!", -len);
         return len;
@@ -215,8 +224,21 @@ int radtcpget(int s, int timeout, uint8_t **buf) {
     return len;
 }
 
+static int tcpwritenb(void *ctx, const uint8_t *buf, int num) {
+    int cnt = write(*(int *)ctx, buf, num);
+
+    if (cnt >= 0)
+        return cnt;
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        return 0;
+    debugerrno(errno, DBG_ERR, "clientradputtcp: write error");
+    return -1;
+}
+
+/* called from the upstream reactor, never blocks; what the socket does not
+   take is queued and written by clientradflushtcp */
 int clientradputtcp(struct server *server, unsigned char *rad, int radlen) {
-    int cnt;
+    int ret, queued;
     struct clsrvconf *conf = server->conf;
 
     if (radlen <= 0) {
@@ -228,44 +250,44 @@ int clientradputtcp(struct server *server, unsigned char *rad, int radlen) {
         pthread_mutex_unlock(&server->lock);
         return 0;
     }
-    if ((cnt = write(server->sock, rad, radlen)) <= 0) {
-        debug(DBG_ERR, "clientradputtcp: write error");
-        pthread_mutex_unlock(&server->lock);
+    ret = radwritenb(&server->wr, tcpwritenb, &server->sock, rad, radlen);
+    queued = server->wr.len - server->wr.off;
+    pthread_mutex_unlock(&server->lock);
+    if (ret < 1) {
+        if (!ret)
+            debug(DBG_WARN, "clientradputtcp: %d bytes already queued for TCP peer %s", queued, conf->name);
         return 0;
     }
-    debug(DBG_DBG, "clientradputtcp: Sent %d bytes, Radius packet of length %zu to TCP peer %s", cnt, radlen, conf->name);
-    pthread_mutex_unlock(&server->lock);
+    debug(DBG_DBG, "clientradputtcp: Sent Radius packet of length %d to TCP peer %s, %d bytes queued", radlen, conf->name, queued);
     return 1;
 }
 
-void *tcpclientrd(void *arg) {
-    struct server *server = (struct server *)arg;
-    unsigned char *buf;
-    int len = 0;
+/* called from the upstream reactor when the socket is writable
+   returns the number of bytes still queued, <0 on error */
+int clientradflushtcp(struct server *server) {
+    int ret;
 
-    for (;;) {
-        len = radtcpget(server->sock, server->conf->retryinterval * (server->conf->retrycount + 1), &buf);
-        if (buf && len > 0) {
-            if (!replyh(server, buf, len))
-                if (closeh(server))
-                    break;
-            buf = NULL;
-        } else if (len == 0) {
-            if (timeouth(server))
-                break;
-        } else {
-            if (closeh(server))
-                break;
-        }
-    }
-    shutdown(server->sock, SHUT_RDWR);
-    close(server->sock);
+    pthread_mutex_lock(&server->lock);
+    ret = server->state == RSP_SERVER_STATE_CONNECTED ? radflushnb(&server->wr, tcpwritenb, &server->sock) : 0;
+    pthread_mutex_unlock(&server->lock);
+    return ret;
+}
 
-    server->clientrdgone = 1;
-    pthread_mutex_lock(&server->newrq_mutex);
-    pthread_cond_signal(&server->newrq_cond);
-    pthread_mutex_unlock(&server->newrq_mutex);
-    return NULL;
+static int tcpreadnb(void *ctx, uint8_t *buf, int num) {
+    int cnt = recv(*(int *)ctx, buf, num, MSG_DONTWAIT);
+
+    if (cnt > 0)
+        return cnt;
+    if (cnt < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return 0;
+    debug(DBG_DBG, cnt ? "clientradgettcp: connection lost" : "clientradgettcp: connection closed");
+    return -1;
+}
+
+/* called from the upstream reactor when the socket is readable, never blocks
+   returns the message length, 0 if the message is not complete yet, <0 on error */
+int clientradgettcp(struct server *server, uint8_t **buf) {
+    return radreadnb(&server->rd, tcpreadnb, &server->sock, server->conf->maxpacketlen, buf);
 }
 
 void *tcpserverwr(void *arg) {
@@ -275,6 +297,7 @@ void *tcpserverwr(void *arg) {
     struct request *reply;
     char tmp[INET6_ADDRSTRLEN];
 
+    threadreg_name("tcpwr:%s", client->conf->name);
     debug(DBG_DBG, "tcpserverwr: starting for %s", addr2string(client->addr, tmp, sizeof(tmp)));
     replyq = client->replyq;
     for (;;) {
@@ -319,7 +342,7 @@ void tcpserverrd(struct client *client) {
     }
 
     for (;;) {
-        len = radtcpget(client->sock, 0, &buf);
+        len = radtcpget(client->sock, 0, client->conf->maxpacketlen, &buf);
         if (!buf || !len) {
             debug(DBG_ERR, "tcpserverrd: connection from %s lost", addr2string(client->addr, tmp, sizeof(tmp)));
             break;
@@ -365,9 +388,11 @@ void *tcpservernew(void *arg) {
         goto exit;
     }
     debug(DBG_WARN, "tcpservernew: incoming TCP connection from %s", addr2string((struct sockaddr *)&from, tmp, sizeof(tmp)));
+    threadreg_name("tcprd:%s", tmp);
 
     conf = find_clconf(handle, (struct sockaddr *)&from, NULL, NULL);
     if (conf) {
+        threadreg_name("tcprd:%s", conf->name);
         client = addclient(conf, 1);
         if (client) {
             if (conf->keepalive)
@@ -408,6 +433,7 @@ void tcpaccept(int s) {
 }
 
 void *tcplistener(void *arg) {
+    threadreg_name("tcplisten");
     accepttcp(*(int *)arg, tcpaccept);
     free(arg);
     return NULL;
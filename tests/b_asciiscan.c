@@ -0,0 +1,60 @@
+/* Copyright (C) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+/* Microbenchmark for the printable ascii scanners; run with "make bench". */
+
+#include "../asciiscan.h"
+#include "../radsecproxy.h"
+#include "../util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define ROUNDS 2000000
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    int count, i, r;
+    const struct asciiscanimpl *impls = asciiscanimpls(&count);
+    unsigned char buf[253];
+    struct tlv attr;
+    size_t sum = 0;
+    double start;
+    uint8_t *s;
+
+    /* a typical user name, long enough to exercise the vector loops */
+    memset(buf, 'x', sizeof(buf));
+    memcpy(buf, "someone.with.a.rather.long.name@department.example.org", 54);
+
+    for (i = 0; i < count; i++) {
+        start = now();
+        for (r = 0; r < ROUNDS; r++)
+            sum += impls[i].printablespan(buf, sizeof(buf) - (r & 7));
+        printf("printablespan %-8s %6.1f ns/call\n", impls[i].name, (now() - start) * 1e9 / ROUNDS);
+    }
+
+    start = now();
+    for (r = 0; r < ROUNDS; r++)
+        sum += verifyutf8(buf, sizeof(buf) - (r & 7));
+    printf("verifyutf8 (%s) %6.1f ns/call\n", asciiscanimplname(), (now() - start) * 1e9 / ROUNDS);
+
+    buf[100] = 0x01;
+    attr.t = 1;
+    attr.l = sizeof(buf);
+    attr.v = buf;
+    start = now();
+    for (r = 0; r < ROUNDS / 10; r++) {
+        s = radattr2ascii(&attr);
+        sum += s[0];
+        free(s);
+    }
+    printf("radattr2ascii (%s) %6.1f ns/call\n", asciiscanimplname(), (now() - start) * 1e9 / (ROUNDS / 10));
+
+    return sum == 0;
+}
@@ -0,0 +1,100 @@
+/* Copyright (C) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+/* Threads taking and releasing neighbouring slots of a server request table,
+ * as sendrq and the upstream reactor do, with the slots packed and their locks
+ * allocated one by one (the former layout) and with one cache line per slot
+ * (struct rqout); run with "make bench". */
+
+#include "../radsecproxy.h"
+#include "../util.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SECONDS 0.5
+#define MAX_THREADS 8
+
+struct packedrqout {
+    pthread_mutex_t *lock;
+    struct request *rq;
+    uint8_t tries;
+    struct timeval expiry;
+};
+
+static struct packedrqout packed[MAX_REQUESTS];
+static struct rqout *aligned;
+static volatile int running;
+
+struct worker {
+    int slot, layout;
+    long count;
+    pthread_t thread;
+} CACHE_ALIGNED;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *run(void *arg) {
+    struct worker *w = arg;
+    struct request *rq = (struct request *)w;
+
+    while (running) {
+        if (w->layout) {
+            pthread_mutex_lock(&aligned[w->slot].lock);
+            aligned[w->slot].rq = aligned[w->slot].rq ? NULL : rq;
+            aligned[w->slot].tries++;
+            pthread_mutex_unlock(&aligned[w->slot].lock);
+        } else {
+            pthread_mutex_lock(packed[w->slot].lock);
+            packed[w->slot].rq = packed[w->slot].rq ? NULL : rq;
+            packed[w->slot].tries++;
+            pthread_mutex_unlock(packed[w->slot].lock);
+        }
+        w->count++;
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    struct worker workers[MAX_THREADS];
+    int n, i, layout;
+    long total;
+    double start;
+
+    aligned = alignedcalloc(CACHE_LINE, MAX_REQUESTS, sizeof(struct rqout));
+    if (!aligned)
+        return 1;
+    for (i = 0; i < MAX_REQUESTS; i++) {
+        packed[i].lock = malloc(sizeof(pthread_mutex_t));
+        pthread_mutex_init(packed[i].lock, NULL);
+        pthread_mutex_init(&aligned[i].lock, NULL);
+    }
+
+    for (layout = 0; layout < 2; layout++) {
+        for (n = 1; n <= MAX_THREADS; n *= 2) {
+            memset(workers, 0, sizeof(workers));
+            running = 1;
+            start = now();
+            for (i = 0; i < n; i++) {
+                workers[i].slot = i;
+                workers[i].layout = layout;
+                pthread_create(&workers[i].thread, NULL, run, &workers[i]);
+            }
+            usleep(SECONDS * 1000000);
+            running = 0;
+            for (total = 0, i = 0; i < n; i++) {
+                pthread_join(workers[i].thread, NULL);
+                total += workers[i].count;
+            }
+            printf("rqout slots %-7s %d threads %8.0f kops/s per thread\n", layout ? "aligned" : "packed", n, total / (now() - start) / n / 1000);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,153 @@
+/* Copyright (C) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+/* TLS handshakes per second over in-memory BIO pairs sharing one SSL_CTX
+ * pair, for a growing number of threads; run with "make bench". Pass -p to
+ * pre-fetch the algorithms as radsecproxy does at startup (sslinit). */
+
+#include "../debug.h"
+#include "../radsecproxy.h"
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SECONDS 1.0
+#define MAX_THREADS 16
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+
+static SSL_CTX *srvctx, *cltctx;
+static volatile int running;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int handshake(void) {
+    SSL *srv, *clt;
+    BIO *sbio, *cbio;
+    int sdone = 0, cdone = 0, r, i;
+
+    srv = SSL_new(srvctx);
+    clt = SSL_new(cltctx);
+    if (!srv || !clt || !BIO_new_bio_pair(&sbio, 0, &cbio, 0))
+        return 0;
+    SSL_set_bio(srv, sbio, sbio);
+    SSL_set_bio(clt, cbio, cbio);
+    SSL_set_accept_state(srv);
+    SSL_set_connect_state(clt);
+    for (i = 0; i < 10 && !(sdone && cdone); i++) {
+        if (!cdone) {
+            r = SSL_do_handshake(clt);
+            if (r == 1)
+                cdone = 1;
+            else if (SSL_get_error(clt, r) != SSL_ERROR_WANT_READ)
+                break;
+        }
+        if (!sdone) {
+            r = SSL_do_handshake(srv);
+            if (r == 1)
+                sdone = 1;
+            else if (SSL_get_error(srv, r) != SSL_ERROR_WANT_READ)
+                break;
+        }
+    }
+    SSL_free(srv);
+    SSL_free(clt);
+    return sdone && cdone;
+}
+
+static void *worker(void *arg) {
+    long *count = arg;
+
+    while (running)
+        if (handshake())
+            (*count)++;
+    return NULL;
+}
+
+static int mkctx(void) {
+    EVP_PKEY *key;
+    X509 *cert;
+
+    key = EVP_EC_gen("P-256");
+    cert = X509_new();
+    if (!key || !cert)
+        return 0;
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+    X509_set_pubkey(cert, key);
+    X509_NAME_add_entry_by_txt(X509_get_subject_name(cert), "CN", MBSTRING_ASC, (unsigned char *)"bench", -1, -1, 0);
+    X509_set_issuer_name(cert, X509_get_subject_name(cert));
+    if (!X509_sign(cert, key, EVP_sha256()))
+        return 0;
+
+    srvctx = SSL_CTX_new(TLS_server_method());
+    cltctx = SSL_CTX_new(TLS_client_method());
+    if (!srvctx || !cltctx || !SSL_CTX_use_certificate(srvctx, cert) || !SSL_CTX_use_PrivateKey(srvctx, key))
+        return 0;
+    /* full handshakes only, as for new radsecproxy connections */
+    SSL_CTX_set_session_cache_mode(srvctx, SSL_SESS_CACHE_OFF);
+    SSL_CTX_set_num_tickets(srvctx, 0);
+    SSL_CTX_set_verify(cltctx, SSL_VERIFY_NONE, NULL);
+    X509_free(cert);
+    EVP_PKEY_free(key);
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    pthread_t threads[MAX_THREADS];
+    long counts[MAX_THREADS];
+    int prefetch = argc > 1 && !strcmp(argv[1], "-p");
+    int n, i;
+    long total;
+    double start;
+
+    debug_init("b_tlshs");
+    debug_set_level(1);
+    if (prefetch)
+        sslinit();
+    else
+        OPENSSL_init_ssl(0, NULL);
+    if (!mkctx()) {
+        ERR_print_errors_fp(stderr);
+        return 1;
+    }
+
+    for (n = 1; n <= MAX_THREADS; n *= 2) {
+        memset(counts, 0, sizeof(counts));
+        running = 1;
+        start = now();
+        for (i = 0; i < n; i++)
+            pthread_create(&threads[i], NULL, worker, &counts[i]);
+        usleep(SECONDS * 1000000);
+        running = 0;
+        for (total = 0, i = 0; i < n; i++) {
+            pthread_join(threads[i], NULL);
+            total += counts[i];
+        }
+        printf("tls handshakes %s %2d threads %8.0f /s\n", prefetch ? "prefetched" : "on demand ", n, total / (now() - start));
+    }
+    SSL_CTX_free(srvctx);
+    SSL_CTX_free(cltctx);
+    return 0;
+}
+
+#else
+
+int main(int argc, char *argv[]) {
+    printf("tls handshakes: needs OpenSSL 3\n");
+    return 0;
+}
+
+#endif
@@ -0,0 +1,112 @@
+/* Copyright (C) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+#include "../acctdup.h"
+#include "../debug.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const uint8_t types[] = {RAD_Attr_Acct_Session_Id, RAD_Attr_Acct_Status_Type, RAD_Attr_Acct_Input_Octets};
+
+static struct radmsg *makeacct(uint8_t id, const char *sessionid, uint8_t delay, uint8_t octets, int reversed) {
+    struct radmsg *msg;
+    uint8_t status[4] = {0, 0, 0, RAD_Acct_Status_Interim_Update};
+    uint8_t val[4] = {0, 0, 0, 0};
+
+    msg = radmsg_init(RAD_Accounting_Request, id, NULL);
+    if (sessionid && !reversed)
+        radmsg_add(msg, maketlv(RAD_Attr_Acct_Session_Id, strlen(sessionid), (void *)sessionid), 0);
+    radmsg_add(msg, maketlv(RAD_Attr_Acct_Status_Type, 4, status), 0);
+    val[3] = delay;
+    radmsg_add(msg, maketlv(RAD_Attr_Acct_Delay_Time, 4, val), 0);
+    val[3] = octets;
+    radmsg_add(msg, maketlv(RAD_Attr_Acct_Input_Octets, 4, val), 0);
+    if (sessionid && reversed)
+        radmsg_add(msg, maketlv(RAD_Attr_Acct_Session_Id, strlen(sessionid), (void *)sessionid), 0);
+    return msg;
+}
+
+static int key(struct radmsg *msg, uint8_t *k) {
+    int r = acctdup_key(msg, types, sizeof(types), k);
+    radmsg_free(msg);
+    return r;
+}
+
+int main(int argc, char *argv[]) {
+    int testcount = 0, ok, i;
+    struct acctdup *d;
+    uint8_t k1[16], k2[16], k[16];
+
+    debug_init("t_acctdup");
+    debug_set_level(1);
+
+    /* keys */
+    {
+        ok = key(makeacct(1, "sess1", 0, 10, 0), k1) && key(makeacct(2, "sess1", 5, 10, 1), k2);
+        if (!ok || memcmp(k1, k2, 16))
+            printf("not ");
+        printf("ok %d - same record with new id, delay and attribute order has the same key\n", ++testcount);
+
+        ok = key(makeacct(1, "sess1", 0, 11, 0), k2);
+        if (!ok || !memcmp(k1, k2, 16))
+            printf("not ");
+        printf("ok %d - different counters give a different key\n", ++testcount);
+
+        ok = key(makeacct(1, "sess2", 0, 10, 0), k2);
+        if (!ok || !memcmp(k1, k2, 16))
+            printf("not ");
+        printf("ok %d - different session id gives a different key\n", ++testcount);
+
+        if (key(makeacct(1, NULL, 0, 10, 0), k2))
+            printf("not ");
+        printf("ok %d - no key without Acct-Session-Id\n", ++testcount);
+    }
+
+    /* cache */
+    {
+        d = acctdup_create(16, 10);
+        if (!d) {
+            printf("Bail out! acctdup_create failed\n");
+            return 1;
+        }
+        if (acctdup_seen(d, k1, 100))
+            printf("not ");
+        printf("ok %d - unknown record is not a duplicate\n", ++testcount);
+
+        acctdup_add(d, k1, 100);
+        if (!acctdup_seen(d, k1, 109) || acctdup_seen(d, k2, 109))
+            printf("not ");
+        printf("ok %d - added record is a duplicate within the interval\n", ++testcount);
+
+        acctdup_add(d, k1, 105);
+        if (acctdup_seen(d, k1, 110))
+            printf("not ");
+        printf("ok %d - record expires after the interval from the first add\n", ++testcount);
+
+        acctdup_add(d, k1, 120);
+        if (!acctdup_seen(d, k1, 121))
+            printf("not ");
+        printf("ok %d - expired record can be added again\n", ++testcount);
+
+        /* fill the table with keys in the same slot, the oldest is replaced */
+        ok = 1;
+        memset(k, 0, sizeof(k));
+        for (i = 0; i < 64; i++) {
+            k[15] = i;
+            acctdup_add(d, k, 200 + i);
+        }
+        for (i = 0; i < 64; i++) {
+            k[15] = i;
+            if (acctdup_seen(d, k, 205 + i / 16) != (i >= 56))
+                ok = 0;
+        }
+        if (!ok)
+            printf("not ");
+        printf("ok %d - colliding keys replace the oldest entry\n", ++testcount);
+        acctdup_free(d);
+    }
+
+    printf("1..%d\n", testcount);
+    return 0;
+}
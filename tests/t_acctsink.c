@@ -0,0 +1,181 @@
+/* Copyright (C) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+#include "../acctsink.h"
+#include "../debug.h"
+#include "../radsecproxy.h"
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static int donecount, doneok;
+
+static void done(void *ctx, int ok) {
+    pthread_mutex_lock(&lock);
+    donecount++;
+    doneok += ok;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+}
+
+static int waitdone(int count) {
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 5;
+    pthread_mutex_lock(&lock);
+    while (donecount < count)
+        if (pthread_cond_timedwait(&cond, &lock, &deadline))
+            break;
+    pthread_mutex_unlock(&lock);
+    return donecount >= count;
+}
+
+static struct radmsg *makeacct(void) {
+    struct radmsg *msg;
+    uint8_t status[4] = {0, 0, 0, RAD_Acct_Status_Start}, ip[4] = {192, 0, 2, 1}, vsa[6] = {0, 0, 0, 9, 1, 0xff};
+
+    msg = radmsg_init(RAD_Accounting_Request, 7, NULL);
+    radmsg_add(msg, maketlv(RAD_Attr_User_Name, 5, "a\"b@c"), 0);
+    radmsg_add(msg, maketlv(RAD_Attr_User_Password, 4, "pass"), 0);
+    radmsg_add(msg, maketlv(RAD_Attr_Acct_Status_Type, 4, status), 0);
+    radmsg_add(msg, maketlv(RAD_Attr_NAS_IP_Address, 4, ip), 0);
+    radmsg_add(msg, maketlv(RAD_Attr_Vendor_Specific, 6, vsa), 0);
+    radmsg_add(msg, maketlv(RAD_Attr_Proxy_State, 2, "ps"), 0);
+    return msg;
+}
+
+static int countlines(const char *file) {
+    FILE *f = fopen(file, "r");
+    int c, n = 0;
+
+    if (!f)
+        return -1;
+    while ((c = fgetc(f)) != EOF)
+        if (c == '\n')
+            n++;
+    fclose(f);
+    return n;
+}
+
+/* number of rotated copies of file in dir */
+static int countrotated(const char *dir, const char *base) {
+    DIR *d = opendir(dir);
+    struct dirent *e;
+    int n = 0;
+
+    if (!d)
+        return -1;
+    while ((e = readdir(d)))
+        if (!strncmp(e->d_name, base, strlen(base)) && e->d_name[strlen(base)] == '.')
+            n++;
+    closedir(d);
+    return n;
+}
+
+int main(int argc, char *argv[]) {
+    int testcount = 0, len, ok, i;
+    struct radmsg *msg;
+    struct acctsink *sink;
+    uint8_t *out, types[] = {RAD_Attr_Acct_Status_Type, RAD_Attr_User_Name};
+    char dir[] = "/tmp/t_acctsinkXXXXXX", file[64];
+    uint32_t n;
+
+    debug_init("t_acctsink");
+    debug_set_level(1);
+    pthread_attr_init(&pthread_attr);
+    msg = makeacct();
+
+    /* formatting */
+    {
+        const char *expect = "{\"time\":1700000000,\"client\":\"nas\",\"realm\":\"*\",\"attrs\":"
+                             "[[1,\"a\\\"b@c\"],[40,1],[4,\"192.0.2.1\"],[26,\"0x0000000901ff\"]]}\n";
+        len = acctsink_format(ACCTSINK_JSONL, msg, NULL, 0, "nas", "*", 1700000000, &out);
+        if (len != strlen(expect) || memcmp(out, expect, len))
+            printf("not ");
+        printf("ok %d - jsonl record without secrets and proxy-state\n", ++testcount);
+        free(out);
+    }
+    {
+        const char *expect = "{\"time\":1,\"client\":\"nas\",\"realm\":\"r\",\"attrs\":[[1,\"a\\\"b@c\"],[40,1]]}\n";
+        len = acctsink_format(ACCTSINK_JSONL, msg, types, sizeof(types), "nas", "r", 1, &out);
+        if (len != strlen(expect) || memcmp(out, expect, len))
+            printf("not ");
+        printf("ok %d - jsonl record with selected attributes\n", ++testcount);
+        free(out);
+    }
+    {
+        len = acctsink_format(ACCTSINK_BINARY, msg, types, sizeof(types), "nas", "r", 1700000000, &out);
+        memcpy(&n, out, 4);
+        ok = len == 4 + 4 + 4 + 2 + 7 + 6 && ntohl(n) == (uint32_t)len;
+        memcpy(&n, out + 4, 4);
+        ok = ok && ntohl(n) == 1700000000 && out[8] == 3 && !memcmp(out + 9, "nas", 3) && out[12] == 1 && out[13] == 'r';
+        ok = ok && out[14] == RAD_Attr_User_Name && out[15] == 7 && out[21] == RAD_Attr_Acct_Status_Type && out[22] == 6;
+        if (!ok)
+            printf("not ");
+        printf("ok %d - binary record layout\n", ++testcount);
+        free(out);
+    }
+
+    /* writing */
+    if (!mkdtemp(dir)) {
+        printf("Bail out! mkdtemp failed\n");
+        return 1;
+    }
+    snprintf(file, sizeof(file), "%s/acct", dir);
+    {
+        sink = acctsink_create("test", file, ACCTSINK_JSONL, 0, 0, 1);
+        ok = sink && acctsink_start(sink, done);
+        for (i = 0; ok && i < 3; i++)
+            ok = acctsink_write(sink, msg, "nas", "*", NULL) == ACCTSINK_PENDING;
+        ok = ok && waitdone(3) && doneok == 3;
+        if (!ok || countlines(file) != 3)
+            printf("not ");
+        printf("ok %d - persisted records are written before done\n", ++testcount);
+    }
+    {
+        unlink(file);
+        sink = acctsink_create("rotate", file, ACCTSINK_JSONL, 1, 0, 1);
+        ok = sink && acctsink_start(sink, done);
+        ok = ok && acctsink_write(sink, msg, "nas", "*", NULL) == ACCTSINK_PENDING && waitdone(4);
+        /* rotation happens right after the write */
+        for (i = 0; ok && i < 50 && countrotated(dir, "acct") < 1; i++)
+            usleep(10000);
+        if (!ok || countrotated(dir, "acct") != 1 || countlines(file) != 0)
+            printf("not ");
+        printf("ok %d - file is rotated once it reaches RotateSize\n", ++testcount);
+    }
+    {
+        char file2[64];
+
+        snprintf(file2, sizeof(file2), "%s/acct2", dir);
+        sink = acctsink_create("rotate2", file2, ACCTSINK_JSONL, 1, 0, 1);
+        ok = sink && acctsink_start(sink, done);
+        /* one at a time, all within a second */
+        for (i = 0; ok && i < 3; i++) {
+            ok = acctsink_write(sink, msg, "nas", "*", NULL) == ACCTSINK_PENDING && waitdone(5 + i);
+            for (n = 0; ok && n < 50 && countrotated(dir, "acct2") < i + 1; n++)
+                usleep(10000);
+        }
+        if (!ok || countrotated(dir, "acct2") != 3)
+            printf("not ");
+        printf("ok %d - rotations within a second keep every file\n", ++testcount);
+    }
+    {
+        sink = acctsink_create("buffered", file, ACCTSINK_JSONL, 0, 0, 0);
+        ok = sink && acctsink_start(sink, done);
+        if (!ok || acctsink_write(sink, msg, "nas", "*", NULL) != ACCTSINK_BUFFERED)
+            printf("not ");
+        printf("ok %d - buffered records can be replied to at once\n", ++testcount);
+    }
+
+    radmsg_free(msg);
+    printf("1..%d\n", testcount);
+    return 0;
+}
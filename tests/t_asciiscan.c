@@ -0,0 +1,161 @@
+/* Copyright (C) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+#include "../asciiscan.h"
+#include "../radsecproxy.h"
+#include "../util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* byte by byte verifyutf8 as it was before printablespan, used as reference */
+static int verifyutf8_ref(const unsigned char *str, size_t str_len) {
+    const unsigned char *byte;
+    size_t charlen;
+
+    for (byte = str; byte < str + str_len; byte++) {
+        if (*byte == 0x00)
+            return 0;
+        if ((*byte & 0x80) == 0x00) {
+            if (*byte < 0x20 || *byte == 0x7F)
+                return 0;
+            continue;
+        }
+        if (*byte > 0xF4)
+            return 0;
+        if ((*byte & 0xE0) == 0xC0) {
+            if ((*byte & 0xFE) == 0xC0)
+                return 0;
+            charlen = 2;
+        } else if ((*byte & 0xF0) == 0xE0)
+            charlen = 3;
+        else if ((*byte & 0xF8) == 0xF0)
+            charlen = 4;
+        else
+            return 0;
+
+        if (byte + charlen - 1 >= str + str_len)
+            return 0;
+        if (charlen == 2 && *byte == 0xC2 && *(byte + 1) < 0xA0)
+            return 0;
+        if (charlen == 3) {
+            if (*byte == 0xE0 && (*(byte + 1) & 0xE0) == 0x80)
+                return 0;
+            if (*byte == 0xED && (*(byte + 1) & 0xE0) == 0xA0)
+                return 0;
+        }
+        if (charlen == 4) {
+            if (*byte == 0xF0 && (*(byte + 1) & 0xF0) == 0x80)
+                return 0;
+            if (*byte == 0xF4 && (*(byte + 1) & 0xF0) != 0x80)
+                return 0;
+        }
+
+        while (--charlen)
+            if ((*(++byte) & 0xC0) != 0x80)
+                return 0;
+    }
+    return 1;
+}
+
+/* fill buf with mostly printable ascii, sprinkled with utf-8 sequences and other bytes */
+static void randomtext(unsigned char *buf, size_t len) {
+    static const unsigned char *seqs[] = {
+        (unsigned char *)"\xc3\xa9", (unsigned char *)"\xe2\x82\xac", (unsigned char *)"\xf0\x9f\x98\x80",
+        (unsigned char *)"\xc2\x80", (unsigned char *)"\xed\xa0\x80", (unsigned char *)"\xf4\x90\x80\x80"};
+    size_t i, n;
+    const unsigned char *seq;
+
+    for (i = 0; i < len;) {
+        switch (rand() % 40) {
+        case 0:
+            buf[i++] = rand() % 256;
+            break;
+        case 1:
+            seq = seqs[rand() % (sizeof(seqs) / sizeof(seqs[0]))];
+            for (n = 0; seq[n] && i < len; n++)
+                buf[i++] = seq[n];
+            break;
+        default:
+            buf[i++] = 0x20 + rand() % 95;
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int testcount = 0, count, i, ok;
+    const struct asciiscanimpl *impls = asciiscanimpls(&count);
+    unsigned char buf[512 + 64];
+    size_t len, off, pos;
+
+    srand(4711);
+
+    for (i = 1; i < count; i++) {
+        ok = 1;
+        for (len = 0; len <= 512 && ok; len++) {
+            for (off = 0; off < 64 && ok; off += 7) {
+                memset(buf, 'a', sizeof(buf));
+                if (impls[i].printablespan(buf + off, len) != len)
+                    ok = 0;
+                for (pos = 0; pos < len && ok; pos += 1 + len / 16) {
+                    buf[off + pos] = "\x00\x1f\x7f\x80\xff"[pos % 5];
+                    if (impls[i].printablespan(buf + off, len) != printablespan_scalar(buf + off, len))
+                        ok = 0;
+                    buf[off + pos] = 0x20 + pos % 95;
+                }
+            }
+        }
+        if (!ok)
+            printf("not ");
+        printf("ok %d - printablespan %s matches scalar\n", ++testcount, impls[i].name);
+    }
+
+    {
+        ok = 1;
+        for (i = 0; i < 20000 && ok; i++) {
+            len = rand() % 300;
+            randomtext(buf, len);
+            if (verifyutf8(buf, len) != verifyutf8_ref(buf, len))
+                ok = 0;
+        }
+        if (!ok)
+            printf("not ");
+        printf("ok %d - verifyutf8 matches byte by byte reference (%s)\n", ++testcount, asciiscanimplname());
+    }
+
+    {
+        struct tlv attr;
+        uint8_t *result, expect[3 * 255 + 1], *e;
+
+        ok = 1;
+        for (i = 0; i < 2000 && ok; i++) {
+            attr.l = 1 + rand() % 255;
+            attr.v = buf;
+            randomtext(buf, attr.l);
+            for (e = expect, pos = 0; pos < attr.l; pos++) {
+                if (buf[pos] < 32 || buf[pos] > 126)
+                    e += sprintf((char *)e, "%%%02x", buf[pos]);
+                else
+                    *e++ = buf[pos];
+            }
+            *e = '\0';
+            result = radattr2ascii(&attr);
+            if (!result || strcmp((char *)result, (char *)expect))
+                ok = 0;
+            free(result);
+        }
+        if (!ok)
+            printf("not ");
+        printf("ok %d - radattr2ascii escapes non-printable bytes\n", ++testcount);
+    }
+
+    {
+        char str[] = "plain text %41%%4243 more%ZZ text%%";
+        if (unhex(str, 0) != 27 || strcmp(str, "plain text ABC more%ZZ text"))
+            printf("not ");
+        printf("ok %d - unhex with runs between escapes\n", ++testcount);
+    }
+
+    printf("1..%d\n", testcount);
+    return 0;
+}
@@ -0,0 +1,83 @@
+/* Copyright (C) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+#include "../debug.h"
+#include "../radsecproxy.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NSERVERS 7
+
+static struct clsrvconf confs[NSERVERS];
+static struct server servers[NSERVERS];
+
+int main(int argc, char *argv[]) {
+    int testcount = 4, i;
+    char *names[NSERVERS] = {"failed", "radius11", "rewrite", "loop", "down", "busy", "best"};
+    struct rewrite rewrite;
+    struct clsrvconf clconf;
+    struct client client;
+    struct request rq;
+    struct list *srvconfs = list_create();
+
+    debug_init("t_failover");
+    debug_set_level(1);
+
+    printf("1..%d\n", testcount);
+    testcount = 1;
+
+    memset(&clconf, 0, sizeof(clconf));
+    memset(&client, 0, sizeof(client));
+    memset(&rq, 0, sizeof(rq));
+    clconf.name = "loop";
+    client.conf = &clconf;
+    rq.from = &client;
+
+    for (i = 0; i < NSERVERS; i++) {
+        confs[i].name = names[i];
+        confs[i].servers = servers + i;
+        servers[i].conf = confs + i;
+        servers[i].state = RSP_SERVER_STATE_CONNECTED;
+        pthread_mutex_init(&servers[i].lock, NULL);
+        list_push(srvconfs, confs + i);
+    }
+    /* each of these has fewer lost requests than the eligible ones, but
+       does not qualify for a reason of its own */
+    servers[1].radius11 = 1;
+    confs[2].rewriteout = &rewrite;
+    confs[3].loopprevention = 1;
+    servers[4].state = RSP_SERVER_STATE_RECONNECTING;
+    servers[5].lostrqs = 3;
+    servers[6].lostrqs = 2;
+
+    {
+        if (failoverserver(srvconfs, servers, &rq) != servers + 6)
+            printf("not ");
+        printf("ok %d - best eligible server\n", testcount++);
+    }
+
+    {
+        servers[6].state = RSP_SERVER_STATE_RECONNECTING;
+        if (failoverserver(srvconfs, servers, &rq) != servers + 5)
+            printf("not ");
+        printf("ok %d - next eligible server\n", testcount++);
+    }
+
+    {
+        rq.radius11 = 1;
+        if (failoverserver(srvconfs, servers, &rq) != servers + 1)
+            printf("not ");
+        printf("ok %d - same RADIUS version\n", testcount++);
+    }
+
+    {
+        servers[1].state = RSP_SERVER_STATE_RECONNECTING;
+        if (failoverserver(srvconfs, servers, &rq))
+            printf("not ");
+        printf("ok %d - no eligible server\n", testcount++);
+    }
+
+    list_free(srvconfs);
+    return 0;
+}
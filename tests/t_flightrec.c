@@ -0,0 +1,123 @@
+/* Copyright (C) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+#include "../debug.h"
+#include "../flightrec.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* read record i of the ring file, 0 on failure */
+static int readrecord(const char *path, int i, struct flightrec_record *rec) {
+    int fd = open(path, O_RDONLY), ok;
+
+    if (fd < 0)
+        return 0;
+    ok = pread(fd, rec, sizeof(*rec), FLIGHTREC_HEADERSIZE + i * sizeof(*rec)) == sizeof(*rec);
+    close(fd);
+    return ok;
+}
+
+static off_t filesize(const char *path) {
+    off_t size;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+        return -1;
+    size = lseek(fd, 0, SEEK_END);
+    close(fd);
+    return size;
+}
+
+static void writeids(int from, int to) {
+    struct flightrec_record rec;
+
+    for (; from < to; from++) {
+        memset(&rec, 0, sizeof(rec));
+        rec.id = from;
+        rec.outcome = FLIGHTREC_REPLIED;
+        flightrec_write(&rec);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int testcount = 0;
+    char path[] = "/tmp/t_flightrecXXXXXX";
+    struct flightrec_record rec;
+    int fd;
+
+    debug_init("t_flightrec");
+    debug_set_level(1);
+
+    fd = mkstemp(path);
+    if (fd < 0) {
+        printf("1..0 # skip cannot create temporary file\n");
+        return 0;
+    }
+    close(fd);
+
+    {
+        if (sizeof(struct flightrec_record) != 128)
+            printf("not ");
+        printf("ok %d - record size\n", ++testcount);
+    }
+
+    {
+        writeids(0, 1);
+        if (flightrec_enabled() || !flightrec_open(path, 4) || !flightrec_enabled() ||
+            filesize(path) != FLIGHTREC_HEADERSIZE + 4 * 128)
+            printf("not ");
+        printf("ok %d - open\n", ++testcount);
+    }
+
+    /* six records in a ring of four, the last four are kept */
+    {
+        int i, ok = 1;
+
+        writeids(0, 6);
+        for (i = 0; i < 4; i++) {
+            if (!readrecord(path, i, &rec))
+                ok = 0;
+            else if (rec.seq != (uint64_t)(i < 2 ? i + 5 : i + 1) || rec.id != rec.seq - 1 || rec.outcome != FLIGHTREC_REPLIED)
+                ok = 0;
+        }
+        if (!ok)
+            printf("not ");
+        printf("ok %d - ring wraps around\n", ++testcount);
+    }
+
+    /* a restart with the same size continues the ring */
+    {
+        flightrec_close();
+        if (!flightrec_open(path, 4))
+            printf("not ");
+        writeids(6, 7);
+        if (!readrecord(path, 2, &rec) || rec.seq != 7 || rec.id != 6 || !readrecord(path, 3, &rec) || rec.seq != 4)
+            printf("not ");
+        printf("ok %d - reopen continues\n", ++testcount);
+    }
+
+    /* a different size starts over */
+    {
+        flightrec_close();
+        if (!flightrec_open(path, 8) || filesize(path) != FLIGHTREC_HEADERSIZE + 8 * 128)
+            printf("not ");
+        writeids(0, 1);
+        if (!readrecord(path, 0, &rec) || rec.seq != 1 || !readrecord(path, 1, &rec) || rec.seq != 0)
+            printf("not ");
+        printf("ok %d - resize starts over\n", ++testcount);
+    }
+
+    {
+        flightrec_close();
+        if (flightrec_enabled() || flightrec_open("/nonexistent/dir/file", 4))
+            printf("not ");
+        printf("ok %d - open failure\n", ++testcount);
+    }
+
+    unlink(path);
+    printf("1..%d\n", testcount);
+    return 0;
+}
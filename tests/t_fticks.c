@@ -33,8 +33,23 @@ _check_hash(const char *mac, const char *key, const char *hash, const char *hmac
 #define HASH1 "29c0ee9d9c41771795a11ff75fefe9f5ccaab523ad31fc4fd8e776c707ad1581"
 #define HMAC1 "57c8cd8031142c51ac9747370f48a5aa731006729d0cdf589ba101864f35f390"
 
+/* the prepared context must hash as fticks_hashmac does */
+static int
+_check_ctx(const char *mac, const char *key, size_t out_len) {
+    struct fticks_hashmac_ctx ctx;
+    uint8_t buf[128], ref[128];
+
+    memset(buf, 'x', sizeof(buf));
+    memset(ref, 'x', sizeof(ref));
+    fticks_hashmac_init(&ctx, (const uint8_t *)key);
+    fticks_hashmac_hash(&ctx, (const uint8_t *)mac, strlen(mac), out_len, buf);
+    if (fticks_hashmac((const uint8_t *)mac, (const uint8_t *)key, out_len, ref) != 0)
+        return -ENOMEM;
+    return memcmp(buf, ref, sizeof(buf)) != 0;
+}
+
 int main(int argc, char *argv[]) {
-    int testcount = 5;
+    int testcount = 9;
     printf("1..%d\n", testcount);
     testcount = 1;
 
@@ -58,5 +73,39 @@ int main(int argc, char *argv[]) {
         printf("not ");
     printf("ok %d - hash weird\n", testcount++);
 
+    if (_check_ctx(MAC1, NULL, 65) || _check_ctx(MAC1, KEY1, 65) ||
+        _check_ctx(MAC1_WEIRD, KEY1, 56) || _check_ctx(MAC1, KEY1, 2))
+        printf("not ");
+    printf("ok %d - prepared context\n", testcount++);
+
+    {
+        struct fticks_hashmac_ctx ctx;
+        uint8_t buf[64 + 1];
+
+        fticks_hashmac_init(&ctx, (const uint8_t *)KEY1);
+        fticks_hashmac_hash(&ctx, (const uint8_t *)MAC1, strlen(MAC1), sizeof(buf), buf);
+        fticks_hashmac_hash(&ctx, (const uint8_t *)MAC1_UC, strlen(MAC1_UC), sizeof(buf), buf);
+        if (strcmp(HMAC1, (const char *)buf) != 0)
+            printf("not ");
+        printf("ok %d - prepared context reused\n", testcount++);
+
+        /* the length bounds the input, as a newline would */
+        fticks_hashmac_hash(&ctx, (const uint8_t *)MAC1 "00:11", strlen(MAC1), sizeof(buf), buf);
+        if (strcmp(HMAC1, (const char *)buf) != 0)
+            printf("not ");
+        printf("ok %d - input length\n", testcount++);
+    }
+
+    {
+        char mac[300];
+
+        /* more than fits the sanitising buffer at once */
+        memset(mac, 'A', sizeof(mac) - 1);
+        mac[sizeof(mac) - 1] = '\0';
+        if (_check_ctx(mac, NULL, 65) || _check_ctx(mac, KEY1, 65))
+            printf("not ");
+        printf("ok %d - long input\n", testcount++);
+    }
+
     return 0;
 }
@@ -0,0 +1,135 @@
+/* Copyright (C) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+#include "../debug.h"
+#include "../gconfig.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static char conffile[] = "/tmp/t_gconfsnap.XXXXXX";
+static char snapfile[sizeof(conffile) + sizeof(GCONF_SNAPSHOT_SUFFIX)];
+
+static int writefile(const char *path, const char *content) {
+    FILE *f = fopen(path, "w");
+    if (!f)
+        return 0;
+    fputs(content, f);
+    return fclose(f) == 0;
+}
+
+/* write a snapshot the way radsecproxy-conf -s does, optionally truncated */
+static int writesnap(int truncate) {
+    char stamp[GCONF_SOURCE_STAMP_LEN];
+    FILE *f = fopen(snapfile, "w");
+    int ok;
+
+    if (!f)
+        return 0;
+    ok = fputs(GCONF_SNAPSHOT_MAGIC, f) != EOF &&
+         gconfsourcestamp(conffile, stamp, sizeof(stamp)) &&
+         writegconfsnaprecord(f, GCONF_SNAP_SOURCE, conffile, stamp) &&
+         writegconfsnaprecord(f, GCONF_SNAP_OPTION, "LogLevel", "3") &&
+         writegconfsnaprecord(f, GCONF_SNAP_BLOCK, "block", "b1") &&
+         writegconfsnaprecord(f, GCONF_SNAP_OPTION, "value", "quoted value") &&
+         writegconfsnaprecord(f, GCONF_SNAP_BLOCKEND, "", "") &&
+         (truncate || writegconfsnaprecord(f, GCONF_SNAP_END, "", ""));
+    return fclose(f) == 0 && ok;
+}
+
+static char *blockvalue;
+
+static int block_cb(struct gconffile **cf, void *arg, char *block, char *opt, char *val) {
+    return getgenericconfig(cf, block, "value", CONF_STR, &blockvalue, NULL);
+}
+
+int main(int argc, char *argv[]) {
+    int testcount = 0, fd;
+    struct gconffile *cf;
+    long int loglevel = 0;
+
+    debug_init("t_gconfsnap");
+    debug_set_level(1);
+
+    fd = mkstemp(conffile);
+    if (fd < 0) {
+        printf("Bail out! could not create temporary file\n");
+        return 1;
+    }
+    close(fd);
+    sprintf(snapfile, "%s%s", conffile, GCONF_SNAPSHOT_SUFFIX);
+    writefile(conffile, "LogLevel 3\nblock b1 {\n\tvalue \"quoted value\"\n}\n");
+
+    /* missing snapshot */
+    {
+        if (openconfigsnapshot(conffile))
+            printf("not ");
+        printf("ok %d - missing snapshot\n", ++testcount);
+    }
+
+    /* read options and blocks from snapshot */
+    {
+        if (!writesnap(0))
+            printf("not ");
+        printf("ok %d - write snapshot\n", ++testcount);
+
+        cf = openconfigsnapshot(conffile);
+        if (!cf ||
+            !getgenericconfig(&cf, NULL, "LogLevel", CONF_LINT, &loglevel, "block", CONF_CBK, block_cb, NULL, NULL) ||
+            loglevel != 3 || !blockvalue || strcmp(blockvalue, "quoted value"))
+            printf("not ");
+        printf("ok %d - read snapshot\n", ++testcount);
+        if (cf)
+            printf("not ");
+        printf("ok %d - snapshot closed at end\n", ++testcount);
+        free(blockvalue);
+    }
+
+    /* truncated snapshot */
+    {
+        writesnap(1);
+        if ((cf = openconfigsnapshot(conffile)))
+            freegconf(&cf);
+        if (cf)
+            printf("not ");
+        printf("ok %d - reject truncated snapshot\n", ++testcount);
+    }
+
+    /* stale snapshot */
+    {
+        writesnap(0);
+        writefile(conffile, "LogLevel 4\nblock b1 {\n\tvalue \"changed value\"\n}\n");
+        if ((cf = openconfigsnapshot(conffile)))
+            freegconf(&cf);
+        if (cf)
+            printf("not ");
+        printf("ok %d - reject stale snapshot\n", ++testcount);
+    }
+
+    /* edit keeping size and modification time */
+    {
+        struct stat st;
+        struct timespec times[2];
+
+        writesnap(0);
+        stat(conffile, &st);
+        times[0] = st.st_atim;
+        times[1] = st.st_mtim;
+        writefile(conffile, "LogLevel 5\nblock b1 {\n\tvalue \"changed value\"\n}\n");
+        utimensat(AT_FDCWD, conffile, times, 0);
+        if ((cf = openconfigsnapshot(conffile)))
+            freegconf(&cf);
+        if (cf)
+            printf("not ");
+        printf("ok %d - reject snapshot after same size edit\n", ++testcount);
+    }
+
+    unlink(snapfile);
+    unlink(conffile);
+    printf("1..%d\n", testcount);
+    return 0;
+}
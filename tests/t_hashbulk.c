@@ -0,0 +1,118 @@
+/* Copyright (C) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+/* radsecproxy-hash bulk mode against line by line mode, on more input than
+ * fits a chunk, from a mapped file and from a stream */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define HASH "../radsecproxy-hash"
+/* more than three of the 1 MiB chunks of bulk mode */
+#define INPUT_SIZE (3 * (1 << 20) + 12345)
+
+static char dir[] = "/tmp/t_hashbulk.XXXXXX";
+static char *hash;
+
+/* read a whole file, returns its length or -1 */
+static long readfile(const char *name, char **data) {
+    char path[64];
+    FILE *f;
+    long len;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    if (!(f = fopen(path, "r")))
+        return -1;
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    rewind(f);
+    *data = malloc(len + 1);
+    if (fread(*data, 1, len, f) != (size_t)len)
+        len = -1;
+    fclose(f);
+    return len;
+}
+
+/* run radsecproxy-hash with args in dir, returns its exit status */
+static int run(const char *args) {
+    char cmd[256];
+
+    snprintf(cmd, sizeof(cmd), "cd %s && %s %s", dir, hash, args);
+    return system(cmd);
+}
+
+/* does output file name equal the reference output n times over */
+static int same(const char *name, const char *ref, long reflen, int n) {
+    char *data;
+    long len = readfile(name, &data);
+    int i, ok = len == n * reflen;
+
+    for (i = 0; ok && i < n; i++)
+        ok = !memcmp(data + i * reflen, ref, reflen);
+    if (len >= 0)
+        free(data);
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    int testcount = 4, i;
+    static const char *formats[] = {"%02x:%02x:%02x:%02x:%02x:%02x\n", "%02X-%02X-%02X-%02X-%02X-%02X\n",
+                                    "%02x%02x.%02x%02x.%02x%02x\n", "%02x%02x%02x%02x%02x%02x\n"};
+    char path[64], *ref;
+    long total = 0, reflen;
+    FILE *f;
+
+    printf("1..%d\n", testcount);
+    testcount = 1;
+
+    if (access(HASH, X_OK) || !(hash = realpath(HASH, NULL)) || !mkdtemp(dir)) {
+        printf("Bail out! " HASH " not built or no temporary directory\n");
+        return 1;
+    }
+    snprintf(path, sizeof(path), "%s/in", dir);
+    f = fopen(path, "w");
+    srand(1);
+    for (i = 0; total < INPUT_SIZE; i++)
+        total += fprintf(f, formats[i % 4], rand() % 256, rand() % 256, rand() % 256, rand() % 256, rand() % 256, rand() % 256);
+    /* a last line without newline */
+    fprintf(f, "00:11:22:33:44:55");
+    fclose(f);
+
+    if (run("-a -k key < in > line") || (reflen = readfile("line", &ref)) <= 0) {
+        printf("Bail out! line by line mode failed\n");
+        return 1;
+    }
+
+    {
+        if (run("-b -a -k key -t 4 in > mapped") || !same("mapped", ref, reflen, 1))
+            printf("not ");
+        printf("ok %d - bulk mode on a mapped file matches line mode\n", testcount++);
+    }
+
+    {
+        if (run("-b -a -k key -t 4 < in > stream") || !same("stream", ref, reflen, 1))
+            printf("not ");
+        printf("ok %d - bulk mode on a stream matches line mode\n", testcount++);
+    }
+
+    {
+        if (run("-b -a -k key -t 3 in in > twice") || !same("twice", ref, reflen, 2))
+            printf("not ");
+        printf("ok %d - bulk mode keeps the order of several files\n", testcount++);
+    }
+
+    {
+        if (run("-b -a -k key -t 1 < in > single") || !same("single", ref, reflen, 1))
+            printf("not ");
+        printf("ok %d - bulk mode with one thread matches line mode\n", testcount++);
+    }
+
+    free(ref);
+    free(hash);
+    snprintf(path, sizeof(path), "rm -r %s", dir);
+    if (system(path))
+        printf("# could not remove %s\n", dir);
+    return 0;
+}
@@ -0,0 +1,191 @@
+/* Copyright (C) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+#include "../debug.h"
+#include "../md5mb.h"
+#include "../radmsg.h"
+#include <nettle/md5.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define NPACKETS 40
+
+static uint8_t secret[] = "testing123", longsecret[100];
+
+/* build a signed packet, with Message-Authenticator if msgauth is set */
+static int makepacket(uint8_t code, uint8_t *auth, int nattrs, int msgauth, uint8_t *sec, int sec_len, uint8_t **buf) {
+    struct radmsg *msg;
+    uint8_t val[200];
+    int i, len;
+
+    memset(val, 'v', sizeof(val));
+    msg = radmsg_init(code, rand() % 256, auth);
+    for (i = 0; i < nattrs; i++)
+        radmsg_add(msg, maketlv(1 + rand() % 25, rand() % 200, val), 0);
+    if (msgauth)
+        radmsg_add(msg, maketlv(RAD_Attr_Message_Authenticator, 16, NULL), 0);
+    len = radmsg2buf(msg, sec, sec_len, buf);
+    radmsg_free(msg);
+    return len;
+}
+
+int main(int argc, char *argv[]) {
+    int testcount = 0, count, i, j, n, ok;
+    const struct md5mbimpl *impls = md5mbimpls(&count);
+    struct md5mbjob jobs[2 * MD5MB_MAXLANES + 3];
+    struct md5_ctx ctx;
+    uint8_t data[2 * MD5MB_MAXLANES + 3][300], digest[16];
+
+    debug_init("t_md5mb");
+    debug_set_level(1);
+    srand(4711);
+    memset(longsecret, 's', sizeof(longsecret));
+
+    for (i = 0; i < count; i++) {
+        ok = 1;
+        for (n = 1; n <= 2 * MD5MB_MAXLANES + 3 && ok; n++) {
+            for (j = 0; j < n; j++) {
+                jobs[j].len = rand() % 300;
+                jobs[j].data = data[j];
+                memset(data[j], rand(), jobs[j].len);
+            }
+            md5mb_impl(&impls[i], jobs, n);
+            for (j = 0; j < n; j++) {
+                md5_init(&ctx);
+                md5_update(&ctx, jobs[j].len, jobs[j].data);
+                md5_digest(&ctx, sizeof(digest), digest);
+                if (memcmp(digest, jobs[j].digest, 16))
+                    ok = 0;
+            }
+        }
+        if (!ok)
+            printf("not ");
+        printf("ok %d - md5mb %s matches nettle\n", ++testcount, impls[i].name);
+    }
+
+    /* the 55/56/63/64 byte boundaries decide on an extra padding block */
+    {
+        uint8_t zeros[130];
+        ok = 1;
+        memset(zeros, 0, sizeof(zeros));
+        for (n = 50; n < 130; n++) {
+            jobs[0].data = zeros;
+            jobs[0].len = n;
+            jobs[1].data = zeros;
+            jobs[1].len = 130 - n;
+            md5mb(jobs, 2);
+            for (j = 0; j < 2; j++) {
+                md5_init(&ctx);
+                md5_update(&ctx, jobs[j].len, jobs[j].data);
+                md5_digest(&ctx, sizeof(digest), digest);
+                if (memcmp(digest, jobs[j].digest, 16))
+                    ok = 0;
+            }
+        }
+        if (!ok)
+            printf("not ");
+        printf("ok %d - md5mb padding block boundaries\n", ++testcount);
+    }
+
+    {
+        struct radauthjob batch[NPACKETS], single;
+        uint8_t *bufs[NPACKETS], rqauth[NPACKETS][16];
+        struct radmsg *msg;
+
+        ok = 1;
+        for (i = 0; i < NPACKETS; i++) {
+            uint8_t *sec = i % 7 == 3 ? longsecret : secret;
+            int sec_len = i % 7 == 3 ? sizeof(longsecret) : sizeof(secret) - 1;
+
+            for (j = 0; j < 16; j++)
+                rqauth[i][j] = rand();
+            memset(&batch[i], 0, sizeof(batch[i]));
+            switch (i % 4) {
+            case 0:
+                memset(rqauth[i], 0, 16);
+                batch[i].len = makepacket(RAD_Accounting_Request, rqauth[i], rand() % 10, 0, sec, sec_len, &bufs[i]);
+                break;
+            case 1:
+                batch[i].len = makepacket(RAD_Access_Accept, rqauth[i], rand() % 10, 1, sec, sec_len, &bufs[i]);
+                batch[i].rqauth = rqauth[i];
+                break;
+            case 2:
+                batch[i].len = makepacket(RAD_Access_Request, rqauth[i], rand() % 10, 1, sec, sec_len, &bufs[i]);
+                break;
+            default:
+                batch[i].len = makepacket(RAD_Accounting_Response, rqauth[i], rand() % 10, i % 3 != 0, sec, sec_len, &bufs[i]);
+                batch[i].rqauth = rqauth[i];
+            }
+            batch[i].buf = bufs[i];
+            batch[i].secret = sec;
+            batch[i].secret_len = sec_len;
+            /* corrupt some packets, the authenticator or the message authenticator */
+            if (i % 5 == 1)
+                bufs[i][batch[i].len - 1] ^= 1;
+            if (i % 5 == 2)
+                bufs[i][4] ^= 1;
+        }
+        radmsg_verifyauth(batch, NPACKETS);
+        for (i = 0; i < NPACKETS; i++) {
+            single = batch[i];
+            radmsg_verifyauth(&single, 1);
+            if (single.authvalid != batch[i].authvalid || single.msgauthinvalid != batch[i].msgauthinvalid) {
+                printf("# packet %d: single %d/%d batch %d/%d\n", i, single.authvalid, single.msgauthinvalid, batch[i].authvalid, batch[i].msgauthinvalid);
+                ok = 0;
+            }
+            if (i % 5 == 0 && (!batch[i].authvalid || batch[i].msgauthinvalid)) {
+                printf("# packet %d: %d/%d\n", i, batch[i].authvalid, batch[i].msgauthinvalid);
+                ok = 0;
+            }
+        }
+        if (!ok)
+            printf("not ");
+        printf("ok %d - batched verification matches single packets\n", ++testcount);
+
+        /* packets in read-only memory, any write crashes */
+        {
+            struct radauthjob ro[NPACKETS];
+            uint8_t *pages = mmap(NULL, NPACKETS * 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+            for (i = 0; i < NPACKETS; i++) {
+                ro[i] = batch[i];
+                ro[i].buf = pages + i * 4096;
+                memcpy(ro[i].buf, bufs[i], batch[i].len);
+            }
+            mprotect(pages, NPACKETS * 4096, PROT_READ);
+            radmsg_verifyauth(ro, NPACKETS);
+            for (i = 0; i < NPACKETS; i++)
+                radmsg_verifyauth(&ro[i], 1);
+            munmap(pages, NPACKETS * 4096);
+            printf("ok %d - verification leaves packets unchanged\n", ++testcount);
+        }
+
+        msg = buf2radmsg_verified(&batch[0]);
+        if (!msg || msg->msgauthinvalid)
+            printf("not ");
+        printf("ok %d - verified accounting request parses\n", ++testcount);
+        radmsg_free(msg);
+
+        /* corrupted authenticator of a reply */
+        msg = buf2radmsg_verified(&batch[17]);
+        if (msg)
+            printf("not ");
+        printf("ok %d - reply with wrong authenticator is rejected\n", ++testcount);
+        radmsg_free(msg);
+
+        /* corrupted request authenticator of an access request only breaks the message authenticator */
+        msg = buf2radmsg_verified(&batch[22]);
+        if (!msg || !msg->msgauthinvalid)
+            printf("not ");
+        printf("ok %d - wrong message authenticator is flagged\n", ++testcount);
+        radmsg_free(msg);
+
+        for (i = 0; i < NPACKETS; i++)
+            free(bufs[i]);
+    }
+
+    printf("1..%d\n", testcount);
+    return 0;
+}
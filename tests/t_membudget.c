@@ -0,0 +1,90 @@
+/* Copyright (C) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+#include "../debug.h"
+#include "../membudget.h"
+#include "../radmsg.h"
+#include <stdio.h>
+#include <string.h>
+
+/* a raw request with the given code and one attribute */
+static int mkrq(uint8_t *buf, uint8_t code, uint8_t type) {
+    memset(buf, 0, 26);
+    buf[0] = code;
+    buf[3] = 26;
+    buf[20] = type;
+    buf[21] = 6;
+    return 26;
+}
+
+int main(int argc, char *argv[]) {
+    int testcount = 0, len;
+    uint8_t access[26], session[26], acct[26], status[26];
+
+    debug_init("t_membudget");
+    debug_set_level(1);
+
+    mkrq(access, RAD_Access_Request, RAD_Attr_User_Name);
+    mkrq(session, RAD_Access_Request, RAD_Attr_State);
+    mkrq(acct, RAD_Accounting_Request, RAD_Attr_State);
+    len = mkrq(status, RAD_Status_Server, RAD_Attr_Message_Authenticator);
+
+    /* classification */
+    {
+        if (membudget_essential(access, len) || !membudget_essential(session, len) ||
+            membudget_essential(acct, len) || !membudget_essential(status, len))
+            printf("not ");
+        printf("ok %d - continued sessions and status server are essential\n", ++testcount);
+    }
+    {
+        session[21] = 30; /* attribute beyond the packet */
+        if (membudget_essential(session, len) || membudget_essential(session, 10))
+            printf("not ");
+        printf("ok %d - truncated packets are not essential\n", ++testcount);
+        session[21] = 6;
+    }
+
+    /* admission */
+    {
+        membudget_init(0, 0);
+        membudget_charge(1 << 30);
+        if (!membudget_admit(access, len) || membudget_used() != 0)
+            printf("not ");
+        printf("ok %d - no limits, nothing charged\n", ++testcount);
+    }
+    {
+        membudget_init(1000, 2000);
+        membudget_charge(999);
+        if (membudget_level() != MEMBUDGET_OK || !membudget_admit(access, len) || !membudget_admit(acct, len))
+            printf("not ");
+        printf("ok %d - below the soft limit all requests are admitted\n", ++testcount);
+    }
+    {
+        membudget_charge(1);
+        if (membudget_level() != MEMBUDGET_SOFT || membudget_admit(access, len) || membudget_admit(acct, len) ||
+            !membudget_admit(session, len) || !membudget_admit(status, len))
+            printf("not ");
+        printf("ok %d - above the soft limit only essential requests are admitted\n", ++testcount);
+    }
+    {
+        membudget_charge(1000);
+        if (membudget_level() != MEMBUDGET_HARD || membudget_admit(session, len) || membudget_admit(status, len))
+            printf("not ");
+        printf("ok %d - above the hard limit no requests are admitted\n", ++testcount);
+    }
+    {
+        membudget_charge(-1500);
+        if (membudget_used() != 500 || membudget_level() != MEMBUDGET_OK || !membudget_admit(access, len))
+            printf("not ");
+        printf("ok %d - releasing memory admits requests again\n", ++testcount);
+    }
+    {
+        membudget_charge(-1000);
+        if (membudget_used() != 0)
+            printf("not ");
+        printf("ok %d - usage does not go below zero\n", ++testcount);
+    }
+
+    printf("1..%d\n", testcount);
+    return 0;
+}
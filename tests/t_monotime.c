@@ -0,0 +1,69 @@
+/* Copyright (C) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+#include "../debug.h"
+#include "../util.h"
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+int main(int argc, char *argv[]) {
+    int testcount = 0;
+    struct timeval a, b;
+    time_t wall;
+
+    debug_init("t_monotime");
+    debug_set_level(1);
+
+    /* readings never near zero, the timers use zero for not set */
+    {
+        monotime(&a);
+        if (a.tv_sec < 1000000 || a.tv_usec < 0 || a.tv_usec >= 1000000)
+            printf("not ");
+        printf("ok %d - monotime reading in range\n", ++testcount);
+    }
+
+    /* never goes backwards */
+    {
+        int i, ok = 1;
+
+        monotime(&a);
+        for (i = 0; i < 100000 && ok; i++) {
+            monotime(&b);
+            if (b.tv_sec < a.tv_sec || (b.tv_sec == a.tv_sec && b.tv_usec < a.tv_usec))
+                ok = 0;
+            a = b;
+        }
+        if (!ok)
+            printf("not ");
+        printf("ok %d - monotime does not go backwards\n", ++testcount);
+    }
+
+    /* advances with real time, at coarse resolution */
+    {
+        long us;
+
+        monotime(&a);
+        usleep(50000);
+        monotime(&b);
+        us = (b.tv_sec - a.tv_sec) * 1000000 + (b.tv_usec - a.tv_usec);
+        if (us < 30000 || us > 1000000)
+            printf("not ");
+        printf("ok %d - monotime advances with time\n", ++testcount);
+    }
+
+    /* monosec agrees with monotime, and is not the wall clock */
+    {
+        time_t s;
+
+        monotime(&a);
+        s = monosec();
+        wall = time(NULL);
+        if (s < a.tv_sec || s > a.tv_sec + 1 || s == wall)
+            printf("not ");
+        printf("ok %d - monosec\n", ++testcount);
+    }
+
+    printf("1..%d\n", testcount);
+    return 0;
+}
@@ -0,0 +1,141 @@
+/* Copyright (C) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+#include "../debug.h"
+#include "../profiler.h"
+#include "../threadreg.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static volatile int stop;
+static clockid_t burnclock;
+static int idlepipe[2];
+static int idleerr;
+
+static void *burner(void *arg) {
+    volatile unsigned long x = 0;
+
+    threadreg_name("burn:1");
+    while (!stop)
+        x++;
+    return NULL;
+}
+
+/* blocked in read during the run, which must not be interrupted */
+static void *idler(void *arg) {
+    char c;
+
+    threadreg_name("idle:1");
+    if (read(idlepipe[0], &c, 1) != 1)
+        idleerr = errno;
+    return NULL;
+}
+
+static uint64_t burncpu(void) {
+    struct timespec ts;
+
+    if (clock_gettime(burnclock, &ts))
+        return 0;
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[]) {
+    int testcount = 0;
+    pthread_t burnth, idleth;
+    char line[4096];
+    FILE *f;
+    int n, lines, count, total, burn, idle, bad;
+    uint64_t cpu, expect;
+
+    debug_init("t_profiler");
+    debug_set_level(1);
+
+    if (!profiler_supported()) {
+        printf("1..0 # skip profiling not supported on this platform\n");
+        return 0;
+    }
+
+    threadreg_altstack(PROFILER_STACK_SIZE);
+    threadreg_name("main");
+    if (pipe(idlepipe) || pthread_create(&burnth, NULL, burner, NULL) || pthread_create(&idleth, NULL, idler, NULL) ||
+        pthread_getcpuclockid(burnth, &burnclock)) {
+        printf("1..0 # skip cannot create threads\n");
+        return 0;
+    }
+    usleep(50000);
+
+    /* invalid parameters */
+    {
+        if (profiler_collect(0, 100) != -1 || profiler_collect(PROFILER_MAX_FREQUENCY + 1, 100) != -1 || profiler_collect(100, 0) != -1)
+            printf("not ");
+        printf("ok %d - invalid parameters\n", ++testcount);
+    }
+
+    /* a busy thread is sampled at about the given frequency of the cpu
+     * time it got, which may be little on a loaded machine */
+    {
+        cpu = burncpu();
+        n = profiler_collect(200, 300);
+        expect = (burncpu() - cpu) * 200 / 1000000000;
+        if (n < 0 || n < (int)expect / 4 || n > (int)expect * 2 + 10)
+            printf("not ");
+        printf("ok %d - collect %d samples, %d expected\n", ++testcount, n, (int)expect);
+    }
+
+    /* folded stacks, tagged by thread name; the idle thread has none */
+    {
+        f = tmpfile();
+        lines = f ? profiler_write(f) : -1;
+        total = burn = idle = bad = 0;
+        if (f) {
+            rewind(f);
+            while (fgets(line, sizeof(line), f)) {
+                char *sp = strrchr(line, ' ');
+
+                count = sp ? atoi(sp + 1) : 0;
+                if (!sp || count < 1 || !strchr(line, ';'))
+                    bad++;
+                total += count;
+                if (!strncmp(line, "burn:1;", 7))
+                    burn += count;
+                if (!strncmp(line, "idle:1;", 7))
+                    idle += count;
+            }
+            fclose(f);
+        }
+        if (lines < (n ? 1 : 0) || bad || total != n || burn < n / 2 || idle)
+            printf("not ");
+        printf("ok %d - folded stacks\n", ++testcount);
+    }
+
+    /* the samples are freed once written */
+    {
+        f = tmpfile();
+        if (!f || profiler_write(f) != 0)
+            printf("not ");
+        printf("ok %d - samples freed\n", ++testcount);
+        if (f)
+            fclose(f);
+    }
+
+    /* system calls are not interrupted */
+    {
+        stop = 1;
+        if (write(idlepipe[1], "x", 1) != 1)
+            return 1;
+        pthread_join(burnth, NULL);
+        pthread_join(idleth, NULL);
+        if (idleerr)
+            printf("not ");
+        printf("ok %d - no interrupted system calls\n", ++testcount);
+    }
+
+    printf("1..%d\n", testcount);
+    return 0;
+}
@@ -0,0 +1,107 @@
+/* Copyright (C) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+#include "../debug.h"
+#include "../radsecproxy.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint8_t secret[] = "xyzzy5461";
+static uint8_t auth[16] = {0x0f, 0x40, 0x3f, 0x94, 0x73, 0x97, 0x80, 0x57, 0xbd, 0x83, 0xd5, 0xcb, 0x98, 0xf4, 0x22, 0x7a};
+
+static int equal(struct tlv *attr, const void *value, int len) {
+    return attr->l == len && !memcmp(attr->v, value, len);
+}
+
+int main(int argc, char *argv[]) {
+    int testcount = 7;
+    struct tlv *attr;
+    uint8_t buf[253];
+
+    debug_init("t_radius11");
+    debug_set_level(1);
+
+    printf("1..%d\n", testcount);
+    testcount = 1;
+
+    /* RFC 2865 section 7.1 example */
+    {
+        uint8_t hidden[] = {0x0d, 0xbe, 0x70, 0x8d, 0x93, 0xd4, 0x13, 0xce, 0x31, 0x96, 0xe4, 0x3f, 0x78, 0x2a, 0x0a, 0xee};
+        attr = maketlv(RAD_Attr_User_Password, 10, "arctangent");
+        if (!pwdhide(attr, secret, 9, auth) || !equal(attr, hidden, 16))
+            printf("not ");
+        printf("ok %d - pwdhide\n", testcount++);
+
+        if (!pwdreveal(attr, secret, 9, auth) || !equal(attr, "arctangent", 10))
+            printf("not ");
+        printf("ok %d - pwdreveal\n", testcount++);
+        freetlv(attr);
+    }
+
+    /* empty and oversized passwords */
+    {
+        int ok = 1;
+        attr = maketlv(RAD_Attr_User_Password, 0, NULL);
+        ok = pwdhide(attr, secret, 9, auth) && attr->l == 16 && pwdreveal(attr, secret, 9, auth) && attr->l == 0;
+        freetlv(attr);
+        memset(buf, 'x', sizeof(buf));
+        attr = maketlv(RAD_Attr_User_Password, 129, buf);
+        ok = ok && !pwdhide(attr, secret, 9, auth);
+        freetlv(attr);
+        if (!ok)
+            printf("not ");
+        printf("ok %d - pwdhide length limits\n", testcount++);
+    }
+
+    /* Tunnel-Password keeps the tag and gets salt and length */
+    {
+        uint8_t value[] = "\x01tunnelsecret";
+        attr = maketlv(RAD_Attr_Tunnel_Password, 13, value);
+        if (!tunnelpwdhide(attr, secret, 9, auth) || attr->l != 3 + 16 || attr->v[0] != 1 || !(attr->v[1] & 0x80) ||
+            !tunnelpwdreveal(attr, secret, 9, auth) || !equal(attr, value, 13))
+            printf("not ");
+        printf("ok %d - tunnel password\n", testcount++);
+        freetlv(attr);
+    }
+
+    /* the encrypted part of a Tunnel-Password is a multiple of 16 */
+    {
+        memset(buf, 0xff, 3 + 17);
+        attr = maketlv(RAD_Attr_Tunnel_Password, 3 + 17, buf);
+        if (tunnelpwdreveal(attr, secret, 9, auth))
+            printf("not ");
+        printf("ok %d - tunnel password invalid length\n", testcount++);
+        freetlv(attr);
+    }
+
+    /* MS-MPPE keys in a Microsoft VSA, other sub attributes are kept */
+    {
+        uint8_t vsa[4 + 2 + 32 + 2 + 32 + 6], *p = vsa;
+        int i;
+
+        memcpy(p, "\x00\x00\x01\x37", 4);
+        p += 4;
+        *p++ = RAD_VS_ATTR_MS_MPPE_Send_Key;
+        *p++ = 2 + 32;
+        for (i = 0; i < 32; i++)
+            *p++ = i;
+        *p++ = RAD_VS_ATTR_MS_MPPE_Recv_Key;
+        *p++ = 2 + 32;
+        for (i = 0; i < 32; i++)
+            *p++ = 0x80 + i;
+        memcpy(p, "\x07\x06\x00\x00\x00\x01", 6);
+
+        attr = maketlv(RAD_Attr_Vendor_Specific, sizeof(vsa), vsa);
+        if (!msmppeconvert(attr, 1, secret, 9, auth) || attr->l != 4 + 2 * (4 + 48) + 6)
+            printf("not ");
+        printf("ok %d - msmppe hide\n", testcount++);
+
+        if (!msmppeconvert(attr, 0, secret, 9, auth) || !equal(attr, vsa, sizeof(vsa)))
+            printf("not ");
+        printf("ok %d - msmppe reveal\n", testcount++);
+        freetlv(attr);
+    }
+
+    return 0;
+}
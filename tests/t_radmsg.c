@@ -17,6 +17,14 @@ void test_radlen(uint8_t *buf, int expected, char *msg) {
     printf("ok %d - radlen %s (expected %d, got %d)\n", ++numtests, msg, expected, actual);
 }
 
+void test_radlen_max(uint8_t *buf, int max, int expected, char *msg) {
+    int actual = get_checked_rad_length_max(buf, max);
+
+    if (actual != expected)
+        printf("not ");
+    printf("ok %d - radlen max %d %s (expected %d, got %d)\n", ++numtests, max, msg, expected, actual);
+}
+
 int main(int argc, char *argv[]) {
     {
         uint8_t buf[] = {0x0c, 0x00, 0x00, 0x2a};
@@ -48,5 +56,21 @@ int main(int argc, char *argv[]) {
         test_radlen(buf, 0, "zero");
     }
 
+    {
+        uint8_t buf[] = {0x0c, 0x00, 0x10, 0x01};
+        test_radlen_max(buf, RAD_Max_Length_Extended, 4097, "above 4096");
+    }
+
+    {
+        uint8_t buf[] = {0x0c, 0x00, 0xff, 0xff};
+        test_radlen_max(buf, RAD_Max_Length_Extended, 65535, "upper bound");
+        test_radlen_max(buf, 16384, -65535, "too big");
+    }
+
+    {
+        uint8_t buf[] = {0x0c, 0x00, 0x00, 0x13};
+        test_radlen_max(buf, RAD_Max_Length_Extended, -19, "too small");
+    }
+
     printf("1..%d\n", numtests);
 }
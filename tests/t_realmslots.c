@@ -0,0 +1,104 @@
+/* Copyright (C) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+#include "../debug.h"
+#include "../radsecproxy.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define IDS 255
+
+static struct server server;
+static struct request rqs[2][IDS];
+
+static void resetserver(void) {
+    free(server.realmslots);
+    memset(&server, 0, sizeof(server));
+    memset(rqs, 0, sizeof(rqs));
+    pthread_mutex_init(&server.realmslots_mutex, NULL);
+    server.realmslots = calloc(2, sizeof(struct realmslots));
+}
+
+/* take IDs for realm r until refused or n are taken, returns the count taken */
+static int take(struct realm *realm, int r, int n) {
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (rqs[r][i].inslots)
+            continue;
+        rqs[r][i].realm = realm;
+        if (!realmslotstake(&server, &rqs[r][i], IDS))
+            break;
+    }
+    return (int)server.realmslots[r].out;
+}
+
+int main(int argc, char *argv[]) {
+    int testcount = 4, a, b, i;
+    struct realm ra, rb;
+
+    debug_init("t_realmslots");
+    debug_set_level(1);
+
+    memset(&ra, 0, sizeof(ra));
+    memset(&rb, 0, sizeof(rb));
+    ra.name = "a.example";
+    ra.share = 1;
+    ra.slotsidx = 0;
+    rb.name = "b.example";
+    rb.share = 1;
+    rb.slotsidx = 1;
+
+    printf("1..%d\n", testcount);
+    testcount = 1;
+
+    /* a realm that is alone at a server may use all IDs */
+    {
+        resetserver();
+        if (take(&ra, 0, IDS) != IDS || server.realmslots[0].shed)
+            printf("not ");
+        printf("ok %d - lone realm uses all IDs\n", testcount++);
+    }
+
+    /* a freed ID goes to another realm once it has a request out */
+    {
+        realmslotsadd(&server, &rqs[0][0], -1);
+        realmslotsadd(&server, &rqs[0][1], -1);
+        if (take(&rb, 1, 1) != 1 || take(&ra, 0, IDS) != IDS - 2)
+            printf("not ");
+        printf("ok %d - other realm takes a freed ID\n", testcount++);
+    }
+
+    /* a realm that found no free ID makes the lone realm give up half */
+    {
+        resetserver();
+        take(&ra, 0, IDS);
+        take(&rb, 1, 1);
+        realmslotsstarved(&server, &rqs[1][0]);
+        realmslotsadd(&server, &rqs[1][0], -1);
+        for (i = 0; i < IDS / 2 + 1; i++)
+            realmslotsadd(&server, &rqs[0][i], -1);
+        if (!server.realmstarved || take(&ra, 0, IDS) != IDS / 2)
+            printf("not ");
+        printf("ok %d - lone realm yields to a starved realm\n", testcount++);
+    }
+
+    /* two realms take IDs in turn until half of them are in use; then realm
+       a of weight 1 has more than its 1 of 5 shares (one held back) and gets
+       no more, while realm b of weight 3 goes on to its 3 of 5 */
+    {
+        resetserver();
+        rb.share = 3;
+        for (a = b = i = 0; i < IDS; i++) {
+            a = take(&ra, 0, a + 1);
+            b = take(&rb, 1, b + 1);
+        }
+        if (a != (IDS / 2 + 1) / 2 || b != IDS * 3 / 5 || !server.realmslots[0].shed)
+            printf("not ");
+        printf("ok %d - realms share IDs by weight\n", testcount++);
+    }
+
+    free(server.realmslots);
+    return 0;
+}
@@ -0,0 +1,140 @@
+/* Copyright (C) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+#include "../debug.h"
+#include "../radsecproxy.h"
+#include "../util.h"
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static struct clsrvconf conf;
+
+/* a connection of the client block from ip and port */
+static struct client *newclient(const char *ip, int port) {
+    struct client *client = alignedcalloc(CACHE_LINE, 1, sizeof(struct client));
+    struct sockaddr_in *sin = calloc(1, sizeof(struct sockaddr_storage));
+
+    sin->sin_family = AF_INET;
+    sin->sin_port = htons(port);
+    inet_pton(AF_INET, ip, &sin->sin_addr);
+    client->addr = (struct sockaddr *)sin;
+    client->conf = &conf;
+    client->nrqs = MAX_REQUESTS;
+    client->rqs = calloc(MAX_REQUESTS, sizeof(struct request *));
+    client->replyq = newqueue();
+    pthread_mutex_init(&client->lock, NULL);
+    return client;
+}
+
+/* a request with id from client, the authenticator filled with auth */
+static struct request *newrq(struct client *from, uint8_t id, uint8_t auth) {
+    struct request *rq = newrequest();
+
+    rq->from = from;
+    rq->rqid = id;
+    rq->rqidx = id;
+    memset(rq->rqauth, auth, 16);
+    return rq;
+}
+
+/* pass rq to addclientrq as a client reader does, returns its result */
+static int add(struct request *rq) {
+    int new = addclientrq(rq);
+
+    freerq(rq);
+    return new;
+}
+
+int main(int argc, char *argv[]) {
+    int testcount = 7, i;
+    struct client *a1, *a2, *a3, *b1, *b2;
+    struct request *rq, *rqb;
+    struct server *server;
+    struct list_node *entry;
+
+    debug_init("t_shareddup");
+    debug_set_level(1);
+
+    printf("1..%d\n", testcount);
+    testcount = 1;
+
+    conf.name = "nas";
+    conf.shareddupcache = 1;
+    conf.dupinterval = DUPLICATE_INTERVAL;
+    conf.maxpacketlen = 4096;
+    server = calloc(1, sizeof(struct server));
+    server->nrequests = MAX_REQUESTS;
+    server->requests = alignedcalloc(CACHE_LINE, MAX_REQUESTS, sizeof(struct rqout));
+    for (i = 0; i < MAX_REQUESTS; i++)
+        pthread_mutex_init(&server->requests[i].lock, NULL);
+
+    a1 = newclient("192.0.2.1", 1812);
+    b1 = newclient("192.0.2.2", 1812);
+
+    /* the same id from two addresses are two requests */
+    {
+        rq = newrq(a1, 7, 'a');
+        rqb = newrq(b1, 7, 'b');
+        if (!add(newrqref(rq)) || !add(newrqref(rqb)))
+            printf("not ");
+        printf("ok %d - same id from another address is new\n", testcount++);
+    }
+
+    /* rq is outstanding at the server while a1 is still open */
+    rq->to = server;
+    rq->newid = 3;
+    server->requests[3].rq = newrqref(rq);
+
+    {
+        a2 = newclient("192.0.2.1", 2000);
+        if (add(newrq(a2, 7, 'a')) || rq->from != a1 || a2->rqs[7])
+            printf("not ");
+        printf("ok %d - retransmit on another open connection is ignored\n", testcount++);
+    }
+
+    {
+        b2 = newclient("192.0.2.2", 2000);
+        if (add(newrq(b2, 7, 'b')))
+            printf("not ");
+        printf("ok %d - other address not evicted\n", testcount++);
+    }
+
+    {
+        removeclientrqs(a1);
+        if (server->requests[3].rq != rq || rq->from != conf.dupclient)
+            printf("not ");
+        printf("ok %d - orphaned request stays outstanding\n", testcount++);
+    }
+
+    {
+        if (add(newrq(a2, 7, 'a')) || rq->from != a2 || a2->rqs[7] != rq)
+            printf("not ");
+        printf("ok %d - retransmit after reconnect joins orphaned request\n", testcount++);
+    }
+
+    {
+        rq->replybuflen = 20;
+        rq->replybuf = calloc(1, 20);
+        rq->replybuf[0] = RAD_Access_Accept;
+        rq->replybuf[3] = 20;
+        a3 = newclient("192.0.2.1", 3000);
+        entry = NULL;
+        if (add(newrq(a3, 7, 'a')) || !(entry = list_first(a3->replyq->entries)) ||
+            ((struct request *)entry->data)->replybuflen != 20 ||
+            memcmp(((struct request *)entry->data)->replybuf, rq->replybuf, 20))
+            printf("not ");
+        printf("ok %d - retransmit after reply is answered from cache\n", testcount++);
+    }
+
+    {
+        if (!add(newrq(a3, 7, 'c')))
+            printf("not ");
+        printf("ok %d - new authenticator is a new request\n", testcount++);
+    }
+
+    freerq(rq);
+    freerq(rqb);
+    return 0;
+}
@@ -0,0 +1,200 @@
+/* Copyright (C) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+#include "../debug.h"
+#include "../hostport.h"
+#include "../sockfilter.h"
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static struct list *hostportlists;
+
+static void addpeers(char **peers) {
+    struct list *hostports = NULL;
+    struct list_node *entry;
+
+    if (!addhostport(&hostports, peers, "1812", 1))
+        return;
+    for (entry = list_first(hostports); entry; entry = list_next(entry))
+        resolvehostport((struct hostportres *)entry->data, AF_UNSPEC, SOCK_DGRAM, 0);
+    list_push(hostportlists, hostports);
+}
+
+static void clearpeers(void) {
+    struct list *hostports;
+
+    while ((hostports = list_shift(hostportlists)))
+        freehostports(hostports);
+}
+
+/* send a datagram from loopback to a filtered socket, return 1 if it is received, 0 if not, -1 on error */
+static int delivered(int family, int *attached) {
+    struct sockaddr_storage addr;
+    socklen_t addrlen = family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+    struct pollfd pfd;
+    int rs, ss, result = -1;
+    char buf[4];
+
+    memset(&addr, 0, sizeof(addr));
+    addr.ss_family = family;
+    if (family == AF_INET)
+        ((struct sockaddr_in *)&addr)->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    else
+        ((struct sockaddr_in6 *)&addr)->sin6_addr = in6addr_loopback;
+
+    rs = socket(family, SOCK_DGRAM, 0);
+    ss = socket(family, SOCK_DGRAM, 0);
+    if (rs < 0 || ss < 0 || bind(rs, (struct sockaddr *)&addr, addrlen) ||
+        getsockname(rs, (struct sockaddr *)&addr, &addrlen))
+        goto exit;
+    *attached = attachsourcefilter(rs, family, hostportlists);
+    if (sendto(ss, "test", 4, 0, (struct sockaddr *)&addr, addrlen) != 4)
+        goto exit;
+    pfd.fd = rs;
+    pfd.events = POLLIN;
+    result = poll(&pfd, 1, 200) == 1 && recv(rs, buf, sizeof(buf), 0) == 4;
+
+exit:
+    if (rs >= 0)
+        close(rs);
+    if (ss >= 0)
+        close(ss);
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+    int testcount = 0, attached, i, ipv6;
+    char **many;
+
+    debug_init("t_sockfilter");
+    debug_set_level(1);
+    hostportlists = list_create();
+
+    {
+        char *peers[] = {"127.0.0.1", NULL};
+        addpeers(peers);
+        if (delivered(AF_INET, &attached) != 1 || !attached)
+            printf("not ");
+        printf("ok %d - known IPv4 host accepted\n", ++testcount);
+        clearpeers();
+    }
+
+    {
+        char *peers[] = {"10.0.0.0/8", "192.0.2.1", NULL};
+        addpeers(peers);
+        if (delivered(AF_INET, &attached) != 0 || !attached)
+            printf("not ");
+        printf("ok %d - unknown IPv4 host dropped\n", ++testcount);
+        clearpeers();
+    }
+
+    {
+        char *peers[] = {"192.0.2.1", NULL};
+        char *prefix[] = {"127.0.0.0/8", NULL};
+        addpeers(peers);
+        addpeers(prefix);
+        if (delivered(AF_INET, &attached) != 1 || !attached)
+            printf("not ");
+        printf("ok %d - IPv4 prefix from second client accepted\n", ++testcount);
+        clearpeers();
+    }
+
+    {
+        char *peers[] = {"192.0.2.0/24", "0.0.0.0/0", NULL};
+        addpeers(peers);
+        if (delivered(AF_INET, &attached) != 1 || attached)
+            printf("not ");
+        printf("ok %d - no filter for 0.0.0.0/0\n", ++testcount);
+        clearpeers();
+    }
+
+    {
+        many = calloc(3001, sizeof(char *));
+        for (i = 0; i < 3000; i++) {
+            many[i] = malloc(16);
+            sprintf(many[i], "10.0.%d.%d", i / 256, i % 256);
+        }
+        addpeers(many);
+        if (delivered(AF_INET, &attached) != 0 || !attached)
+            printf("not ");
+        printf("ok %d - 3000 IPv4 hosts fit in one filter\n", ++testcount);
+        free(many[2999]);
+        many[2999] = strdup("127.0.0.1");
+        clearpeers();
+        addpeers(many);
+        if (delivered(AF_INET, &attached) != 1 || !attached)
+            printf("not ");
+        printf("ok %d - last of 3000 IPv4 hosts accepted\n", ++testcount);
+        clearpeers();
+        for (i = 0; i < 3000; i++)
+            free(many[i]);
+        free(many);
+    }
+
+    ipv6 = socket(AF_INET6, SOCK_DGRAM, 0);
+    if (ipv6 >= 0)
+        close(ipv6);
+
+    {
+        char *peers[] = {"[2001:db8::]/32", "[::1]", NULL};
+        addpeers(peers);
+        if (ipv6 < 0)
+            printf("ok %d # skip no IPv6\n", ++testcount);
+        else {
+            if (delivered(AF_INET6, &attached) != 1 || !attached)
+                printf("not ");
+            printf("ok %d - known IPv6 host accepted\n", ++testcount);
+        }
+        clearpeers();
+    }
+
+    {
+        char *peers[] = {"[2001:db8::]/32", "[::2]", "[fe80::]/10", NULL};
+        addpeers(peers);
+        if (ipv6 < 0)
+            printf("ok %d # skip no IPv6\n", ++testcount);
+        else {
+            if (delivered(AF_INET6, &attached) != 0 || !attached)
+                printf("not ");
+            printf("ok %d - unknown IPv6 host dropped\n", ++testcount);
+        }
+        clearpeers();
+    }
+
+    {
+        char *peers[] = {"[::]/1", "[8000::]/1", NULL};
+        addpeers(peers);
+        if (ipv6 < 0)
+            printf("ok %d # skip no IPv6\n", ++testcount);
+        else {
+            if (delivered(AF_INET6, &attached) != 1 || !attached)
+                printf("not ");
+            printf("ok %d - IPv6 short prefix accepted\n", ++testcount);
+        }
+        clearpeers();
+    }
+
+    {
+        char *peers[] = {"[::1]/127", NULL};
+        addpeers(peers);
+        if (ipv6 < 0)
+            printf("ok %d # skip no IPv6\n", ++testcount);
+        else {
+            if (delivered(AF_INET6, &attached) != 1 || !attached)
+                printf("not ");
+            printf("ok %d - IPv6 long prefix accepted\n", ++testcount);
+        }
+        clearpeers();
+    }
+
+    list_destroy(hostportlists);
+    printf("1..%d\n", testcount);
+    return 0;
+}
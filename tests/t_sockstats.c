@@ -0,0 +1,131 @@
+/* Copyright (C) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+#include "../debug.h"
+#include "../sockstats.h"
+#include "../util.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static int udpsocket(struct sockaddr_in *sa) {
+    socklen_t len = sizeof(*sa);
+    int s = socket(AF_INET, SOCK_DGRAM, 0);
+
+    memset(sa, 0, sizeof(*sa));
+    sa->sin_family = AF_INET;
+    sa->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (s < 0 || bind(s, (struct sockaddr *)sa, sizeof(*sa)) || getsockname(s, (struct sockaddr *)sa, &len))
+        return -1;
+    return s;
+}
+
+static int readone(int s, struct sockstats *st) {
+    uint8_t buf[1024];
+    struct iovec iov = {.iov_base = buf, .iov_len = sizeof(buf)};
+    union {
+        uint8_t buf[SOCKSTATS_CMSG_SPACE];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg;
+    int n;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = &control;
+    msg.msg_controllen = sizeof(control);
+    n = recvmsg(s, &msg, MSG_DONTWAIT);
+    if (n >= 0)
+        sockstats_update(st, &msg);
+    return n;
+}
+
+int main(int argc, char *argv[]) {
+    int testcount = 0;
+    struct sockaddr_in rsa, ssa;
+    struct sockstats *st;
+    uint8_t pkt[512];
+    int r, s, i;
+
+    debug_init("t_sockstats");
+    debug_set_level(1);
+
+    r = udpsocket(&rsa);
+    s = udpsocket(&ssa);
+    if (r < 0 || s < 0) {
+        printf("1..0 # skip no loopback udp sockets\n");
+        return 0;
+    }
+    set_sockbufs(r, 4096, 0);
+    sockstats_timestamps(1);
+    st = sockstats_add(r, "test");
+
+    /* registry */
+    {
+        if (!st || sockstats_find(r) != st || sockstats_find(s))
+            printf("not ");
+        printf("ok %d - sockstats_add and sockstats_find\n", ++testcount);
+    }
+
+    /* overflow the small receive buffer, then read one packet */
+    {
+        memset(pkt, 0, sizeof(pkt));
+        for (i = 0; i < 200; i++)
+            sendto(s, pkt, sizeof(pkt), 0, (struct sockaddr *)&rsa, sizeof(rsa));
+        if (readone(r, st) != sizeof(pkt) || st->packets != 1)
+            printf("not ");
+        printf("ok %d - packet accounted\n", ++testcount);
+    }
+
+    /* the kernel reports the drops with the packets queued after them */
+    {
+        while (readone(r, st) > 0)
+            ;
+        sendto(s, pkt, sizeof(pkt), 0, (struct sockaddr *)&rsa, sizeof(rsa));
+        readone(r, st);
+#ifdef SO_RXQ_OVFL
+        if (!st->drops || st->drops > 199)
+            printf("not ");
+        printf("ok %d - kernel drops reported\n", ++testcount);
+#else
+        printf("ok %d # skip SO_RXQ_OVFL not supported\n", ++testcount);
+#endif
+    }
+
+    {
+#ifdef SCM_TIMESTAMPNS
+        if (st->qdelayn != st->packets || st->qdelaysum < st->qdelaymax || st->qdelaymax > 10000000)
+            printf("not ");
+        printf("ok %d - receive queue delay recorded\n", ++testcount);
+#else
+        printf("ok %d # skip SO_TIMESTAMPNS not supported\n", ++testcount);
+#endif
+    }
+
+    /* the log remembers the drops and resets the maximum delay */
+    {
+        uint32_t drops = st->drops;
+
+        sockstats_log();
+        if (st->drops != drops || st->dropslast != drops || st->qdelaymax)
+            printf("not ");
+        printf("ok %d - sockstats_log\n", ++testcount);
+    }
+
+    /* no statistics for unregistered sockets */
+    {
+        sendto(s, pkt, sizeof(pkt), 0, (struct sockaddr *)&rsa, sizeof(rsa));
+        if (readone(r, NULL) != sizeof(pkt))
+            printf("not ");
+        printf("ok %d - update without statistics\n", ++testcount);
+    }
+
+    close(r);
+    close(s);
+    printf("1..%d\n", testcount);
+    return 0;
+}
@@ -0,0 +1,158 @@
+/* Copyright (C) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+#include "../debug.h"
+#include "../threadreg.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LONGNAME "tlsrd:a-client-with-a-long-name"
+
+static int toworker[2], tomain[2];
+
+static void burn(long ns) {
+    struct timespec start, now;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+    do
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    while ((now.tv_sec - start.tv_sec) * 1000000000L + now.tv_nsec - start.tv_nsec < ns);
+}
+
+static void *worker(void *arg) {
+    char c;
+
+    threadreg_name("tlsrd:%s", "a-client-with-a-long-name");
+    burn(20000000);
+    if (write(tomain[1], "x", 1) != 1 || read(toworker[0], &c, 1) != 1)
+        return NULL;
+    threadreg_name("tlsrd:%s", "nas1");
+    if (write(tomain[1], "x", 1) != 1 || read(toworker[0], &c, 1) != 1)
+        return NULL;
+    return NULL;
+}
+
+static struct threadstats *findname(struct threadstats *stats, int n, const char *name) {
+    int i;
+
+    for (i = 0; i < n; i++)
+        if (!strcmp(stats[i].name, name))
+            return &stats[i];
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    int testcount = 0;
+    struct threadstats *stats, *s;
+    pthread_t th;
+    char c;
+    int n;
+
+    debug_init("t_threadreg");
+    debug_set_level(1);
+
+    /* nothing registered yet */
+    {
+        n = threadreg_snapshot(&stats);
+        if (n != 0)
+            printf("not ");
+        printf("ok %d - empty registry\n", ++testcount);
+        free(stats);
+    }
+
+    /* the calling thread */
+    {
+        threadreg_name("main");
+        n = threadreg_snapshot(&stats);
+        if (n != 1 || strcmp(stats[0].name, "main"))
+            printf("not ");
+        printf("ok %d - register calling thread\n", ++testcount);
+        free(stats);
+    }
+
+    if (pipe(toworker) || pipe(tomain) || pthread_create(&th, NULL, worker, NULL)) {
+        printf("1..%d\n", testcount);
+        return 1;
+    }
+
+    /* a second thread, with its cpu time */
+    {
+        if (read(tomain[0], &c, 1) != 1)
+            return 1;
+        n = threadreg_snapshot(&stats);
+        s = findname(stats, n, LONGNAME);
+        if (n != 2 || !s || s->cpu < 20000000 || s->cpudelta != s->cpu)
+            printf("not ");
+        printf("ok %d - register thread with cpu time\n", ++testcount);
+        free(stats);
+    }
+
+    /* cpu time since the previous snapshot */
+    {
+        n = threadreg_snapshot(&stats);
+        s = findname(stats, n, LONGNAME);
+        if (!s || s->cpudelta >= 20000000 || s->cpudelta > s->cpu)
+            printf("not ");
+        printf("ok %d - cpu time since previous snapshot\n", ++testcount);
+        free(stats);
+    }
+
+#if defined(__linux__)
+    /* the kernel thread name, cut to 15 characters, and context switches */
+    {
+        char path[64], comm[32] = "";
+        FILE *f;
+
+        n = threadreg_snapshot(&stats);
+        s = findname(stats, n, LONGNAME);
+        if (s) {
+            snprintf(path, sizeof(path), "/proc/self/task/%d/comm", s->tid);
+            if ((f = fopen(path, "r"))) {
+                if (!fgets(comm, sizeof(comm), f))
+                    comm[0] = '\0';
+                fclose(f);
+            }
+        }
+#if defined(HAVE_PTHREAD_SETNAME_NP)
+        if (!s || strncmp(comm, LONGNAME, 15) || comm[15] != '\n')
+            printf("not ");
+#endif
+        printf("ok %d - kernel thread name\n", ++testcount);
+        if (!s || s->vcsw < 0 || s->nvcsw < 0)
+            printf("not ");
+        printf("ok %d - context switches\n", ++testcount);
+        free(stats);
+    }
+#endif
+
+    /* renaming */
+    {
+        if (write(toworker[1], "x", 1) != 1 || read(tomain[0], &c, 1) != 1)
+            return 1;
+        n = threadreg_snapshot(&stats);
+        if (n != 2 || !findname(stats, n, "tlsrd:nas1") || findname(stats, n, LONGNAME))
+            printf("not ");
+        printf("ok %d - rename thread\n", ++testcount);
+        free(stats);
+    }
+
+    /* removed on exit */
+    {
+        if (write(toworker[1], "x", 1) != 1)
+            return 1;
+        pthread_join(th, NULL);
+        n = threadreg_snapshot(&stats);
+        if (n != 1 || strcmp(stats[0].name, "main"))
+            printf("not ");
+        printf("ok %d - unregister on exit\n", ++testcount);
+        free(stats);
+        threadreg_log();
+    }
+
+    printf("1..%d\n", testcount);
+    return 0;
+}
@@ -0,0 +1,184 @@
+/* Copyright (C) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+#include "../debug.h"
+#include "../radsecproxy.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct stream {
+    uint8_t *data;
+    int len;
+    int pos;
+    int chunk;   /* max bytes per read */
+    int blocked; /* every other read would block */
+};
+
+static int streamread(void *ctx, uint8_t *buf, int num) {
+    struct stream *s = (struct stream *)ctx;
+
+    if (s->blocked ^= 1)
+        return 0;
+    if (s->pos == s->len)
+        return -1;
+    if (num > s->chunk)
+        num = s->chunk;
+    if (num > s->len - s->pos)
+        num = s->len - s->pos;
+    memcpy(buf, s->data + s->pos, num);
+    s->pos += num;
+    return num;
+}
+
+/* takes up to chunk bytes per write until len is reached, then blocks;
+   fails if pos is negative */
+static int streamwrite(void *ctx, const uint8_t *buf, int num) {
+    struct stream *s = (struct stream *)ctx;
+
+    if (s->pos < 0)
+        return -1;
+    if (num > s->chunk)
+        num = s->chunk;
+    if (num > s->len - s->pos)
+        num = s->len - s->pos;
+    memcpy(s->data + s->pos, buf, num);
+    s->pos += num;
+    return num;
+}
+
+int main(int argc, char *argv[]) {
+    int testcount = 9, len, calls;
+    uint8_t msgs[20 + 30], *buf = NULL;
+    struct radread rd;
+    struct stream s;
+
+    debug_init("t_upstream");
+    debug_set_level(1);
+
+    printf("1..%d\n", testcount);
+    testcount = 1;
+
+    memset(msgs, 0, sizeof(msgs));
+    msgs[0] = RAD_Access_Accept;
+    msgs[3] = 20;
+    msgs[20] = RAD_Access_Reject;
+    msgs[23] = 30;
+    memset(msgs + 40, 0xaa, 10);
+
+    /* messages arriving one byte at a time */
+    {
+        memset(&rd, 0, sizeof(rd));
+        memset(&s, 0, sizeof(s));
+        s.data = msgs;
+        s.len = sizeof(msgs);
+        s.chunk = 1;
+        for (calls = 0; !(len = radreadnb(&rd, streamread, &s, RAD_Max_Length, &buf)); calls++)
+            ;
+        if (len != 20 || !buf || memcmp(buf, msgs, 20) || calls < 20)
+            printf("not ");
+        printf("ok %d - partial reads\n", testcount++);
+        free(buf);
+        buf = NULL;
+
+        while (!(len = radreadnb(&rd, streamread, &s, RAD_Max_Length, &buf)))
+            ;
+        if (len != 30 || !buf || memcmp(buf, msgs + 20, 30))
+            printf("not ");
+        printf("ok %d - second message\n", testcount++);
+        free(buf);
+        buf = NULL;
+
+        while (!(len = radreadnb(&rd, streamread, &s, RAD_Max_Length, &buf)))
+            ;
+        if (len != -1 || buf)
+            printf("not ");
+        printf("ok %d - end of stream\n", testcount++);
+        radreadreset(&rd);
+    }
+
+    /* invalid length in header */
+    {
+        uint8_t bad[4] = {RAD_Access_Accept, 0, 0, 4};
+        memset(&rd, 0, sizeof(rd));
+        memset(&s, 0, sizeof(s));
+        s.data = bad;
+        s.len = sizeof(bad);
+        s.chunk = 4;
+        while (!(len = radreadnb(&rd, streamread, &s, RAD_Max_Length, &buf)))
+            ;
+        if (len != -1 || buf)
+            printf("not ");
+        printf("ok %d - invalid length\n", testcount++);
+        radreadreset(&rd);
+    }
+
+    /* messages above 4096 bytes, only if the connection allows them */
+    {
+        uint8_t *big = calloc(1, 10000);
+        big[0] = RAD_Access_Challenge;
+        big[2] = 10000 >> 8;
+        big[3] = 10000 & 0xff;
+        memset(&rd, 0, sizeof(rd));
+        memset(&s, 0, sizeof(s));
+        s.data = big;
+        s.len = 10000;
+        s.chunk = 1500;
+        while (!(len = radreadnb(&rd, streamread, &s, RAD_Max_Length, &buf)))
+            ;
+        if (len != -1 || buf)
+            printf("not ");
+        printf("ok %d - large message rejected\n", testcount++);
+        radreadreset(&rd);
+
+        memset(&s, 0, sizeof(s));
+        s.data = big;
+        s.len = 10000;
+        s.chunk = 1500;
+        while (!(len = radreadnb(&rd, streamread, &s, RAD_Max_Length_Extended, &buf)))
+            ;
+        if (len != 10000 || !buf || memcmp(buf, big, 10000))
+            printf("not ");
+        printf("ok %d - large message accepted\n", testcount++);
+        free(buf);
+        buf = NULL;
+        radreadreset(&rd);
+        free(big);
+    }
+
+    /* writes to a stream that is not writable are queued whole */
+    {
+        struct radwrite wr;
+        uint8_t sink[sizeof(msgs)], *big = calloc(1, UPSTREAM_WRITE_MAX);
+
+        memset(&wr, 0, sizeof(wr));
+        memset(&s, 0, sizeof(s));
+        s.data = sink;
+        s.len = 7;
+        s.chunk = 5;
+        if (radwritenb(&wr, streamwrite, &s, msgs, 20) != 1 || radwritenb(&wr, streamwrite, &s, msgs + 20, 30) != 1 ||
+            s.pos != 7 || wr.len - wr.off != 43)
+            printf("not ");
+        s.len = sizeof(sink);
+        for (calls = 0; (len = radflushnb(&wr, streamwrite, &s)) > 0; calls++)
+            ;
+        if (len || memcmp(sink, msgs, sizeof(msgs)))
+            printf("not ");
+        printf("ok %d - queued writes\n", testcount++);
+
+        s.pos = s.len = 0;
+        if (radwritenb(&wr, streamwrite, &s, big, UPSTREAM_WRITE_MAX) != 1 || radwritenb(&wr, streamwrite, &s, msgs, 20) != 0 ||
+            wr.len - wr.off != UPSTREAM_WRITE_MAX)
+            printf("not ");
+        printf("ok %d - full queue\n", testcount++);
+
+        s.pos = -1;
+        if (radflushnb(&wr, streamwrite, &s) != -1)
+            printf("not ");
+        printf("ok %d - write error\n", testcount++);
+        radwritereset(&wr);
+        free(big);
+    }
+
+    return 0;
+}
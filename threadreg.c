@@ -0,0 +1,251 @@
+/* Copyright (c) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+/* Registry of the live threads. Every thread names itself by its role and
+ * peer when it starts, so that it can be told apart in top -H, perf or a
+ * debugger, and its cpu time and context switches are logged on SIGUSR1.
+ * The entry of a thread is removed by the destructor of its thread-specific
+ * key when the thread exits; the destructor takes the registry lock, so the
+ * threads in the registry are alive as long as the lock is held. */
+
+#define _GNU_SOURCE
+
+#include "threadreg.h"
+#include "debug.h"
+#include "list.h"
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+struct threadreg {
+    char name[THREADREG_NAMELEN];
+    pthread_t thread;
+    int tid;
+    uint64_t cpulast;
+    void *altstack;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_key_t key;
+static struct list *threads;
+static size_t altstacksize;
+/* stack of the calling thread, set along with its alternate signal stack */
+static __thread uintptr_t stacklo, stackhi;
+
+static void unregister(void *arg) {
+    struct threadreg *t = (struct threadreg *)arg;
+    stack_t ss;
+
+    pthread_mutex_lock(&lock);
+    list_removedata(threads, t);
+    pthread_mutex_unlock(&lock);
+    if (t->altstack) {
+        memset(&ss, 0, sizeof(ss));
+        ss.ss_flags = SS_DISABLE;
+        sigaltstack(&ss, NULL);
+        free(t->altstack);
+    }
+    free(t);
+}
+
+/* signal handlers running on the thread stacks, only THREAD_STACK_SIZE
+ * bytes, could overflow them */
+static void setaltstack(struct threadreg *t) {
+    stack_t ss;
+#if defined(__linux__)
+    pthread_attr_t attr;
+    void *addr;
+    size_t size;
+
+    if (!pthread_getattr_np(pthread_self(), &attr)) {
+        if (!pthread_attr_getstack(&attr, &addr, &size)) {
+            stacklo = (uintptr_t)addr;
+            stackhi = (uintptr_t)addr + size;
+        }
+        pthread_attr_destroy(&attr);
+    }
+#endif
+
+    t->altstack = malloc(altstacksize);
+    if (!t->altstack)
+        return;
+    memset(&ss, 0, sizeof(ss));
+    ss.ss_sp = t->altstack;
+    ss.ss_size = altstacksize;
+    if (sigaltstack(&ss, NULL)) {
+        free(t->altstack);
+        t->altstack = NULL;
+    }
+}
+
+static void makekey(void) {
+    if (pthread_key_create(&key, unregister))
+        debug(DBG_ERR, "threadreg: failed to create thread key");
+    threads = list_create();
+}
+
+static void setkernelname(const char *name) {
+#if defined(HAVE_PTHREAD_SETNAME_NP)
+    char comm[16];
+    size_t len = strlen(name);
+
+    if (len > sizeof(comm) - 1)
+        len = sizeof(comm) - 1;
+    memcpy(comm, name, len);
+    comm[len] = '\0';
+#if defined(__APPLE__)
+    pthread_setname_np(comm);
+#else
+    pthread_setname_np(pthread_self(), comm);
+#endif
+#endif
+}
+
+/**
+ * @brief give threads registering from now on an alternate signal stack,
+ * for signal handlers installed with SA_ONSTACK
+ *
+ * @param size size of the stacks, 0 for none
+ */
+void threadreg_altstack(size_t size) {
+    altstacksize = size;
+}
+
+/**
+ * @brief the stack of the calling thread, if it registered after
+ * threadreg_altstack; async-signal-safe
+ *
+ * @param lo set to the lowest address of the stack, 0 if unknown
+ * @param hi set to the address just above the stack, 0 if unknown
+ */
+void threadreg_stack(uintptr_t *lo, uintptr_t *hi) {
+    *lo = stacklo;
+    *hi = stackhi;
+}
+
+/**
+ * @brief name the calling thread and add it to the registry if not yet in it;
+ * a thread may rename itself once it knows its peer
+ *
+ * @param fmt printf style format of the name, role:peer by convention
+ */
+void threadreg_name(const char *fmt, ...) {
+    struct threadreg *t;
+    va_list ap;
+
+    pthread_once(&once, makekey);
+    t = pthread_getspecific(key);
+    if (!t) {
+        t = calloc(1, sizeof(struct threadreg));
+        if (!t)
+            return;
+        t->thread = pthread_self();
+#if defined(__linux__)
+        t->tid = syscall(SYS_gettid);
+#endif
+        pthread_mutex_lock(&lock);
+        if (!threads || !list_push(threads, t)) {
+            pthread_mutex_unlock(&lock);
+            free(t);
+            return;
+        }
+        pthread_mutex_unlock(&lock);
+        pthread_setspecific(key, t);
+        if (altstacksize)
+            setaltstack(t);
+    }
+
+    pthread_mutex_lock(&lock);
+    va_start(ap, fmt);
+    vsnprintf(t->name, sizeof(t->name), fmt, ap);
+    va_end(ap);
+    setkernelname(t->name);
+    pthread_mutex_unlock(&lock);
+}
+
+static void readcsw(int tid, long *vcsw, long *nvcsw) {
+    char path[64], line[128];
+    FILE *f;
+
+    *vcsw = *nvcsw = -1;
+    if (!tid)
+        return;
+    snprintf(path, sizeof(path), "/proc/self/task/%d/status", tid);
+    f = fopen(path, "r");
+    if (!f)
+        return;
+    while (fgets(line, sizeof(line), f)) {
+        if (!strncmp(line, "voluntary_ctxt_switches:", 24))
+            *vcsw = strtol(line + 24, NULL, 10);
+        else if (!strncmp(line, "nonvoluntary_ctxt_switches:", 27))
+            *nvcsw = strtol(line + 27, NULL, 10);
+    }
+    fclose(f);
+}
+
+/**
+ * @brief take the cpu time and context switches of all registered threads
+ *
+ * @param stats set to a newly allocated array, to be freed by the caller
+ * @return the number of threads, -1 on malloc failure
+ */
+int threadreg_snapshot(struct threadstats **stats) {
+    struct list_node *entry;
+    struct threadreg *t;
+    struct threadstats *s;
+    struct timespec ts;
+    clockid_t clock;
+    int n = 0;
+
+    pthread_once(&once, makekey);
+    pthread_mutex_lock(&lock);
+    s = calloc((threads ? list_count(threads) : 0) + 1, sizeof(struct threadstats));
+    if (!s) {
+        pthread_mutex_unlock(&lock);
+        return -1;
+    }
+    for (entry = list_first(threads); entry; entry = list_next(entry), n++) {
+        t = (struct threadreg *)entry->data;
+        memcpy(s[n].name, t->name, sizeof(s[n].name));
+        s[n].tid = t->tid;
+        s[n].clock = (clockid_t)-1;
+        if (!pthread_getcpuclockid(t->thread, &clock) && !clock_gettime(clock, &ts)) {
+            s[n].clock = clock;
+            s[n].cpu = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+            s[n].cpudelta = s[n].cpu - t->cpulast;
+            t->cpulast = s[n].cpu;
+        }
+        readcsw(t->tid, &s[n].vcsw, &s[n].nvcsw);
+    }
+    pthread_mutex_unlock(&lock);
+    *stats = s;
+    return n;
+}
+
+/**
+ * @brief log the cpu time and context switches of all registered threads
+ */
+void threadreg_log(void) {
+    struct threadstats *stats;
+    int n, i;
+
+    n = threadreg_snapshot(&stats);
+    for (i = 0; i < n; i++)
+        debug(DBG_NOTICE, "threadreg: %s (tid %d): cpu %.3fs (%.3fs since last), context switches %ld voluntary, %ld involuntary",
+              stats[i].name, stats[i].tid, stats[i].cpu / 1e9, stats[i].cpudelta / 1e9, stats[i].vcsw, stats[i].nvcsw);
+    if (n >= 0)
+        free(stats);
+}
+
+/* Local Variables: */
+/* c-file-style: "stroustrup" */
+/* End: */
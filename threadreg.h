@@ -0,0 +1,34 @@
+/* Copyright (c) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+#ifndef _THREADREG_H
+#define _THREADREG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/* max length of a thread name in the registry; the kernel keeps 15 chars */
+#define THREADREG_NAMELEN 64
+
+struct threadstats {
+    char name[THREADREG_NAMELEN];
+    int tid;           /* kernel thread id, 0 if unknown */
+    clockid_t clock;   /* cpu clock of the thread while it lives, -1 if unknown */
+    uint64_t cpu;      /* cpu time in nanoseconds */
+    uint64_t cpudelta; /* cpu time since the previous threadreg_snapshot */
+    long vcsw;         /* voluntary context switches, -1 if unknown */
+    long nvcsw;        /* involuntary context switches, -1 if unknown */
+};
+
+void threadreg_altstack(size_t size);
+void threadreg_stack(uintptr_t *lo, uintptr_t *hi);
+void threadreg_name(const char *fmt, ...);
+int threadreg_snapshot(struct threadstats **stats);
+void threadreg_log(void);
+
+#endif /* _THREADREG_H */
+
+/* Local Variables: */
+/* c-file-style: "stroustrup" */
+/* End: */
@@ -6,6 +6,7 @@
 #include "debug.h"
 #include "hostport.h"
 #include "radsecproxy.h"
+#include "threadreg.h"
 #include "util.h"
 #include <arpa/inet.h>
 #include <ctype.h>
@@ -32,7 +33,6 @@ static void setprotoopts(struct commonprotoopts *opts);
 static char **getlistenerargs(void);
 void *tlslistener(void *arg);
 int tlsconnect(struct server *server, int timeout, int reconnect);
-void *tlsclientrd(void *arg);
 int clientradputtls(struct server *server, unsigned char *rad, int radlen);
 void tlssetsrcres(void);
 
@@ -50,8 +50,9 @@ static const struct protodefs protodefs = {
     getlistenerargs,                             /* getlistenerargs */
     tlslistener,                                 /* listener */
     tlsconnect,                                  /* connecter */
-    tlsclientrd,                                 /* clientconnreader */
+    tlsclientradget,                             /* clientradget */
     clientradputtls,                             /* clientradput */
+    NULL,                                        /* clientradflush */
     NULL,                                        /* addclient */
     NULL,                                        /* addserverextra */
     tlssetsrcres,                                /* setsrcres */
@@ -96,7 +97,7 @@ static void cleanup_connection(struct server *server) {
 int tlsconnect(struct server *server, int timeout, int reconnect) {
     struct timeval now, start;
     uint32_t wait;
-    int firsttry = 1;
+    int firsttry = 1, radius11 = 0;
     X509 *cert;
     SSL_CTX *ctx = NULL;
     unsigned long error;
@@ -118,12 +119,12 @@ int tlsconnect(struct server *server, int timeout, int reconnect) {
             debug(DBG_WARN, "tlsconnect: could not resolve source address to bind for server %s, using default", server->conf->name);
     }
 
-    gettimeofday(&start, NULL);
+    monotime(&start);
 
     for (;;) {
         cleanup_connection(server);
         wait = connect_wait(start, server->connecttime, firsttry);
-        gettimeofday(&now, NULL);
+        monotime(&now);
         if (timeout && (now.tv_sec - start.tv_sec) + wait > timeout) {
             debug(DBG_DBG, "tlsconnect: timeout");
             if (source)
@@ -132,10 +133,10 @@ int tlsconnect(struct server *server, int timeout, int reconnect) {
         }
         if (wait)
             debug(DBG_INFO, "Next connection attempt to %s in %lds", server->conf->name, wait);
-        sleep(wait);
+        connect_sleep(wait);
         firsttry = 0;
 
-        gettimeofday(&now, NULL);
+        monotime(&now);
         if (timeout && (now.tv_sec - start.tv_sec) > timeout) {
             debug(DBG_DBG, "tlsconnect: timeout");
             if (source)
@@ -153,6 +154,7 @@ int tlsconnect(struct server *server, int timeout, int reconnect) {
 
             if (server->conf->keepalive)
                 enable_keepalive(server->sock);
+            set_sockbufs(server->sock, server->conf->rcvbuf, server->conf->sndbuf);
 
             pthread_mutex_lock(&server->conf->tlsconf->lock);
             if (!(ctx = tlsgetctx(handle, server->conf->tlsconf))) {
@@ -172,6 +174,11 @@ int tlsconnect(struct server *server, int timeout, int reconnect) {
                 debug(DBG_WARN, "tlsconnect: failed to set ex data");
             }
 
+            if (!tlssetalpn(server->ssl, server->conf->radiusversion)) {
+                debug(DBG_ERR, "tlsconnect: failed to set ALPN");
+                goto concleanup;
+            }
+
             if (server->conf->sni) {
                 struct in6_addr tmp;
                 char *servername = server->conf->sniservername                                                   ? server->conf->sniservername
@@ -191,6 +198,8 @@ int tlsconnect(struct server *server, int timeout, int reconnect) {
                 debug(DBG_ERR, "tlsconnect: SSL connect to %s (%s port %s) failed", server->conf->name, hp->host, hp->port);
                 goto concleanup;
             }
+            if ((radius11 = tlsradiusversion(server->ssl, server->conf)) < 0)
+                goto concleanup;
 
             if (server->conf->pskid && server->conf->pskkey) {
                 if (SSL_session_reused(server->ssl)) {
@@ -232,8 +241,9 @@ int tlsconnect(struct server *server, int timeout, int reconnect) {
         if (server->ssl)
             break;
     }
-    gettimeofday(&server->connecttime, NULL);
+    monotime(&server->connecttime);
     server->tlsnewkey = server->connecttime;
+    tlslogktls(server->ssl, server->conf->name);
 
     origflags = fcntl(server->sock, F_GETFL, 0);
     if (origflags == -1) {
@@ -247,8 +257,8 @@ int tlsconnect(struct server *server, int timeout, int reconnect) {
     server->lostrqs = 0;
     pthread_mutex_unlock(&server->lock);
     pthread_mutex_lock(&server->newrq_mutex);
+    server->radius11 = radius11;
     server->conreset = reconnect;
-    pthread_cond_signal(&server->newrq_cond);
     pthread_mutex_unlock(&server->newrq_mutex);
     if (source)
         freeaddrinfo(source);
@@ -271,9 +281,10 @@ int clientradputtls(struct server *server, unsigned char *rad, int radlen) {
         return 0;
     }
 
-    gettimeofday(&now, NULL);
+    monotime(&now);
 #if OPENSSL_VERSION_NUMBER >= 0x10101000
-    if (now.tv_sec - server->tlsnewkey.tv_sec > RSP_TLS_REKEY_INTERVAL && SSL_version(server->ssl) >= TLS1_3_VERSION) {
+    if (now.tv_sec - server->tlsnewkey.tv_sec > RSP_TLS_REKEY_INTERVAL && SSL_version(server->ssl) >= TLS1_3_VERSION &&
+        !tlsktlssend(server->ssl)) {
         debug(DBG_DBG, "clientradputtls: perform key update for long-running connection");
         if (SSL_get_key_update_type(server->ssl) == SSL_KEY_UPDATE_NONE &&
             !SSL_key_update(server->ssl, SSL_KEY_UPDATE_REQUESTED))
@@ -292,44 +303,9 @@ int clientradputtls(struct server *server, unsigned char *rad, int radlen) {
     return 1;
 }
 
-void *tlsclientrd(void *arg) {
-    struct server *server = (struct server *)arg;
-    unsigned char *buf = NULL;
-    int len = 0;
-
-    for (;;) {
-        len = radtlsget(server->ssl, server->conf->retryinterval * (server->conf->retrycount + 1), &server->lock, &buf);
-        if (buf && len > 0) {
-            if (!replyh(server, buf, len))
-                if (closeh(server))
-                    break;
-            buf = NULL;
-        } else if (SSL_get_shutdown(server->ssl)) {
-            if (closeh(server))
-                break;
-        } else {
-            if (timeouth(server))
-                break;
-        }
-    }
-    debug(DBG_INFO, "tlsclientrd: exiting for %s", server->conf->name);
-    pthread_mutex_lock(&server->lock);
-    server->state = RSP_SERVER_STATE_FAILING;
-    SSL_shutdown(server->ssl);
-    shutdown(server->sock, SHUT_RDWR);
-    close(server->sock);
-
-    /* Wake up clientwr(). */
-    server->clientrdgone = 1;
-    pthread_mutex_unlock(&server->lock);
-    pthread_mutex_lock(&server->newrq_mutex);
-    pthread_cond_signal(&server->newrq_cond);
-    pthread_mutex_unlock(&server->newrq_mutex);
-    return NULL;
-}
 
 void *tlsservernew(void *arg) {
-    int s, origflags;
+    int s, origflags, radius11;
     struct sockaddr_storage from;
     socklen_t fromlen = sizeof(from);
     struct clsrvconf *conf;
@@ -350,6 +326,7 @@ void *tlsservernew(void *arg) {
         goto exit;
     }
     debug(DBG_WARN, "tlsservernew: incoming TLS connection from %s", addr2string((struct sockaddr *)&from, tmp, sizeof(tmp)));
+    threadreg_name("tlsrd:%s", tmp);
 
     if (!(conf = find_clconf(handle, (struct sockaddr *)&from, &cur, &hp))) {
         debug(DBG_WARN, "tlsservernew: ignoring unknown TLS client %s", addr2string((struct sockaddr *)&from, tmp, sizeof(tmp)));
@@ -371,6 +348,7 @@ void *tlsservernew(void *arg) {
     if (!SSL_set_ex_data(ssl, RSP_EX_DATA_CONFIG_LIST, find_all_clconf(handle, (struct sockaddr *)&from, cur, &hp))) {
         debug(DBG_WARN, "tlsservernew: failed to set ex data");
     }
+    tlssetradiusversions(ssl, handle, (struct sockaddr *)&from, cur);
 
     SSL_set_fd(ssl, s);
     if (sslaccepttimeout(ssl, 30) <= 0) {
@@ -427,9 +405,15 @@ void *tlsservernew(void *arg) {
               addr2string((struct sockaddr *)&from, tmp, sizeof(tmp)));
         goto exit;
     }
+    if ((radius11 = tlsradiusversion(ssl, conf)) < 0)
+        goto exit;
+
+    tlslogktls(ssl, conf->name);
 
+    threadreg_name("tlsrd:%s", conf->name);
     client = addclient(conf, 1);
     if (client) {
+        client->radius11 = radius11;
         if (conf->keepalive)
             enable_keepalive(s);
         client->ssl = ssl;
@@ -472,6 +456,7 @@ void tlsaccept(int s) {
 }
 
 void *tlslistener(void *arg) {
+    threadreg_name("tlslisten");
     accepttcp(*(int *)arg, tlsaccept);
     free(arg);
     return NULL;
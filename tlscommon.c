@@ -9,6 +9,7 @@
 #include "hash.h"
 #include "hostport.h"
 #include "radsecproxy.h"
+#include "threadreg.h"
 #include "util.h"
 #include <arpa/inet.h>
 #include <assert.h>
@@ -19,6 +20,11 @@
 #include <netdb.h>
 #include <netinet/in.h>
 #include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/kdf.h>
+#endif
 #include <openssl/md5.h>
 #include <openssl/rand.h>
 #include <openssl/ssl.h>
@@ -46,8 +52,11 @@ static struct tls *tlsdefaultpsk = NULL;
 static unsigned char cookie_secret[COOKIE_SECRET_LENGTH];
 static uint8_t cookie_secret_initialized = 0;
 
+static uint8_t lowmemory = 0;
+
 int RSP_EX_DATA_CONFIG;
 int RSP_EX_DATA_CONFIG_LIST;
+int RSP_EX_DATA_RADIUSVERSIONS;
 
 struct certattrmatch {
     int (*matchfn)(GENERAL_NAME *, struct certattrmatch *);
@@ -82,6 +91,63 @@ void ssl_locking_callback(int mode, int type, const char *file, int line) {
 }
 #endif
 
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+/* OpenSSL 3 looks up algorithm implementations by name and properties in a
+ * global store, both for implicit fetches inside handshakes and for every use
+ * of legacy EVP_xxx() objects. Fetch the ones used by TLS once at startup and
+ * keep the references, so the store is warm before any handshake thread runs
+ * and the DTLS cookie HMAC does not fetch on every call. Algorithms not
+ * offered by the loaded providers are skipped. */
+static const char *prefetchdigests[] = {"SHA2-256", "SHA2-384", "SHA1", "MD5-SHA1"};
+static const char *prefetchciphers[] = {"AES-128-GCM", "AES-256-GCM", "ChaCha20-Poly1305", "AES-128-CBC", "AES-256-CBC"};
+static const char *prefetchkeymgmts[] = {"RSA", "RSA-PSS", "EC", "X25519", "X448", "ED25519", "ED448", "DH"};
+static const char *prefetchkeyexchs[] = {"ECDH", "X25519", "X448", "DH"};
+static const char *prefetchsignatures[] = {"RSA", "ECDSA", "ED25519", "ED448"};
+static const char *prefetchkdfs[] = {"TLS13-KDF", "HKDF", "TLS1-PRF"};
+static const char *prefetchmacs[] = {"HMAC"};
+
+#define PREFETCHCOUNT(names) (sizeof(names) / sizeof(names[0]))
+
+static EVP_MD *prefetchedmds[PREFETCHCOUNT(prefetchdigests)];
+static EVP_CIPHER *prefetchedciphers[PREFETCHCOUNT(prefetchciphers)];
+static EVP_KEYMGMT *prefetchedkeymgmts[PREFETCHCOUNT(prefetchkeymgmts)];
+static EVP_KEYEXCH *prefetchedkeyexchs[PREFETCHCOUNT(prefetchkeyexchs)];
+static EVP_SIGNATURE *prefetchedsignatures[PREFETCHCOUNT(prefetchsignatures)];
+static EVP_KDF *prefetchedkdfs[PREFETCHCOUNT(prefetchkdfs)];
+static EVP_MAC *prefetchedmacs[PREFETCHCOUNT(prefetchmacs)];
+
+#define PREFETCH(fetch, names, store)                         \
+    for (i = 0; i < PREFETCHCOUNT(names); i++) {              \
+        if ((store[i] = fetch(NULL, names[i], NULL)) != NULL) \
+            fetched++;                                        \
+        total++;                                              \
+    }
+
+static void sslprefetch(void) {
+    size_t i;
+    int fetched = 0, total = 0;
+
+    PREFETCH(EVP_MD_fetch, prefetchdigests, prefetchedmds);
+    PREFETCH(EVP_CIPHER_fetch, prefetchciphers, prefetchedciphers);
+    PREFETCH(EVP_KEYMGMT_fetch, prefetchkeymgmts, prefetchedkeymgmts);
+    PREFETCH(EVP_KEYEXCH_fetch, prefetchkeyexchs, prefetchedkeyexchs);
+    PREFETCH(EVP_SIGNATURE_fetch, prefetchsignatures, prefetchedsignatures);
+    PREFETCH(EVP_KDF_fetch, prefetchkdfs, prefetchedkdfs);
+    PREFETCH(EVP_MAC_fetch, prefetchmacs, prefetchedmacs);
+    ERR_clear_error();
+    debug(DBG_DBG, "sslprefetch: fetched %d of %d algorithms", fetched, total);
+}
+
+/* the cookie HMAC digest, the prefetched SHA2-256 if available */
+static const EVP_MD *cookiemd(void) {
+    return prefetchedmds[0] ? prefetchedmds[0] : EVP_sha256();
+}
+#else
+static const EVP_MD *cookiemd(void) {
+    return EVP_sha256();
+}
+#endif
+
 void sslinit(void) {
 #if OPENSSL_VERSION_NUMBER < 0x10100000
     int i;
@@ -106,6 +172,10 @@ void sslinit(void) {
     OPENSSL_init_ssl(0, NULL);
     RSP_EX_DATA_CONFIG = CRYPTO_get_ex_new_index(CRYPTO_EX_INDEX_SSL, 0, NULL, NULL, NULL, NULL);
     RSP_EX_DATA_CONFIG_LIST = CRYPTO_get_ex_new_index(CRYPTO_EX_INDEX_SSL, 0, NULL, NULL, NULL, NULL);
+    RSP_EX_DATA_RADIUSVERSIONS = CRYPTO_get_ex_new_index(CRYPTO_EX_INDEX_SSL, 0, NULL, NULL, NULL, NULL);
+#endif
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    sslprefetch();
 #endif
 }
 
@@ -216,7 +286,7 @@ static int cookie_calculate_hash(struct sockaddr *peer, time_t time, uint8_t *re
     memcpy(buf, &time, sizeof(time_t));
     memcpy(buf + sizeof(time_t), peer, SOCKADDRP_SIZE(peer));
 
-    HMAC(EVP_sha256(), (const void *)cookie_secret, COOKIE_SECRET_LENGTH,
+    HMAC(cookiemd(), (const void *)cookie_secret, COOKIE_SECRET_LENGTH,
          buf, length, result, resultlength);
     OPENSSL_free(buf);
     return 1;
@@ -236,7 +306,7 @@ static int cookie_generate_cb(SSL *ssl, unsigned char *cookie, unsigned int *coo
 
     if (BIO_dgram_get_peer(SSL_get_rbio(ssl), &peer) <= 0)
         return 0;
-    gettimeofday(&now, NULL);
+    monotime(&now);
     if (!cookie_calculate_hash((struct sockaddr *)&peer, now.tv_sec, result, &resultlength))
         return 0;
 
@@ -266,7 +336,7 @@ static int cookie_verify_cb(SSL *ssl, const unsigned char *cookie, unsigned int
         return 0;
     }
 
-    gettimeofday(&now, NULL);
+    monotime(&now);
     cookie_time = *(time_t *)cookie;
     if (now.tv_sec - cookie_time > 5) {
         debug(DBG_DBG, "cookie_verify_cb: cookie invalid or older than 5s. ignoring.");
@@ -443,6 +513,119 @@ int psk_find_session_cb(SSL *ssl, const unsigned char *id, size_t idlen, SSL_SES
     return 1;
 }
 
+#define ALPN_RADIUS10 "\x0a" \
+                     "radius/1.0"
+#define ALPN_RADIUS11 "\x0a" \
+                     "radius/1.1"
+#define ALPN_LEN 11
+
+#define RADIUSVERSION_V10 1
+#define RADIUSVERSION_V11 2
+
+static uintptr_t radiusversions(struct clsrvconf *conf) {
+    return (conf->radiusversion != RSP_RADIUS_V11 ? RADIUSVERSION_V10 : 0) |
+           (conf->radiusversion != RSP_RADIUS_V10 ? RADIUSVERSION_V11 : 0);
+}
+
+/**
+ * @brief remember the RADIUS versions allowed by any of the client blocks
+ * matching an incoming connection, for the ALPN selection during accept
+ *
+ * @param ssl the incoming connection
+ * @param type RAD_TLS or RAD_DTLS
+ * @param addr the client address
+ * @param cur the first matching client block
+ */
+void tlssetradiusversions(SSL *ssl, uint8_t type, struct sockaddr *addr, struct list_node *cur) {
+    struct clsrvconf *conf = (struct clsrvconf *)cur->data;
+    struct hostportres *hp;
+    uintptr_t versions = 0;
+
+    do {
+        versions |= radiusversions(conf);
+    } while ((conf = find_clconf(type, addr, &cur, &hp)) != NULL);
+    if (!SSL_set_ex_data(ssl, RSP_EX_DATA_RADIUSVERSIONS, (void *)versions))
+        debug(DBG_WARN, "tlssetradiusversions: failed to set ex data");
+}
+
+/* select radius/1.1 if the client offers it and the client block (or any
+ * candidate block until it is known) allows it, else radius/1.0. Reject
+ * clients that only offer versions we don't accept. */
+static int alpn_select_cb(SSL *ssl, const unsigned char **out, unsigned char *outlen, const unsigned char *in, unsigned int inlen, void *arg) {
+    struct clsrvconf *conf;
+    const unsigned char *p, *sel10 = NULL, *sel11 = NULL;
+    uintptr_t versions;
+    uint8_t offered = 0;
+
+    conf = (struct clsrvconf *)SSL_get_ex_data(ssl, RSP_EX_DATA_CONFIG);
+    versions = conf ? radiusversions(conf) : (uintptr_t)SSL_get_ex_data(ssl, RSP_EX_DATA_RADIUSVERSIONS);
+
+    for (p = in; p + ALPN_LEN <= in + inlen; p += 1 + *p) {
+        if (!memcmp(p, ALPN_RADIUS10, ALPN_LEN)) {
+            offered = 1;
+            sel10 = p;
+        } else if (!memcmp(p, ALPN_RADIUS11, ALPN_LEN)) {
+            offered = 1;
+            sel11 = p;
+        }
+    }
+
+    p = (versions & RADIUSVERSION_V11) && sel11   ? sel11
+        : (versions & RADIUSVERSION_V10) && sel10 ? sel10
+                                                  : NULL;
+    if (!p) {
+        if (!offered)
+            return SSL_TLSEXT_ERR_NOACK;
+        debug(DBG_WARN, "alpn_select_cb: client offers no acceptable RADIUS version");
+        return SSL_TLSEXT_ERR_ALERT_FATAL;
+    }
+    *out = p + 1;
+    *outlen = *p;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+/**
+ * @brief offer the RADIUS versions allowed by the configuration via ALPN.
+ * RADIUS/1.0 only is the classic RadSec without ALPN.
+ *
+ * @param ssl the client connection
+ * @param version the configured version
+ * @return 1 if ok, 0 on error
+ */
+int tlssetalpn(SSL *ssl, enum rsp_radiusversion version) {
+    switch (version) {
+    case RSP_RADIUS_V11:
+        return SSL_set_alpn_protos(ssl, (const unsigned char *)ALPN_RADIUS11, ALPN_LEN) == 0;
+    case RSP_RADIUS_ANY:
+        return SSL_set_alpn_protos(ssl, (const unsigned char *)ALPN_RADIUS11 ALPN_RADIUS10, 2 * ALPN_LEN) == 0;
+    default:
+        return 1;
+    }
+}
+
+/**
+ * @brief check the negotiated RADIUS version against the configuration
+ *
+ * @param ssl the established connection
+ * @param conf the client or server block
+ * @return 1 for RADIUS/1.1, 0 for RADIUS/1.0, -1 if not acceptable
+ */
+int tlsradiusversion(SSL *ssl, struct clsrvconf *conf) {
+    const unsigned char *alpn = NULL;
+    unsigned int alpnlen = 0;
+    int radius11;
+
+    SSL_get0_alpn_selected(ssl, &alpn, &alpnlen);
+    radius11 = alpnlen == ALPN_LEN - 1 && !memcmp(alpn, ALPN_RADIUS11 + 1, ALPN_LEN - 1);
+    if ((conf->radiusversion == RSP_RADIUS_V11 && !radius11) ||
+        (conf->radiusversion == RSP_RADIUS_V10 && radius11)) {
+        debug(DBG_ERR, "tlsradiusversion: %s negotiated RADIUS/%s, not allowed by configuration", conf->name, radius11 ? "1.1" : "1.0");
+        return -1;
+    }
+    debug(DBG_INFO, "tlsradiusversion: using RADIUS/%s with %s", radius11 ? "1.1" : "1.0", conf->name);
+    return radius11;
+}
+
 void keylog_cb(const SSL *ssl, const char *line) {
     static FILE *keylog = NULL;
     static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -558,6 +741,11 @@ static SSL_CTX *tlscreatectx(uint8_t type, struct tls *conf) {
                 SSL_CTX_set_min_proto_version(ctx, conf->tlsminversion);
             if (conf->tlsmaxversion >= 0)
                 SSL_CTX_set_max_proto_version(ctx, conf->tlsmaxversion);
+#ifdef SSL_OP_ENABLE_KTLS
+            /* OpenSSL falls back to userspace if the kernel cannot take over */
+            if (conf->ktls)
+                SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#endif
         }
 #else
         /* No TLS_method(), use SSLv23_method() and disable SSLv2 and SSLv3. */
@@ -600,6 +788,8 @@ static SSL_CTX *tlscreatectx(uint8_t type, struct tls *conf) {
         break;
 #endif
     }
+    if (ctx && lowmemory)
+        SSL_CTX_set_mode(ctx, SSL_MODE_RELEASE_BUFFERS);
     if (!ctx) {
         debug(DBG_ERR, "tlscreatectx: Error initialising SSL/TLS in TLS context %s", conf->name);
         return NULL;
@@ -712,6 +902,7 @@ static SSL_CTX *tlscreatectx(uint8_t type, struct tls *conf) {
     SSL_CTX_set_cookie_verify_cb(ctx, cookie_verify_cb);
     SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, verify_cb);
     SSL_CTX_set_verify_depth(ctx, MAX_CERT_DEPTH + 1);
+    SSL_CTX_set_alpn_select_cb(ctx, alpn_select_cb, NULL);
 #if OPENSSL_VERSION_NUMBER >= 0x10101000
     SSL_CTX_set_psk_use_session_callback(ctx, psk_use_session_cb);
     SSL_CTX_set_psk_find_session_callback(ctx, psk_find_session_cb);
@@ -758,7 +949,7 @@ SSL_CTX *tlsgetctx(uint8_t type, struct tls *t) {
 
     if (!t)
         return NULL;
-    gettimeofday(&now, NULL);
+    monotime(&now);
 
     switch (type) {
 #ifdef RADPROT_TLS
@@ -797,6 +988,26 @@ SSL_CTX *tlsgetctx(uint8_t type, struct tls *t) {
     return NULL;
 }
 
+/* release read and write buffers of idle connections; contexts created while
+ * parsing the config, before the global option was known, are updated too */
+void tlssetlowmemory(uint8_t on) {
+    struct tls *conf;
+    struct hash_entry *entry;
+
+    lowmemory = on;
+    if (!lowmemory)
+        return;
+    for (entry = hash_first(tlsconfs); entry; entry = hash_next(entry)) {
+        conf = (struct tls *)entry->data;
+        pthread_mutex_lock(&conf->lock);
+        if (conf->tlsctx)
+            SSL_CTX_set_mode(conf->tlsctx, SSL_MODE_RELEASE_BUFFERS);
+        if (conf->dtlsctx)
+            SSL_CTX_set_mode(conf->dtlsctx, SSL_MODE_RELEASE_BUFFERS);
+        pthread_mutex_unlock(&conf->lock);
+    }
+}
+
 void tlsreload(void) {
     struct tls *conf;
     struct hash_entry *entry;
@@ -805,7 +1016,7 @@ void tlsreload(void) {
 
     debug(DBG_NOTICE, "reloading certs, CAs, CRLs");
 
-    gettimeofday(&now, NULL);
+    monotime(&now);
 
     for (entry = hash_first(tlsconfs); entry; entry = hash_next(entry)) {
         conf = (struct tls *)entry->data;
@@ -1156,6 +1367,7 @@ int conftls_cb(struct gconffile **cf, void *arg, char *block, char *opt, char *v
                           "TlsVersion", CONF_STR, &tlsversion,
                           "DtlsVersion", CONF_STR, &dtlsversion,
                           "DhFile", CONF_STR, &dhfile,
+                          "KTLS", CONF_BLN, &conf->ktls,
                           NULL)) {
         debug(DBG_ERR, "conftls_cb: configuration error in block %s", val);
         goto errexit;
@@ -1192,7 +1404,17 @@ int conftls_cb(struct gconffile **cf, void *arg, char *block, char *opt, char *v
         free(dtlsversion);
         dtlsversion = NULL;
     }
+#ifndef SSL_OP_ENABLE_KTLS
+    if (conf->ktls) {
+        debug(DBG_WARN, "conftls_cb: KTLS in block %s requires OpenSSL 3.0 or later, ignoring", val);
+        conf->ktls = 0;
+    }
+#endif
 #else
+    if (conf->ktls) {
+        debug(DBG_WARN, "conftls_cb: KTLS in block %s requires OpenSSL 3.0 or later, ignoring", val);
+        conf->ktls = 0;
+    }
     if (tlsversion || dtlsversion) {
         debug(DBG_ERR, "error in block %s, setting tls/dtls version requires openssl 1.1.0 or later", val);
         goto errexit;
@@ -1246,10 +1468,7 @@ int conftls_cb(struct gconffile **cf, void *arg, char *block, char *opt, char *v
         debug(DBG_ERR, "conftls_cb: malloc failed");
         goto errexit;
     }
-    if (!tlsgetctx(RAD_TLS, conf)) {
-        debug(DBG_ERR, "conftls_cb: error creating ctx for TLS block %s", val);
-        goto errexit;
-    }
+    /* contexts are created on first use by tlsgetctx(), so unused blocks cost nothing at startup */
     debug(DBG_DBG, "conftls_cb: added TLS block %s", val);
     return 1;
 
@@ -1428,7 +1647,10 @@ int sslaccepttimeout(SSL *ssl, int timeout) {
             fds[0].events |= POLLOUT;
             want_write = 0;
         }
-        if ((ndesc = poll(fds, 1, timeout * 1000)) < 1) {
+        do
+            ndesc = poll(fds, 1, timeout * 1000);
+        while (ndesc < 0 && errno == EINTR);
+        if (ndesc < 1) {
             if (ndesc == 0)
                 debug(DBG_DBG, "sslaccepttimeout: timeout during SSL_accept");
             else
@@ -1490,7 +1712,10 @@ int sslconnecttimeout(SSL *ssl, int timeout) {
             fds[0].events |= POLLOUT;
             want_write = 0;
         }
-        if ((ndesc = poll(fds, 1, timeout * 1000)) < 1) {
+        do
+            ndesc = poll(fds, 1, timeout * 1000);
+        while (ndesc < 0 && errno == EINTR);
+        if (ndesc < 1) {
             if (ndesc == 0)
                 debug(DBG_DBG, "sslconnecttimeout: timeout during SSL_connect");
             else
@@ -1557,7 +1782,9 @@ int sslreadtimeout(SSL *ssl, unsigned char *buf, int num, int timeout, pthread_m
             }
             pthread_mutex_unlock(lock);
 
-            ndesc = poll(fds, 1, timeout ? timeout * 1000 : -1);
+            do
+                ndesc = poll(fds, 1, timeout ? timeout * 1000 : -1);
+            while (ndesc < 0 && errno == EINTR);
             if (ndesc == 0)
                 return ndesc;
 
@@ -1648,7 +1875,9 @@ int sslwrite(SSL *ssl, void *buf, int num, uint8_t blocking) {
             fds[0].events = fds[0].events | POLLIN;
             want_read = 0;
         }
-        ret = poll(fds, 1, blocking ? 1000 : 0);
+        do
+            ret = poll(fds, 1, blocking ? 1000 : 0);
+        while (ret < 0 && errno == EINTR);
         if (ret == 0) {
             if (blocking)
                 continue;
@@ -1692,10 +1921,11 @@ int sslwrite(SSL *ssl, void *buf, int num, uint8_t blocking) {
  * @param ssl SSL session to read from
  * @param timeout while reading. 0 means no timeout (blocking)
  * @param lock to aquire
+ * @param maxlen largest message length accepted on this connection
  * @param buf newly allocated buffer containing the read bytes
  * @return int number of bytes read, 0 on timeout or error
  */
-int radtlsget(SSL *ssl, int timeout, pthread_mutex_t *lock, uint8_t **buf) {
+int radtlsget(SSL *ssl, int timeout, pthread_mutex_t *lock, int maxlen, uint8_t **buf) {
     int cnt, len;
     unsigned char init_buf[4];
 
@@ -1703,7 +1933,7 @@ int radtlsget(SSL *ssl, int timeout, pthread_mutex_t *lock, uint8_t **buf) {
     if (cnt < 1)
         return 0;
 
-    len = get_checked_rad_length(init_buf);
+    len = get_checked_rad_length_max(init_buf, maxlen);
     if (len <= 0) {
         debug(DBG_ERR, "radtlsget: invalid message length (%d)! closing connection!", -len);
         pthread_mutex_lock(lock);
@@ -1733,6 +1963,97 @@ int radtlsget(SSL *ssl, int timeout, pthread_mutex_t *lock, uint8_t **buf) {
     return len;
 }
 
+/**
+ * @brief log whether the kernel took over record encryption (kTLS)
+ *
+ * Only logs for sessions with the KTLS option enabled in their tls block.
+ *
+ * @param ssl established TLS session
+ * @param peer name of the peer
+ */
+void tlslogktls(SSL *ssl, const char *peer) {
+#ifdef SSL_OP_ENABLE_KTLS
+    if (!(SSL_get_options(ssl) & SSL_OP_ENABLE_KTLS))
+        return;
+    debug(DBG_INFO, "tlslogktls: kTLS offload for %s: send %s, receive %s", peer,
+          BIO_get_ktls_send(SSL_get_wbio(ssl)) ? "on" : "off",
+          BIO_get_ktls_recv(SSL_get_rbio(ssl)) ? "on" : "off");
+#endif
+}
+
+/**
+ * @brief check if records sent on a session are encrypted by the kernel
+ *
+ * The kernel cannot update the keys of an offloaded session, so we must
+ * not request key updates on it.
+ *
+ * @param ssl established TLS session
+ * @return int 1 if kTLS is used for sending, else 0
+ */
+int tlsktlssend(SSL *ssl) {
+#ifdef SSL_OP_ENABLE_KTLS
+    return BIO_get_ktls_send(SSL_get_wbio(ssl));
+#else
+    return 0;
+#endif
+}
+
+static int sslreadnb(void *ctx, uint8_t *buf, int num) {
+    SSL *ssl = (SSL *)ctx;
+    unsigned long error;
+    int cnt;
+
+    if (SSL_get_shutdown(ssl))
+        return -1;
+    cnt = SSL_read(ssl, buf, num);
+    if (cnt > 0)
+        return cnt;
+    switch (SSL_get_error(ssl, cnt)) {
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+        return 0;
+    case SSL_ERROR_ZERO_RETURN:
+        debug(DBG_DBG, "sslreadnb: got ssl shutdown");
+        SSL_shutdown(ssl);
+        break;
+    case SSL_ERROR_SYSCALL:
+        if (errno)
+            debugerrno(errno, DBG_INFO, "sslreadnb: connection lost");
+        else
+            debug(DBG_INFO, "sslreadnb: connection lost: EOF");
+        /* fallthrough */
+    case SSL_ERROR_SSL:
+        while ((error = ERR_get_error()))
+            debug(DBG_ERR, "sslreadnb: SSL: %s", ERR_error_string(error, NULL));
+        SSL_set_shutdown(ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+        break;
+    default:
+        debug(DBG_ERR, "sslreadnb: uncaught SSL error");
+        SSL_shutdown(ssl);
+        SSL_set_shutdown(ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+    }
+    return -1;
+}
+
+/**
+ * @brief read a RADIUS message from a server without blocking
+ *
+ * Called from the upstream reactor when the connection is readable. The socket
+ * must be non-blocking, a partially read message is kept in the server.
+ *
+ * @param server server to read from
+ * @param buf newly allocated buffer containing the message
+ * @return int length of the message, 0 if it is not complete yet, or -1 if the connection is lost
+ */
+int tlsclientradget(struct server *server, uint8_t **buf) {
+    int len;
+
+    pthread_mutex_lock(&server->lock);
+    len = radreadnb(&server->rd, sslreadnb, server->ssl, server->conf->maxpacketlen, buf);
+    pthread_mutex_unlock(&server->lock);
+    return len;
+}
+
 void *tlsserverwr(void *arg) {
     int cnt;
     struct client *client = (struct client *)arg;
@@ -1741,9 +2062,10 @@ void *tlsserverwr(void *arg) {
     char tmp[INET6_ADDRSTRLEN];
     struct timeval now;
 
+    threadreg_name("%swr:%s", client->conf->pdef->name, client->conf->name);
     debug(DBG_DBG, "tlsserverwr: starting for %s", addr2string(client->addr, tmp, sizeof(tmp)));
     replyq = client->replyq;
-    gettimeofday(&client->tlsnewkey, NULL);
+    monotime(&client->tlsnewkey);
     for (;;) {
         pthread_mutex_lock(&replyq->mutex);
         while (!list_first(replyq->entries)) {
@@ -1767,9 +2089,10 @@ void *tlsserverwr(void *arg) {
             pthread_exit(NULL);
         }
 
-        gettimeofday(&now, NULL);
+        monotime(&now);
 #if OPENSSL_VERSION_NUMBER >= 0x10101000
-        if (now.tv_sec - client->tlsnewkey.tv_sec > RSP_TLS_REKEY_INTERVAL && SSL_version(client->ssl) >= TLS1_3_VERSION) {
+        if (now.tv_sec - client->tlsnewkey.tv_sec > RSP_TLS_REKEY_INTERVAL && SSL_version(client->ssl) >= TLS1_3_VERSION &&
+            !tlsktlssend(client->ssl)) {
             debug(DBG_DBG, "tlsserverwr: perform key update for long-running connection");
             if (SSL_get_key_update_type(client->ssl) == SSL_KEY_UPDATE_NONE &&
                 !SSL_key_update(client->ssl, SSL_KEY_UPDATE_REQUESTED))
@@ -1810,7 +2133,7 @@ void tlsserverrd(struct client *client) {
     }
 
     for (;;) {
-        len = radtlsget(client->ssl, IDLE_TIMEOUT * 3, &client->lock, &buf);
+        len = radtlsget(client->ssl, IDLE_TIMEOUT * 3, &client->lock, client->conf->maxpacketlen, &buf);
         if (!buf || !len) {
             pthread_mutex_lock(&client->lock);
             if (SSL_get_shutdown(client->ssl))
@@ -1925,6 +2248,7 @@ void terminateinvalidserver(struct server *srv) {
         debug(DBG_NOTICE, "terminateinvalidserver: certificate has become invalid, terminating connection to %s",
               srv->conf->name);
         SSL_shutdown(srv->ssl);
+        upstreamwakeup(srv);
         break;
     case 1:
         debug(DBG_DBG, "terminateinvalidserver: certificate still valid for %s, continue",
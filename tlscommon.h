@@ -32,6 +32,7 @@ struct tls {
     int tlsmaxversion;
     int dtlsminversion;
     int dtlsmaxversion;
+    uint8_t ktls;
 #if OPENSSL_VERSION_NUMBER >= 0x30000000
     EVP_PKEY *dhparam;
 #else
@@ -52,6 +53,7 @@ extern int RSP_EX_DATA_CONFIG;
 extern int RSP_EX_DATA_CONFIG_LIST;
 
 void sslinit(void);
+void tlssetlowmemory(uint8_t on);
 struct tls *tlsgettls(char *alt1, char *alt2);
 struct tls *tlsgetdefaultpsk(void);
 SSL_CTX *tlsgetctx(uint8_t type, struct tls *t);
@@ -63,11 +65,17 @@ int addmatchcertattr(struct clsrvconf *conf, const char *match);
 void freematchcertattr(struct clsrvconf *conf);
 void tlsreload(void);
 int tlssetsni(SSL *ssl, char *sni);
+int tlssetalpn(SSL *ssl, enum rsp_radiusversion version);
+int tlsradiusversion(SSL *ssl, struct clsrvconf *conf);
+void tlssetradiusversions(SSL *ssl, uint8_t type, struct sockaddr *addr, struct list_node *cur);
 int sslconnecttimeout(SSL *ssl, int timeout);
 int sslaccepttimeout(SSL *ssl, int timeout);
 int sslreadtimeout(SSL *ssl, unsigned char *buf, int num, int timeout, pthread_mutex_t *lock);
 int sslwrite(SSL *ssl, void *buf, int num, uint8_t blocking);
-int radtlsget(SSL *ssl, int timeout, pthread_mutex_t *lock, uint8_t **buf);
+int radtlsget(SSL *ssl, int timeout, pthread_mutex_t *lock, int maxlen, uint8_t **buf);
+int tlsclientradget(struct server *server, uint8_t **buf);
+void tlslogktls(SSL *ssl, const char *peer);
+int tlsktlssend(SSL *ssl);
 void tlsserverrd(struct client *client);
 void terminateinvalidserver(struct server *srv);
 void terminateinvalidclient(struct client *cli);
@@ -0,0 +1,67 @@
+#! /bin/sh
+
+# Generate a synthetic configuration with many client and server
+# blocks, used to measure the startup time of large deployments.
+# Run radsecproxy on the result with -f -d 4 (add -p to stop after
+# reading the configuration) and look for the "startup:" lines.
+# Servers use the host localhost unless a domain is given, in which
+# case server<n>.<domain> is used so that resolving many distinct
+# names is part of the measurement.
+
+usage() {
+   echo "Usage: ${0} <clients> <servers> [tlsblocks] [serverdomain]"
+   exit 1
+}
+
+test -n "${2}" || usage
+
+CLIENTS=${1}
+SERVERS=${2}
+TLSBLOCKS=${3:-1}
+DOMAIN=${4}
+
+cat <<CONF
+ListenUDP 127.0.0.1:0
+
+CONF
+
+i=0
+while [ $i -lt "$TLSBLOCKS" ]; do
+    cat <<CONF
+tls tls$i {
+    CACertificatePath /etc/ssl/certs
+    CertificateFile /etc/radsecproxy/cert.pem
+    CertificateKeyFile /etc/radsecproxy/key.pem
+}
+
+CONF
+    i=$((i + 1))
+done
+
+i=0
+while [ $i -lt "$CLIENTS" ]; do
+    echo "client client$i {"
+    echo "    host 10.$((i / 65536 % 256)).$((i / 256 % 256)).$((i % 256))"
+    echo "    type udp"
+    echo "    secret synthetic-secret-$i"
+    echo "}"
+    i=$((i + 1))
+done
+echo
+
+i=0
+while [ $i -lt "$SERVERS" ]; do
+    echo "server server$i {"
+    if [ -n "$DOMAIN" ]; then
+        echo "    host server$i.$DOMAIN"
+    else
+        echo "    host localhost"
+    fi
+    echo "    type udp"
+    echo "    secret synthetic-secret-$i"
+    echo "}"
+    echo "realm /^realm$i\\.example\$/ {"
+    echo "    server server$i"
+    echo "}"
+    i=$((i + 1))
+done
@@ -0,0 +1,80 @@
+#! /usr/bin/env python3
+
+# Decode the flight recorder file of radsecproxy (option FlightRecorder),
+# printing the recorded requests oldest first. Run it on the host that
+# wrote the file, the records are in its byte order. Can be run while
+# radsecproxy is writing; records being written are skipped.
+
+import argparse
+import datetime
+import socket
+import struct
+import sys
+
+MAGIC = b"RSPFREC1"
+VERSION = 1
+HEADER = struct.Struct("=8sIIQQ")
+HEADERSIZE = 64
+RECORD = struct.Struct("=QqIBBBBBBH16s24s24s24s12x")
+
+OUTCOMES = ["dropped", "replied", "local", "timeout", "duplicate", "shed"]
+CODES = {1: "Access-Request", 2: "Access-Accept", 3: "Access-Reject",
+         4: "Accounting-Request", 5: "Accounting-Response",
+         11: "Access-Challenge", 12: "Status-Server"}
+
+
+def name(raw):
+    return raw.split(b"\0", 1)[0].decode("utf-8", "replace") or "-"
+
+
+def peer(family, addr, port):
+    port = socket.ntohs(port)
+    if family == socket.AF_INET:
+        return "%s:%d" % (socket.inet_ntop(socket.AF_INET, addr[:4]), port)
+    if family == socket.AF_INET6:
+        return "[%s]:%d" % (socket.inet_ntop(socket.AF_INET6, addr), port)
+    return "-"
+
+
+def records(data):
+    magic, version, recsize, count, _ = HEADER.unpack_from(data)
+    if magic != MAGIC or version != VERSION or recsize != RECORD.size:
+        sys.exit("not a radsecproxy flight recorder file (version %d)" % VERSION)
+    if len(data) < HEADERSIZE + count * recsize:
+        sys.exit("file is truncated")
+    found = []
+    for i in range(count):
+        rec = RECORD.unpack_from(data, HEADERSIZE + i * recsize)
+        seq = rec[0]
+        # empty, being written, or a stale record of a different ring size
+        if seq == 0 or (seq - 1) % count != i:
+            continue
+        found.append(rec)
+    found.sort(key=lambda r: r[0])
+    return found
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode a radsecproxy flight recorder file.")
+    parser.add_argument("file")
+    parser.add_argument("-n", type=int, default=0, metavar="COUNT", help="only the last COUNT requests")
+    args = parser.parse_args()
+
+    with open(args.file, "rb") as f:
+        data = f.read()
+    recs = records(data)
+    if args.n > 0:
+        recs = recs[-args.n:]
+    for (seq, time, latency, code, rqid, replycode, outcome, tries, family, port,
+         addr, client, realm, server) in recs:
+        when = datetime.datetime.fromtimestamp(time / 1e6, datetime.timezone.utc)
+        print("%s %8.1fms %-10s %-20s id %3d %-26s realm %s server %s tries %d %s%s" % (
+            when.strftime("%Y-%m-%dT%H:%M:%S.%fZ"), latency / 1000.0,
+            OUTCOMES[outcome] if outcome < len(OUTCOMES) else str(outcome),
+            CODES.get(code, str(code)), rqid, "%s %s" % (name(client), peer(family, addr, port)),
+            name(realm), name(server), tries,
+            "reply " if replycode else "", CODES.get(replycode, str(replycode)) if replycode else ""))
+
+
+if __name__ == "__main__":
+    main()
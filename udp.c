@@ -26,6 +26,8 @@
 
 #ifdef RADPROT_UDP
 #include "debug.h"
+#include "sockstats.h"
+#include "threadreg.h"
 #include "util.h"
 
 static void setprotoopts(struct commonprotoopts *opts);
@@ -51,8 +53,9 @@ static const struct protodefs protodefs = {
     getlistenerargs,        /* getlistenerargs */
     udpserverrd,            /* listener */
     NULL,                   /* connecter */
-    NULL,                   /* clientconnreader */
+    NULL,                   /* clientradget */
     clientradputudp,        /* clientradput */
+    NULL,                   /* clientradflush */
     addclientudp,           /* addclient */
     addserverextraudp,      /* addserverextra */
     udpsetsrcres,           /* setsrcres */
@@ -62,6 +65,8 @@ static const struct protodefs protodefs = {
 struct client_sock {
     struct sockaddr_storage *source;
     int socket;
+    long rcvbuf; /* largest of the servers sharing the socket */
+    long sndbuf;
 };
 
 static struct list *client_sock;
@@ -135,12 +140,18 @@ uint16_t port_get(struct sockaddr *sa) {
 /* exactly one of client and server must be non-NULL */
 /* return who we received from in *client or *server */
 /* return from in sa if not NULL */
-int radudpget(int s, struct client **client, struct server **server, unsigned char **buf) {
+/* st is updated with the socket telemetry, may be NULL */
+int radudpget(int s, struct sockstats *st, struct client **client, struct server **server, unsigned char **buf) {
     int cnt, len;
     unsigned char init_buf[4];
     struct sockaddr_storage from;
     struct sockaddr *fromcopy;
-    socklen_t fromlen = sizeof(from);
+    struct msghdr msg;
+    struct iovec iov;
+    union {
+        uint8_t buf[SOCKSTATS_CMSG_SPACE + CMSG_SPACE(64)]; /* and the packet info of listeners */
+        struct cmsghdr align;
+    } control;
     struct clsrvconf *p;
     struct list_node *node;
     struct client *c = NULL;
@@ -153,11 +164,21 @@ int radudpget(int s, struct client **client, struct server **server, unsigned ch
             *buf = NULL;
         }
 
-        cnt = recvfrom(s, init_buf, 4, MSG_PEEK | MSG_TRUNC, (struct sockaddr *)&from, &fromlen);
+        iov.iov_base = init_buf;
+        iov.iov_len = sizeof(init_buf);
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &from;
+        msg.msg_namelen = sizeof(from);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = &control;
+        msg.msg_controllen = sizeof(control);
+        cnt = recvmsg(s, &msg, MSG_PEEK | MSG_TRUNC);
         if (cnt == -1) {
-            debug(DBG_ERR, "radudpget: recvfrom failed - %s", strerror(errno));
+            debug(DBG_ERR, "radudpget: recvmsg failed - %s", strerror(errno));
             continue;
         }
+        sockstats_update(st, &msg);
 
         p = client
                 ? find_clconf(handle, (struct sockaddr *)&from, NULL, NULL)
@@ -174,7 +195,7 @@ int radudpget(int s, struct client **client, struct server **server, unsigned ch
             sock_dgram_skip(s);
             continue;
         }
-        if (len > 4096) {
+        if (len > RAD_Max_Length) {
             debug(DBG_WARN, "radudpget: length too big");
             sock_dgram_skip(s);
             continue;
@@ -205,7 +226,7 @@ int radudpget(int s, struct client **client, struct server **server, unsigned ch
                 node = list_next(node);
                 if (s != c->sock)
                     continue;
-                gettimeofday(&now, NULL);
+                monotime(&now);
                 if (!*client && addr_equal((struct sockaddr *)&from, c->addr)) {
                     c->expiry = now.tv_sec + 60;
                     *client = c;
@@ -233,7 +254,7 @@ int radudpget(int s, struct client **client, struct server **server, unsigned ch
                 }
                 c->sock = s;
                 c->addr = fromcopy;
-                gettimeofday(&now, NULL);
+                monotime(&now);
                 c->expiry = now.tv_sec + 60;
                 *client = c;
             }
@@ -270,10 +291,12 @@ void *udpclientrd(void *arg) {
     unsigned char *buf = NULL;
     int *s = (int *)arg;
     int len = 0;
+    struct sockstats *st = sockstats_find(*s);
 
+    threadreg_name("udpreply");
     for (;;) {
         server = NULL;
-        len = radudpget(*s, NULL, &server, &buf);
+        len = radudpget(*s, st, NULL, &server, &buf);
         replyh(server, buf, len);
         buf = NULL;
     }
@@ -282,16 +305,18 @@ void *udpclientrd(void *arg) {
 void *udpserverrd(void *arg) {
     struct request *rq;
     int *sp = (int *)arg;
+    struct sockstats *st = sockstats_find(*sp);
 
+    threadreg_name("udplisten");
     for (;;) {
         rq = newrequest();
         if (!rq) {
             sleep(5); /* malloc failed */
             continue;
         }
-        rq->buflen = radudpget(*sp, &rq->from, NULL, &rq->buf);
+        rq->buflen = radudpget(*sp, st, &rq->from, NULL, &rq->buf);
         rq->udpsock = *sp;
-        gettimeofday(&rq->created, NULL);
+        stamprq(rq);
         radsrv(rq);
     }
     free(sp);
@@ -303,6 +328,7 @@ void *udpserverwr(void *arg) {
     struct request *reply;
     struct sockaddr_storage to;
 
+    threadreg_name("udpwr");
     for (;;) {
         pthread_mutex_lock(&replyq->mutex);
         while (!(reply = (struct request *)list_shift(replyq->entries))) {
@@ -330,7 +356,8 @@ void addclientudp(struct client *client) {
 void addserverextraudp(struct clsrvconf *conf) {
     struct addrinfo *source = NULL, *tmpaddrinfo;
     struct list_node *entry;
-    char tmp[32];
+    struct client_sock *cls = NULL;
+    char tmp[INET6_ADDRSTRLEN], name[INET6_ADDRSTRLEN + 16];
 
     assert(list_first(conf->hostports) != NULL);
 
@@ -347,13 +374,14 @@ void addserverextraudp(struct clsrvconf *conf) {
         if (tmpaddrinfo->ai_family == AF_UNSPEC || tmpaddrinfo->ai_family == ((struct hostportres *)list_first(conf->hostports)->data)->addrinfo->ai_family) {
             for (entry = list_first(client_sock); entry; entry = list_next(entry)) {
                 if (memcmp(tmpaddrinfo->ai_addr, ((struct client_sock *)entry->data)->source, tmpaddrinfo->ai_addrlen) == 0) {
-                    conf->servers->sock = ((struct client_sock *)entry->data)->socket;
+                    cls = (struct client_sock *)entry->data;
+                    conf->servers->sock = cls->socket;
                     debug(DBG_DBG, "addserverextraudp: reusing existing socket #%d (%s) for server %s", conf->servers->sock, addr2string(tmpaddrinfo->ai_addr, tmp, sizeof(tmp)), conf->name);
                     break;
                 }
             }
             if (conf->servers->sock < 0) {
-                struct client_sock *cls = malloc(sizeof(struct client_sock));
+                cls = calloc(1, sizeof(struct client_sock));
                 if (!cls)
                     debugx(1, DBG_ERR, "addserverextraudp: malloc failed");
                 cls->socket = bindtoaddr(tmpaddrinfo, tmpaddrinfo->ai_family, 0);
@@ -365,12 +393,22 @@ void addserverextraudp(struct clsrvconf *conf) {
                 if (!list_push(client_sock, cls))
                     debugx(1, DBG_ERR, "addserverextraudp: malloc failed");
                 conf->servers->sock = cls->socket;
+                snprintf(name, sizeof(name), "udp source %s", addr2string((struct sockaddr *)cls->source, tmp, sizeof(tmp)));
+                if (cls->socket >= 0 && !sockstats_add(cls->socket, name))
+                    debugx(1, DBG_ERR, "addserverextraudp: malloc failed");
                 break;
             }
         }
     }
     if (conf->servers->sock < 0)
         debugx(1, DBG_ERR, "addserver: failed to create client socket for server %s", conf->name);
+    if (conf->rcvbuf > cls->rcvbuf || conf->sndbuf > cls->sndbuf) {
+        if (conf->rcvbuf > cls->rcvbuf)
+            cls->rcvbuf = conf->rcvbuf;
+        if (conf->sndbuf > cls->sndbuf)
+            cls->sndbuf = conf->sndbuf;
+        set_sockbufs(cls->socket, cls->rcvbuf, cls->sndbuf);
+    }
 
     if (source)
         freeaddrinfo(source);
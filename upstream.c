@@ -0,0 +1,572 @@
+/* Copyright (c) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+/* All server connections are served by a small number of reactor threads.
+ * A reactor polls the connections of its servers for replies and runs
+ * clientwrrun() for a server when sendrq() signals it or when its
+ * retransmission or status server timer expires. Requests a stream
+ * connection does not take right away are queued and written once it is
+ * writable. Setting up a server and
+ * reconnecting may block for a long time, they run in short-lived helper
+ * threads while the reactor carries on with the other servers. */
+
+#include "upstream.h"
+#include "debug.h"
+#include "radsecproxy.h"
+#include "threadreg.h"
+#include "util.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <openssl/ssl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+/* max number of messages read from one connection before serving the others */
+#define UPSTREAM_READ_BURST 64
+
+enum upstream_phase {
+    UPSTREAM_STARTING, /* clientwrstart() has finished */
+    UPSTREAM_RUNNING,
+    UPSTREAM_RETIRING /* setup failed, waiting before removing the server */
+};
+
+struct upstream;
+
+struct upstreamsrv {
+    struct server *server;
+    struct upstream *upstream;
+    enum upstream_phase phase;
+    int result; /* of clientwrstart() */
+    /* protected by upstream->mutex */
+    uint8_t busy; /* reconnect running in a helper thread */
+    uint8_t signalled;
+    /* only used by the reactor thread */
+    uint8_t helper; /* copy of busy */
+    uint8_t woken;
+    uint8_t reconnect;
+    uint8_t reconnecting;
+    uint8_t readable;
+    uint8_t writable;
+    time_t next;
+    time_t readtimeout;
+    time_t retire;
+};
+
+struct upstream {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    int pipe[2];
+    uint8_t signalled;
+    struct list *servers;
+};
+
+static struct upstream *upstreams = NULL;
+static int nupstreams = 0;
+static int nextupstream = 0;
+static pthread_mutex_t nextupstream_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief read a RADIUS message from a non-blocking stream
+ *
+ * Reads as much of the message as is available, a partially read message
+ * is kept in rd until the rest of it arrives.
+ *
+ * @param rd read state of the connection
+ * @param readfn reads up to num bytes, returns the number of bytes read, 0 if it would block or -1 on error
+ * @param ctx passed to readfn
+ * @param maxlen largest message length accepted on this connection
+ * @param buf newly allocated buffer containing the message
+ * @return int length of the message, 0 if it is not complete yet or -1 if the connection is broken
+ */
+int radreadnb(struct radread *rd, int (*readfn)(void *, uint8_t *, int), void *ctx, int maxlen, uint8_t **buf) {
+    int cnt, len;
+
+    while (rd->got < 4) {
+        cnt = readfn(ctx, rd->hdr + rd->got, 4 - rd->got);
+        if (cnt <= 0)
+            return cnt;
+        rd->got += cnt;
+    }
+    if (!rd->buf) {
+        rd->len = get_checked_rad_length_max(rd->hdr, maxlen);
+        if (rd->len <= 0) {
+            debug(DBG_ERR, "radreadnb: invalid message length (%d)! closing connection!", -rd->len);
+            return -1;
+        }
+        rd->buf = malloc(rd->len);
+        if (!rd->buf) {
+            debug(DBG_ERR, "radreadnb: malloc failed! closing connection!");
+            return -1;
+        }
+        memcpy(rd->buf, rd->hdr, 4);
+    }
+    while (rd->got < rd->len) {
+        cnt = readfn(ctx, rd->buf + rd->got, rd->len - rd->got);
+        if (cnt <= 0)
+            return cnt;
+        rd->got += cnt;
+    }
+
+    *buf = rd->buf;
+    len = rd->len;
+    rd->buf = NULL;
+    rd->got = 0;
+    debug(DBG_DBG, "radreadnb: got %d bytes", len);
+    return len;
+}
+
+/* discard a partially read message, e.g. after reconnecting */
+void radreadreset(struct radread *rd) {
+    free(rd->buf);
+    memset(rd, 0, sizeof(struct radread));
+}
+
+/**
+ * @brief write the messages queued for a non-blocking stream
+ *
+ * @param wr write queue of the connection
+ * @param writefn writes up to num bytes, returns the number of bytes written, 0 if it would block or -1 on error
+ * @param ctx passed to writefn
+ * @return int number of bytes still queued or -1 if the connection is broken
+ */
+int radflushnb(struct radwrite *wr, int (*writefn)(void *, const uint8_t *, int), void *ctx) {
+    int cnt;
+
+    while (wr->off < wr->len) {
+        cnt = writefn(ctx, wr->buf + wr->off, wr->len - wr->off);
+        if (cnt < 0)
+            return -1;
+        if (!cnt)
+            break;
+        wr->off += cnt;
+    }
+    if (wr->off == wr->len)
+        wr->off = wr->len = 0;
+    return wr->len - wr->off;
+}
+
+/**
+ * @brief queue a RADIUS message for a non-blocking stream and write as much
+ * of the queue as the connection takes
+ *
+ * Messages are queued whole, so a short write never cuts one off in the
+ * stream. What is left is written by radflushnb() once the connection is
+ * writable.
+ *
+ * @param wr write queue of the connection
+ * @param writefn as for radflushnb()
+ * @param ctx passed to writefn
+ * @param msg the message
+ * @param len length of the message
+ * @return int 1 if the message is queued, 0 if the queue is full or -1 if the connection is broken
+ */
+int radwritenb(struct radwrite *wr, int (*writefn)(void *, const uint8_t *, int), void *ctx, const uint8_t *msg, int len) {
+    uint8_t *buf;
+    int size;
+
+    if (wr->len - wr->off + len > UPSTREAM_WRITE_MAX)
+        return 0;
+    if (wr->off) {
+        memmove(wr->buf, wr->buf + wr->off, wr->len - wr->off);
+        wr->len -= wr->off;
+        wr->off = 0;
+    }
+    if (wr->len + len > wr->size) {
+        size = wr->size * 2 > wr->len + len ? wr->size * 2 : wr->len + len;
+        buf = realloc(wr->buf, size);
+        if (!buf) {
+            debug(DBG_ERR, "radwritenb: malloc failed");
+            return 0;
+        }
+        wr->buf = buf;
+        wr->size = size;
+    }
+    memcpy(wr->buf + wr->len, msg, len);
+    wr->len += len;
+    return radflushnb(wr, writefn, ctx) < 0 ? -1 : 1;
+}
+
+/* discard the queued messages, e.g. when reconnecting */
+void radwritereset(struct radwrite *wr) {
+    free(wr->buf);
+    memset(wr, 0, sizeof(struct radwrite));
+}
+
+/* called with u->mutex held */
+static void signalreactor(struct upstream *u) {
+    char c = 0;
+
+    if (u->signalled)
+        return;
+    u->signalled = 1;
+    if (write(u->pipe[1], &c, 1) < 0 && errno != EAGAIN)
+        debugerrno(errno, DBG_ERR, "signalreactor: write failed");
+}
+
+/** Wake up the reactor of a server, e.g. when a new request is queued */
+void upstreamwakeup(struct server *server) {
+    struct upstreamsrv *us = server->upstream;
+
+    if (!us)
+        return;
+    pthread_mutex_lock(&us->upstream->mutex);
+    us->signalled = 1;
+    signalreactor(us->upstream);
+    pthread_mutex_unlock(&us->upstream->mutex);
+}
+
+/** Reconnect the server once the current handler returns.
+ * Only called by the reactor thread, from closeh() and timeouth(). */
+void upstreamreconnect(struct server *server) {
+    if (server->upstream)
+        server->upstream->reconnect = 1;
+}
+
+static void *upstreamsetup(void *arg) {
+    struct upstreamsrv *us = (struct upstreamsrv *)arg;
+    struct upstream *u = us->upstream;
+
+    threadreg_name("setup:%s", us->server->conf->name);
+    us->result = clientwrstart(us->server);
+
+    pthread_mutex_lock(&u->mutex);
+    if (!list_push(u->servers, us)) {
+        pthread_mutex_unlock(&u->mutex);
+        debug(DBG_ERR, "malloc failed");
+        clientwrcleanup(us->server);
+        free(us);
+        return NULL;
+    }
+    us->signalled = 1;
+    signalreactor(u);
+    pthread_mutex_unlock(&u->mutex);
+    return NULL;
+}
+
+static void *upstreamconnect(void *arg) {
+    struct upstreamsrv *us = (struct upstreamsrv *)arg;
+
+    threadreg_name("conn:%s", us->server->conf->name);
+    us->server->conf->pdef->connecter(us->server, 0, 1);
+
+    pthread_mutex_lock(&us->upstream->mutex);
+    us->busy = 0;
+    us->signalled = 1;
+    signalreactor(us->upstream);
+    pthread_mutex_unlock(&us->upstream->mutex);
+    return NULL;
+}
+
+static int startreconnect(struct upstreamsrv *us) {
+    pthread_t th;
+
+    pthread_mutex_lock(&us->upstream->mutex);
+    us->busy = 1;
+    pthread_mutex_unlock(&us->upstream->mutex);
+    if (pthread_create(&th, &pthread_attr, upstreamconnect, (void *)us)) {
+        debugerrno(errno, DBG_ERR, "startreconnect: pthread_create failed");
+        pthread_mutex_lock(&us->upstream->mutex);
+        us->busy = 0;
+        pthread_mutex_unlock(&us->upstream->mutex);
+        return 0;
+    }
+    pthread_detach(th);
+    us->helper = 1;
+    us->reconnecting = 1;
+    return 1;
+}
+
+/** Hand a new server to a reactor. Its setup runs in a helper thread,
+ * the reactor picks it up when that has finished. */
+int upstreamadd(struct server *server) {
+    struct upstreamsrv *us;
+    pthread_t th;
+
+    us = calloc(1, sizeof(struct upstreamsrv));
+    if (!us) {
+        debug(DBG_ERR, "malloc failed");
+        return 0;
+    }
+    pthread_mutex_lock(&nextupstream_lock);
+    us->upstream = upstreams + nextupstream;
+    nextupstream = (nextupstream + 1) % nupstreams;
+    pthread_mutex_unlock(&nextupstream_lock);
+    us->server = server;
+    us->phase = UPSTREAM_STARTING;
+    server->upstream = us;
+
+    if (pthread_create(&th, &pthread_attr, upstreamsetup, (void *)us)) {
+        debugerrno(errno, DBG_ERR, "upstreamadd: pthread_create failed");
+        server->upstream = NULL;
+        free(us);
+        return 0;
+    }
+    pthread_detach(th);
+    return 1;
+}
+
+static time_t readinterval(struct server *server) {
+    return server->conf->retryinterval * (server->conf->retrycount + 1);
+}
+
+static void upstreamclose(struct server *server) {
+    pthread_mutex_lock(&server->lock);
+    server->state = RSP_SERVER_STATE_FAILING;
+    if (server->ssl)
+        SSL_shutdown(server->ssl);
+    if (server->sock >= 0) {
+        shutdown(server->sock, SHUT_RDWR);
+        close(server->sock);
+        server->sock = -1;
+    }
+    pthread_mutex_unlock(&server->lock);
+}
+
+static void upstreamremove(struct upstream *u, struct upstreamsrv *us) {
+    pthread_mutex_lock(&u->mutex);
+    list_removedata(u->servers, us);
+    pthread_mutex_unlock(&u->mutex);
+    clientwrcleanup(us->server);
+    free(us);
+}
+
+/* returns 1 if the server should be removed */
+static int upstreamread(struct upstreamsrv *us, time_t now) {
+    struct server *server = us->server;
+    uint8_t *buf = NULL;
+    int i, len;
+
+    for (i = 0; i < UPSTREAM_READ_BURST; i++) {
+        len = server->conf->pdef->clientradget(server, &buf);
+        if (!len) {
+            us->readable = 0;
+            return 0;
+        }
+        if (len < 0 || !replyh(server, buf, len)) {
+            us->readable = 0;
+            return closeh(server);
+        }
+        buf = NULL;
+        if (us->readtimeout)
+            us->readtimeout = now + readinterval(server);
+    }
+    /* more may be buffered, keep reading on the next pass */
+    return 0;
+}
+
+/* returns 1 if the server should be removed */
+static int upstreamflush(struct upstreamsrv *us) {
+    struct server *server = us->server;
+
+    us->writable = 0;
+    if (server->conf->pdef->clientradflush(server) >= 0)
+        return 0;
+    return closeh(server);
+}
+
+/* returns 0 if the server has been removed */
+static int upstreamserve(struct upstream *u, struct upstreamsrv *us, time_t now) {
+    struct server *server = us->server;
+    uint8_t woken = us->woken;
+
+    us->woken = 0;
+    switch (us->phase) {
+    case UPSTREAM_STARTING:
+        if (us->result < 0) {
+            clientwrflush(server);
+            us->phase = UPSTREAM_RETIRING;
+            us->retire = now + FAILED_SERVER_HOLD;
+            return 1;
+        }
+        if (!us->result) {
+            upstreamremove(u, us);
+            return 0;
+        }
+        us->phase = UPSTREAM_RUNNING;
+        us->readable = 1;
+        us->readtimeout = readinterval(server) ? now + readinterval(server) : 0;
+        woken = 1;
+        break;
+    case UPSTREAM_RETIRING:
+        if (now < us->retire)
+            return 1;
+        upstreamremove(u, us);
+        return 0;
+    case UPSTREAM_RUNNING:
+        break;
+    }
+
+    if (us->reconnecting && !us->helper) {
+        us->reconnecting = 0;
+        radreadreset(&server->rd);
+        us->readable = 1;
+        if (us->readtimeout)
+            us->readtimeout = now + readinterval(server);
+    }
+
+    if (!us->helper && !us->reconnect && server->conf->pdef->clientradget) {
+        /* the session may have been shut down by terminateinvalidserver() */
+        if (woken && server->ssl && SSL_get_shutdown(server->ssl))
+            us->readable = 1;
+        if ((us->readable && upstreamread(us, now)) ||
+            (us->writable && upstreamflush(us)) ||
+            (!us->reconnect && us->readtimeout && now >= us->readtimeout && timeouth(server))) {
+            debug(DBG_INFO, "upstreamserve: closing connection to %s", server->conf->name);
+            upstreamclose(server);
+            upstreamremove(u, us);
+            return 0;
+        }
+        if (us->readtimeout && now >= us->readtimeout)
+            us->readtimeout = now + readinterval(server);
+    }
+
+    if (us->reconnect && !us->helper && startreconnect(us))
+        us->reconnect = 0;
+
+    if (woken || now >= us->next)
+        us->next = clientwrrun(server);
+    return 1;
+}
+
+static void mindeadline(time_t *deadline, time_t t) {
+    if (t && (!*deadline || t < *deadline))
+        *deadline = t;
+}
+
+static void *upstreamreactor(void *arg) {
+    struct upstream *u = (struct upstream *)arg;
+    struct upstreamsrv **srvs = NULL, **polled = NULL, *us;
+    struct pollfd *fds = NULL;
+    struct list_node *entry;
+    struct timeval now;
+    time_t deadline;
+    int n, nfds, size = 0, i, timeout;
+    char drain[64];
+    void *p;
+
+    threadreg_name("up:%d", (int)(u - upstreams));
+    for (;;) {
+        pthread_mutex_lock(&u->mutex);
+        n = list_count(u->servers);
+        if (n + 1 > size) {
+            size = n + 1 + 64;
+            if ((p = realloc(srvs, size * sizeof(*srvs))))
+                srvs = p;
+            if (p && (p = realloc(polled, size * sizeof(*polled))))
+                polled = p;
+            if (p && (p = realloc(fds, size * sizeof(*fds))))
+                fds = p;
+            if (!p) {
+                pthread_mutex_unlock(&u->mutex);
+                debug(DBG_ERR, "malloc failed");
+                size = 0;
+                sleep(1);
+                continue;
+            }
+        }
+        i = 0;
+        for (entry = list_first(u->servers); entry; entry = list_next(entry)) {
+            us = (struct upstreamsrv *)entry->data;
+            us->helper = us->busy;
+            us->woken = us->signalled;
+            us->signalled = 0;
+            srvs[i++] = us;
+        }
+        if (u->signalled) {
+            while (read(u->pipe[0], drain, sizeof(drain)) > 0)
+                ;
+            u->signalled = 0;
+        }
+        pthread_mutex_unlock(&u->mutex);
+
+        monotime(&now);
+        fds[0].fd = u->pipe[0];
+        fds[0].events = POLLIN;
+        nfds = 1;
+        deadline = 0;
+        timeout = -1;
+        for (i = 0; i < n; i++) {
+            us = srvs[i];
+            if (!upstreamserve(u, us, now.tv_sec))
+                continue;
+            if (us->phase == UPSTREAM_RETIRING) {
+                mindeadline(&deadline, us->retire);
+                continue;
+            }
+            mindeadline(&deadline, us->next);
+            if (us->reconnect)
+                mindeadline(&deadline, now.tv_sec + 1);
+            if (us->helper || us->reconnect || !us->server->conf->pdef->clientradget || us->server->sock < 0)
+                continue;
+            mindeadline(&deadline, us->readtimeout);
+            if (us->readable)
+                timeout = 0;
+            fds[nfds].fd = us->server->sock;
+            fds[nfds].events = POLLIN;
+            /* the queue is only written by this thread while no helper runs */
+            if (us->server->conf->pdef->clientradflush && us->server->wr.len)
+                fds[nfds].events |= POLLOUT;
+            polled[nfds++] = us;
+        }
+
+        if (timeout && deadline) {
+            monotime(&now);
+            timeout = deadline > now.tv_sec ? (deadline - now.tv_sec) * 1000 - now.tv_usec / 1000 : 0;
+        }
+        if (poll(fds, nfds, timeout) < 0) {
+            if (errno != EINTR)
+                debugerrno(errno, DBG_ERR, "upstreamreactor: poll failed");
+            continue;
+        }
+        for (i = 1; i < nfds; i++) {
+            if (fds[i].revents & ~POLLOUT)
+                polled[i]->readable = 1;
+            if (fds[i].revents & POLLOUT)
+                polled[i]->writable = 1;
+        }
+    }
+    return NULL;
+}
+
+/** Start the reactor threads, before any server is added */
+int upstreaminit(int threads) {
+    struct upstream *u;
+    int i;
+
+    upstreams = calloc(threads, sizeof(struct upstream));
+    if (!upstreams) {
+        debug(DBG_ERR, "malloc failed");
+        return 0;
+    }
+    for (i = 0; i < threads; i++) {
+        u = upstreams + i;
+        if (pthread_mutex_init(&u->mutex, NULL) || pipe(u->pipe)) {
+            debugerrno(errno, DBG_ERR, "upstreaminit: failed to set up reactor");
+            return 0;
+        }
+        if (fcntl(u->pipe[0], F_SETFL, O_NONBLOCK) == -1 || fcntl(u->pipe[1], F_SETFL, O_NONBLOCK) == -1)
+            debugerrno(errno, DBG_WARN, "upstreaminit: failed to set O_NONBLOCK");
+        u->servers = list_create();
+        if (!u->servers) {
+            debug(DBG_ERR, "malloc failed");
+            return 0;
+        }
+        if (pthread_create(&u->thread, &pthread_attr, upstreamreactor, (void *)u)) {
+            debugerrno(errno, DBG_ERR, "upstreaminit: pthread_create failed");
+            return 0;
+        }
+        pthread_detach(u->thread);
+        nupstreams++;
+    }
+    debug(DBG_DBG, "upstreaminit: started %d reactor threads", threads);
+    return 1;
+}
+
+/* Local Variables: */
+/* c-file-style: "stroustrup" */
+/* End: */
@@ -0,0 +1,47 @@
+/* Copyright (c) 2024, SWITCH */
+/* See LICENSE for licensing information. */
+
+#ifndef _UPSTREAM_H
+#define _UPSTREAM_H
+
+#include <stdint.h>
+
+/* max number of reactor threads serving the server connections */
+#define UPSTREAM_MAX_THREADS 64
+
+/* max number of bytes queued for a stream connection that is not writable */
+#define UPSTREAM_WRITE_MAX 262144
+
+/* a RADIUS message being read from a non-blocking stream connection */
+struct radread {
+    uint8_t hdr[4];
+    uint8_t *buf;
+    int len;
+    int got;
+};
+
+/* RADIUS messages queued for a non-blocking stream connection */
+struct radwrite {
+    uint8_t *buf;
+    int size;
+    int len; /* bytes queued */
+    int off; /* bytes of them written */
+};
+
+struct server;
+
+int radreadnb(struct radread *rd, int (*readfn)(void *, uint8_t *, int), void *ctx, int maxlen, uint8_t **buf);
+void radreadreset(struct radread *rd);
+int radwritenb(struct radwrite *wr, int (*writefn)(void *, const uint8_t *, int), void *ctx, const uint8_t *msg, int len);
+int radflushnb(struct radwrite *wr, int (*writefn)(void *, const uint8_t *, int), void *ctx);
+void radwritereset(struct radwrite *wr);
+int upstreaminit(int threads);
+int upstreamadd(struct server *server);
+void upstreamwakeup(struct server *server);
+void upstreamreconnect(struct server *server);
+
+#endif /* _UPSTREAM_H */
+
+/* Local Variables: */
+/* c-file-style: "stroustrup" */
+/* End: */
@@ -4,6 +4,7 @@
 /* See LICENSE for licensing information. */
 
 #include "util.h"
+#include "asciiscan.h"
 #include "debug.h"
 #include <assert.h>
 #include <errno.h>
@@ -13,10 +14,12 @@
 #include <netinet/tcp.h>
 #include <poll.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
 
 char *stringcopy(const char *s, int len) {
@@ -33,58 +36,82 @@ char *stringcopy(const char *s, int len) {
     return r;
 }
 
+/* calloc with the memory aligned to align bytes, to be freed with free */
+void *alignedcalloc(size_t align, size_t nmemb, size_t size) {
+    void *p;
+
+    if (size && nmemb > SIZE_MAX / size)
+        return NULL;
+    if (posix_memalign(&p, align, nmemb * size))
+        return NULL;
+    memset(p, 0, nmemb * size);
+    return p;
+}
+
+/* returns the length of the valid utf-8 character at byte, 0 if invalid */
+static size_t utf8charlen(const unsigned char *byte, const unsigned char *end) {
+    size_t charlen, i;
+
+    if (*byte == 0x00)
+        return 0;
+    if ((*byte & 0x80) == 0x00)
+        return *byte < 0x20 || *byte == 0x7F ? 0 : 1;
+    if (*byte > 0xF4)
+        return 0;
+    if ((*byte & 0xE0) == 0xC0) {
+        if ((*byte & 0xFE) == 0xC0)
+            return 0;
+        charlen = 2;
+    } else if ((*byte & 0xF0) == 0xE0)
+        charlen = 3;
+    else if ((*byte & 0xF8) == 0xF0)
+        charlen = 4;
+    else
+        return 0;
+
+    if (byte + charlen - 1 >= end)
+        return 0;
+    if (charlen == 2 && *byte == 0xC2 && *(byte + 1) < 0xA0)
+        return 0;
+    if (charlen == 3) {
+        if (*byte == 0xE0 && (*(byte + 1) & 0xE0) == 0x80)
+            return 0;
+        if (*byte == 0xED && (*(byte + 1) & 0xE0) == 0xA0)
+            return 0;
+    }
+    if (charlen == 4) {
+        if (*byte == 0xF0 && (*(byte + 1) & 0xF0) == 0x80)
+            return 0;
+        if (*byte == 0xF4 && (*(byte + 1) & 0xF0) != 0x80)
+            return 0;
+    }
+
+    for (i = 1; i < charlen; i++)
+        if ((byte[i] & 0xC0) != 0x80)
+            return 0;
+    return charlen;
+}
+
 /**
  * @brief verify if str is properly utf-8 encoded
- * 
+ * Runs of printable ASCII are skipped using printablespan(), other characters
+ * are checked one by one.
+ *
  * @param str string to verify
  * @param str_len length of the string without terminating null.
  * @return int 1 if valid utf-8, 0 otherwise
  */
 int verifyutf8(const unsigned char *str, size_t str_len) {
-    const unsigned char *byte;
+    const unsigned char *byte = str, *end = str + str_len;
     size_t charlen;
 
-    for (byte = str; byte < str + str_len; byte++) {
-        if (*byte == 0x00)
-            return 0;
-        if ((*byte & 0x80) == 0x00) {
-            if (*byte < 0x20 || *byte == 0x7F)
-                return 0;
-            continue;
-        }
-        if (*byte > 0xF4)
-            return 0;
-        if ((*byte & 0xE0) == 0xC0) {
-            if ((*byte & 0xFE) == 0xC0)
-                return 0;
-            charlen = 2;
-        } else if ((*byte & 0xF0) == 0xE0)
-            charlen = 3;
-        else if ((*byte & 0xF8) == 0xF0)
-            charlen = 4;
-        else
-            return 0;
-
-        if (byte + charlen - 1 >= str + str_len)
-            return 0;
-        if (charlen == 2 && *byte == 0xC2 && *(byte + 1) < 0xA0)
+    while (byte < end) {
+        byte += printablespan(byte, end - byte);
+        if (byte == end)
+            break;
+        if (!(charlen = utf8charlen(byte, end)))
             return 0;
-        if (charlen == 3) {
-            if (*byte == 0xE0 && (*(byte + 1) & 0xE0) == 0x80)
-                return 0;
-            if (*byte == 0xED && (*(byte + 1) & 0xE0) == 0xA0)
-                return 0;
-        }
-        if (charlen == 4) {
-            if (*byte == 0xF0 && (*(byte + 1) & 0xF0) == 0x80)
-                return 0;
-            if (*byte == 0xF4 && (*(byte + 1) & 0xF0) != 0x80)
-                return 0;
-        }
-
-        while (--charlen)
-            if ((*(++byte) & 0xC0) != 0x80)
-                return 0;
+        byte += charlen;
     }
     return 1;
 }
@@ -204,6 +231,28 @@ void enable_keepalive(int socket) {
     }
 }
 
+/**
+ * @brief Set the socket buffer sizes, the kernel default is kept for 0
+ *
+ * @param socket the socket
+ * @param rcvbuf receive buffer size in bytes
+ * @param sndbuf send buffer size in bytes
+ */
+void set_sockbufs(int socket, long rcvbuf, long sndbuf) {
+    int optval;
+
+    if (rcvbuf) {
+        optval = rcvbuf;
+        if (setsockopt(socket, SOL_SOCKET, SO_RCVBUF, &optval, sizeof(optval)) < 0)
+            debugerrno(errno, DBG_WARN, "set_sockbufs: setsockopt SO_RCVBUF %d failed", optval);
+    }
+    if (sndbuf) {
+        optval = sndbuf;
+        if (setsockopt(socket, SOL_SOCKET, SO_SNDBUF, &optval, sizeof(optval)) < 0)
+            debugerrno(errno, DBG_WARN, "set_sockbufs: setsockopt SO_SNDBUF %d failed", optval);
+    }
+}
+
 int bindtoaddr(struct addrinfo *addrinfo, int family, int reuse) {
     int s, on = 1;
     struct addrinfo *res;
@@ -236,7 +285,7 @@ int bindtoaddr(struct addrinfo *addrinfo, int family, int reuse) {
 }
 
 int connectnonblocking(int s, const struct sockaddr *addr, socklen_t addrlen, int timeout) {
-    int origflags, r = -1, sockerr = 0;
+    int origflags, r = -1, sockerr = 0, ndesc;
     socklen_t errlen = sizeof(sockerr);
     struct pollfd fds[1];
 
@@ -258,7 +307,10 @@ int connectnonblocking(int s, const struct sockaddr *addr, socklen_t addrlen, in
 
     fds[0].fd = s;
     fds[0].events = POLLOUT;
-    if (poll(fds, 1, timeout * 1000) < 1)
+    do
+        ndesc = poll(fds, 1, timeout * 1000);
+    while (ndesc < 0 && errno == EINTR);
+    if (ndesc < 1)
         goto exit;
 
     if (fds[0].revents & POLLERR) {
@@ -349,10 +401,47 @@ exit:
     close(socket);
 }
 
+/* Offset added to the monotonic clock so that its readings never come near
+ * zero, which the timers use to mean "not set" */
+#define MONOTIME_BASE 1000000000
+
+/**
+ * @brief Read the monotonic clock used for all timers and intervals
+ *
+ * Prefers the coarse clock, which returns the time of the last kernel tick
+ * without a hardware clock read. A few milliseconds of resolution is plenty
+ * for timers counting in seconds. Readings do not jump when the wall clock
+ * is set, and are unrelated to the wall-clock time.
+ *
+ * @param tv the current time
+ */
+void monotime(struct timeval *tv) {
+    struct timespec ts;
+
+#ifdef CLOCK_MONOTONIC_COARSE
+    if (clock_gettime(CLOCK_MONOTONIC_COARSE, &ts))
+#endif
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+    tv->tv_sec = ts.tv_sec + MONOTIME_BASE;
+    tv->tv_usec = ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief Seconds of the monotonic clock, see monotime()
+ *
+ * @return the current time in seconds
+ */
+time_t monosec(void) {
+    struct timeval now;
+
+    monotime(&now);
+    return now.tv_sec;
+}
+
 uint32_t connect_wait(struct timeval attempt_start, struct timeval last_success, int firsttry) {
     struct timeval now;
 
-    gettimeofday(&now, NULL);
+    monotime(&now);
 
     if (attempt_start.tv_sec < last_success.tv_sec ||
         attempt_start.tv_sec > now.tv_sec) {
@@ -375,6 +464,16 @@ uint32_t connect_wait(struct timeval attempt_start, struct timeval last_success,
     return now.tv_sec - attempt_start.tv_sec;
 }
 
+/* sleep for the wait returned by connect_wait; unlike sleep() go back to
+ * sleep for the rest of it when a signal such as the SIGPROF of the profiler
+ * interrupts */
+void connect_sleep(uint32_t wait) {
+    struct timespec ts = {wait, 0};
+
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+        ;
+}
+
 /**
  * @brief Skip (discard) dgram frame at front of queue
  * 
@@ -387,6 +486,36 @@ void sock_dgram_skip(int socket) {
         debug(DBG_ERR, "sock_dgram_skip: recv failed - %s", strerror(errno));
 }
 
+/**
+ * @brief Count the entries of a dispatch table that the CPU can run.
+ *
+ * Dispatch tables start with a portable implementation and list the others by
+ * increasing CPU requirements, so the last entry counted is the one to use.
+ *
+ * @param features the CPU_* flags needed by the first entry
+ * @param n number of entries
+ * @param stride size of an entry
+ * @return number of leading entries the CPU supports
+ */
+int cpuimpls(const unsigned *features, int n, size_t stride) {
+    unsigned f;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        f = *(const unsigned *)((const char *)features + i * stride);
+#if defined(__x86_64__) || defined(__i386__)
+        if (f & CPU_AVX2) {
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2"))
+                f &= ~CPU_AVX2;
+        }
+#endif
+        if (f)
+            break;
+    }
+    return i;
+}
+
 /* Local Variables: */
 /* c-file-style: "stroustrup" */
 /* End: */
@@ -12,6 +12,7 @@
 #define SOCKADDRP_SIZE(addr) ((addr)->sa_family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6))
 
 char *stringcopy(const char *s, int len);
+void *alignedcalloc(size_t align, size_t nmemb, size_t size);
 int verifyutf8(const unsigned char *str, size_t str_len);
 const char *addr2string(struct sockaddr *addr, char *buf, size_t len);
 struct sockaddr *addr_copy(struct sockaddr *in);
@@ -21,10 +22,19 @@ void sock_dgram_skip(int socket);
 void printfchars(char *prefixfmt, char *prefix, char *charfmt, uint8_t *chars, int len);
 void disable_DF_bit(int socket, struct addrinfo *res);
 void enable_keepalive(int socket);
+void set_sockbufs(int socket, long rcvbuf, long sndbuf);
 int bindtoaddr(struct addrinfo *addrinfo, int family, int reuse);
 int connecttcp(struct addrinfo *addrinfo, struct addrinfo *src, uint16_t timeout);
 void accepttcp(int socket, void handler(int));
+void monotime(struct timeval *tv);
+time_t monosec(void);
 uint32_t connect_wait(struct timeval attempt_start, struct timeval last_success, int firsttry);
+void connect_sleep(uint32_t wait);
+
+/* CPU features an entry of a dispatch table may need, see cpuimpls() */
+#define CPU_AVX2 0x1
+
+int cpuimpls(const unsigned *features, int n, size_t stride);
 
 /* Local Variables: */
 /* c-file-style: "stroustrup" */